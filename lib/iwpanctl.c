@@ -0,0 +1,323 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "iwpanctl.h"
+
+/* Plain libc: controllers link this without ELL */
+
+#define PENDING_MAX	64
+
+struct iwpanctl {
+	int fd;
+	uint32_t seq;
+	unsigned int queued;
+	struct iwpanctl_request batch[IWPANCTL_BATCH_MAX];
+	/*
+	 * Everything a synchronous call met besides its own response:
+	 * events, injection statuses, answers to flushed batches. Also
+	 * responses that did not fit the caller's buffer.
+	 */
+	struct iwpanctl_response pending[PENDING_MAX];
+	unsigned int pending_head;
+	unsigned int pending_tail;
+	bool pending_overflow;
+	struct iwpanctl_response packet[IWPANCTL_BATCH_MAX];
+};
+
+struct iwpanctl *iwpanctl_connect(const char *path)
+{
+	struct iwpanctl *ctl;
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+
+	ctl = calloc(1, sizeof(*ctl));
+	if (!ctl) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ctl->fd = fd;
+
+	return ctl;
+}
+
+void iwpanctl_close(struct iwpanctl *ctl)
+{
+	if (!ctl)
+		return;
+
+	close(ctl->fd);
+	free(ctl);
+}
+
+int iwpanctl_get_fd(struct iwpanctl *ctl)
+{
+	return ctl->fd;
+}
+
+static uint32_t next_seq(struct iwpanctl *ctl)
+{
+	/* 0 is reserved for events */
+	if (!++ctl->seq)
+		ctl->seq = 1;
+
+	return ctl->seq;
+}
+
+uint32_t iwpanctl_queue(struct iwpanctl *ctl, uint16_t op, uint32_t ifindex,
+							uint32_t value)
+{
+	struct iwpanctl_request *req;
+
+	if (ctl->queued == IWPANCTL_BATCH_MAX)
+		return 0;
+
+	req = &ctl->batch[ctl->queued++];
+	req->seq = next_seq(ctl);
+	req->op = op;
+	req->reserved = 0;
+	req->ifindex = ifindex;
+	req->value = value;
+
+	return req->seq;
+}
+
+uint32_t iwpanctl_inject(struct iwpanctl *ctl, uint32_t ifindex,
+					const void *frame, size_t len)
+{
+	struct iwpanctl_request req;
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	if (!len || len > IWPANCTL_FRAME_MAX) {
+		errno = EMSGSIZE;
+		return 0;
+	}
+
+	req.seq = next_seq(ctl);
+	req.op = IWPANCTL_OP_INJECT;
+	req.reserved = 0;
+	req.ifindex = ifindex;
+	req.value = len;
+
+	iov[0].iov_base = &req;
+	iov[0].iov_len = sizeof(req);
+	iov[1].iov_base = (void *) frame;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if (sendmsg(ctl->fd, &msg, MSG_NOSIGNAL) < 0)
+		return 0;
+
+	return req.seq;
+}
+
+int iwpanctl_flush(struct iwpanctl *ctl)
+{
+	unsigned int count = ctl->queued;
+	ssize_t n;
+
+	if (!count)
+		return 0;
+
+	n = send(ctl->fd, ctl->batch, count * sizeof(ctl->batch[0]),
+							MSG_NOSIGNAL);
+	if (n < 0)
+		return -errno;
+
+	ctl->queued = 0;
+
+	return count;
+}
+
+static void stash(struct iwpanctl *ctl,
+				const struct iwpanctl_response *resp)
+{
+	if (ctl->pending_tail - ctl->pending_head == PENDING_MAX) {
+		ctl->pending_overflow = true;
+		return;
+	}
+
+	ctl->pending[ctl->pending_tail++ % PENDING_MAX] = *resp;
+}
+
+static int recv_packet(struct iwpanctl *ctl, bool wait)
+{
+	ssize_t n;
+
+	n = recv(ctl->fd, ctl->packet, sizeof(ctl->packet),
+						wait ? 0 : MSG_DONTWAIT);
+	if (n < 0)
+		return (!wait && errno == EAGAIN) ? 0 : -errno;
+
+	if (n == 0)
+		return -ECONNRESET;
+
+	return n / sizeof(ctl->packet[0]);
+}
+
+int iwpanctl_recv(struct iwpanctl *ctl, struct iwpanctl_response *resp,
+					unsigned int max, bool wait)
+{
+	unsigned int count = 0;
+	int n, i;
+
+	if (!max)
+		return -EINVAL;
+
+	while (count < max && ctl->pending_head != ctl->pending_tail) {
+		resp[count] = ctl->pending[ctl->pending_head++ % PENDING_MAX];
+
+		if (ctl->pending_overflow) {
+			resp[count].state.flags |= IWPANCTL_F_OVERFLOW;
+			ctl->pending_overflow = false;
+		}
+
+		count++;
+	}
+
+	if (count)
+		return count;
+
+	n = recv_packet(ctl, wait);
+	if (n <= 0)
+		return n;
+
+	/* A response packet never exceeds the batch the caller sent */
+	for (i = 0; i < n; i++) {
+		if ((unsigned int) i < max)
+			resp[i] = ctl->packet[i];
+		else
+			stash(ctl, &ctl->packet[i]);
+	}
+
+	return (unsigned int) n < max ? n : (int) max;
+}
+
+static int call(struct iwpanctl *ctl, uint16_t op, uint32_t ifindex,
+				uint32_t value, struct iwpanctl_state *state)
+{
+	uint32_t seq;
+	int n, i, err;
+
+	/* Anything queued and not flushed would be answered first */
+	if (ctl->queued)
+		return -EBUSY;
+
+	seq = iwpanctl_queue(ctl, op, ifindex, value);
+
+	err = iwpanctl_flush(ctl);
+	if (err < 0)
+		return err;
+
+	for (;;) {
+		n = recv_packet(ctl, true);
+		if (n < 0)
+			return n;
+
+		for (i = 0; i < n; i++) {
+			const struct iwpanctl_response *resp = &ctl->packet[i];
+
+			if (resp->op == IWPANCTL_OP_EVENT ||
+							resp->seq != seq) {
+				stash(ctl, resp);
+				continue;
+			}
+
+			if (state)
+				*state = resp->state;
+
+			return resp->error;
+		}
+	}
+}
+
+int iwpanctl_get(struct iwpanctl *ctl, uint32_t ifindex,
+					struct iwpanctl_state *state)
+{
+	return call(ctl, IWPANCTL_OP_GET, ifindex, 0, state);
+}
+
+int iwpanctl_set_powered(struct iwpanctl *ctl, uint32_t ifindex,
+							bool powered)
+{
+	return call(ctl, IWPANCTL_OP_SET_POWERED, ifindex, powered, NULL);
+}
+
+int iwpanctl_set_panid(struct iwpanctl *ctl, uint32_t ifindex,
+							uint16_t panid)
+{
+	return call(ctl, IWPANCTL_OP_SET_PANID, ifindex, panid, NULL);
+}
+
+int iwpanctl_set_channel(struct iwpanctl *ctl, uint32_t ifindex,
+							uint8_t channel)
+{
+	return call(ctl, IWPANCTL_OP_SET_CHANNEL, ifindex, channel, NULL);
+}
+
+int iwpanctl_subscribe(struct iwpanctl *ctl, uint32_t ifindex)
+{
+	return call(ctl, IWPANCTL_OP_SUBSCRIBE, ifindex, 0, NULL);
+}
+
+int iwpanctl_unsubscribe(struct iwpanctl *ctl)
+{
+	return call(ctl, IWPANCTL_OP_UNSUBSCRIBE, 0, 0, NULL);
+}
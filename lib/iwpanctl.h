@@ -0,0 +1,118 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary control protocol, see doc/control-api.txt. A request packet
+ * on the SOCK_SEQPACKET socket carries one or more struct
+ * iwpanctl_request and is answered by one packet carrying a struct
+ * iwpanctl_response per request, in order. Fields are in host byte
+ * order: the socket is local.
+ */
+
+#define IWPANCTL_BATCH_MAX	64	/* Requests per packet */
+#define IWPANCTL_FRAME_MAX	125	/* Injected MAC frame, FCS excluded */
+
+enum iwpanctl_op {
+	IWPANCTL_OP_GET = 1,
+	IWPANCTL_OP_SET_POWERED,
+	IWPANCTL_OP_SET_PANID,
+	IWPANCTL_OP_SET_CHANNEL,
+	IWPANCTL_OP_SUBSCRIBE,
+	IWPANCTL_OP_UNSUBSCRIBE,
+	IWPANCTL_OP_INJECT,		/* Alone in its packet, see below */
+	IWPANCTL_OP_EVENT = 0x100,	/* Unsolicited, seq 0 */
+};
+
+#define IWPANCTL_F_OVERFLOW	0x1	/* Events were dropped before this */
+
+struct iwpanctl_request {
+	uint32_t seq;
+	uint16_t op;
+	uint16_t reserved;
+	uint32_t ifindex;
+	uint32_t value;
+};
+
+struct iwpanctl_state {
+	uint8_t powered;
+	uint8_t available;
+	uint8_t page;
+	uint8_t channel;
+	uint16_t panid;
+	uint16_t flags;
+};
+
+/* The adapter state after the request, even when it failed */
+struct iwpanctl_response {
+	uint32_t seq;
+	uint16_t op;
+	int16_t error;		/* Negative errno */
+	uint32_t ifindex;
+	struct iwpanctl_state state;
+};
+
+struct iwpanctl;
+
+struct iwpanctl *iwpanctl_connect(const char *path);
+void iwpanctl_close(struct iwpanctl *ctl);
+int iwpanctl_get_fd(struct iwpanctl *ctl);
+
+/*
+ * One request, waits for its response. Anything else received
+ * meanwhile, events, injection statuses and responses to flushed
+ * requests, is kept for iwpanctl_recv(). Fails with -EBUSY while
+ * requests are queued and not flushed.
+ */
+int iwpanctl_get(struct iwpanctl *ctl, uint32_t ifindex,
+					struct iwpanctl_state *state);
+int iwpanctl_set_powered(struct iwpanctl *ctl, uint32_t ifindex,
+							bool powered);
+int iwpanctl_set_panid(struct iwpanctl *ctl, uint32_t ifindex,
+							uint16_t panid);
+int iwpanctl_set_channel(struct iwpanctl *ctl, uint32_t ifindex,
+							uint8_t channel);
+int iwpanctl_subscribe(struct iwpanctl *ctl, uint32_t ifindex);
+int iwpanctl_unsubscribe(struct iwpanctl *ctl);
+
+/*
+ * Pipelining: requests are batched until iwpanctl_flush() sends them
+ * as one packet. Any number of packets may be in flight; responses
+ * are matched by the sequence number iwpanctl_queue() returns.
+ */
+uint32_t iwpanctl_queue(struct iwpanctl *ctl, uint16_t op, uint32_t ifindex,
+							uint32_t value);
+int iwpanctl_flush(struct iwpanctl *ctl);
+int iwpanctl_recv(struct iwpanctl *ctl, struct iwpanctl_response *resp,
+					unsigned int max, bool wait);
+
+/*
+ * Raw frame injection: one packet per frame, sent right away. The
+ * status arrives through iwpanctl_recv() once the frame was handed to
+ * the kernel, possibly after responses to later requests. Returns the
+ * sequence number, 0 with errno set on failure.
+ */
+uint32_t iwpanctl_inject(struct iwpanctl *ctl, uint32_t ifindex,
+					const void *frame, size_t len);
@@ -0,0 +1,694 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "bridge.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+
+int bridge_link_open(uint32_t ifindex)
+{
+	struct sockaddr_ll ll;
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC,
+						htons(ETH_P_IEEE802154));
+	if (fd < 0)
+		return -errno;
+
+	/* Frames the interface receives, without the FCS */
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_IEEE802154);
+	ll.sll_ifindex = ifindex;
+
+	if (bind(fd, (struct sockaddr *) &ll, sizeof(ll)) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * A bridge moves frames between a link socket and a local datagram
+ * socket through one io_uring, driven by raw syscalls. Each direction
+ * has a group of buffers registered with the ring as a provided buffer
+ * ring. One multishot receive per socket keeps picking buffers from
+ * its group; the frame is then sent from the very same buffer to the
+ * other socket and the buffer goes back to the group once the send
+ * completed: no copy in userspace.
+ *
+ * The ring fd is watched by the main loop. All sends prepared while
+ * draining the completion queue leave in a single io_uring_enter().
+ * A receive that finds every buffer of its group in flight stops and
+ * is armed again once a buffer came back; the frames the kernel
+ * dropped meanwhile show up as kernel_drops on the link side.
+ */
+
+#define BRIDGE_MAX		4	/* Adapters bridging at once */
+#define BRIDGE_BUFFERS		32	/* Per direction, a power of two */
+#define BRIDGE_BUFFER_SIZE	128
+#define BRIDGE_SQ_ENTRIES	64
+#define BRIDGE_CQ_ENTRIES	256
+#define BRIDGE_ROUNDS		4	/* Reap and submit per wakeup */
+#define BRIDGE_CANCEL_TIMEOUT	1	/* sec */
+
+#define SIDE_LINK		0	/* Also the buffer group ids */
+#define SIDE_SOCKET		1
+
+/* user_data of a request: operation, side received from, buffer */
+#define OP_RECV			1
+#define OP_SEND			2
+#define USER_DATA(op, side, bid) \
+	((uint64_t) (op) | (uint64_t) (side) << 4 | (uint64_t) (bid) << 8)
+#define USER_OP(data)		((data) & 0xf)
+#define USER_SIDE(data)		(((data) >> 4) & 0xf)
+#define USER_BID(data)		((data) >> 8)
+
+struct bridge_side {
+	int fd;
+	struct io_uring_buf_ring *ring;
+	uint16_t tail;
+	unsigned int held;	/* Buffers filled, not given back yet */
+	bool armed;		/* Multishot receive in place */
+	bool failed;
+	uint8_t data[BRIDGE_BUFFERS][BRIDGE_BUFFER_SIZE];
+};
+
+struct bridge {
+	char name[IFNAMSIZ];
+	int fd;
+	struct l_io *io;
+
+	uint8_t *rings;		/* Submission and completion rings */
+	size_t rings_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	void *buf_rings;
+	size_t buf_rings_len;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local;	/* Prepared, published by submit() */
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct bridge_side sides[2];
+	struct bridge_stats stats;
+};
+
+static struct pool *bridge_pool = NULL;
+
+static int ring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned int to_submit)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int ring_register(int fd, unsigned int opcode, void *arg,
+							unsigned int count)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static int ring_map(struct bridge *bridge)
+{
+	struct io_uring_params p;
+	size_t sq_len, cq_len;
+	unsigned int *array;
+	unsigned int i;
+	void *map;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = BRIDGE_CQ_ENTRIES;
+
+	bridge->fd = ring_setup(BRIDGE_SQ_ENTRIES, &p);
+	if (bridge->fd < 0)
+		return -errno;
+
+	/* Any kernel with multishot receives maps both rings at once */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+		return -EOPNOTSUPP;
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	bridge->rings_len = sq_len > cq_len ? sq_len : cq_len;
+
+	map = mmap(NULL, bridge->rings_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, bridge->fd,
+				IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	bridge->rings = map;
+
+	bridge->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	map = mmap(NULL, bridge->sqes_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, bridge->fd,
+				IORING_OFF_SQES);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	bridge->sqes = map;
+
+	bridge->sq_head = (unsigned int *) (bridge->rings + p.sq_off.head);
+	bridge->sq_tail = (unsigned int *) (bridge->rings + p.sq_off.tail);
+	bridge->sq_mask = *(unsigned int *) (bridge->rings +
+							p.sq_off.ring_mask);
+	bridge->sq_entries = p.sq_entries;
+	bridge->sq_local = *bridge->sq_tail;
+
+	/* Submission slot i always holds sqes[i] */
+	array = (unsigned int *) (bridge->rings + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+
+	bridge->cq_head = (unsigned int *) (bridge->rings + p.cq_off.head);
+	bridge->cq_tail = (unsigned int *) (bridge->rings + p.cq_off.tail);
+	bridge->cq_mask = *(unsigned int *) (bridge->rings +
+							p.cq_off.ring_mask);
+	bridge->cqes = (struct io_uring_cqe *) (bridge->rings +
+							p.cq_off.cqes);
+
+	return 0;
+}
+
+static void buffer_add(struct bridge_side *side, unsigned int bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &side->ring->bufs[side->tail & (BRIDGE_BUFFERS - 1)];
+	buf->addr = (uintptr_t) side->data[bid];
+	buf->len = BRIDGE_BUFFER_SIZE;
+	buf->bid = bid;
+
+	side->tail++;
+	__atomic_store_n(&side->ring->tail, side->tail, __ATOMIC_RELEASE);
+}
+
+static void buffer_return(struct bridge_side *side, unsigned int bid)
+{
+	side->held--;
+	buffer_add(side, bid);
+}
+
+static int buffers_register(struct bridge *bridge)
+{
+	struct io_uring_buf_reg reg;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t ring_len;
+	unsigned int i, bid;
+	void *map;
+
+	/* Each buffer ring starts on a page of its own */
+	ring_len = BRIDGE_BUFFERS * sizeof(struct io_uring_buf);
+	ring_len = (ring_len + page - 1) / page * page;
+
+	map = mmap(NULL, 2 * ring_len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	bridge->buf_rings = map;
+	bridge->buf_rings_len = 2 * ring_len;
+
+	for (i = 0; i < L_ARRAY_SIZE(bridge->sides); i++) {
+		struct bridge_side *side = &bridge->sides[i];
+
+		side->ring = (struct io_uring_buf_ring *)
+					((uint8_t *) map + i * ring_len);
+
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (uintptr_t) side->ring;
+		reg.ring_entries = BRIDGE_BUFFERS;
+		reg.bgid = i;
+
+		if (ring_register(bridge->fd, IORING_REGISTER_PBUF_RING,
+							&reg, 1) < 0)
+			return -errno;
+
+		for (bid = 0; bid < BRIDGE_BUFFERS; bid++)
+			buffer_add(side, bid);
+	}
+
+	return 0;
+}
+
+static void submit(struct bridge *bridge)
+{
+	unsigned int pending;
+
+	__atomic_store_n(bridge->sq_tail, bridge->sq_local, __ATOMIC_RELEASE);
+
+	pending = bridge->sq_local -
+			__atomic_load_n(bridge->sq_head, __ATOMIC_ACQUIRE);
+	if (!pending)
+		return;
+
+	metrics_inc(&bridge->stats.submits);
+
+	/* EBUSY: completions to reap first, submitted on the next round */
+	if (ring_enter(bridge->fd, pending) < 0 && errno != EBUSY &&
+				errno != EAGAIN && errno != EINTR)
+		l_warn("%s: bridge submit: %s", bridge->name,
+							strerror(errno));
+}
+
+static struct io_uring_sqe *get_sqe(struct bridge *bridge)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head;
+
+	head = __atomic_load_n(bridge->sq_head, __ATOMIC_ACQUIRE);
+
+	if (bridge->sq_local - head >= bridge->sq_entries) {
+		submit(bridge);
+
+		head = __atomic_load_n(bridge->sq_head, __ATOMIC_ACQUIRE);
+		if (bridge->sq_local - head >= bridge->sq_entries)
+			return NULL;
+	}
+
+	sqe = &bridge->sqes[bridge->sq_local & bridge->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	bridge->sq_local++;
+
+	return sqe;
+}
+
+static void arm_receive(struct bridge *bridge, unsigned int from)
+{
+	struct bridge_side *side = &bridge->sides[from];
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe(bridge);
+	if (!sqe)
+		return;
+
+	/* MSG_TRUNC: the length of longer datagrams, to drop them */
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = side->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = from;
+	sqe->msg_flags = MSG_TRUNC;
+	sqe->user_data = USER_DATA(OP_RECV, from, 0);
+
+	side->armed = true;
+}
+
+static void forward(struct bridge *bridge, unsigned int from,
+						unsigned int bid, int len)
+{
+	struct bridge_side *side = &bridge->sides[from];
+	struct io_uring_sqe *sqe;
+
+	if (len <= 0 || len > BRIDGE_FRAME_MAX) {
+		metrics_inc(&bridge->stats.bad_size);
+		buffer_return(side, bid);
+		return;
+	}
+
+	sqe = get_sqe(bridge);
+	if (!sqe) {
+		metrics_inc(&bridge->stats.send_failed);
+		buffer_return(side, bid);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = bridge->sides[!from].fd;
+	sqe->addr = (uintptr_t) side->data[bid];
+	sqe->len = len;
+	sqe->user_data = USER_DATA(OP_SEND, from, bid);
+}
+
+static void received(struct bridge *bridge, unsigned int from,
+					const struct io_uring_cqe *cqe)
+{
+	struct bridge_side *side = &bridge->sides[from];
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		side->armed = false;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		side->held++;
+		forward(bridge, from, cqe->flags >> IORING_CQE_BUFFER_SHIFT,
+								cqe->res);
+		return;
+	}
+
+	switch (cqe->res) {
+	case 0:
+		/* An empty datagram, it took no buffer */
+		metrics_inc(&bridge->stats.bad_size);
+		break;
+	case -ENOBUFS:
+		metrics_inc(&bridge->stats.no_buffer);
+		break;
+	case -ECONNREFUSED:
+		/* An earlier send to a UDP collector not listening */
+		metrics_inc(&bridge->stats.send_failed);
+		break;
+	default:
+		l_warn("%s: bridge %s receive: %s", bridge->name,
+				from == SIDE_LINK ? "link" : "socket",
+				strerror(-cqe->res));
+		side->failed = true;
+		break;
+	}
+}
+
+static void sent(struct bridge *bridge, unsigned int from,
+			unsigned int bid, const struct io_uring_cqe *cqe)
+{
+	if (cqe->res < 0)
+		metrics_inc(&bridge->stats.send_failed);
+	else if (from == SIDE_LINK)
+		metrics_inc(&bridge->stats.to_socket);
+	else
+		metrics_inc(&bridge->stats.to_link);
+
+	buffer_return(&bridge->sides[from], bid);
+}
+
+/* Sends to an idle socket complete within submit(): reap them too */
+static bool ring_ready(struct l_io *io, void *user_data)
+{
+	struct bridge *bridge = user_data;
+	const struct io_uring_cqe *cqe;
+	unsigned int head, tail, i;
+	unsigned int round;
+	uint64_t data;
+
+	for (round = 0; round < BRIDGE_ROUNDS; round++) {
+		head = *bridge->cq_head;
+		tail = __atomic_load_n(bridge->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail && round)
+			break;
+
+		for (; head != tail; head++) {
+			cqe = &bridge->cqes[head & bridge->cq_mask];
+			data = cqe->user_data;
+
+			if (USER_OP(data) == OP_RECV)
+				received(bridge, USER_SIDE(data), cqe);
+			else if (USER_OP(data) == OP_SEND)
+				sent(bridge, USER_SIDE(data), USER_BID(data),
+									cqe);
+		}
+
+		__atomic_store_n(bridge->cq_head, head, __ATOMIC_RELEASE);
+
+		for (i = 0; i < L_ARRAY_SIZE(bridge->sides); i++) {
+			struct bridge_side *side = &bridge->sides[i];
+
+			if (!side->armed && !side->failed &&
+						side->held < BRIDGE_BUFFERS)
+				arm_receive(bridge, i);
+		}
+
+		submit(bridge);
+	}
+
+	return true;
+}
+
+LATENCY_IO(ring_ready)
+
+static int endpoint_open(const char *endpoint)
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_un un;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} addr;
+	char host[INET6_ADDRSTRLEN];
+	const char *port;
+	socklen_t len;
+	unsigned long num;
+	char *end;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+
+	if (endpoint[0] == '/') {
+		if (strlen(endpoint) >= sizeof(addr.un.sun_path))
+			return -EINVAL;
+
+		addr.un.sun_family = AF_UNIX;
+		strcpy(addr.un.sun_path, endpoint);
+		len = sizeof(addr.un);
+	} else {
+		if (endpoint[0] == '[') {
+			endpoint++;
+			port = strstr(endpoint, "]:");
+		} else
+			port = strrchr(endpoint, ':');
+
+		if (!port || (size_t) (port - endpoint) >= sizeof(host))
+			return -EINVAL;
+
+		memcpy(host, endpoint, port - endpoint);
+		host[port - endpoint] = '\0';
+		port += *port == ']' ? 2 : 1;
+
+		num = strtoul(port, &end, 10);
+		if (!*port || *end || !num || num > 65535)
+			return -EINVAL;
+
+		if (inet_pton(AF_INET, host, &addr.in.sin_addr) == 1) {
+			addr.in.sin_family = AF_INET;
+			addr.in.sin_port = htons(num);
+			len = sizeof(addr.in);
+		} else if (inet_pton(AF_INET6, host,
+					&addr.in6.sin6_addr) == 1) {
+			addr.in6.sin6_family = AF_INET6;
+			addr.in6.sin6_port = htons(num);
+			len = sizeof(addr.in6);
+		} else
+			return -EINVAL;
+	}
+
+	fd = socket(addr.sa.sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	/* An autobound name lets a Unix collector answer */
+	if ((addr.sa.sa_family == AF_UNIX &&
+			bind(fd, &addr.sa, sizeof(sa_family_t)) < 0) ||
+			connect(fd, &addr.sa, len) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+/* Waits for the sends still reading from the buffers */
+static void ring_cancel(struct bridge *bridge)
+{
+	struct io_uring_sync_cancel_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.flags = IORING_ASYNC_CANCEL_ANY;
+	reg.timeout.tv_sec = BRIDGE_CANCEL_TIMEOUT;
+
+	if (ring_register(bridge->fd, IORING_REGISTER_SYNC_CANCEL,
+						&reg, 1) < 0 && errno != ENOENT)
+		l_warn("%s: bridge cancel: %s", bridge->name,
+							strerror(errno));
+}
+
+static void bridge_release(struct bridge *bridge)
+{
+	unsigned int i;
+
+	l_io_destroy(bridge->io);
+
+	if (bridge->fd >= 0) {
+		ring_cancel(bridge);
+		close(bridge->fd);
+	}
+
+	if (bridge->sqes)
+		munmap(bridge->sqes, bridge->sqes_len);
+
+	if (bridge->rings)
+		munmap(bridge->rings, bridge->rings_len);
+
+	if (bridge->buf_rings)
+		munmap(bridge->buf_rings, bridge->buf_rings_len);
+
+	for (i = 0; i < L_ARRAY_SIZE(bridge->sides); i++)
+		if (bridge->sides[i].fd >= 0)
+			close(bridge->sides[i].fd);
+
+	pool_release(bridge_pool, bridge);
+}
+
+struct bridge *bridge_new(const char *name, int link_fd,
+						const char *endpoint)
+{
+	struct bridge *bridge;
+	int err;
+
+	/* Carved from the memory budget by the first bridge */
+	if (!bridge_pool)
+		bridge_pool = pool_new("bridge", sizeof(struct bridge),
+								BRIDGE_MAX);
+
+	bridge = bridge_pool ? pool_alloc(bridge_pool) : NULL;
+	if (!bridge) {
+		l_error("'%s': no bridge left", name);
+		close(link_fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memset(bridge, 0, sizeof(*bridge));
+	snprintf(bridge->name, sizeof(bridge->name), "%s", name);
+	bridge->fd = -1;
+	bridge->sides[SIDE_LINK].fd = link_fd;
+
+	bridge->sides[SIDE_SOCKET].fd = endpoint_open(endpoint);
+	if (bridge->sides[SIDE_SOCKET].fd < 0) {
+		err = bridge->sides[SIDE_SOCKET].fd;
+		goto failed;
+	}
+
+	err = ring_map(bridge);
+	if (err < 0)
+		goto failed;
+
+	err = buffers_register(bridge);
+	if (err < 0)
+		goto failed;
+
+	bridge->io = l_io_new(bridge->fd);
+	l_io_set_read_handler(bridge->io, ring_ready_timed, bridge, NULL);
+
+	arm_receive(bridge, SIDE_LINK);
+	arm_receive(bridge, SIDE_SOCKET);
+	submit(bridge);
+
+	l_info("%s: bridged to %s", name, endpoint);
+
+	return bridge;
+
+failed:
+	l_warn("%s: bridge to %s: %s", name, endpoint, strerror(-err));
+	bridge_release(bridge);
+	errno = -err;
+
+	return NULL;
+}
+
+void bridge_free(struct bridge *bridge)
+{
+	if (!bridge)
+		return;
+
+	l_info("%s: bridge stopped", bridge->name);
+
+	bridge_release(bridge);
+}
+
+void bridge_get_stats(struct bridge *bridge, struct bridge_stats *stats)
+{
+	struct tpacket_stats kernel;
+	socklen_t len = sizeof(kernel);
+
+	/* Reading the counters resets them */
+	if (!getsockopt(bridge->sides[SIDE_LINK].fd, SOL_PACKET,
+				PACKET_STATISTICS, &kernel, &len))
+		bridge->stats.kernel_drops += kernel.tp_drops;
+
+	*stats = bridge->stats;
+}
+
+#else
+
+struct bridge *bridge_new(const char *name, int link_fd,
+						const char *endpoint)
+{
+	l_warn("%s: built without io_uring, no bridge", name);
+	close(link_fd);
+	errno = EOPNOTSUPP;
+
+	return NULL;
+}
+
+void bridge_free(struct bridge *bridge)
+{
+}
+
+void bridge_get_stats(struct bridge *bridge, struct bridge_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define BRIDGE_FRAME_MAX	125	/* aMaxPHYPacketSize less the FCS */
+
+struct bridge_stats {
+	uint64_t to_socket;	/* Frames from the link sent to the socket */
+	uint64_t to_link;	/* Datagrams from the socket sent on the link */
+	uint64_t no_buffer;	/* Receives stopped, every buffer in flight */
+	uint64_t bad_size;	/* Empty or longer than BRIDGE_FRAME_MAX */
+	uint64_t send_failed;
+	uint64_t kernel_drops;	/* Link socket queue overruns */
+	uint64_t submits;	/* io_uring_enter() calls */
+};
+
+struct bridge;
+
+/* Raw 802.15.4 frames of a wpan interface, an fd or a negative errno */
+int bridge_link_open(uint32_t ifindex);
+
+/*
+ * Takes link_fd over, even on failure. endpoint is the path of a Unix
+ * datagram socket or a numeric UDP "address:port" ("[address]:port"
+ * for IPv6). NULL with errno set on failure.
+ */
+struct bridge *bridge_new(const char *name, int link_fd,
+						const char *endpoint);
+void bridge_free(struct bridge *bridge);
+void bridge_get_stats(struct bridge *bridge, struct bridge_stats *stats);
@@ -0,0 +1,552 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+
+#include <ell/ell.h>
+
+#include "capture.h"
+#include "monitor.h"
+#include "latency.h"
+#include "worker.h"
+#include "pool.h"
+
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define LINKTYPE_IEEE802_15_4	195	/* MAC frames including FCS */
+
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		32
+#define RING_FRAME_SIZE		256	/* 127 byte PSDU + tpacket headers */
+#define RING_BLOCK_TIMEOUT	100	/* ms: flush partially filled blocks */
+
+#define CAPTURE_FILES		8	/* Rotating files: <path>.0 ... */
+#define CAPTURE_BATCH		256	/* Frames per writev() */
+#define CAPTURE_MAX		4	/* Concurrent captures */
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} __attribute__ ((packed));
+
+struct pcap_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_nsec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} __attribute__ ((packed));
+
+struct capture_block {
+	struct capture *capture;
+	struct tpacket_block_desc *bd;
+	bool queued;
+};
+
+struct capture {
+	uint32_t phy;
+	struct monitor monitor;
+	capture_start_cb_t start_cb;	/* NULL once answered */
+	capture_stopped_cb_t stopped_cb;
+	void *user_data;
+
+	int fd;
+	struct l_io *io;
+	uint8_t *ring;
+	unsigned int block;
+	struct capture_block blocks[RING_BLOCK_NR];
+	unsigned int inflight;		/* Blocks owned by a worker */
+	bool stopped;			/* Stop queued from a handler */
+	bool stopping;
+
+	char path[PATH_MAX - 2];	/* Room for ".N" */
+	int file_fd;
+	unsigned int file_index;
+	uint64_t file_size;
+	uint32_t size_limit;
+	uint32_t time_limit;
+	struct l_timeout *timeout;
+
+	uint64_t frames;
+	uint64_t bytes;
+
+	struct pcap_rec_hdr rec[CAPTURE_BATCH];
+	struct iovec iov[CAPTURE_BATCH * 2];
+};
+
+static struct pool *capture_pool = NULL;
+
+static int file_open(struct capture *capture)
+{
+	struct pcap_file_hdr hdr = {
+		.magic = PCAP_MAGIC_NSEC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = RING_FRAME_SIZE,
+		.linktype = LINKTYPE_IEEE802_15_4,
+	};
+	char name[PATH_MAX];
+	int fd;
+
+	snprintf(name, sizeof(name), "%s.%u", capture->path,
+							capture->file_index);
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		l_error("capture: open(%s): %s", name, strerror(errno));
+		return -errno;
+	}
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(fd);
+		return -EIO;
+	}
+
+	capture->file_fd = fd;
+	capture->file_size = sizeof(hdr);
+
+	return 0;
+}
+
+static int file_rotate(struct capture *capture)
+{
+	close(capture->file_fd);
+	capture->file_fd = -1;
+	capture->file_index = (capture->file_index + 1) % CAPTURE_FILES;
+
+	return file_open(capture);
+}
+
+static bool file_writev(struct capture *capture, int iovcnt, size_t len)
+{
+	if (capture->size_limit && capture->file_size + len >
+						capture->size_limit &&
+					file_rotate(capture) < 0)
+		return false;
+
+	if (writev(capture->file_fd, capture->iov, iovcnt) < 0) {
+		l_error("capture: writev: %s", strerror(errno));
+		return false;
+	}
+
+	capture->file_size += len;
+
+	return true;
+}
+
+/* Frames are written straight from the ring, one writev() per batch */
+static bool write_block(struct capture *capture, struct tpacket_block_desc *bd)
+{
+	struct tpacket3_hdr *ppd;
+	uint32_t i, n = 0;
+	size_t len = 0;
+
+	ppd = (struct tpacket3_hdr *) ((uint8_t *) bd +
+					bd->hdr.bh1.offset_to_first_pkt);
+
+	for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+		struct pcap_rec_hdr *rec = &capture->rec[n];
+
+		rec->ts_sec = ppd->tp_sec;
+		rec->ts_nsec = ppd->tp_nsec;
+		rec->incl_len = ppd->tp_snaplen;
+		rec->orig_len = ppd->tp_len;
+
+		capture->iov[n * 2].iov_base = rec;
+		capture->iov[n * 2].iov_len = sizeof(*rec);
+		capture->iov[n * 2 + 1].iov_base = (uint8_t *) ppd +
+								ppd->tp_mac;
+		capture->iov[n * 2 + 1].iov_len = ppd->tp_snaplen;
+
+		len += sizeof(*rec) + ppd->tp_snaplen;
+		capture->bytes += ppd->tp_snaplen;
+		n++;
+
+		if (n == CAPTURE_BATCH) {
+			if (!file_writev(capture, n * 2, len))
+				return false;
+
+			n = 0;
+			len = 0;
+		}
+
+		ppd = (struct tpacket3_hdr *) ((uint8_t *) ppd +
+							ppd->tp_next_offset);
+	}
+
+	capture->frames += bd->hdr.bh1.num_pkts;
+
+	if (n)
+		return file_writev(capture, n * 2, len);
+
+	return true;
+}
+
+static void capture_stop_idle(void *user_data)
+{
+	capture_stop(user_data);
+}
+
+/* Called from the ring and timeout handlers: the io goes away from an idle */
+static void capture_stopped(struct capture *capture)
+{
+	if (capture->stopped)
+		return;
+
+	capture->stopped = true;
+	capture->stopped_cb(capture->user_data);
+	l_idle_oneshot(capture_stop_idle, capture, NULL);
+}
+
+/* Hand the block back to the kernel */
+static void block_release(struct tpacket_block_desc *bd)
+{
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+							__ATOMIC_RELEASE);
+}
+
+/* Worker thread: the file state is only touched by the one worker */
+static int block_write_job(void *user_data)
+{
+	struct capture_block *block = user_data;
+	bool ok;
+
+	ok = write_block(block->capture, block->bd);
+	block_release(block->bd);
+
+	return ok ? 0 : -EIO;
+}
+
+static void capture_put(struct capture *capture);
+static bool ring_read_timed(struct l_io *io, void *user_data);
+
+static void block_written(int result, void *user_data)
+{
+	struct capture_block *block = user_data;
+	struct capture *capture = block->capture;
+
+	block->queued = false;
+	capture->inflight--;
+
+	if (capture->stopping) {
+		capture_put(capture);
+		return;
+	}
+
+	if (capture->stopped)
+		return;
+
+	if (result < 0) {
+		capture_stopped(capture);
+		return;
+	}
+
+	if (!capture->inflight)
+		l_io_set_read_handler(capture->io, ring_read_timed, capture,
+									NULL);
+}
+
+static bool ring_read(struct l_io *io, void *user_data)
+{
+	struct capture *capture = user_data;
+	struct capture_block *block;
+
+	if (capture->stopped)
+		return false;
+
+	for (;;) {
+		block = &capture->blocks[capture->block];
+
+		if (block->queued || !(block->bd->hdr.bh1.block_status &
+							TP_STATUS_USER))
+			break;
+
+		/* Blocks are written in ring order, by a single thread */
+		if (worker_submit(capture->phy, block_write_job,
+						block_written, block)) {
+			block->queued = true;
+			capture->inflight++;
+		} else if (capture->inflight) {
+			break;
+		} else {
+			if (!write_block(capture, block->bd)) {
+				capture_stopped(capture);
+				return false;
+			}
+
+			block_release(block->bd);
+		}
+
+		capture->block = (capture->block + 1) % RING_BLOCK_NR;
+	}
+
+	/*
+	 * Blocks owned by a worker keep the socket readable: stop polling
+	 * until they are all back, block_written() re-arms the handler.
+	 */
+	return !capture->inflight;
+}
+
+LATENCY_IO(ring_read)
+
+static int ring_open(struct capture *capture)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCK_NR,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE *
+							RING_BLOCK_NR,
+		.tp_retire_blk_tov = RING_BLOCK_TIMEOUT,
+	};
+	int version = TPACKET_V3;
+	unsigned int i;
+	int fd, err;
+
+	/* Protocol 0: nothing is queued until bound to the monitor */
+	fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+					&version, sizeof(version)) < 0 ||
+			setsockopt(fd, SOL_PACKET, PACKET_RX_RING,
+					&req, sizeof(req)) < 0)
+		goto fail;
+
+	capture->ring = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					fd, 0);
+	if (capture->ring == MAP_FAILED) {
+		capture->ring = NULL;
+		goto fail;
+	}
+
+	for (i = 0; i < RING_BLOCK_NR; i++) {
+		capture->blocks[i].capture = capture;
+		capture->blocks[i].bd = (struct tpacket_block_desc *)
+				(capture->ring + i * RING_BLOCK_SIZE);
+	}
+
+	err = monitor_bind(&capture->monitor, fd);
+	if (err < 0) {
+		errno = -err;
+		goto fail;
+	}
+
+	capture->fd = fd;
+
+	return 0;
+
+fail:
+	err = -errno;
+	close(fd);
+
+	return err;
+}
+
+static void capture_free(struct capture *capture)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	if (capture->fd >= 0 && getsockopt(capture->fd, SOL_PACKET,
+				PACKET_STATISTICS, &stats, &len) == 0)
+		l_info("capture: %s %" PRIu64 " frames, %" PRIu64
+				" bytes, %u dropped", capture->monitor.ifname,
+				capture->frames, capture->bytes,
+				stats.tp_drops);
+
+	l_timeout_remove(capture->timeout);
+	l_io_destroy(capture->io);
+
+	if (capture->ring)
+		munmap(capture->ring, RING_BLOCK_SIZE * RING_BLOCK_NR);
+
+	if (capture->fd >= 0)
+		close(capture->fd);
+
+	if (capture->file_fd >= 0)
+		close(capture->file_fd);
+
+	pool_release(capture_pool, capture);
+}
+
+/* Blocks owned by a worker and NEW_INTERFACE keep the capture around */
+static void capture_put(struct capture *capture)
+{
+	if (capture->inflight || capture->monitor.creating)
+		return;
+
+	capture_free(capture);
+}
+
+static void start_done(struct capture *capture, int err)
+{
+	capture_start_cb_t start_cb = capture->start_cb;
+
+	capture->start_cb = NULL;
+	start_cb(err, capture->user_data);
+}
+
+static void start_failed(struct capture *capture, int err)
+{
+	start_done(capture, err);
+	capture_stop(capture);
+}
+
+static void time_limit_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct capture *capture = user_data;
+
+	l_info("capture: %s time limit reached", capture->monitor.ifname);
+	capture_stopped(capture);
+}
+
+LATENCY_TIMEOUT(time_limit_expired)
+
+static void capture_monitor_created(int err, void *user_data)
+{
+	struct capture *capture = user_data;
+
+	if (err < 0) {
+		start_failed(capture, err);
+		return;
+	}
+
+	err = ring_open(capture);
+	if (err < 0) {
+		l_error("capture: ring on %s: %s", capture->monitor.ifname,
+							strerror(-err));
+		start_failed(capture, err);
+		return;
+	}
+
+	err = file_open(capture);
+	if (err < 0) {
+		start_failed(capture, err);
+		return;
+	}
+
+	capture->io = l_io_new(capture->fd);
+	l_io_set_read_handler(capture->io, ring_read_timed, capture, NULL);
+
+	l_info("capture: %s (ifindex %u) -> %s.*", capture->monitor.ifname,
+				capture->monitor.ifindex, capture->path);
+
+	if (capture->time_limit)
+		capture->timeout = l_timeout_create(capture->time_limit,
+						time_limit_expired_timed,
+						capture, NULL);
+
+	start_done(capture, 0);
+}
+
+static void capture_released(void *user_data)
+{
+	capture_put(user_data);
+}
+
+struct capture *capture_start(struct l_genl_family *nl802154, uint32_t phy,
+				const char *path, uint32_t size_limit,
+				uint32_t time_limit,
+				capture_start_cb_t start_cb,
+				capture_stopped_cb_t stopped_cb,
+				void *user_data)
+{
+	struct capture *capture;
+
+	if (strlen(path) >= sizeof(capture->path))
+		return NULL;
+
+	if (!capture_pool)
+		capture_pool = pool_new("capture", sizeof(struct capture),
+								CAPTURE_MAX);
+
+	capture = capture_pool ? pool_alloc(capture_pool) : NULL;
+	if (!capture)
+		return NULL;
+
+	capture->phy = phy;
+	strcpy(capture->path, path);
+	capture->size_limit = size_limit;
+	capture->time_limit = time_limit;
+	capture->start_cb = start_cb;
+	capture->stopped_cb = stopped_cb;
+	capture->user_data = user_data;
+	capture->fd = -1;
+	capture->file_fd = -1;
+
+	if (!monitor_create(&capture->monitor, nl802154, phy, "monitor",
+					capture_monitor_created,
+					capture_released, capture)) {
+		capture_free(capture);
+		return NULL;
+	}
+
+	return capture;
+}
+
+void capture_stop(struct capture *capture)
+{
+	/*
+	 * Still waiting for NL802154_CMD_NEW_INTERFACE: answer the caller
+	 * now, the interface is removed once the kernel acknowledges it.
+	 */
+	if (capture->start_cb)
+		start_done(capture, -ECANCELED);
+
+	/* Remove the monitor interface created for this capture */
+	monitor_remove(&capture->monitor);
+
+	capture->stopping = true;
+
+	l_io_destroy(capture->io);
+	capture->io = NULL;
+	l_timeout_remove(capture->timeout);
+	capture->timeout = NULL;
+
+	/* Freed by block_written() or capture_released() otherwise */
+	capture_put(capture);
+}
+
+uint32_t capture_get_phy(const struct capture *capture)
+{
+	return capture->phy;
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct capture;
+struct l_genl_family;
+
+/*
+ * On error the capture is freed once the callback returns. capture_stop()
+ * before the monitor is up answers with -ECANCELED.
+ */
+typedef void (*capture_start_cb_t)(int err, void *user_data);
+/* Time limit reached or write error: freed once the callback returns */
+typedef void (*capture_stopped_cb_t)(void *user_data);
+
+struct capture *capture_start(struct l_genl_family *nl802154, uint32_t phy,
+				const char *path, uint32_t size_limit,
+				uint32_t time_limit,
+				capture_start_cb_t start_cb,
+				capture_stopped_cb_t stopped_cb,
+				void *user_data);
+void capture_stop(struct capture *capture);
+uint32_t capture_get_phy(const struct capture *capture);
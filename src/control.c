@@ -0,0 +1,605 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <ell/ell.h>
+
+#include "lib/iwpanctl.h"
+#include "metrics.h"
+#include "phy.h"
+#include "pool.h"
+#include "trace.h"
+#include "latency.h"
+#include "control.h"
+
+/*
+ * Fixed layout requests on a local SOCK_SEQPACKET socket, for
+ * controllers that cannot afford a D-Bus round trip per setting. The
+ * requests end up in the same phy.c setters as the Adapter properties.
+ *
+ * A client blocked on its receive buffer is not read from until its
+ * response packet went out: pipelining is bounded by the socket
+ * buffers, not by memory in the daemon.
+ *
+ * Injected frames are answered once they left, with the statuses of
+ * frames that left together coalesced in one packet. A client has at
+ * most IWPANCTL_BATCH_MAX frames in flight, so their statuses always
+ * fit in tx[].
+ */
+
+#define CONTROL_CLIENT_MAX	16
+#define CONTROL_READ_MAX	16	/* Packets per wakeup, for fairness */
+
+struct control_client {
+	struct l_io *io;
+	char name[32];		/* Rate limit key */
+	bool closed;
+	bool subscribed;
+	uint32_t ifindex;	/* Subscription, 0 for all adapters */
+	bool overflow;		/* Events dropped since the last one sent */
+	size_t pending;		/* Bytes of out[] waiting for the client */
+	struct iwpanctl_response out[IWPANCTL_BATCH_MAX];
+	unsigned int inflight;	/* Injected frames not reported yet */
+	unsigned int tx_count;	/* Statuses in tx[] */
+	struct l_idle *tx_idle;
+	struct iwpanctl_response tx[IWPANCTL_BATCH_MAX];
+};
+
+struct control_stats {
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t packets;
+	uint64_t events_sent;
+	uint64_t events_dropped;
+	uint64_t rejected;
+	uint64_t frames_sent;
+	uint64_t frames_failed;
+};
+
+static struct l_io *listen_io = NULL;
+static char *listen_path = NULL;
+static struct l_queue *client_list = NULL;
+static struct pool *client_pool = NULL;
+static struct control_stats stats;
+
+static void client_destroy(void *user_data)
+{
+	struct control_client *client = user_data;
+
+	/* Frames still queued go out unreported */
+	phy_adapter_inject_cancel(client);
+
+	if (client->tx_idle)
+		l_idle_remove(client->tx_idle);
+
+	l_io_destroy(client->io);
+	pool_release(client_pool, client);
+}
+
+/* Called from the io callbacks: the io goes away from an idle */
+static void client_close(struct control_client *client)
+{
+	if (client->closed)
+		return;
+
+	client->closed = true;
+	l_queue_remove(client_list, client);
+	l_idle_oneshot(client_destroy, client, NULL);
+}
+
+static void client_disconnect(struct l_io *io, void *user_data)
+{
+	client_close(user_data);
+}
+
+static void fill_state(struct iwpanctl_response *resp,
+				const struct phy_adapter *adapter)
+{
+	resp->state.powered = adapter->powered;
+	resp->state.available = adapter->available;
+	resp->state.page = adapter->page;
+	resp->state.channel = adapter->channel;
+	resp->state.panid = adapter->panid;
+}
+
+static void handle(struct control_client *client,
+				const struct iwpanctl_request *req,
+				struct iwpanctl_response *resp)
+{
+	struct phy_adapter adapter;
+	int err = 0;
+
+	memset(resp, 0, sizeof(*resp));
+	resp->seq = req->seq;
+	resp->op = req->op;
+	resp->ifindex = req->ifindex;
+
+	metrics_inc(&stats.requests);
+
+	switch (req->op) {
+	case IWPANCTL_OP_GET:
+		break;
+	case IWPANCTL_OP_SET_POWERED:
+		if (req->value > 1)
+			err = -EINVAL;
+		else
+			err = phy_adapter_set_powered(req->ifindex,
+						client->name, req->value);
+		break;
+	case IWPANCTL_OP_SET_PANID:
+		if (req->value > UINT16_MAX)
+			err = -EINVAL;
+		else
+			err = phy_adapter_set_panid(req->ifindex,
+						client->name, req->value);
+		break;
+	case IWPANCTL_OP_SET_CHANNEL:
+		if (req->value > UINT8_MAX)
+			err = -EINVAL;
+		else
+			err = phy_adapter_set_channel(req->ifindex,
+						client->name, req->value);
+		break;
+	case IWPANCTL_OP_SUBSCRIBE:
+		/* All adapters, including the ones yet to appear */
+		if (!req->ifindex) {
+			client->subscribed = true;
+			client->ifindex = 0;
+			return;
+		}
+
+		break;
+	case IWPANCTL_OP_UNSUBSCRIBE:
+		client->subscribed = false;
+		return;
+	default:
+		err = -EOPNOTSUPP;
+		break;
+	}
+
+	/* The state after the request spares a GET after each SET */
+	if (phy_adapter_get(req->ifindex, &adapter) == 0)
+		fill_state(resp, &adapter);
+	else if (!err)
+		err = -ENODEV;
+
+	if (req->op == IWPANCTL_OP_SUBSCRIBE && !err) {
+		client->subscribed = true;
+		client->ifindex = req->ifindex;
+	}
+
+	resp->error = err;
+
+	if (err)
+		metrics_inc(&stats.errors);
+}
+
+static bool client_read_timed(struct l_io *io, void *user_data);
+
+/* 1: sent, 0: the client is full, -1: the client is gone */
+static int client_send_status(struct control_client *client)
+{
+	ssize_t n;
+
+	n = send(l_io_get_fd(client->io), client->tx,
+				client->tx_count * sizeof(client->tx[0]),
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0 && errno == EAGAIN)
+		return 0;
+
+	if (n < 0) {
+		client_close(client);
+		return -1;
+	}
+
+	client->inflight -= client->tx_count;
+	client->tx_count = 0;
+
+	return 1;
+}
+
+static bool client_write(struct l_io *io, void *user_data)
+{
+	struct control_client *client = user_data;
+	ssize_t n;
+
+	if (client->pending) {
+		n = send(l_io_get_fd(io), client->out, client->pending,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && errno == EAGAIN)
+			return true;
+
+		if (n < 0) {
+			client_close(client);
+			return false;
+		}
+
+		client->pending = 0;
+		l_io_set_read_handler(io, client_read_timed, client, NULL);
+	}
+
+	/* Injection statuses wait behind the responses */
+	if (client->tx_count)
+		return client_send_status(client) == 0;
+
+	return false;
+}
+
+static void client_flush_status(struct l_idle *idle, void *user_data)
+{
+	struct control_client *client = user_data;
+
+	l_idle_remove(client->tx_idle);
+	client->tx_idle = NULL;
+
+	/* client_write() sends them after the responses */
+	if (client->closed || client->pending)
+		return;
+
+	if (client_send_status(client) == 0)
+		l_io_set_write_handler(client->io, client_write, client, NULL);
+}
+
+static void frame_injected(int status, uint64_t tag, void *user_data)
+{
+	struct control_client *client = user_data;
+	struct iwpanctl_response *resp = &client->tx[client->tx_count++];
+
+	memset(resp, 0, sizeof(*resp));
+	resp->seq = tag;
+	resp->op = IWPANCTL_OP_INJECT;
+	resp->error = status;
+	resp->ifindex = tag >> 32;
+
+	metrics_inc(status ? &stats.frames_failed : &stats.frames_sent);
+
+	/* Statuses of frames sent in the same batch share a packet */
+	if (!client->tx_idle)
+		client->tx_idle = l_idle_create(client_flush_status, client,
+									NULL);
+}
+
+/* False when answered right away, true when frame_injected() will */
+static bool handle_inject(struct control_client *client,
+				const struct iwpanctl_request *req, size_t len,
+				struct iwpanctl_response *resp)
+{
+	uint64_t tag = (uint64_t) req->ifindex << 32 | req->seq;
+	int err;
+
+	metrics_inc(&stats.requests);
+
+	if (req->value != len - sizeof(*req))
+		err = -EINVAL;
+	else if (client->inflight == IWPANCTL_BATCH_MAX)
+		err = -ENOBUFS;
+	else
+		err = phy_adapter_inject(req->ifindex, req + 1, req->value,
+						frame_injected, tag, client);
+
+	if (!err) {
+		client->inflight++;
+		return true;
+	}
+
+	memset(resp, 0, sizeof(*resp));
+	resp->seq = req->seq;
+	resp->op = req->op;
+	resp->ifindex = req->ifindex;
+	resp->error = err;
+
+	metrics_inc(&stats.errors);
+
+	return false;
+}
+
+/* False when the client cannot take more: stop reading from it */
+static bool client_send(struct control_client *client, size_t len)
+{
+	ssize_t n;
+
+	n = send(l_io_get_fd(client->io), client->out, len,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n >= 0)
+		return true;
+
+	if (errno != EAGAIN) {
+		client_close(client);
+		return false;
+	}
+
+	client->pending = len;
+	l_io_set_write_handler(client->io, client_write, client, NULL);
+
+	return false;
+}
+
+static bool client_read(struct l_io *io, void *user_data)
+{
+	struct control_client *client = user_data;
+	struct iwpanctl_request req[IWPANCTL_BATCH_MAX];
+	unsigned int i, count, packets;
+	ssize_t n;
+
+	for (packets = 0; packets < CONTROL_READ_MAX; packets++) {
+		n = recv(l_io_get_fd(io), req, sizeof(req),
+						MSG_DONTWAIT | MSG_TRUNC);
+		if (n < 0 && errno == EAGAIN)
+			return true;
+
+		if (n <= 0) {
+			client_close(client);
+			return false;
+		}
+
+		/* One frame per packet, behind its request */
+		if ((size_t) n >= sizeof(req[0]) && (size_t) n <= sizeof(req) &&
+					req[0].op == IWPANCTL_OP_INJECT) {
+			metrics_inc(&stats.packets);
+
+			if (handle_inject(client, req, n, &client->out[0]))
+				continue;
+
+			if (!client_send(client, sizeof(client->out[0])))
+				return false;
+
+			continue;
+		}
+
+		/* Not a protocol client: drop it rather than guess */
+		if ((size_t) n > sizeof(req) || n % sizeof(req[0])) {
+			l_error("%s: malformed request of %zd bytes",
+							client->name, n);
+			client_close(client);
+			return false;
+		}
+
+		metrics_inc(&stats.packets);
+
+		count = n / sizeof(req[0]);
+
+		for (i = 0; i < count; i++)
+			handle(client, &req[i], &client->out[i]);
+
+		if (!client_send(client, count * sizeof(client->out[0])))
+			return false;
+	}
+
+	return true;
+}
+
+LATENCY_IO(client_read)
+
+static void notify_client(void *data, void *user_data)
+{
+	struct control_client *client = data;
+	const struct iwpanctl_response *event = user_data;
+	struct iwpanctl_response out = *event;
+	ssize_t n;
+
+	if (!client->subscribed ||
+			(client->ifindex && client->ifindex != event->ifindex))
+		return;
+
+	/* Its responses come first, and they are already late */
+	if (client->pending) {
+		client->overflow = true;
+		metrics_inc(&stats.events_dropped);
+		return;
+	}
+
+	if (client->overflow)
+		out.state.flags |= IWPANCTL_F_OVERFLOW;
+
+	/* Errors other than a full buffer are left to the io callbacks */
+	n = send(l_io_get_fd(client->io), &out, sizeof(out),
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0) {
+		client->overflow = true;
+		metrics_inc(&stats.events_dropped);
+		return;
+	}
+
+	client->overflow = false;
+	metrics_inc(&stats.events_sent);
+}
+
+void control_notify(const struct phy_adapter *adapter, bool removed)
+{
+	struct iwpanctl_response event;
+
+	if (l_queue_isempty(client_list))
+		return;
+
+	memset(&event, 0, sizeof(event));
+	event.op = IWPANCTL_OP_EVENT;
+	event.ifindex = adapter->ifindex;
+	fill_state(&event, adapter);
+
+	if (removed) {
+		event.error = -ENODEV;
+		event.state.available = false;
+	}
+
+	l_queue_foreach(client_list, notify_client, &event);
+}
+
+static bool listen_read(struct l_io *io, void *user_data)
+{
+	struct control_client *client;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int fd;
+
+	fd = accept4(l_io_get_fd(io), NULL, NULL,
+					SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return true;
+
+	client = pool_alloc(client_pool);
+	if (!client) {
+		metrics_inc(&stats.rejected);
+		close(fd);
+		return true;
+	}
+
+	/* Rate limits apply per process, like per D-Bus sender */
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		cred.pid = 0;
+
+	snprintf(client->name, sizeof(client->name), "control:%d",
+								cred.pid);
+
+	client->io = l_io_new(fd);
+	l_io_set_close_on_destroy(client->io, true);
+	l_io_set_read_handler(client->io, client_read_timed, client, NULL);
+	l_io_set_disconnect_handler(client->io, client_disconnect,
+								client, NULL);
+
+	l_queue_push_tail(client_list, client);
+
+	return true;
+}
+
+static void append_counter(struct l_string *out, const char *name,
+				const char *help, const uint64_t *counter)
+{
+	metrics_family(out, name, "counter", help);
+	l_string_append_printf(out, "%s_total %" PRIu64 "\n", name,
+						metrics_read(counter));
+}
+
+void control_metrics(struct l_string *out)
+{
+	if (!listen_io)
+		return;
+
+	metrics_family(out, "iwpand_control_clients", "gauge",
+					"Connected control socket clients");
+	l_string_append_printf(out, "iwpand_control_clients %u\n",
+					l_queue_length(client_list));
+
+	append_counter(out, "iwpand_control_requests",
+			"Control socket requests", &stats.requests);
+	append_counter(out, "iwpand_control_errors",
+			"Control socket requests that failed", &stats.errors);
+	append_counter(out, "iwpand_control_packets",
+			"Control socket request packets", &stats.packets);
+	append_counter(out, "iwpand_control_rejected",
+			"Connections refused at the client limit",
+			&stats.rejected);
+
+	metrics_family(out, "iwpand_control_frames", "counter",
+			"Frames injected through the control socket");
+	l_string_append_printf(out, "iwpand_control_frames_total"
+				"{result=\"sent\"} %" PRIu64 "\n"
+				"iwpand_control_frames_total"
+				"{result=\"failed\"} %" PRIu64 "\n",
+				metrics_read(&stats.frames_sent),
+				metrics_read(&stats.frames_failed));
+
+	metrics_family(out, "iwpand_control_events", "counter",
+			"Adapter change events for subscribed clients");
+	l_string_append_printf(out, "iwpand_control_events_total"
+				"{result=\"sent\"} %" PRIu64 "\n"
+				"iwpand_control_events_total"
+				"{result=\"dropped\"} %" PRIu64 "\n",
+				metrics_read(&stats.events_sent),
+				metrics_read(&stats.events_dropped));
+}
+
+bool control_init(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!path)
+		return true;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		l_error("control: socket path too long");
+		return false;
+	}
+
+	client_pool = pool_new("control_client",
+				sizeof(struct control_client),
+				CONTROL_CLIENT_MAX);
+	if (!client_pool)
+		return false;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK,
+									0);
+	if (fd < 0)
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	/* Setters are not behind the bus policy here: owner only */
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+				chmod(path, 0600) < 0 || listen(fd, 8) < 0) {
+		l_error("control: %s: %s", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	listen_io = l_io_new(fd);
+	l_io_set_close_on_destroy(listen_io, true);
+	l_io_set_read_handler(listen_io, listen_read, NULL, NULL);
+	listen_path = l_strdup(path);
+	client_list = l_queue_new();
+
+	l_info("control: listening on %s", path);
+
+	return true;
+}
+
+void control_exit(void)
+{
+	if (!listen_io)
+		return;
+
+	l_io_destroy(listen_io);
+	listen_io = NULL;
+	unlink(listen_path);
+
+	l_free(listen_path);
+	listen_path = NULL;
+
+	l_queue_destroy(client_list, client_destroy);
+	client_list = NULL;
+}
@@ -33,6 +33,7 @@
 #define IWPAND_DBUS_SERVICE	"net.connman.iwpand"
 
 struct l_dbus *g_dbus = NULL;
+static char *service_name = NULL;
 
 struct l_dbus_message *dbus_error_invalid_args(struct l_dbus_message *msg)
 {
@@ -40,6 +41,51 @@ struct l_dbus_message *dbus_error_invalid_args(struct l_dbus_message *msg)
 					"Argument type is wrong");
 }
 
+struct l_dbus_message *dbus_error_failed(struct l_dbus_message *msg, int err)
+{
+	return l_dbus_message_new_error(msg, IWPAND_DBUS_SERVICE ".Failed",
+						"Operation failed (%s)",
+						strerror(-err));
+}
+
+struct l_dbus_message *dbus_error_in_progress(struct l_dbus_message *msg)
+{
+	return l_dbus_message_new_error(msg, IWPAND_DBUS_SERVICE ".InProgress",
+					"Operation already in progress");
+}
+
+struct l_dbus_message *dbus_error_not_available(struct l_dbus_message *msg)
+{
+	return l_dbus_message_new_error(msg,
+					IWPAND_DBUS_SERVICE ".NotAvailable",
+					"Adapter is not available");
+}
+
+struct l_dbus_message *dbus_error_not_found(struct l_dbus_message *msg)
+{
+	return l_dbus_message_new_error(msg, IWPAND_DBUS_SERVICE ".NotFound",
+					"No such object");
+}
+
+struct l_dbus_message *dbus_error_busy(struct l_dbus_message *msg)
+{
+	return l_dbus_message_new_error(msg, IWPAND_DBUS_SERVICE ".Busy",
+					"Too many requests, retry later");
+}
+
+void dbus_append_dict_basic(struct l_dbus_message_builder *builder,
+				const char *key, char type, const void *data)
+{
+	char signature[2] = { type, '\0' };
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', key);
+	l_dbus_message_builder_enter_variant(builder, signature);
+	l_dbus_message_builder_append_basic(builder, type, data);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+}
+
 static void debug(const char *str, void *user_data)
 {
 	const char *prefix = user_data;
@@ -51,12 +97,12 @@ static void request_name_callback(struct l_dbus *dbus, bool success,
 					bool queued, void *user_data)
 {
 	if (!success)
-		l_error("Name request failed");
+		l_error("Name request for %s failed", service_name);
 }
 
 static void ready_callback(void *user_data)
 {
-	l_dbus_name_acquire(g_dbus, IWPAND_DBUS_SERVICE, false, false, true,
+	l_dbus_name_acquire(g_dbus, service_name, false, false, true,
 						request_name_callback, NULL);
 
 	if (!l_dbus_object_manager_enable(g_dbus))
@@ -73,9 +119,32 @@ struct l_dbus *dbus_get_bus(void)
 	return g_dbus;
 }
 
-bool dbus_init(bool enable_debug)
+/*
+ * The system bus unless an address is given: "session", or any bus
+ * address such as a private dbus-daemon run without privileges. Shard
+ * workers own a name of their own, the supervisor fronts for them.
+ */
+bool dbus_init(const char *address, const char *name, bool enable_debug)
 {
-	g_dbus = l_dbus_new_default(L_DBUS_SYSTEM_BUS);
+	service_name = l_strdup(name ? name : IWPAND_DBUS_SERVICE);
+
+	if (!address)
+		g_dbus = l_dbus_new_default(L_DBUS_SYSTEM_BUS);
+	else if (!strcmp(address, "session"))
+		g_dbus = l_dbus_new_default(L_DBUS_SESSION_BUS);
+	else
+		g_dbus = l_dbus_new(address);
+
+	if (!g_dbus) {
+		l_error("Unable to connect to %s",
+					address ? address : "the system bus");
+		l_free(service_name);
+		service_name = NULL;
+		return false;
+	}
+
+	if (address)
+		l_info("D-Bus: serving on %s", address);
 
 	if (enable_debug)
 		l_dbus_set_debug(g_dbus, debug, "[DBUS] ", NULL);
@@ -90,4 +159,7 @@ void dbus_exit(void)
 {
 	l_dbus_destroy(g_dbus);
 	g_dbus = NULL;
+
+	l_free(service_name);
+	service_name = NULL;
 }
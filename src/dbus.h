@@ -22,6 +22,15 @@
 struct l_dbus;
 struct l_dbus *dbus_get_bus(void);
 struct l_dbus_message *dbus_error_invalid_args(struct l_dbus_message *msg);
+struct l_dbus_message *dbus_error_failed(struct l_dbus_message *msg, int err);
+struct l_dbus_message *dbus_error_in_progress(struct l_dbus_message *msg);
+struct l_dbus_message *dbus_error_not_available(struct l_dbus_message *msg);
+struct l_dbus_message *dbus_error_not_found(struct l_dbus_message *msg);
+struct l_dbus_message *dbus_error_busy(struct l_dbus_message *msg);
 
-bool dbus_init(bool enable_debug);
+struct l_dbus_message_builder;
+void dbus_append_dict_basic(struct l_dbus_message_builder *builder,
+				const char *key, char type, const void *data);
+
+bool dbus_init(const char *address, const char *name, bool enable_debug);
 void dbus_exit(void);
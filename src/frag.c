@@ -0,0 +1,241 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ell/ell.h>
+
+#include "frag.h"
+
+/* Per network namespace, shared by every 6LoWPAN link */
+#define SYSCTL_DIR		"sys/net/ieee802154/6lowpan"
+#define HIGH_THRESH		"6lowpanfrag_high_thresh"
+#define LOW_THRESH		"6lowpanfrag_low_thresh"
+#define TIMEOUT			"6lowpanfrag_time"
+
+#define TIMEOUT_MAX		3600
+
+static char proc_root[PATH_MAX] = "/proc";
+
+/* For tests: a directory laid out like /proc */
+void frag_set_proc_root(const char *path)
+{
+	snprintf(proc_root, sizeof(proc_root), "%s", path);
+}
+
+static int sysctl_read(const char *name, uint32_t *value)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	ssize_t len;
+	char *end;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", proc_root, SYSCTL_DIR, name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (len <= 0)
+		return -EIO;
+
+	buf[len] = '\0';
+	*value = strtoul(buf, &end, 10);
+
+	if (end == buf)
+		return -EIO;
+
+	return 0;
+}
+
+static int sysctl_write(const char *name, uint32_t value)
+{
+	char path[PATH_MAX];
+	char buf[16];
+	ssize_t len, written;
+	int fd, err = 0;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", proc_root, SYSCTL_DIR, name);
+	len = snprintf(buf, sizeof(buf), "%u\n", value);
+
+	fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	written = write(fd, buf, len);
+	if (written < 0)
+		err = -errno;
+	else if (written != len)
+		err = -EIO;
+
+	close(fd);
+
+done:
+	if (err < 0)
+		l_error("%s = %u: %s", name, value, strerror(-err));
+
+	return err;
+}
+
+bool frag_config_valid(const struct frag_config *config)
+{
+	if (config->timeout > TIMEOUT_MAX)
+		return false;
+
+	/* The kernel bounds each threshold by the other one */
+	if (config->high_thresh && config->low_thresh &&
+				config->low_thresh > config->high_thresh)
+		return false;
+
+	return true;
+}
+
+int frag_read(struct frag_config *config)
+{
+	int err;
+
+	err = sysctl_read(HIGH_THRESH, &config->high_thresh);
+	if (err < 0)
+		return err;
+
+	err = sysctl_read(LOW_THRESH, &config->low_thresh);
+	if (err < 0)
+		return err;
+
+	return sysctl_read(TIMEOUT, &config->timeout);
+}
+
+/*
+ * All three values or none: the thresholds are written in the order
+ * the kernel accepts and restored on failure.
+ */
+int frag_apply(const struct frag_config *config)
+{
+	struct frag_config old, new;
+	const char *name[2] = { HIGH_THRESH, LOW_THRESH };
+	uint32_t new_value[2], old_value[2];
+	int i, err;
+
+	if (!config->high_thresh && !config->low_thresh && !config->timeout)
+		return 0;
+
+	err = frag_read(&old);
+	if (err < 0)
+		return err;
+
+	new.high_thresh = config->high_thresh ? : old.high_thresh;
+	new.low_thresh = config->low_thresh ? : old.low_thresh;
+	new.timeout = config->timeout ? : old.timeout;
+
+	if (new.low_thresh > new.high_thresh)
+		return -EINVAL;
+
+	new_value[0] = new.high_thresh;
+	new_value[1] = new.low_thresh;
+	old_value[0] = old.high_thresh;
+	old_value[1] = old.low_thresh;
+
+	/* Raising: high first, lowering: low first */
+	if (new.high_thresh < old.high_thresh) {
+		name[0] = LOW_THRESH;
+		name[1] = HIGH_THRESH;
+		new_value[0] = new.low_thresh;
+		new_value[1] = new.high_thresh;
+		old_value[0] = old.low_thresh;
+		old_value[1] = old.high_thresh;
+	}
+
+	for (i = 0; i < 2; i++) {
+		err = sysctl_write(name[i], new_value[i]);
+		if (err < 0)
+			goto restore;
+	}
+
+	err = sysctl_write(TIMEOUT, new.timeout);
+	if (err < 0)
+		goto restore;
+
+	l_info("6LoWPAN reassembly: high %u low %u timeout %u",
+			new.high_thresh, new.low_thresh, new.timeout);
+
+	return 0;
+
+restore:
+	while (i--)
+		sysctl_write(name[i], old_value[i]);
+
+	return err;
+}
+
+/*
+ * Netns wide IPv6 reassembly counters, the kernel exports none for the
+ * 6LoWPAN fragment queue alone.
+ */
+bool frag_stats(uint64_t *fails, uint64_t *timeouts)
+{
+	char path[PATH_MAX];
+	char line[128];
+	char name[64];
+	uint64_t value;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/net/snmp6", proc_root);
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return false;
+
+	*fails = 0;
+	*timeouts = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %" SCNu64, name, &value) != 2)
+			continue;
+
+		if (!strcmp(name, "Ip6ReasmFails"))
+			*fails = value;
+		else if (!strcmp(name, "Ip6ReasmTimeout"))
+			*timeouts = value;
+	}
+
+	fclose(fp);
+
+	return true;
+}
@@ -0,0 +1,36 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* 6LoWPAN reassembly limits, 0: left as the kernel has it */
+struct frag_config {
+	uint32_t high_thresh;	/* Bytes */
+	uint32_t low_thresh;	/* Bytes */
+	uint32_t timeout;	/* Seconds */
+};
+
+void frag_set_proc_root(const char *path);
+
+bool frag_config_valid(const struct frag_config *config);
+int frag_read(struct frag_config *config);
+int frag_apply(const struct frag_config *config);
+
+bool frag_stats(uint64_t *fails, uint64_t *timeouts);
@@ -0,0 +1,455 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include <ell/ell.h>
+
+#include "nl802154.h"
+#include "metrics.h"
+#include "pool.h"
+#include "hop.h"
+
+/*
+ * Each schedule runs on its own thread, so hops are not held up by a
+ * busy main loop (D-Bus calls, dumps, captures). The thread sleeps on an
+ * absolute timerfd: slots do not drift, and slots it wakes up too late
+ * for are reported as expirations and skipped rather than replayed.
+ *
+ * One NL802154_CMD_SET_CHANNEL message per entry of the sequence is
+ * built up front and sent as is on a generic netlink socket of the
+ * schedule. It goes out without NLM_F_ACK and outside of ELL's request
+ * queue: the socket only becomes readable when the kernel refuses a hop.
+ */
+
+#define NL802154_GENL_NAME	"nl802154"
+
+#define HOP_MAX			16	/* Schedules, one per PHY at most */
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK		270
+#endif
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK		10
+#endif
+
+struct hop_msg {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	struct nlattr phy_attr;
+	uint32_t phy;
+	struct nlattr page_attr;
+	uint8_t page;
+	uint8_t page_pad[3];
+	struct nlattr channel_attr;
+	uint8_t channel;
+	uint8_t channel_pad[3];
+};
+
+struct hop_schedule {
+	char name[IFNAMSIZ];
+	pthread_t thread;
+	int nl_fd;
+	int timer_fd;
+	int stop_fd;
+	uint64_t start;		/* CLOCK_MONOTONIC, nsec */
+	uint64_t slot_ns;
+	uint32_t slot_ms;
+	uint64_t tick;		/* Slots elapsed, hop thread only */
+	unsigned int count;
+	uint8_t channel;	/* Last channel hopped to */
+	struct hop_stats stats;
+	struct hop_msg msgs[HOP_SEQUENCE_MAX];
+};
+
+static struct pool *hop_pool = NULL;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Looks the family up on the schedule's socket, before it goes async */
+static int family_resolve(int fd)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct genlmsghdr genl;
+		struct nlattr attr;
+		char name[NLA_ALIGN(sizeof(NL802154_GENL_NAME))];
+	} req;
+	struct timeval tv = { .tv_sec = 1 };
+	uint32_t buf[1024];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	struct nlmsgerr *err;
+	struct nlattr *attr;
+	ssize_t len;
+	int attrlen;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = GENL_ID_CTRL;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = 1;
+	req.genl.cmd = CTRL_CMD_GETFAMILY;
+	req.genl.version = 1;
+	req.attr.nla_len = NLA_HDRLEN + sizeof(NL802154_GENL_NAME);
+	req.attr.nla_type = CTRL_ATTR_FAMILY_NAME;
+	memcpy(req.name, NL802154_GENL_NAME, sizeof(NL802154_GENL_NAME));
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		return -errno;
+
+	if (send(fd, &req, sizeof(req), 0) < 0)
+		return -errno;
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+		return -errno;
+
+	if (!NLMSG_OK(nlh, len))
+		return -EPROTO;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
+		err = NLMSG_DATA(nlh);
+		return err->error ? err->error : -EPROTO;
+	}
+
+	if (nlh->nlmsg_type != GENL_ID_CTRL ||
+			nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return -EPROTO;
+
+	attr = (struct nlattr *) ((char *) NLMSG_DATA(nlh) + GENL_HDRLEN);
+	attrlen = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+	while (attrlen >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN &&
+						attr->nla_len <= attrlen) {
+		if ((attr->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID &&
+				attr->nla_len >= NLA_HDRLEN + sizeof(uint16_t))
+			return *(uint16_t *) ((char *) attr + NLA_HDRLEN);
+
+		attrlen -= NLA_ALIGN(attr->nla_len);
+		attr = (struct nlattr *) ((char *) attr +
+						NLA_ALIGN(attr->nla_len));
+	}
+
+	return -ENOENT;
+}
+
+static void msg_build(struct hop_msg *msg, uint16_t family,
+				uint32_t wpan_phy, uint8_t page,
+				uint8_t channel)
+{
+	memset(msg, 0, sizeof(*msg));
+
+	msg->nlh.nlmsg_len = sizeof(*msg);
+	msg->nlh.nlmsg_type = family;
+	msg->nlh.nlmsg_flags = NLM_F_REQUEST;
+	msg->genl.cmd = NL802154_CMD_SET_CHANNEL;
+
+	msg->phy_attr.nla_len = NLA_HDRLEN + sizeof(msg->phy);
+	msg->phy_attr.nla_type = NL802154_ATTR_WPAN_PHY;
+	msg->phy = wpan_phy;
+
+	msg->page_attr.nla_len = NLA_HDRLEN + sizeof(msg->page);
+	msg->page_attr.nla_type = NL802154_ATTR_PAGE;
+	msg->page = page;
+
+	msg->channel_attr.nla_len = NLA_HDRLEN + sizeof(msg->channel);
+	msg->channel_attr.nla_type = NL802154_ATTR_CHANNEL;
+	msg->channel = channel;
+}
+
+static void hop_tick(struct hop_schedule *hop)
+{
+	struct hop_stats *stats = &hop->stats;
+	struct hop_msg *msg;
+	uint64_t expirations;
+	uint64_t deadline;
+	uint64_t now;
+	uint64_t jitter;
+
+	if (read(hop->timer_fd, &expirations, sizeof(expirations)) !=
+					sizeof(expirations) || !expirations)
+		return;
+
+	/* Only the current slot is served: the ones slept through are lost */
+	if (expirations > 1)
+		__atomic_fetch_add(&stats->missed, expirations - 1,
+							__ATOMIC_RELAXED);
+
+	hop->tick += expirations;
+	deadline = hop->start + (hop->tick - 1) * hop->slot_ns;
+
+	msg = &hop->msgs[(hop->tick - 1) % hop->count];
+	msg->nlh.nlmsg_seq = hop->tick;
+
+	if (send(hop->nl_fd, msg, sizeof(*msg), 0) < 0) {
+		metrics_inc(&stats->failed);
+		return;
+	}
+
+	/*
+	 * Generic netlink runs the command in the sender's context: the
+	 * driver has switched channel by the time send() returns.
+	 */
+	now = now_ns();
+	jitter = now > deadline ? (now - deadline) / 1000 : 0;
+
+	__atomic_store_n(&hop->channel, msg->channel, __ATOMIC_RELAXED);
+	metrics_inc(&stats->hops);
+	__atomic_fetch_add(&stats->jitter_total, jitter, __ATOMIC_RELAXED);
+
+	/* Single writer: no compare and swap needed */
+	if (jitter > metrics_read(&stats->jitter_max))
+		__atomic_store_n(&stats->jitter_max, jitter,
+							__ATOMIC_RELAXED);
+
+	if (jitter * 10 > (uint64_t) hop->slot_ms * 1000)
+		metrics_inc(&stats->late);
+}
+
+/* Without NLM_F_ACK, only refused hops are answered */
+static void hop_errors(struct hop_schedule *hop)
+{
+	uint32_t buf[256];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	int len;
+
+	while ((len = recv(hop->nl_fd, buf, sizeof(buf),
+						MSG_DONTWAIT)) > 0) {
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+						nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			err = NLMSG_DATA(nlh);
+			if (err->error)
+				metrics_inc(&hop->stats.failed);
+		}
+	}
+}
+
+static void *hop_main(void *user_data)
+{
+	struct hop_schedule *hop = user_data;
+	struct pollfd fds[] = {
+		{ .fd = hop->timer_fd, .events = POLLIN },
+		{ .fd = hop->nl_fd, .events = POLLIN },
+		{ .fd = hop->stop_fd, .events = POLLIN },
+	};
+
+	for (;;) {
+		if (poll(fds, L_ARRAY_SIZE(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (fds[2].revents)
+			break;
+
+		if (fds[0].revents & POLLIN)
+			hop_tick(hop);
+
+		if (fds[1].revents & POLLIN)
+			hop_errors(hop);
+	}
+
+	return NULL;
+}
+
+static void hop_close(struct hop_schedule *hop)
+{
+	if (hop->nl_fd >= 0)
+		close(hop->nl_fd);
+
+	if (hop->timer_fd >= 0)
+		close(hop->timer_fd);
+
+	if (hop->stop_fd >= 0)
+		close(hop->stop_fd);
+
+	pool_release(hop_pool, hop);
+}
+
+int hop_start(const char *name, uint32_t wpan_phy, uint8_t page,
+				const uint8_t *channels, unsigned int count,
+				uint32_t slot_ms, struct hop_schedule **out)
+{
+	struct hop_schedule *hop;
+	struct itimerspec its;
+	sigset_t all, old;
+	unsigned int i;
+	int one = 1;
+	int family;
+	int err;
+
+	if (!count || count > HOP_SEQUENCE_MAX || slot_ms < HOP_SLOT_MIN ||
+						slot_ms > HOP_SLOT_MAX)
+		return -EINVAL;
+
+	/* Carved from the memory budget when the first schedule starts */
+	if (!hop_pool)
+		hop_pool = pool_new("hop_schedule",
+					sizeof(struct hop_schedule), HOP_MAX);
+
+	hop = hop_pool ? pool_alloc(hop_pool) : NULL;
+	if (!hop) {
+		l_error("'%s': no hop schedule left", name);
+		return -ENOMEM;
+	}
+
+	snprintf(hop->name, sizeof(hop->name), "%s", name);
+	hop->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+							NETLINK_GENERIC);
+	hop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_CLOEXEC | TFD_NONBLOCK);
+	hop->stop_fd = eventfd(0, EFD_CLOEXEC);
+
+	if (hop->nl_fd < 0 || hop->timer_fd < 0 || hop->stop_fd < 0) {
+		err = -errno;
+		l_error("'%s': hop schedule: %s", name, strerror(-err));
+		goto fail;
+	}
+
+	family = family_resolve(hop->nl_fd);
+	if (family < 0) {
+		err = family;
+		l_error("'%s': %s lookup: %s", name, NL802154_GENL_NAME,
+							strerror(-err));
+		goto fail;
+	}
+
+	/* Refusals do not need to carry the request back */
+	setsockopt(hop->nl_fd, SOL_NETLINK, NETLINK_CAP_ACK,
+							&one, sizeof(one));
+
+	for (i = 0; i < count; i++)
+		msg_build(&hop->msgs[i], family, wpan_phy, page,
+							channels[i]);
+
+	hop->count = count;
+	hop->slot_ms = slot_ms;
+	hop->slot_ns = (uint64_t) slot_ms * 1000000;
+	hop->channel = channels[0];
+	hop->start = now_ns();
+
+	/* The first slot starts now: the timer fires right away */
+	its.it_value.tv_sec = hop->start / 1000000000;
+	its.it_value.tv_nsec = hop->start % 1000000000;
+	its.it_interval.tv_sec = slot_ms / 1000;
+	its.it_interval.tv_nsec = (slot_ms % 1000) * 1000000;
+
+	if (timerfd_settime(hop->timer_fd, TFD_TIMER_ABSTIME,
+							&its, NULL) < 0) {
+		err = -errno;
+		l_error("'%s': hop timer: %s", name, strerror(-err));
+		goto fail;
+	}
+
+	/* Signals stay with the main loop's signalfd */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&hop->thread, NULL, hop_main, hop);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		l_error("'%s': hop thread: %s", name, strerror(err));
+		err = -err;
+		goto fail;
+	}
+
+	l_info("'%s': hopping over %u channels, %u ms slots", name,
+							count, slot_ms);
+
+	*out = hop;
+
+	return 0;
+
+fail:
+	hop_close(hop);
+	return err;
+}
+
+void hop_stop(struct hop_schedule *hop)
+{
+	uint64_t one = 1;
+
+	if (!hop)
+		return;
+
+	while (write(hop->stop_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+
+	pthread_join(hop->thread, NULL);
+
+	l_info("'%s': hopping stopped after %" PRIu64 " hops, %" PRIu64
+			" late", hop->name, hop->stats.hops, hop->stats.late);
+
+	hop_close(hop);
+}
+
+uint8_t hop_channel(const struct hop_schedule *hop)
+{
+	return __atomic_load_n(&hop->channel, __ATOMIC_RELAXED);
+}
+
+uint32_t hop_slot(const struct hop_schedule *hop)
+{
+	return hop->slot_ms;
+}
+
+void hop_get_stats(const struct hop_schedule *hop, struct hop_stats *stats)
+{
+	stats->hops = metrics_read(&hop->stats.hops);
+	stats->late = metrics_read(&hop->stats.late);
+	stats->missed = metrics_read(&hop->stats.missed);
+	stats->failed = metrics_read(&hop->stats.failed);
+	stats->jitter_total = metrics_read(&hop->stats.jitter_total);
+	stats->jitter_max = metrics_read(&hop->stats.jitter_max);
+}
@@ -0,0 +1,45 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define HOP_SEQUENCE_MAX	64
+#define HOP_SLOT_MIN		2	/* msec */
+#define HOP_SLOT_MAX		60000	/* msec */
+
+struct hop_stats {
+	uint64_t hops;
+	uint64_t late;		/* Landed more than a tenth of a slot late */
+	uint64_t missed;	/* Slots skipped: no hop at all */
+	uint64_t failed;	/* Not sent or refused by the kernel */
+	uint64_t jitter_total;	/* usec */
+	uint64_t jitter_max;	/* usec */
+};
+
+struct hop_schedule;
+
+int hop_start(const char *name, uint32_t wpan_phy, uint8_t page,
+				const uint8_t *channels, unsigned int count,
+				uint32_t slot_ms, struct hop_schedule **out);
+void hop_stop(struct hop_schedule *hop);
+
+uint8_t hop_channel(const struct hop_schedule *hop);
+uint32_t hop_slot(const struct hop_schedule *hop);
+void hop_get_stats(const struct hop_schedule *hop, struct hop_stats *stats);
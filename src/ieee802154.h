@@ -0,0 +1,60 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Not exported by the kernel uapi headers: see net/af_ieee802154.h
+ */
+#ifndef AF_IEEE802154
+#define AF_IEEE802154		36
+#endif
+#define SOL_IEEE802154		0
+#define WPAN_WANTLQI		3
+
+#define IEEE802154_ADDR_LONG	0x3
+
+struct ieee802154_addr_sa {
+	int addr_type;
+	uint16_t pan_id;
+	union {
+		uint8_t hwaddr[8];	/* Big endian */
+		uint16_t short_addr;
+	};
+};
+
+struct sockaddr_ieee802154 {
+	sa_family_t family;
+	struct ieee802154_addr_sa addr;
+};
+
+/* extaddr as nl802154 reports it, in host order */
+static inline void ieee802154_sa_from_extaddr(struct sockaddr_ieee802154 *sa,
+							uint64_t extaddr)
+{
+	int i;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->family = AF_IEEE802154;
+	sa->addr.addr_type = IEEE802154_ADDR_LONG;
+
+	for (i = 0; i < 8; i++)
+		sa->addr.hwaddr[i] = extaddr >> (56 - 8 * i);
+}
@@ -0,0 +1,375 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <ell/ell.h>
+
+#include "ieee802154.h"
+#include "inject.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+
+/*
+ * Raw MAC frames go out through an AF_IEEE802154 SOCK_RAW socket bound
+ * to the adapter: the kernel only appends the FCS. Frames queue up in
+ * a per adapter ring and leave in sendmmsg() batches, so frames
+ * submitted within one main loop iteration cost a single syscall.
+ *
+ * The status of a frame is the one of its hand over to the kernel:
+ * raw sockets do not report the MAC level outcome (ACK, CSMA failure).
+ */
+
+#define INJECT_BATCH		16	/* Frames per sendmmsg() */
+#define INJECT_MAX		4	/* Adapters injecting at once */
+#define INJECT_RETRY_MS		1	/* After ENOBUFS from the driver */
+
+#define CREDIT_SCALE		1000	/* Credit units per frame */
+
+struct inject_frame {
+	inject_done_func_t done;
+	void *user_data;
+	uint64_t tag;
+	uint8_t len;
+	uint8_t data[INJECT_FRAME_MAX];
+};
+
+struct inject {
+	char ifname[16];
+	int fd;
+	struct l_io *io;
+	struct l_idle *kick;
+	struct l_timeout *pacing;
+	bool blocked;		/* Waiting for the socket */
+	bool paced;		/* Waiting for the pacing timeout */
+	uint64_t credit;
+	uint64_t last;
+	unsigned int head;
+	unsigned int tail;
+	struct inject_frame queue[INJECT_QUEUE_MAX];
+	struct inject_stats stats;
+
+	/* sendmmsg() scratch */
+	struct mmsghdr msgs[INJECT_BATCH];
+	struct iovec iov[INJECT_BATCH];
+};
+
+static struct pool *inject_pool = NULL;
+
+/* Frames per second and burst, 0: as fast as the kernel takes them */
+static uint32_t pacing_rate = 0;
+static uint32_t pacing_burst = 0;
+
+static void refill(struct inject *inject)
+{
+	uint64_t max = (uint64_t) pacing_burst * CREDIT_SCALE;
+	uint64_t now = latency_now();
+
+	/* Scale of 1000: no overflow even after days without frames */
+	inject->credit += (now - inject->last) * pacing_rate / 1000;
+	if (inject->credit > max)
+		inject->credit = max;
+
+	inject->last = now;
+}
+
+static void complete(struct inject *inject, int status)
+{
+	struct inject_frame *frame;
+
+	frame = &inject->queue[inject->head++ % INJECT_QUEUE_MAX];
+
+	metrics_inc(status ? &inject->stats.failed : &inject->stats.sent);
+
+	if (frame->done)
+		frame->done(status, frame->tag, frame->user_data);
+}
+
+static void pacing_expired_timed(struct l_timeout *timeout, void *user_data);
+static bool socket_writable_timed(struct l_io *io, void *user_data);
+
+static void wait_ms(struct inject *inject, uint64_t ms)
+{
+	inject->paced = true;
+
+	if (inject->pacing)
+		l_timeout_modify_ms(inject->pacing, ms);
+	else
+		inject->pacing = l_timeout_create_ms(ms, pacing_expired_timed,
+							inject, NULL);
+}
+
+static unsigned int paced_count(struct inject *inject, unsigned int count)
+{
+	uint64_t allowed;
+
+	if (!pacing_rate)
+		return count;
+
+	refill(inject);
+
+	allowed = inject->credit / CREDIT_SCALE;
+	if (allowed >= count)
+		return count;
+
+	if (!allowed) {
+		/* Until one frame worth of credit is back */
+		wait_ms(inject, (CREDIT_SCALE - inject->credit) /
+							pacing_rate + 1);
+		metrics_inc(&inject->stats.paced);
+	}
+
+	return allowed;
+}
+
+static void process(struct inject *inject)
+{
+	while (inject->head != inject->tail && !inject->blocked &&
+							!inject->paced) {
+		unsigned int count = inject->tail - inject->head;
+		unsigned int i;
+		int n;
+
+		if (count > INJECT_BATCH)
+			count = INJECT_BATCH;
+
+		count = paced_count(inject, count);
+		if (!count)
+			return;
+
+		for (i = 0; i < count; i++) {
+			const struct inject_frame *frame = &inject->queue[
+				(inject->head + i) % INJECT_QUEUE_MAX];
+
+			inject->iov[i].iov_base = (void *) frame->data;
+			inject->iov[i].iov_len = frame->len;
+		}
+
+		n = sendmmsg(inject->fd, inject->msgs, count, MSG_DONTWAIT);
+		metrics_inc(&inject->stats.syscalls);
+
+		if (n < 0 && errno == EAGAIN) {
+			inject->blocked = true;
+			l_io_set_write_handler(inject->io,
+						socket_writable_timed,
+						inject, NULL);
+			return;
+		}
+
+		/* The device queue is full, not the socket: poll it */
+		if (n < 0 && errno == ENOBUFS) {
+			wait_ms(inject, INJECT_RETRY_MS);
+			return;
+		}
+
+		/* The first frame failed, the others get their own chance */
+		if (n < 0) {
+			complete(inject, -errno);
+			continue;
+		}
+
+		if (pacing_rate)
+			inject->credit -= (uint64_t) n * CREDIT_SCALE;
+
+		for (i = 0; i < (unsigned int) n; i++)
+			complete(inject, 0);
+	}
+}
+
+static void pacing_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct inject *inject = user_data;
+
+	inject->paced = false;
+	process(inject);
+}
+
+LATENCY_TIMEOUT(pacing_expired)
+
+static bool socket_writable(struct l_io *io, void *user_data)
+{
+	struct inject *inject = user_data;
+
+	inject->blocked = false;
+	process(inject);
+
+	/* Blocked again: keep the handler */
+	return inject->blocked;
+}
+
+LATENCY_IO(socket_writable)
+
+/* Frames submitted in one main loop iteration leave together */
+static void kick(struct l_idle *idle, void *user_data)
+{
+	struct inject *inject = user_data;
+
+	l_idle_remove(inject->kick);
+	inject->kick = NULL;
+
+	process(inject);
+}
+
+struct inject *inject_new(const char *ifname, uint64_t extaddr)
+{
+	struct inject *inject;
+	struct sockaddr_ieee802154 sa;
+	int size = 0;
+	int i;
+
+	/* Carved from the memory budget on the first injection */
+	if (!inject_pool)
+		inject_pool = pool_new("inject", sizeof(struct inject),
+								INJECT_MAX);
+
+	inject = inject_pool ? pool_alloc(inject_pool) : NULL;
+	if (!inject) {
+		l_error("'%s': no injection queue left", ifname);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	snprintf(inject->ifname, sizeof(inject->ifname), "%s", ifname);
+
+	inject->fd = socket(AF_IEEE802154, SOCK_RAW | SOCK_CLOEXEC |
+							SOCK_NONBLOCK, 0);
+	if (inject->fd < 0)
+		goto failed;
+
+	ieee802154_sa_from_extaddr(&sa, extaddr);
+
+	/* Raw sockets also get every received frame: keep none */
+	if (bind(inject->fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 ||
+			setsockopt(inject->fd, SOL_SOCKET, SO_RCVBUF,
+						&size, sizeof(size)) < 0) {
+		close(inject->fd);
+		goto failed;
+	}
+
+	inject->io = l_io_new(inject->fd);
+	l_io_set_close_on_destroy(inject->io, true);
+
+	for (i = 0; i < INJECT_BATCH; i++) {
+		inject->msgs[i].msg_hdr.msg_iov = &inject->iov[i];
+		inject->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	inject->credit = (uint64_t) pacing_burst * CREDIT_SCALE;
+	inject->last = latency_now();
+
+	return inject;
+
+failed:
+	i = errno;
+	l_warn("%s: injection socket: %s", ifname, strerror(i));
+	pool_release(inject_pool, inject);
+	errno = i;
+
+	return NULL;
+}
+
+/* Frames still queued are reported as not sent */
+void inject_free(struct inject *inject)
+{
+	if (!inject)
+		return;
+
+	if (inject->kick)
+		l_idle_remove(inject->kick);
+
+	l_timeout_remove(inject->pacing);
+	l_io_destroy(inject->io);
+
+	while (inject->head != inject->tail)
+		complete(inject, -ENODEV);
+
+	pool_release(inject_pool, inject);
+}
+
+unsigned int inject_room(const struct inject *inject)
+{
+	return INJECT_QUEUE_MAX - (inject->tail - inject->head);
+}
+
+int inject_submit(struct inject *inject, const void *frame, size_t len,
+			inject_done_func_t done, uint64_t tag,
+			void *user_data)
+{
+	struct inject_frame *slot;
+
+	if (!len || len > INJECT_FRAME_MAX)
+		return -EMSGSIZE;
+
+	if (!inject_room(inject))
+		return -ENOBUFS;
+
+	slot = &inject->queue[inject->tail++ % INJECT_QUEUE_MAX];
+	slot->done = done;
+	slot->user_data = user_data;
+	slot->tag = tag;
+	slot->len = len;
+	memcpy(slot->data, frame, len);
+
+	if (!inject->kick && !inject->blocked && !inject->paced)
+		inject->kick = l_idle_create(kick, inject, NULL);
+
+	return 0;
+}
+
+/* The frames still go out, their submitter is just not told */
+void inject_cancel(struct inject *inject, void *user_data)
+{
+	unsigned int i;
+
+	for (i = inject->head; i != inject->tail; i++) {
+		struct inject_frame *frame =
+				&inject->queue[i % INJECT_QUEUE_MAX];
+
+		if (frame->user_data == user_data)
+			frame->done = NULL;
+	}
+}
+
+void inject_get_stats(const struct inject *inject,
+					struct inject_stats *stats)
+{
+	stats->sent = metrics_read(&inject->stats.sent);
+	stats->failed = metrics_read(&inject->stats.failed);
+	stats->syscalls = metrics_read(&inject->stats.syscalls);
+	stats->paced = metrics_read(&inject->stats.paced);
+}
+
+void inject_set_pacing(uint32_t rate, uint32_t burst)
+{
+	pacing_rate = rate;
+	pacing_burst = burst ? : 1;
+}
@@ -0,0 +1,50 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define INJECT_FRAME_MAX	125	/* aMaxPHYPacketSize less the FCS */
+#define INJECT_QUEUE_MAX	64	/* Frames waiting per adapter */
+
+/* 0 once the kernel took the frame, or a negative errno */
+typedef void (*inject_done_func_t)(int status, uint64_t tag,
+							void *user_data);
+
+struct inject_stats {
+	uint64_t sent;
+	uint64_t failed;
+	uint64_t syscalls;
+	uint64_t paced;		/* Batches held back by the pacing */
+};
+
+struct inject;
+
+struct inject *inject_new(const char *ifname, uint64_t extaddr);
+void inject_free(struct inject *inject);
+
+unsigned int inject_room(const struct inject *inject);
+int inject_submit(struct inject *inject, const void *frame, size_t len,
+			inject_done_func_t done, uint64_t tag,
+			void *user_data);
+void inject_cancel(struct inject *inject, void *user_data);
+void inject_get_stats(const struct inject *inject,
+					struct inject_stats *stats);
+
+void inject_set_pacing(uint32_t rate, uint32_t burst);
@@ -0,0 +1,351 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include <ell/ell.h>
+
+#include "iphc.h"
+#include "pool.h"
+
+#define IPHC_ROOT_DEFAULT	"/sys/kernel/debug/6lowpan"
+
+/* One table per adapter, carved on first use */
+#define IPHC_TABLE_MAX		16
+
+/* Calls waiting for the same flush */
+#define IPHC_WAITERS		8
+
+struct iphc_waiter {
+	iphc_commit_func_t func;
+	void *user_data;
+};
+
+struct iphc_table {
+	char ifname[IFNAMSIZ];
+	char link[IFNAMSIZ];		/* 6LoWPAN link written to */
+	struct iphc_context contexts[IPHC_CONTEXT_MAX];	/* Requested */
+	struct iphc_context applied[IPHC_CONTEXT_MAX];	/* In the kernel */
+	uint16_t known;			/* applied[] entries to trust */
+	struct l_idle *flush;
+	struct iphc_waiter waiters[IPHC_WAITERS];
+	unsigned int waiter_count;
+};
+
+static char root[PATH_MAX] = IPHC_ROOT_DEFAULT;
+static struct pool *table_pool = NULL;
+
+/*
+ * Stand-ins for testing need the <link>/contexts/<id> directories,
+ * the files are created.
+ */
+void iphc_set_root(const char *path)
+{
+	snprintf(root, sizeof(root), "%s", path);
+}
+
+static int write_attr(const char *link, unsigned int id, const char *attr,
+							const char *value)
+{
+	char path[PATH_MAX];
+	ssize_t len = strlen(value);
+	int fd, err = 0;
+
+	if (snprintf(path, sizeof(path), "%s/%s/contexts/%u/%s", root, link,
+					id, attr) >= (int) sizeof(path))
+		return -ENAMETOOLONG;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	if (write(fd, value, len) != len)
+		err = -EIO;
+
+	if (close(fd) < 0 && !err)
+		err = -errno;
+
+done:
+	if (err < 0)
+		l_error("%s: %s", path, strerror(-err));
+
+	return err;
+}
+
+/* Parsed by the kernel as eight groups of 4 hex digits and a length */
+static void format_prefix(const struct iphc_context *ctx, char *buf,
+								size_t size)
+{
+	const uint8_t *a = ctx->prefix.s6_addr;
+
+	snprintf(buf, size, "%04x:%04x:%04x:%04x:%04x:%04x:%04x:%04x %u\n",
+			a[0] << 8 | a[1], a[2] << 8 | a[3],
+			a[4] << 8 | a[5], a[6] << 8 | a[7],
+			a[8] << 8 | a[9], a[10] << 8 | a[11],
+			a[12] << 8 | a[13], a[14] << 8 | a[15], ctx->plen);
+}
+
+static int context_apply(struct iphc_table *table, unsigned int id)
+{
+	const struct iphc_context *want = &table->contexts[id];
+	struct iphc_context *have = &table->applied[id];
+	bool prefix;
+	char buf[64];
+	int err;
+
+	/* Unknown kernel state: take the full sequence below */
+	if (!(table->known & (1 << id))) {
+		/* Never set from here: left to whoever else manages it */
+		if (!want->active)
+			return 0;
+
+		have->active = true;
+		have->plen = 0xff;
+		have->compression = !want->compression;
+	}
+
+	prefix = have->plen != want->plen ||
+			memcmp(&have->prefix, &want->prefix,
+						sizeof(want->prefix));
+
+	/* Never compress against a half written context */
+	if (have->active && (!want->active || prefix)) {
+		err = write_attr(table->link, id, "active", "0\n");
+		if (err < 0)
+			return err;
+
+		have->active = false;
+		table->known |= 1 << id;
+	}
+
+	if (!want->active)
+		return 0;
+
+	if (prefix) {
+		format_prefix(want, buf, sizeof(buf));
+
+		err = write_attr(table->link, id, "prefix", buf);
+		if (err < 0)
+			return err;
+
+		have->prefix = want->prefix;
+		have->plen = want->plen;
+	}
+
+	if (have->compression != want->compression) {
+		err = write_attr(table->link, id, "compression",
+					want->compression ? "1\n" : "0\n");
+		if (err < 0)
+			return err;
+
+		have->compression = want->compression;
+	}
+
+	if (!have->active) {
+		err = write_attr(table->link, id, "active", "1\n");
+		if (err < 0)
+			return err;
+
+		have->active = true;
+	}
+
+	return 0;
+}
+
+static void table_flush(struct l_idle *idle, void *user_data)
+{
+	struct iphc_table *table = user_data;
+	unsigned int id, i, count = table->waiter_count;
+	int err = 0;
+
+	l_idle_remove(table->flush);
+	table->flush = NULL;
+	table->waiter_count = 0;
+
+	/* Only what differs from the kernel is written */
+	for (id = 0; id < IPHC_CONTEXT_MAX && !err; id++)
+		err = context_apply(table, id);
+
+	if (err < 0) {
+		/* Report what the kernel has, it is retried on next commit */
+		for (id = 0; id < IPHC_CONTEXT_MAX; id++)
+			if (!(table->known & (1 << id)))
+				memset(&table->applied[id], 0,
+						sizeof(table->applied[id]));
+
+		table->known = 0;
+		memcpy(table->contexts, table->applied,
+						sizeof(table->contexts));
+	}
+
+	l_debug("%s: contexts flushed for %u calls: %d", table->link,
+								count, err);
+
+	for (i = 0; i < count; i++)
+		table->waiters[i].func(err, table->waiters[i].user_data);
+}
+
+/*
+ * Changes made within one main loop iteration are written together,
+ * func is called once they reached the kernel.
+ */
+int iphc_commit(struct iphc_table *table, const char *link,
+				iphc_commit_func_t func, void *user_data)
+{
+	if (table->waiter_count == IPHC_WAITERS)
+		return -EBUSY;
+
+	/* A different link starts with its own kernel table */
+	if (strcmp(table->link, link)) {
+		snprintf(table->link, sizeof(table->link), "%s", link);
+		table->known = 0;
+	}
+
+	if (!table->flush) {
+		table->flush = l_idle_create(table_flush, table, NULL);
+		if (!table->flush)
+			return -ENOMEM;
+	}
+
+	table->waiters[table->waiter_count].func = func;
+	table->waiters[table->waiter_count].user_data = user_data;
+	table->waiter_count++;
+
+	return 0;
+}
+
+/* "2001:db8::/64" */
+bool iphc_parse_prefix(const char *str, struct in6_addr *prefix,
+							uint8_t *plen)
+{
+	char addr[INET6_ADDRSTRLEN];
+	const char *slash = strchr(str, '/');
+	char *end;
+	unsigned long len;
+
+	if (!slash || slash == str || slash - str >= (int) sizeof(addr))
+		return false;
+
+	memcpy(addr, str, slash - str);
+	addr[slash - str] = '\0';
+
+	if (inet_pton(AF_INET6, addr, prefix) != 1)
+		return false;
+
+	errno = 0;
+	len = strtoul(slash + 1, &end, 10);
+	if (errno || end == slash + 1 || *end || len > 128)
+		return false;
+
+	*plen = len;
+
+	return true;
+}
+
+const struct iphc_context *iphc_context_get(const struct iphc_table *table,
+								uint8_t id)
+{
+	if (id >= IPHC_CONTEXT_MAX || !table->contexts[id].active)
+		return NULL;
+
+	return &table->contexts[id];
+}
+
+bool iphc_context_set(struct iphc_table *table, uint8_t id,
+				const struct in6_addr *prefix, uint8_t plen,
+				bool compression)
+{
+	struct iphc_context *ctx;
+
+	if (id >= IPHC_CONTEXT_MAX || plen > 128)
+		return false;
+
+	ctx = &table->contexts[id];
+	ctx->prefix = *prefix;
+	ctx->plen = plen;
+	ctx->compression = compression;
+	ctx->active = true;
+
+	return true;
+}
+
+bool iphc_context_remove(struct iphc_table *table, uint8_t id)
+{
+	if (!iphc_context_get(table, id))
+		return false;
+
+	table->contexts[id].active = false;
+
+	return true;
+}
+
+struct iphc_table *iphc_table_new(const char *ifname)
+{
+	struct iphc_table *table;
+
+	if (!table_pool)
+		table_pool = pool_new("iphc_table", sizeof(struct iphc_table),
+							IPHC_TABLE_MAX);
+
+	table = table_pool ? pool_alloc(table_pool) : NULL;
+	if (!table) {
+		l_error("'%s': no context table left", ifname);
+		return NULL;
+	}
+
+	snprintf(table->ifname, sizeof(table->ifname), "%s", ifname);
+
+	return table;
+}
+
+void iphc_table_free(struct iphc_table *table)
+{
+	unsigned int i;
+
+	if (!table)
+		return;
+
+	if (table->flush)
+		l_idle_remove(table->flush);
+
+	for (i = 0; i < table->waiter_count; i++)
+		table->waiters[i].func(-ECANCELED,
+					table->waiters[i].user_data);
+
+	pool_release(table_pool, table);
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <netinet/in.h>
+
+/* LOWPAN_IPHC_CTX_TABLE_SIZE in the kernel */
+#define IPHC_CONTEXT_MAX	16
+
+struct iphc_context {
+	struct in6_addr prefix;
+	uint8_t plen;
+	bool compression;
+	bool active;
+};
+
+struct iphc_table;
+
+typedef void (*iphc_commit_func_t)(int err, void *user_data);
+
+void iphc_set_root(const char *path);
+
+struct iphc_table *iphc_table_new(const char *ifname);
+void iphc_table_free(struct iphc_table *table);
+
+bool iphc_parse_prefix(const char *str, struct in6_addr *prefix,
+							uint8_t *plen);
+
+const struct iphc_context *iphc_context_get(const struct iphc_table *table,
+								uint8_t id);
+bool iphc_context_set(struct iphc_table *table, uint8_t id,
+				const struct in6_addr *prefix, uint8_t plen,
+				bool compression);
+bool iphc_context_remove(struct iphc_table *table, uint8_t id);
+
+int iphc_commit(struct iphc_table *table, const char *link,
+				iphc_commit_func_t func, void *user_data);
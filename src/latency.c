@@ -0,0 +1,243 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "dbus.h"
+#include "trace.h"
+#include "latency.h"
+
+#define DEBUG_INTERFACE		"net.connman.iwpand.Debug"
+#define DEBUG_PATH		"/"
+
+#define LOOP_LAG_INTERVAL	100	/* ms */
+
+/* Sites register themselves the first time they are hit */
+static struct latency_site *site_list = NULL;
+
+static struct l_timeout *lag_timeout = NULL;
+static uint64_t lag_expected;
+static uint32_t lag_last;
+static uint32_t lag_max;
+static struct latency_site lag_site = { .name = "main_loop_lag" };
+
+static unsigned int bucket(uint64_t usec)
+{
+	unsigned int i = 0;
+
+	while (usec && i < LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+static void site_add(struct latency_site *site, uint64_t usec)
+{
+	if (!site->registered) {
+		site->registered = true;
+		site->next = site_list;
+		site_list = site;
+	}
+
+	site->count++;
+	site->total += usec;
+	site->buckets[bucket(usec)]++;
+
+	if (usec > site->max)
+		site->max = usec;
+}
+
+void latency_record(struct latency_site *site, uint64_t start)
+{
+	site_add(site, latency_now() - start);
+}
+
+/*
+ * A callback blocking the loop delays this timeout: the difference to
+ * the programmed expiration is the time other callbacks held the loop.
+ */
+static void lag_expired(struct l_timeout *timeout, void *user_data)
+{
+	uint64_t now = latency_now();
+	uint64_t lag = now > lag_expected ? now - lag_expected : 0;
+
+	lag_last = lag;
+	if (lag > lag_max)
+		lag_max = lag;
+
+	site_add(&lag_site, lag);
+
+	lag_expected = now + LOOP_LAG_INTERVAL * 1000;
+	l_timeout_modify_ms(timeout, LOOP_LAG_INTERVAL);
+}
+
+static void append_site(struct l_dbus_message_builder *builder,
+					const struct latency_site *site)
+{
+	unsigned int i;
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+	dbus_append_dict_basic(builder, "Name", 's', site->name);
+	dbus_append_dict_basic(builder, "Count", 't', &site->count);
+	dbus_append_dict_basic(builder, "Total", 't', &site->total);
+	dbus_append_dict_basic(builder, "Max", 't', &site->max);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', "Histogram");
+	l_dbus_message_builder_enter_variant(builder, "au");
+	l_dbus_message_builder_enter_array(builder, "u");
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		l_dbus_message_builder_append_basic(builder, 'u',
+							&site->buckets[i]);
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
+static struct l_dbus_message *method_get_latency(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	const struct latency_site *site;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+	for (site = site_list; site; site = site->next)
+		append_site(builder, site);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+static void site_reset(struct latency_site *site)
+{
+	site->count = 0;
+	site->total = 0;
+	site->max = 0;
+	memset(site->buckets, 0, sizeof(site->buckets));
+}
+
+static struct l_dbus_message *method_reset(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct latency_site *site;
+
+	l_info("Debug.Reset()");
+
+	for (site = site_list; site; site = site->next)
+		site_reset(site);
+
+	lag_last = 0;
+	lag_max = 0;
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static bool property_get_loop_lag(struct l_dbus *dbus,
+				     struct l_dbus_message *msg,
+				     struct l_dbus_message_builder *builder,
+				     void *user_data)
+{
+	l_dbus_message_builder_append_basic(builder, 'u', &lag_last);
+
+	return true;
+}
+
+static bool property_get_max_loop_lag(struct l_dbus *dbus,
+				     struct l_dbus_message *msg,
+				     struct l_dbus_message_builder *builder,
+				     void *user_data)
+{
+	l_dbus_message_builder_append_basic(builder, 'u', &lag_max);
+
+	return true;
+}
+
+static void register_debug_interface(struct l_dbus_interface *interface)
+{
+	l_dbus_interface_method(interface, "GetLatency", 0,
+				method_get_latency, "aa{sv}", "",
+				"callbacks");
+	l_dbus_interface_method(interface, "Reset", 0, method_reset, "", "");
+
+	if (!l_dbus_interface_property(interface, "LoopLag", 0, "u",
+				       property_get_loop_lag, NULL))
+		l_error("Can't add 'LoopLag' property");
+
+	if (!l_dbus_interface_property(interface, "MaxLoopLag", 0, "u",
+				       property_get_max_loop_lag, NULL))
+		l_error("Can't add 'MaxLoopLag' property");
+}
+
+bool latency_init(void)
+{
+	if (!l_dbus_register_interface(dbus_get_bus(), DEBUG_INTERFACE,
+					register_debug_interface,
+					NULL, false)) {
+		l_error("Unable to register %s interface", DEBUG_INTERFACE);
+		return false;
+	}
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), DEBUG_PATH,
+						DEBUG_INTERFACE, NULL))
+		l_error("'%s': Unable to register %s interface",
+						DEBUG_PATH, DEBUG_INTERFACE);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), DEBUG_PATH,
+					L_DBUS_INTERFACE_PROPERTIES, NULL))
+		l_error("'%s': Unable to register %s interface",
+				DEBUG_PATH, L_DBUS_INTERFACE_PROPERTIES);
+
+	lag_expected = latency_now() + LOOP_LAG_INTERVAL * 1000;
+	lag_timeout = l_timeout_create_ms(LOOP_LAG_INTERVAL, lag_expired,
+								NULL, NULL);
+
+	return true;
+}
+
+void latency_exit(void)
+{
+	l_timeout_remove(lag_timeout);
+	lag_timeout = NULL;
+
+	l_dbus_object_remove_interface(dbus_get_bus(), DEBUG_PATH,
+							DEBUG_INTERFACE);
+	l_dbus_unregister_interface(dbus_get_bus(), DEBUG_INTERFACE);
+}
@@ -0,0 +1,139 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <time.h>
+
+#define LATENCY_BUCKETS		22	/* log2(usec): <1us ... >=1s */
+
+struct latency_site {
+	const char *name;
+	uint64_t count;
+	uint64_t total;		/* usec */
+	uint64_t max;		/* usec */
+	uint32_t buckets[LATENCY_BUCKETS];
+	struct latency_site *next;
+	bool registered;
+};
+
+static inline uint64_t latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void latency_record(struct latency_site *site, uint64_t start);
+
+/*
+ * Wrappers timing a main loop callback: define them right after the
+ * callback and register <callback>_timed instead of the callback.
+ * nl802154 replies, method calls and property writes are also handed
+ * to the --trace recorder here.
+ */
+#define LATENCY_SITE(fn) \
+	static struct latency_site fn##_site = { .name = #fn }
+
+#define LATENCY_GENL_CALLBACK(fn)					\
+LATENCY_SITE(fn);							\
+static void fn##_timed(struct l_genl_msg *msg, void *user_data)	\
+{									\
+	uint64_t start = latency_now();					\
+	trace_genl(0, #fn, msg);					\
+	fn(msg, user_data);						\
+	latency_record(&fn##_site, start);				\
+}
+
+#define LATENCY_GETTER(fn)						\
+LATENCY_SITE(fn);							\
+static bool fn##_timed(struct l_dbus *dbus, struct l_dbus_message *msg,	\
+			struct l_dbus_message_builder *builder,		\
+			void *user_data)				\
+{									\
+	uint64_t start = latency_now();					\
+	bool ret = fn(dbus, msg, builder, user_data);			\
+	latency_record(&fn##_site, start);				\
+	return ret;							\
+}
+
+#define LATENCY_SETTER(fn)						\
+LATENCY_SITE(fn);							\
+static struct l_dbus_message *fn##_timed(struct l_dbus *dbus,		\
+			struct l_dbus_message *message,			\
+			struct l_dbus_message_iter *new_value,		\
+			l_dbus_property_complete_cb_t complete,		\
+			void *user_data)				\
+{									\
+	uint64_t start = latency_now();					\
+	struct l_dbus_message *ret;					\
+	trace_dbus(message, new_value);					\
+	ret = fn(dbus, message, new_value, complete, user_data);	\
+	latency_record(&fn##_site, start);				\
+	return ret;							\
+}
+
+#define LATENCY_METHOD(fn)						\
+LATENCY_SITE(fn);							\
+static struct l_dbus_message *fn##_timed(struct l_dbus *dbus,		\
+			struct l_dbus_message *message,			\
+			void *user_data)				\
+{									\
+	uint64_t start = latency_now();					\
+	struct l_dbus_message *ret;					\
+	trace_dbus(message, NULL);					\
+	ret = fn(dbus, message, user_data);				\
+	latency_record(&fn##_site, start);				\
+	return ret;							\
+}
+
+#define LATENCY_TIMEOUT(fn)						\
+LATENCY_SITE(fn);							\
+static void fn##_timed(struct l_timeout *timeout, void *user_data)	\
+{									\
+	uint64_t start = latency_now();					\
+	fn(timeout, user_data);						\
+	latency_record(&fn##_site, start);				\
+}
+
+#define LATENCY_IO(fn)							\
+LATENCY_SITE(fn);							\
+static bool fn##_timed(struct l_io *io, void *user_data)		\
+{									\
+	uint64_t start = latency_now();					\
+	bool ret = fn(io, user_data);					\
+	latency_record(&fn##_site, start);				\
+	return ret;							\
+}
+
+#define LATENCY_NETLINK_NOTIFY(fn)					\
+LATENCY_SITE(fn);							\
+static void fn##_timed(uint16_t type, const void *data, uint32_t len,	\
+							void *user_data)\
+{									\
+	uint64_t start = latency_now();					\
+	fn(type, data, len, user_data);					\
+	latency_record(&fn##_site, start);				\
+}
+
+bool latency_init(void);
+void latency_exit(void);
@@ -24,17 +24,144 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 
+#include <net/if.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/if_arp.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
 #include <ell/ell.h>
 
 #include "lowpan.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
 
-static struct l_netlink *rtnl = NULL;
+#define RTNL_RCVBUF_DEFAULT	(1 << 20)
+#define RTNL_BUFSIZE		32768
+
+/* A netlink socket runs one dump at a time, others wait here */
+#define RTNL_DUMP_MAX		4
+
+struct lowpan_link {
+	uint32_t ifindex;
+	uint32_t parent;	/* IFLA_LINK: the wpan interface */
+	char name[IFNAMSIZ];
+	bool stale;
+};
+
+static int rtnl_fd = -1;
+static struct l_io *rtnl_io = NULL;
+static unsigned int users;
+static struct l_queue *links = NULL;
+
+static int rcvbuf = RTNL_RCVBUF_DEFAULT;
+static int rcvbuf_actual;
+static bool filter_enabled = true;
+static bool filter_attached;
+static lowpan_resync_func_t resync_func = NULL;
+
+/* Link dump queued or in progress, 0 if none */
+static uint32_t dump_seq;
+static uint32_t last_seq;	/* Starts at 1: events carry seq 0 */
+static bool dump_again;
+
+struct rtnl_dump_request {
+	uint16_t type;
+	uint32_t seq;
+};
+
+static struct rtnl_dump_request dump_queue[RTNL_DUMP_MAX];
+static unsigned int dump_head;
+static unsigned int dump_count;
+static uint32_t dump_running;	/* Sequence number of the dump sent */
+
+/* Replies to requests of another module sharing the socket */
+static lowpan_rtnl_func_t client_func = NULL;
+static void *client_data;
+
+/* Kept across lowpan_init()/lowpan_exit() */
+static uint64_t newlink_events;
+static uint64_t dellink_events;
+static uint64_t overflows;
+static uint64_t dumps;
+static uint64_t links_lost;
+static uint64_t wakeups;
+static uint64_t messages;
+static uint64_t ignored;	/* Link messages of other link types */
+
+static bool link_match_ifindex(const void *a, const void *b)
+{
+	const struct lowpan_link *link = a;
+
+	return link->ifindex == L_PTR_TO_UINT(b);
+}
+
+static bool link_match_parent(const void *a, const void *b)
+{
+	const struct lowpan_link *link = a;
+
+	return link->parent == L_PTR_TO_UINT(b) && link->name[0];
+}
+
+static bool link_match_stale(const void *a, const void *b)
+{
+	const struct lowpan_link *link = a;
+
+	return link->stale;
+}
+
+static void link_update(const struct ifinfomsg *ifi, uint32_t len)
+{
+	struct lowpan_link *link;
+	const struct rtattr *rta = IFLA_RTA(ifi);
+	const char *name = NULL;
+	uint32_t parent = 0;
+
+	len -= NLMSG_ALIGN(sizeof(*ifi));
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			if (RTA_PAYLOAD(rta) <= IFNAMSIZ &&
+					memchr(RTA_DATA(rta), '\0',
+							RTA_PAYLOAD(rta)))
+				name = RTA_DATA(rta);
+			break;
+		case IFLA_LINK:
+			/* The wpan interface the link was created on */
+			if (RTA_PAYLOAD(rta) == sizeof(uint32_t))
+				memcpy(&parent, RTA_DATA(rta), sizeof(parent));
+			break;
+		}
+	}
+
+	link = l_queue_find(links, link_match_ifindex,
+					L_UINT_TO_PTR(ifi->ifi_index));
+	if (!link) {
+		link = l_new(struct lowpan_link, 1);
+		link->ifindex = ifi->ifi_index;
+		l_queue_push_tail(links, link);
+	}
+
+	if (name)
+		strcpy(link->name, name);
+
+	if (parent)
+		link->parent = parent;
+
+	link->stale = false;
+}
 
 static void rtnl_link_notify(uint16_t type, const void *data, uint32_t len,
 							void *user_data)
@@ -44,43 +171,551 @@ static void rtnl_link_notify(uint16_t type, const void *data, uint32_t len,
 	 * Callback called when virtual link is created or deleted.
 	 */
 	const struct ifinfomsg *ifi = data;
+	bool from_dump = L_PTR_TO_UINT(user_data);
 
-	if (ifi->ifi_type != ARPHRD_6LOWPAN)
+	if (len < NLMSG_ALIGN(sizeof(*ifi)) ||
+					ifi->ifi_type != ARPHRD_6LOWPAN) {
+		metrics_inc(&ignored);
 		return;
+	}
 
 	switch (type) {
 	case RTM_NEWLINK:
+		link_update(ifi, len);
+
+		if (from_dump)
+			break;
+
 		l_info("RTNL_NEWLINK");
+		metrics_inc(&newlink_events);
 		break;
 	case RTM_DELLINK:
+		l_free(l_queue_remove_if(links, link_match_ifindex,
+					L_UINT_TO_PTR(ifi->ifi_index)));
 		l_info("RTM_DELLINK");
+		metrics_inc(&dellink_events);
 		break;
 	}
 }
 
-bool lowpan_init(void)
+LATENCY_NETLINK_NOTIFY(rtnl_link_notify)
+
+static void mark_link_stale(void *data, void *user_data)
 {
-	l_info("6LoWPAN init");
+	struct lowpan_link *link = data;
+
+	link->stale = true;
+}
+
+static void rtnl_dump_failed(uint32_t seq, int err)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct nlmsgerr err;
+	} msg;
+
+	if (seq == dump_seq) {
+		l_error("rtnl: link dump: %s", strerror(-err));
+		dump_seq = 0;
+		return;
+	}
+
+	if (!client_func)
+		return;
+
+	/* Reported to the client like a kernel error */
+	memset(&msg, 0, sizeof(msg));
+	msg.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(msg.err));
+	msg.hdr.nlmsg_type = NLMSG_ERROR;
+	msg.hdr.nlmsg_seq = seq;
+	msg.err.error = err;
+
+	client_func(&msg.hdr, 0, client_data);
+}
+
+static void rtnl_dump_next(void)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifinfomsg ifi;
+	} req;
+	struct rtnl_dump_request *dump;
+	size_t len;
+
+	while (!dump_running && dump_count) {
+		dump = &dump_queue[dump_head];
+		dump_head = (dump_head + 1) % RTNL_DUMP_MAX;
+		dump_count--;
+
+		/* Every request body starts with its address family */
+		switch (dump->type) {
+		case RTM_GETADDR:
+			len = sizeof(struct ifaddrmsg);
+			break;
+		case RTM_GETROUTE:
+			len = sizeof(struct rtmsg);
+			break;
+		default:
+			len = sizeof(struct ifinfomsg);
+			break;
+		}
+
+		memset(&req, 0, sizeof(req));
+		req.hdr.nlmsg_len = NLMSG_LENGTH(len);
+		req.hdr.nlmsg_type = dump->type;
+		req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		req.hdr.nlmsg_seq = dump->seq;
+		req.ifi.ifi_family = dump->type == RTM_GETLINK ?
+							AF_UNSPEC : AF_INET6;
 
-	rtnl = l_netlink_new(NETLINK_ROUTE);
-	if (!rtnl) {
-		l_error("Failed to open netlink route socket");
+		trace_rtnl(TRACE_OUT, &req, req.hdr.nlmsg_len);
+
+		if (send(rtnl_fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+			rtnl_dump_failed(dump->seq, -errno);
+			continue;
+		}
+
+		dump_running = dump->seq;
+	}
+}
+
+/* Failures may be reported before this returns: seq is known by then */
+static bool rtnl_dump_queue(uint16_t type, uint32_t seq)
+{
+	struct rtnl_dump_request *dump;
+
+	if (rtnl_fd < 0 || dump_count == RTNL_DUMP_MAX)
 		return false;
+
+	dump = &dump_queue[(dump_head + dump_count++) % RTNL_DUMP_MAX];
+	dump->type = type;
+	dump->seq = seq;
+
+	rtnl_dump_next();
+
+	return true;
+}
+
+static void rtnl_dump(void)
+{
+	/* Restart once the running dump completes */
+	if (dump_seq) {
+		dump_again = true;
+		return;
 	}
 
-	if (!l_netlink_register(rtnl, RTNLGRP_LINK,
-				rtnl_link_notify, NULL, NULL)) {
-		l_error("Failed to register RTNL link notifications");
-		l_netlink_destroy(rtnl);
+	/* Whatever the dump does not return was deleted meanwhile */
+	l_queue_foreach(links, mark_link_stale, NULL);
+
+	dump_again = false;
+	dump_seq = ++last_seq;
+
+	if (!rtnl_dump_queue(RTM_GETLINK, dump_seq)) {
+		l_error("rtnl: link dump: queue full");
+		dump_seq = 0;
+	}
+}
+
+static void rtnl_dump_done(bool complete)
+{
+	struct lowpan_link *link;
+
+	dump_seq = 0;
+
+	if (!complete || dump_again) {
+		rtnl_dump();
+		return;
+	}
+
+	metrics_inc(&dumps);
+
+	/* DELLINK events lost in the overflow */
+	while ((link = l_queue_remove_if(links, link_match_stale, NULL))) {
+		l_info("rtnl: %s (ifindex %u) gone after resync",
+						link->name, link->ifindex);
+		metrics_inc(&links_lost);
+		l_free(link);
+	}
+}
+
+static void rtnl_overflow(void)
+{
+	bool dumping = dump_seq;
+
+	metrics_inc(&overflows);
+	l_warn("rtnl: receive buffer overrun, link events lost");
+
+	/*
+	 * Only multicast messages are dropped, a running dump completes
+	 * and is then repeated to catch what was lost meanwhile.
+	 */
+	rtnl_dump();
+
+	/* Adapter state depends on the same links: resync it as well */
+	if (!dumping && resync_func)
+		resync_func();
+
+	/* Replies to the client may be among the lost messages */
+	if (client_func)
+		client_func(NULL, -ENOBUFS, client_data);
+}
+
+static void rtnl_process(const void *buf, int len)
+{
+	const struct nlmsghdr *nlh;
+	bool intr = false;
+	bool dump_end = false;
+
+	for (nlh = buf; NLMSG_OK(nlh, (unsigned int) len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+		bool from_dump = dump_seq && nlh->nlmsg_seq == dump_seq;
+
+		metrics_inc(&messages);
+
+		if (dump_running && nlh->nlmsg_seq == dump_running &&
+				(nlh->nlmsg_type == NLMSG_DONE ||
+					nlh->nlmsg_type == NLMSG_ERROR))
+			dump_end = true;
+
+		/* Client request, or leftover of a failed dump */
+		if (nlh->nlmsg_seq && !from_dump) {
+			if (client_func)
+				client_func(nlh, 0, client_data);
+			continue;
+		}
+
+		if (from_dump && (nlh->nlmsg_flags & NLM_F_DUMP_INTR))
+			intr = true;
+
+		switch (nlh->nlmsg_type) {
+		case NLMSG_DONE:
+			if (from_dump)
+				rtnl_dump_done(!intr);
+			break;
+		case NLMSG_ERROR:
+			if (from_dump) {
+				l_error("rtnl: link dump failed");
+				dump_seq = 0;
+			}
+			break;
+		case RTM_NEWLINK:
+		case RTM_DELLINK:
+			rtnl_link_notify_timed(nlh->nlmsg_type,
+					NLMSG_DATA(nlh), NLMSG_PAYLOAD(nlh, 0),
+					L_UINT_TO_PTR(from_dump));
+			break;
+		}
+	}
+
+	/* The socket is free for the next queued dump */
+	if (dump_end) {
+		dump_running = 0;
+		rtnl_dump_next();
+	}
+}
+
+static bool rtnl_read(struct l_io *io, void *user_data)
+{
+	static uint32_t buf[RTNL_BUFSIZE / sizeof(uint32_t)];
+	ssize_t len;
+
+	metrics_inc(&wakeups);
+
+	for (;;) {
+		len = recv(rtnl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* The socket stays usable, the queue was flushed */
+			if (errno == ENOBUFS) {
+				trace_rtnl(TRACE_OVERFLOW, NULL, 0);
+				rtnl_overflow();
+				continue;
+			}
+
+			break;
+		}
+
+		trace_rtnl(0, buf, len);
+		rtnl_process(buf, len);
+	}
+
+	return true;
+}
+
+LATENCY_IO(rtnl_read)
+
+/*
+ * Link events of every interface on the host share RTNLGRP_LINK: on a
+ * container host veth and bridge churn would wake the daemon for
+ * nothing. The kernel runs this on each skb and only the first message
+ * is looked at, which is enough for events: one message per skb. Dump
+ * parts and replies to requests carry a sequence number and always
+ * pass; so do messages of any other type. Fields are loaded in network
+ * byte order, hence the htons() of the host order values.
+ */
+static bool rtnl_attach_filter(int fd)
+{
+	struct sock_filter code[] = {
+		/* Replies and dumps: seq != 0 */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				offsetof(struct nlmsghdr, nlmsg_seq)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 6),
+
+		/* Events other than link ones */
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+				offsetof(struct nlmsghdr, nlmsg_type)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_NEWLINK), 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_DELLINK), 0, 3),
+
+		/* Link events: 6LoWPAN and 802.15.4 interfaces only */
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, NLMSG_HDRLEN +
+				offsetof(struct ifinfomsg, ifi_type)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(ARPHRD_6LOWPAN),
+									1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(ARPHRD_IEEE802154),
+									0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len = L_ARRAY_SIZE(code),
+		.filter = code,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+					&prog, sizeof(prog)) < 0) {
+		l_warn("rtnl: link event filter: %s", strerror(errno));
 		return false;
 	}
 
 	return true;
 }
 
+static int rtnl_open(void)
+{
+	struct sockaddr_nl addr;
+	socklen_t len = sizeof(rcvbuf_actual);
+	int one = 1;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+							NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+
+	/* FORCE needs CAP_NET_ADMIN, plain SO_RCVBUF is capped at rmem_max */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+					&rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+					&rcvbuf, sizeof(rcvbuf));
+
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf_actual, &len) < 0)
+		rcvbuf_actual = 0;
+
+	/* Error acks without the request: more of them fit the buffer */
+	setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	filter_attached = filter_enabled && rtnl_attach_filter(fd);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+void lowpan_metrics(struct l_string *out)
+{
+	metrics_family(out, "iwpand_lowpan_link_events", "counter",
+					"6LoWPAN link notifications received");
+	l_string_append_printf(out, "iwpand_lowpan_link_events_total"
+				"{event=\"newlink\"} %" PRIu64 "\n"
+				"iwpand_lowpan_link_events_total"
+				"{event=\"dellink\"} %" PRIu64 "\n",
+				metrics_read(&newlink_events),
+				metrics_read(&dellink_events));
+
+	metrics_family(out, "iwpand_lowpan_links", "gauge",
+					"6LoWPAN links currently known");
+	l_string_append_printf(out, "iwpand_lowpan_links %u\n",
+						l_queue_length(links));
+
+	metrics_family(out, "iwpand_rtnl_overflows", "counter",
+				"rtnl receive buffer overruns (ENOBUFS)");
+	l_string_append_printf(out, "iwpand_rtnl_overflows_total %" PRIu64
+				"\n", metrics_read(&overflows));
+
+	metrics_family(out, "iwpand_rtnl_dumps", "counter",
+					"Completed RTM_GETLINK dumps");
+	l_string_append_printf(out, "iwpand_rtnl_dumps_total %" PRIu64 "\n",
+						metrics_read(&dumps));
+
+	metrics_family(out, "iwpand_rtnl_links_lost", "counter",
+			"6LoWPAN links found gone by a dump after overrun");
+	l_string_append_printf(out, "iwpand_rtnl_links_lost_total %" PRIu64
+				"\n", metrics_read(&links_lost));
+
+	metrics_family(out, "iwpand_rtnl_wakeups", "counter",
+				"Wakeups to read the rtnl socket");
+	l_string_append_printf(out, "iwpand_rtnl_wakeups_total %" PRIu64
+				"\n", metrics_read(&wakeups));
+
+	metrics_family(out, "iwpand_rtnl_messages", "counter",
+				"rtnl messages read, and link messages of "
+				"other link types dropped after reading");
+	l_string_append_printf(out, "iwpand_rtnl_messages_total"
+				"{result=\"read\"} %" PRIu64 "\n"
+				"iwpand_rtnl_messages_total"
+				"{result=\"ignored\"} %" PRIu64 "\n",
+				metrics_read(&messages),
+				metrics_read(&ignored));
+
+	metrics_family(out, "iwpand_rtnl_filter", "gauge",
+			"Link event filter attached to the rtnl socket");
+	l_string_append_printf(out, "iwpand_rtnl_filter %d\n",
+							filter_attached);
+
+	metrics_family(out, "iwpand_rtnl_rcvbuf_bytes", "gauge",
+				"rtnl socket receive buffer granted");
+	l_string_append_printf(out, "iwpand_rtnl_rcvbuf_bytes %d\n",
+							rcvbuf_actual);
+}
+
+uint32_t lowpan_link_index(uint32_t parent)
+{
+	const struct lowpan_link *link;
+
+	link = l_queue_find(links, link_match_parent, L_UINT_TO_PTR(parent));
+
+	return link ? link->ifindex : 0;
+}
+
+void lowpan_rtnl_register(lowpan_rtnl_func_t func, void *user_data)
+{
+	client_func = func;
+	client_data = user_data;
+}
+
+/* Reserves count sequence numbers for the client requests */
+uint32_t lowpan_rtnl_seq(unsigned int count)
+{
+	uint32_t first = last_seq + 1;
+
+	last_seq += count;
+
+	return first;
+}
+
+/* AF_INET6 RTM_GETADDR or RTM_GETROUTE, seq from lowpan_rtnl_seq() */
+bool lowpan_rtnl_dump(uint16_t type, uint32_t seq)
+{
+	return rtnl_dump_queue(type, seq);
+}
+
+/* Several netlink messages in one call: the kernel runs them in order */
+int lowpan_rtnl_send(const struct iovec *iov, unsigned int count)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = (struct iovec *) iov,
+		.msg_iovlen = count,
+	};
+	unsigned int i;
+
+	if (rtnl_fd < 0)
+		return -ENOTCONN;
+
+	for (i = 0; i < count; i++)
+		trace_rtnl(TRACE_OUT, iov[i].iov_base, iov[i].iov_len);
+
+	if (sendmsg(rtnl_fd, &msg, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* NULL unless powered: links are only tracked while rtnl is open */
+const char *lowpan_link_name(uint32_t parent)
+{
+	const struct lowpan_link *link;
+
+	link = l_queue_find(links, link_match_parent, L_UINT_TO_PTR(parent));
+
+	return link ? link->name : NULL;
+}
+
+void lowpan_set_rcvbuf(int size)
+{
+	rcvbuf = size;
+}
+
+void lowpan_set_rtnl_filter(bool enable)
+{
+	filter_enabled = enable;
+}
+
+void lowpan_set_resync_handler(lowpan_resync_func_t func)
+{
+	resync_func = func;
+}
+
+/* Shared by all powered adapters */
+bool lowpan_init(void)
+{
+	if (users++)
+		return true;
+
+	l_info("6LoWPAN init");
+
+	rtnl_fd = rtnl_open();
+	if (rtnl_fd < 0) {
+		l_error("Failed to open netlink route socket: %s",
+							strerror(-rtnl_fd));
+		users = 0;
+		return false;
+	}
+
+	l_info("rtnl: receive buffer %d bytes", rcvbuf_actual);
+
+	links = l_queue_new();
+	rtnl_io = l_io_new(rtnl_fd);
+	l_io_set_close_on_destroy(rtnl_io, true);
+	l_io_set_read_handler(rtnl_io, rtnl_read_timed, NULL, NULL);
+
+	/* Links that existed before we started listening */
+	rtnl_dump();
+
+	return true;
+}
+
 void lowpan_exit(void)
 {
+	if (!users || --users)
+		return;
+
 	l_info("6LoWPAN exit");
 
-	l_netlink_destroy(rtnl);
+	l_io_destroy(rtnl_io);
+	rtnl_io = NULL;
+	rtnl_fd = -1;
+
+	l_queue_destroy(links, l_free);
+	links = NULL;
+	dump_seq = 0;
+	dump_running = 0;
+	dump_count = 0;
+
+	if (client_func)
+		client_func(NULL, -ESHUTDOWN, client_data);
 }
@@ -20,5 +20,33 @@
  *
  */
 
+typedef void (*lowpan_resync_func_t)(void);
+
+void lowpan_set_rcvbuf(int size);
+void lowpan_set_rtnl_filter(bool enable);
+void lowpan_set_resync_handler(lowpan_resync_func_t func);
+
+const char *lowpan_link_name(uint32_t parent);
+uint32_t lowpan_link_index(uint32_t parent);
+
+/*
+ * Other users of the rtnl socket. func gets every reply carrying a
+ * sequence number that is not the link dump's, or NULL and -ENOBUFS
+ * when replies were lost, or NULL and -ESHUTDOWN when the socket goes.
+ */
+struct nlmsghdr;
+struct iovec;
+
+typedef void (*lowpan_rtnl_func_t)(const struct nlmsghdr *nlh, int err,
+							void *user_data);
+
+void lowpan_rtnl_register(lowpan_rtnl_func_t func, void *user_data);
+uint32_t lowpan_rtnl_seq(unsigned int count);
+bool lowpan_rtnl_dump(uint16_t type, uint32_t seq);
+int lowpan_rtnl_send(const struct iovec *iov, unsigned int count);
+
 bool lowpan_init(void);
 void lowpan_exit(void);
+
+struct l_string;
+void lowpan_metrics(struct l_string *out);
@@ -30,8 +30,22 @@
 #include <ell/ell.h>
 #include "phy.h"
 #include "dbus.h"
+#include "trace.h"
+#include "latency.h"
+#include "lowpan.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "worker.h"
+#include "pool.h"
+#include "iphc.h"
+#include "route.h"
+#include "control.h"
+#include "inject.h"
+#include "shard.h"
+#include "proxy.h"
 
 #define NL802154_GENL_NAME "nl802154"
+#define OPT_SHARD 0x100		/* --shard, given to workers only */
 
 static struct l_timeout *timeout;
 static bool terminating;
@@ -61,6 +75,9 @@ static void signal_handler(struct l_signal *signal, uint32_t signo,
 	case SIGTERM:
 		terminate();
 		break;
+	case SIGCHLD:
+		shard_reap();
+		break;
 	}
 }
 
@@ -76,7 +93,98 @@ static void nl802154_appeared(void *user_data)
 static void nl802154_vanished(void *user_data)
 {
 	l_debug("nl802154 vanished");
-	phy_exit(user_data);
+	phy_suspend(user_data);
+}
+
+static void shard_appeared(void *user_data)
+{
+	if (terminating)
+		return;
+
+	l_debug("nl802154 appeared");
+	shard_scan(user_data);
+}
+
+static void shard_vanished(void *user_data)
+{
+	l_debug("nl802154 vanished");
+	shard_suspend();
+}
+
+/* Workers keep their own sockets and trace next to the configured ones */
+static char *worker_path(const char *path, int index)
+{
+	if (!path)
+		return NULL;
+
+	return l_strdup_printf("%s.%d", path, index);
+}
+
+/*
+ * With --shards the process only supervises: the PHYs, the adapters on
+ * them and the control socket live in the workers.
+ */
+static int supervise(unsigned int shards, char *argv[],
+				uint32_t client_rate, uint32_t client_burst)
+{
+	struct l_genl *genl = NULL;
+	struct l_genl_family *nl802154 = NULL;
+	int ret = EXIT_FAILURE;
+
+	metrics_register(pool_metrics);
+	metrics_register(shard_metrics);
+	metrics_register(proxy_metrics);
+	metrics_register(ratelimit_metrics);
+
+	/* Workers see the supervisor as their only client */
+	if (!ratelimit_init(client_rate, client_burst, 0, 0)) {
+		l_error("Rate limit init fail");
+		goto done;
+	}
+
+	if (!shard_init(shards, argv)) {
+		l_error("Shard init fail");
+		goto done;
+	}
+
+	if (!proxy_init(shards)) {
+		l_error("D-Bus proxy init fail");
+		goto done;
+	}
+
+	genl = l_genl_new_default();
+	if (!genl) {
+		l_error("Generic Netlink fail");
+		goto done;
+	}
+
+	nl802154 = l_genl_family_new(genl, NL802154_GENL_NAME);
+	if (!nl802154) {
+		l_error("Failed to open nl802154 interface");
+		goto done;
+	}
+
+	if (!l_genl_family_set_watches(nl802154, shard_appeared,
+					shard_vanished, nl802154, NULL)) {
+		l_error("Failed to add NL watch");
+		goto done;
+	}
+
+	ret = 0;
+
+	l_main_run();
+
+done:
+	proxy_exit();
+	shard_exit();
+	ratelimit_exit();
+
+	if (nl802154)
+		l_genl_family_unref(nl802154);
+
+	l_genl_unref(genl);
+
+	return ret;
 }
 
 static void usage(void)
@@ -87,12 +195,39 @@ static void usage(void)
 	printf("Options:\n"
 		"\t-c, --channel          Radio channel to use\n"
 		"\t-p, --page		  Radio channel page to use\n"
+		"\t-m, --metrics          OpenMetrics Unix socket path\n"
+		"\t-r, --client-rate      Setter calls/s[/burst] per client\n"
+		"\t-a, --adapter-rate     Setter calls/s[/burst] per adapter\n"
+		"\t-w, --workers          Worker threads, 0 to run inline\n"
+		"\t-b, --rtnl-rcvbuf      rtnl receive buffer size in bytes\n"
+		"\t-M, --memory-budget    Object pool budget in KiB\n"
+		"\t-I, --iphc-root        6LoWPAN debugfs directory\n"
+		"\t-t, --trace            Record netlink and D-Bus traffic\n"
+		"\t-C, --control          Binary control Unix socket path\n"
+		"\t-B, --dbus-address     D-Bus address or \"session\"\n"
+		"\t-T, --tx-rate          Raw frames/s[/burst] per adapter\n"
+		"\t-F, --no-rtnl-filter   Read link events of all interfaces\n"
+		"\t-S, --shards           Worker processes to spread PHYs on\n"
 		"\t-h, --help             Show help options\n");
 }
 static const struct option main_options[] = {
 	{ "version",		no_argument,       NULL, 'v' },
 	{ "page",		required_argument, NULL, 'p' },
 	{ "channel",		required_argument, NULL, 'c' },
+	{ "metrics",		required_argument, NULL, 'm' },
+	{ "client-rate",	required_argument, NULL, 'r' },
+	{ "adapter-rate",	required_argument, NULL, 'a' },
+	{ "workers",		required_argument, NULL, 'w' },
+	{ "rtnl-rcvbuf",	required_argument, NULL, 'b' },
+	{ "memory-budget",	required_argument, NULL, 'M' },
+	{ "iphc-root",		required_argument, NULL, 'I' },
+	{ "trace",		required_argument, NULL, 't' },
+	{ "control",		required_argument, NULL, 'C' },
+	{ "dbus-address",	required_argument, NULL, 'B' },
+	{ "tx-rate",		required_argument, NULL, 'T' },
+	{ "no-rtnl-filter",	no_argument,       NULL, 'F' },
+	{ "shards",		required_argument, NULL, 'S' },
+	{ "shard",		required_argument, NULL, OPT_SHARD },
 	{ "help",		no_argument,       NULL, 'h' },
 	{ }
 };
@@ -102,12 +237,26 @@ int main(int argc, char *argv[])
 	struct l_genl *genl;
 	struct l_genl_family *nl802154;
 	struct l_signal *sig;
+	const char *metrics_path = NULL;
+	const char *trace_path = NULL;
+	const char *control_path = NULL;
+	const char *dbus_address = NULL;
+	char *dbus_name = NULL;
+	char *paths[3] = { };
+	uint32_t client_rate = 5, client_burst = 10;
+	uint32_t adapter_rate = 20, adapter_burst = 40;
+	uint32_t tx_rate = 0, tx_burst = 0;
+	unsigned int workers = 2;
+	unsigned int shards = 0;
+	int shard_index = -1;
+	size_t budget = 512 * 1024;
 	sigset_t mask;
 	int ret = EXIT_FAILURE;
 	int opt;
 
 	for (;;) {
-		opt = getopt_long(argc, argv, "c:p:", main_options, NULL);
+		opt = getopt_long(argc, argv, "c:p:m:r:a:w:b:M:I:t:C:B:T:FS:h",
+							main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -118,6 +267,59 @@ int main(int argc, char *argv[])
 		case 'p':
 			page = atoi(optarg);
 			break;
+		case 'm':
+			metrics_path = optarg;
+			break;
+		case 'r':
+			if (!ratelimit_parse(optarg, &client_rate,
+							&client_burst)) {
+				fprintf(stderr, "Invalid client rate\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			if (!ratelimit_parse(optarg, &adapter_rate,
+							&adapter_burst)) {
+				fprintf(stderr, "Invalid adapter rate\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		case 'b':
+			lowpan_set_rcvbuf(atoi(optarg));
+			break;
+		case 'M':
+			budget = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 'I':
+			iphc_set_root(optarg);
+			break;
+		case 'F':
+			lowpan_set_rtnl_filter(false);
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'C':
+			control_path = optarg;
+			break;
+		case 'B':
+			dbus_address = optarg;
+			break;
+		case 'T':
+			if (!ratelimit_parse(optarg, &tx_rate, &tx_burst)) {
+				fprintf(stderr, "Invalid transmit rate\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			shards = atoi(optarg);
+			break;
+		case OPT_SHARD:
+			shard_index = atoi(optarg);
+			break;
 		case 'h':
 			usage();
 			return EXIT_SUCCESS;
@@ -131,6 +333,24 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (shards > SHARD_MAX || shard_index >= SHARD_MAX) {
+		fprintf(stderr, "At most %u shards\n", SHARD_MAX);
+		return EXIT_FAILURE;
+	}
+
+	/* A worker gets the supervisor's arguments plus --shard */
+	if (shard_index >= 0) {
+		shards = 0;
+		dbus_name = l_strdup_printf(SHARD_DBUS_SERVICE "%d",
+								shard_index);
+		metrics_path = paths[0] = worker_path(metrics_path,
+								shard_index);
+		trace_path = paths[1] = worker_path(trace_path, shard_index);
+		control_path = paths[2] = worker_path(control_path,
+								shard_index);
+		client_rate = 0;
+	}
+
 	if (!l_main_init())
 		return EXIT_FAILURE;
 
@@ -138,17 +358,78 @@ int main(int argc, char *argv[])
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 
+	if (shards)
+		sigaddset(&mask, SIGCHLD);
+
 	sig = l_signal_create(&mask, signal_handler, NULL, NULL);
 
 	l_log_set_stderr();
 	l_debug_enable("*");
 	l_info("Wireless PAN daemon version %s", VERSION);
 
-	if (!dbus_init(false)) {
+	if (trace_path && !trace_open(trace_path))
+		goto fail_trace;
+
+	if (!dbus_init(dbus_address, dbus_name, false)) {
 		l_error("D-Bus init fail");
 		goto fail_dbus;
 	}
 
+	latency_init();
+
+	/* Everything allocated per object from here on comes from pools */
+	pool_init(budget);
+
+	if (!metrics_init(metrics_path)) {
+		l_error("Metrics init fail");
+		goto fail_metrics;
+	}
+
+	if (shards) {
+		ret = supervise(shards, argv, client_rate, client_burst);
+		metrics_exit();
+		goto fail_metrics;
+	}
+
+	metrics_register(pool_metrics);
+	metrics_register(phy_metrics);
+	metrics_register(lowpan_metrics);
+	lowpan_set_resync_handler(phy_resync);
+
+	route_init();
+	metrics_register(route_metrics);
+
+	if (!ratelimit_init(client_rate, client_burst,
+					adapter_rate, adapter_burst)) {
+		l_error("Rate limit init fail");
+		goto fail_genl;
+	}
+
+	metrics_register(ratelimit_metrics);
+	inject_set_pacing(tx_rate, tx_burst);
+
+	if (!control_init(control_path)) {
+		l_error("Control socket init fail");
+		goto fail_genl;
+	}
+
+	metrics_register(control_metrics);
+	phy_set_adapter_watch(control_notify);
+
+	if (!worker_init(workers))
+		l_warn("Worker threads unavailable, running inline");
+
+	metrics_register(worker_metrics);
+
+	if (shard_index >= 0) {
+		phy_set_filter(shard_owns);
+
+		if (!shard_worker_init(shard_index)) {
+			l_error("Shard %d has no supervisor", shard_index);
+			goto fail_genl;
+		}
+	}
+
 	genl = l_genl_new_default();
 	if (!genl) {
 		l_error("Generic Netlink fail");
@@ -173,6 +454,8 @@ int main(int argc, char *argv[])
 
 	l_main_run();
 
+	phy_exit(nl802154);
+
 fail_watch:
 	l_genl_family_unref(nl802154);
 
@@ -180,11 +463,31 @@ fail_nl802154:
 	l_genl_unref(genl);
 
 fail_genl:
+	shard_worker_exit();
+
+	/* Completes the writes of captures stopped by phy_exit() */
+	worker_exit();
+	control_exit();
+	route_exit();
+	ratelimit_exit();
+	metrics_exit();
+
+fail_metrics:
+	pool_exit();
+	latency_exit();
 	dbus_exit();
 
 fail_dbus:
+	trace_close();
+
+fail_trace:
 	l_signal_remove(sig);
 	l_main_exit();
 
+	l_free(dbus_name);
+	l_free(paths[0]);
+	l_free(paths[1]);
+	l_free(paths[2]);
+
 	return ret;
 }
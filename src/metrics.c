@@ -0,0 +1,199 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ell/ell.h>
+
+#include "metrics.h"
+
+/*
+ * OpenMetrics text exposition on a local stream socket: every accepted
+ * connection gets a freshly rendered snapshot and is closed. Nothing is
+ * rendered unless the socket is scraped.
+ */
+
+struct scrape {
+	struct l_io *io;
+	char *text;
+	size_t len;
+	size_t offset;
+};
+
+static struct l_io *listen_io = NULL;
+static char *listen_path = NULL;
+static struct l_queue *render_list = NULL;
+
+void metrics_family(struct l_string *out, const char *name,
+					const char *type, const char *help)
+{
+	l_string_append_printf(out, "# TYPE %s %s\n# HELP %s %s\n",
+						name, type, name, help);
+}
+
+bool metrics_register(metrics_render_func_t render)
+{
+	if (!render_list)
+		return false;
+
+	return l_queue_push_tail(render_list, render);
+}
+
+static void render_one(void *data, void *user_data)
+{
+	metrics_render_func_t render = data;
+
+	render(user_data);
+}
+
+static char *render(size_t *len)
+{
+	struct l_string *out = l_string_new(4096);
+
+	l_queue_foreach(render_list, render_one, out);
+	l_string_append(out, "# EOF\n");
+
+	*len = l_string_length(out);
+
+	return l_string_unwrap(out);
+}
+
+static void scrape_free(void *data)
+{
+	struct scrape *scrape = data;
+
+	l_io_destroy(scrape->io);
+	l_free(scrape->text);
+	l_free(scrape);
+}
+
+/* Write handler removed: the io goes away from an idle */
+static void scrape_done(void *data)
+{
+	l_idle_oneshot(scrape_free, data, NULL);
+}
+
+static bool scrape_write(struct l_io *io, void *user_data)
+{
+	struct scrape *scrape = user_data;
+	ssize_t n;
+
+	n = send(l_io_get_fd(io), scrape->text + scrape->offset,
+				scrape->len - scrape->offset,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0 && errno == EAGAIN)
+		return true;
+
+	if (n > 0)
+		scrape->offset += n;
+
+	if (n > 0 && scrape->offset < scrape->len)
+		return true;
+
+	/* Done or peer gone: scrape_done() frees the scrape */
+	return false;
+}
+
+static bool listen_read(struct l_io *io, void *user_data)
+{
+	struct scrape *scrape;
+	int fd;
+
+	fd = accept4(l_io_get_fd(io), NULL, NULL,
+					SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return true;
+
+	scrape = l_new(struct scrape, 1);
+	scrape->text = render(&scrape->len);
+	scrape->io = l_io_new(fd);
+	l_io_set_close_on_destroy(scrape->io, true);
+	l_io_set_write_handler(scrape->io, scrape_write, scrape,
+							scrape_done);
+
+	return true;
+}
+
+bool metrics_init(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	render_list = l_queue_new();
+
+	if (!path)
+		return true;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		l_error("metrics: socket path too long");
+		return false;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+						listen(fd, 8) < 0) {
+		l_error("metrics: %s: %s", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	listen_io = l_io_new(fd);
+	l_io_set_close_on_destroy(listen_io, true);
+	l_io_set_read_handler(listen_io, listen_read, NULL, NULL);
+	listen_path = l_strdup(path);
+
+	l_info("metrics: serving OpenMetrics on %s", path);
+
+	return true;
+}
+
+void metrics_exit(void)
+{
+	if (listen_io) {
+		l_io_destroy(listen_io);
+		listen_io = NULL;
+		unlink(listen_path);
+	}
+
+	l_free(listen_path);
+	listen_path = NULL;
+
+	l_queue_destroy(render_list, NULL);
+	render_list = NULL;
+}
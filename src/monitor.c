@@ -0,0 +1,194 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <ell/ell.h>
+
+#include "nl802154.h"
+#include "monitor.h"
+#include "trace.h"
+#include "latency.h"
+
+static void monitor_delete(struct monitor *monitor)
+{
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_DEL_INTERFACE, 32);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX,
+				sizeof(monitor->ifindex), &monitor->ifindex);
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_send(monitor->nl802154, msg, NULL, NULL, NULL))
+		l_error("NL802154_CMD_DEL_INTERFACE failed");
+
+	monitor->ifindex = 0;
+}
+
+static void monitor_created_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct monitor *monitor = user_data;
+	int err;
+
+	err = l_genl_msg_get_error(msg);
+
+	/* NL802154_CMD_NEW_INTERFACE is only acknowledged */
+	if (!err) {
+		monitor->ifindex = if_nametoindex(monitor->ifname);
+		if (!monitor->ifindex)
+			err = -ENODEV;
+	}
+
+	/* Removed while waiting: only the interface is left to delete */
+	if (monitor->removed) {
+		if (monitor->ifindex)
+			monitor_delete(monitor);
+
+		return;
+	}
+
+	if (err < 0)
+		l_error("'%s': NL802154_CMD_NEW_INTERFACE: %s",
+					monitor->ifname, strerror(-err));
+
+	monitor->created(err, monitor->user_data);
+}
+
+LATENCY_GENL_CALLBACK(monitor_created_callback)
+
+static void monitor_created_destroy(void *user_data)
+{
+	struct monitor *monitor = user_data;
+
+	monitor->creating = false;
+
+	if (monitor->removed)
+		monitor->released(monitor->user_data);
+}
+
+/* The interface is named <prefix><phy> */
+bool monitor_create(struct monitor *monitor, struct l_genl_family *nl802154,
+				uint32_t phy, const char *prefix,
+				monitor_created_func_t created,
+				monitor_released_func_t released,
+				void *user_data)
+{
+	struct l_genl_msg *msg;
+	uint32_t iftype = NL802154_IFTYPE_MONITOR;
+
+	memset(monitor, 0, sizeof(*monitor));
+	monitor->nl802154 = nl802154;
+	monitor->created = created;
+	monitor->released = released;
+	monitor->user_data = user_data;
+	snprintf(monitor->ifname, sizeof(monitor->ifname), "%s%u", prefix,
+									phy);
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY,
+						sizeof(phy), &phy);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFNAME,
+				strlen(monitor->ifname) + 1, monitor->ifname);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFTYPE,
+						sizeof(iftype), &iftype);
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	monitor->creating = true;
+
+	if (!l_genl_family_send(nl802154, msg, monitor_created_callback_timed,
+					monitor, monitor_created_destroy)) {
+		l_error("NL802154_CMD_NEW_INTERFACE failed");
+		monitor->creating = false;
+		return false;
+	}
+
+	return true;
+}
+
+static int link_up(int fd, const char *ifname)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0)
+		return -errno;
+
+	ifr.ifr_flags |= IFF_UP;
+
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* fd is an AF_PACKET socket opened with protocol 0 */
+int monitor_bind(const struct monitor *monitor, int fd)
+{
+	struct sockaddr_ll ll;
+	int err;
+
+	err = link_up(fd, monitor->ifname);
+	if (err < 0)
+		return err;
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_ALL);
+	ll.sll_ifindex = monitor->ifindex;
+
+	if (bind(fd, (struct sockaddr *) &ll, sizeof(ll)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Deletes the interface, or has it deleted once the kernel answers
+ * NL802154_CMD_NEW_INTERFACE. True in that case: the owner must stay
+ * around until the released callback.
+ */
+bool monitor_remove(struct monitor *monitor)
+{
+	if (monitor->ifindex)
+		monitor_delete(monitor);
+
+	if (monitor->creating)
+		monitor->removed = true;
+
+	return monitor->creating;
+}
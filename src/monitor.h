@@ -0,0 +1,53 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * The monitor interface a capture or a survey listens on. Embedded in
+ * its owner: created with NL802154_CMD_NEW_INTERFACE, brought up and
+ * bound to the owner's packet socket, deleted when the owner is done.
+ */
+
+struct l_genl_family;
+
+/* ifindex is set unless err is */
+typedef void (*monitor_created_func_t)(int err, void *user_data);
+/* Removed while being created: the owner can be freed now */
+typedef void (*monitor_released_func_t)(void *user_data);
+
+struct monitor {
+	struct l_genl_family *nl802154;
+	uint32_t ifindex;
+	char ifname[IFNAMSIZ];
+	bool creating;		/* NEW_INTERFACE in flight */
+	bool removed;		/* While creating */
+	monitor_created_func_t created;
+	monitor_released_func_t released;
+	void *user_data;
+};
+
+bool monitor_create(struct monitor *monitor, struct l_genl_family *nl802154,
+				uint32_t phy, const char *prefix,
+				monitor_created_func_t created,
+				monitor_released_func_t released,
+				void *user_data);
+int monitor_bind(const struct monitor *monitor, int fd);
+bool monitor_remove(struct monitor *monitor);
@@ -0,0 +1,382 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <ell/ell.h>
+
+#include "ieee802154.h"
+#include "neighbor.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+
+#define NEIGHBOR_SLOTS_BITS	8
+#define NEIGHBOR_SLOTS		(1 << NEIGHBOR_SLOTS_BITS)
+#define NEIGHBOR_PROBE		16	/* Max linear probe length */
+#define NEIGHBOR_BATCH		32	/* Frames per recvmmsg() */
+
+#define NEIGHBOR_TABLE_MAX	16	/* One per adapter */
+
+struct neighbor_table {
+	char ifname[16];
+	int fd;
+	struct l_io *io;
+	struct neighbor slots[NEIGHBOR_SLOTS];
+
+	/* recvmmsg() scratch: only source address and LQI are needed */
+	struct mmsghdr msgs[NEIGHBOR_BATCH];
+	struct iovec iov[NEIGHBOR_BATCH];
+	struct sockaddr_ieee802154 src[NEIGHBOR_BATCH];
+	uint8_t cmsg[NEIGHBOR_BATCH][CMSG_SPACE(sizeof(uint8_t))];
+	uint8_t payload[NEIGHBOR_BATCH];
+};
+
+static struct pool *table_pool = NULL;
+
+static unsigned int slot_hash(uint8_t mode, uint64_t addr, uint16_t panid)
+{
+	uint64_t key = addr ^ ((uint64_t) panid << 48) ^ mode;
+
+	/* Fibonacci hashing: top bits of the golden ratio product */
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - NEIGHBOR_SLOTS_BITS);
+}
+
+static bool slot_match(const struct neighbor *n, uint8_t mode,
+					uint64_t addr, uint16_t panid)
+{
+	return n->mode == mode && n->addr == addr && n->panid == panid;
+}
+
+void neighbor_update(struct neighbor_table *table, uint8_t mode,
+				uint64_t addr, uint16_t panid, uint8_t lqi,
+				uint64_t now)
+{
+	unsigned int i, h;
+	struct neighbor *n, *victim = NULL;
+
+	/* Extended addresses are unique regardless of the PAN */
+	if (mode == NEIGHBOR_ADDR_LONG)
+		panid = 0;
+
+	h = slot_hash(mode, addr, panid);
+
+	for (i = 0; i < NEIGHBOR_PROBE; i++) {
+		n = &table->slots[(h + i) & (NEIGHBOR_SLOTS - 1)];
+
+		if (slot_match(n, mode, addr, panid))
+			goto update;
+
+		if (!n->mode) {
+			victim = n;
+			break;
+		}
+
+		if (!victim || n->last_seen < victim->last_seen)
+			victim = n;
+	}
+
+	/* Probe window full: recycle the least recently seen record */
+	n = victim;
+	n->mode = mode;
+	n->addr = addr;
+	n->panid = panid;
+	n->frames = 0;
+	n->lqi_avg = lqi << 4;
+	n->lqi_min = lqi;
+	n->lqi_max = lqi;
+
+update:
+	n->lqi = lqi;
+	n->lqi_avg += ((int) (lqi << 4) - (int) n->lqi_avg) / 8;
+	n->frames++;
+	n->last_seen = now;
+
+	if (lqi < n->lqi_min)
+		n->lqi_min = lqi;
+
+	if (lqi > n->lqi_max)
+		n->lqi_max = lqi;
+}
+
+const struct neighbor *neighbor_lookup(struct neighbor_table *table,
+				uint8_t mode, uint64_t addr, uint16_t panid)
+{
+	unsigned int i, h;
+	struct neighbor *n;
+
+	if (mode == NEIGHBOR_ADDR_LONG)
+		panid = 0;
+
+	h = slot_hash(mode, addr, panid);
+
+	for (i = 0; i < NEIGHBOR_PROBE; i++) {
+		n = &table->slots[(h + i) & (NEIGHBOR_SLOTS - 1)];
+
+		if (slot_match(n, mode, addr, panid))
+			return n;
+	}
+
+	return NULL;
+}
+
+static int compare_best(const void *a, const void *b)
+{
+	const struct neighbor *n1 = *(const struct neighbor **) a;
+	const struct neighbor *n2 = *(const struct neighbor **) b;
+
+	return (int) n2->lqi_avg - (int) n1->lqi_avg;
+}
+
+static int compare_weakest(const void *a, const void *b)
+{
+	return compare_best(b, a);
+}
+
+unsigned int neighbor_top(struct neighbor_table *table, bool weakest,
+				const struct neighbor **list, unsigned int max)
+{
+	const struct neighbor *all[NEIGHBOR_SLOTS];
+	unsigned int i, count = 0;
+
+	for (i = 0; i < NEIGHBOR_SLOTS; i++) {
+		if (table->slots[i].mode)
+			all[count++] = &table->slots[i];
+	}
+
+	qsort(all, count, sizeof(all[0]),
+				weakest ? compare_weakest : compare_best);
+
+	if (count > max)
+		count = max;
+
+	memcpy(list, all, count * sizeof(all[0]));
+
+	return count;
+}
+
+bool neighbor_parse_address(const char *str, uint8_t *mode, uint64_t *addr)
+{
+	unsigned int b[8];
+	unsigned int i;
+	char c;
+
+	if (sscanf(str, "%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x%c",
+				&b[0], &b[1], &b[2], &b[3], &b[4], &b[5],
+				&b[6], &b[7], &c) == 8) {
+		*mode = NEIGHBOR_ADDR_LONG;
+		*addr = 0;
+
+		for (i = 0; i < 8; i++)
+			*addr = (*addr << 8) | b[i];
+
+		return true;
+	}
+
+	if (sscanf(str, "0x%04x%c", &b[0], &c) == 1) {
+		*mode = NEIGHBOR_ADDR_SHORT;
+		*addr = b[0];
+		return true;
+	}
+
+	return false;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t neighbor_age(const struct neighbor *n)
+{
+	return (now_usec() - n->last_seen) / 1000;
+}
+
+static uint8_t frame_lqi(struct msghdr *hdr)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg;
+					cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_IEEE802154 &&
+				cmsg->cmsg_type == WPAN_WANTLQI)
+			return *CMSG_DATA(cmsg);
+	}
+
+	return 0;
+}
+
+static void frame_received(struct neighbor_table *table,
+				struct mmsghdr *msg, uint64_t now)
+{
+	const struct sockaddr_ieee802154 *sa = msg->msg_hdr.msg_name;
+	uint64_t addr = 0;
+	unsigned int i;
+
+	switch (sa->addr.addr_type) {
+	case NEIGHBOR_ADDR_LONG:
+		for (i = 0; i < 8; i++)
+			addr = (addr << 8) | sa->addr.hwaddr[i];
+		break;
+	case NEIGHBOR_ADDR_SHORT:
+		addr = sa->addr.short_addr;
+		break;
+	default:
+		return;
+	}
+
+	neighbor_update(table, sa->addr.addr_type, addr, sa->addr.pan_id,
+					frame_lqi(&msg->msg_hdr), now);
+}
+
+static bool socket_read(struct l_io *io, void *user_data)
+{
+	struct neighbor_table *table = user_data;
+	uint64_t now;
+	int i, n;
+
+	for (i = 0; i < NEIGHBOR_BATCH; i++) {
+		table->msgs[i].msg_hdr.msg_namelen = sizeof(table->src[i]);
+		table->msgs[i].msg_hdr.msg_controllen = sizeof(table->cmsg[i]);
+	}
+
+	n = recvmmsg(table->fd, table->msgs, NEIGHBOR_BATCH,
+						MSG_DONTWAIT | MSG_TRUNC, NULL);
+	if (n <= 0)
+		return true;
+
+	now = now_usec();
+
+	for (i = 0; i < n; i++)
+		frame_received(table, &table->msgs[i], now);
+
+	return true;
+}
+
+LATENCY_IO(socket_read)
+
+static void socket_close(struct neighbor_table *table)
+{
+	l_io_destroy(table->io);
+	table->io = NULL;
+
+	if (table->fd >= 0)
+		close(table->fd);
+
+	table->fd = -1;
+}
+
+/*
+ * A datagram socket bound to the adapter extended address receives a
+ * copy of every data frame delivered by that adapter, tagged with its
+ * LQI. The kernel does not report RSSI to user space.
+ */
+bool neighbor_table_rebind(struct neighbor_table *table, uint64_t extaddr)
+{
+	struct sockaddr_ieee802154 sa;
+	int one = 1;
+
+	socket_close(table);
+
+	table->fd = socket(AF_IEEE802154, SOCK_DGRAM | SOCK_CLOEXEC |
+							SOCK_NONBLOCK, 0);
+	if (table->fd < 0) {
+		l_warn("%s: neighbor socket: %s", table->ifname,
+							strerror(errno));
+		return false;
+	}
+
+	ieee802154_sa_from_extaddr(&sa, extaddr);
+
+	if (setsockopt(table->fd, SOL_IEEE802154, WPAN_WANTLQI,
+						&one, sizeof(one)) < 0 ||
+			bind(table->fd, (struct sockaddr *) &sa,
+						sizeof(sa)) < 0) {
+		l_warn("%s: neighbor socket setup: %s", table->ifname,
+							strerror(errno));
+		socket_close(table);
+		return false;
+	}
+
+	table->io = l_io_new(table->fd);
+	l_io_set_read_handler(table->io, socket_read_timed, table, NULL);
+
+	return true;
+}
+
+struct neighbor_table *neighbor_table_new(const char *ifname,
+							uint64_t extaddr)
+{
+	struct neighbor_table *table;
+	int i;
+
+	/* Carved from the memory budget when the first adapter shows up */
+	if (!table_pool)
+		table_pool = pool_new("neighbor_table",
+					sizeof(struct neighbor_table),
+					NEIGHBOR_TABLE_MAX);
+
+	table = table_pool ? pool_alloc(table_pool) : NULL;
+	if (!table) {
+		l_error("'%s': no neighbor table left", ifname);
+		return NULL;
+	}
+
+	table->fd = -1;
+	snprintf(table->ifname, sizeof(table->ifname), "%s", ifname);
+
+	for (i = 0; i < NEIGHBOR_BATCH; i++) {
+		table->iov[i].iov_base = &table->payload[i];
+		table->iov[i].iov_len = 1;
+		table->msgs[i].msg_hdr.msg_iov = &table->iov[i];
+		table->msgs[i].msg_hdr.msg_iovlen = 1;
+		table->msgs[i].msg_hdr.msg_name = &table->src[i];
+		table->msgs[i].msg_hdr.msg_control = table->cmsg[i];
+	}
+
+	neighbor_table_rebind(table, extaddr);
+
+	return table;
+}
+
+void neighbor_table_free(struct neighbor_table *table)
+{
+	if (!table)
+		return;
+
+	socket_close(table);
+	pool_release(table_pool, table);
+}
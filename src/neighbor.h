@@ -0,0 +1,54 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define NEIGHBOR_ADDR_SHORT	0x2
+#define NEIGHBOR_ADDR_LONG	0x3
+
+struct neighbor {
+	uint64_t addr;		/* Extended address or short address */
+	uint16_t panid;		/* Source PAN of short addressed frames */
+	uint8_t mode;		/* NEIGHBOR_ADDR_SHORT or _LONG, 0: free */
+	uint8_t lqi;		/* Last received LQI */
+	uint16_t lqi_avg;	/* Moving average, 1/16 LQI units */
+	uint8_t lqi_min;
+	uint8_t lqi_max;
+	uint32_t frames;
+	uint64_t last_seen;	/* CLOCK_MONOTONIC, usec */
+};
+
+struct neighbor_table;
+
+struct neighbor_table *neighbor_table_new(const char *ifname,
+							uint64_t extaddr);
+void neighbor_table_free(struct neighbor_table *table);
+bool neighbor_table_rebind(struct neighbor_table *table, uint64_t extaddr);
+
+void neighbor_update(struct neighbor_table *table, uint8_t mode,
+				uint64_t addr, uint16_t panid, uint8_t lqi,
+				uint64_t now);
+const struct neighbor *neighbor_lookup(struct neighbor_table *table,
+				uint8_t mode, uint64_t addr, uint16_t panid);
+uint32_t neighbor_age(const struct neighbor *n);
+unsigned int neighbor_top(struct neighbor_table *table, bool weakest,
+				const struct neighbor **list, unsigned int max);
+
+bool neighbor_parse_address(const char *str, uint8_t *mode, uint64_t *addr);
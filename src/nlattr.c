@@ -0,0 +1,189 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "nl802154.h"
+#include "nlattr.h"
+
+static const struct nlattr_policy wpan_phy_policy[] = {
+	NLATTR_FIELD(NL802154_ATTR_WPAN_PHY, NLATTR_U32,
+				struct nlattr_wpan_phy, wpan_phy),
+	NLATTR_FIELD(NL802154_ATTR_WPAN_PHY_NAME, NLATTR_STRING,
+				struct nlattr_wpan_phy, name),
+	NLATTR_FIELD(NL802154_ATTR_PAGE, NLATTR_U8,
+				struct nlattr_wpan_phy, page),
+	NLATTR_FIELD(NL802154_ATTR_CHANNEL, NLATTR_U8,
+				struct nlattr_wpan_phy, channel),
+	NLATTR_NESTED_FIELD(NL802154_ATTR_CHANNELS_SUPPORTED,
+				NL802154_ATTR_SUPPORTED_CHANNEL,
+				struct nlattr_wpan_phy, channels),
+};
+
+const struct nlattr_table nlattr_wpan_phy_table = {
+	.policy = wpan_phy_policy,
+	.max = L_ARRAY_SIZE(wpan_phy_policy) - 1,
+};
+
+static const struct nlattr_policy interface_policy[] = {
+	NLATTR_FIELD(NL802154_ATTR_WPAN_PHY, NLATTR_U32,
+				struct nlattr_interface, wpan_phy),
+	NLATTR_FIELD(NL802154_ATTR_IFINDEX, NLATTR_U32,
+				struct nlattr_interface, ifindex),
+	NLATTR_FIELD(NL802154_ATTR_IFNAME, NLATTR_STRING,
+				struct nlattr_interface, name),
+	NLATTR_FIELD(NL802154_ATTR_IFTYPE, NLATTR_U32,
+				struct nlattr_interface, iftype),
+	NLATTR_FIELD(NL802154_ATTR_WPAN_DEV, NLATTR_U64,
+				struct nlattr_interface, wpan_dev),
+	NLATTR_FIELD(NL802154_ATTR_PAN_ID, NLATTR_U16,
+				struct nlattr_interface, panid),
+	NLATTR_FIELD(NL802154_ATTR_SHORT_ADDR, NLATTR_U16,
+				struct nlattr_interface, short_addr),
+	NLATTR_FIELD(NL802154_ATTR_EXTENDED_ADDR, NLATTR_U64,
+				struct nlattr_interface, extended_addr),
+};
+
+const struct nlattr_table nlattr_interface_table = {
+	.policy = interface_policy,
+	.max = L_ARRAY_SIZE(interface_policy) - 1,
+};
+
+static bool decode_one(const struct nlattr_policy *policy, uint16_t len,
+					const void *data, uint8_t *dst)
+{
+	switch (policy->kind) {
+	case NLATTR_U8:
+	case NLATTR_U16:
+	case NLATTR_U32:
+	case NLATTR_U64:
+		if (len != policy->size)
+			return false;
+
+		memcpy(dst + policy->offset, data, len);
+		return true;
+	case NLATTR_STRING:
+		/* Must fit the destination including the terminating NUL */
+		if (len == 0 || len > policy->size ||
+				((const char *) data)[len - 1] != '\0')
+			return false;
+
+		memcpy(dst + policy->offset, data, len);
+		return true;
+	}
+
+	return true;
+}
+
+/*
+ * One element per nested attribute of the element type, in order.
+ * Elements beyond the array are dropped: a newer kernel may report
+ * more of them.
+ */
+static bool decode_nested(struct l_genl_attr *attr,
+				const struct nlattr_policy *policy,
+				uint8_t *dst)
+{
+	struct l_genl_attr nested;
+	uint16_t type, len;
+	const void *data;
+	unsigned int offset = policy->offset;
+
+	if (!l_genl_attr_recurse(attr, &nested))
+		return false;
+
+	while (l_genl_attr_next(&nested, &type, &len, &data)) {
+		if (type != policy->nested)
+			continue;
+
+		if (len != policy->elem)
+			return false;
+
+		if (offset + len > policy->offset + policy->size)
+			continue;
+
+		memcpy(dst + offset, data, len);
+		offset += len;
+	}
+
+	return true;
+}
+
+/*
+ * Single pass over the attribute stream: every attribute known by the
+ * policy table is length checked and copied into 'dst'. Unknown
+ * attributes are skipped. Returns false on the first malformed
+ * attribute, leaving 'dst' partially filled.
+ */
+bool nlattr_decode_attrs(struct l_genl_attr *attr,
+				const struct nlattr_table *table,
+				void *dst, uint64_t *seen)
+{
+	const struct nlattr_policy *policy;
+	uint16_t type, len;
+	const void *data;
+	uint64_t mask = 0;
+	bool ok;
+
+	while (l_genl_attr_next(attr, &type, &len, &data)) {
+		if (type > table->max)
+			continue;
+
+		policy = &table->policy[type];
+		if (policy->kind == NLATTR_UNUSED)
+			continue;
+
+		if (policy->kind == NLATTR_NESTED)
+			ok = decode_nested(attr, policy, dst);
+		else
+			ok = decode_one(policy, len, data, dst);
+
+		if (!ok) {
+			l_warn("Malformed attribute %u (len %u)", type, len);
+			return false;
+		}
+
+		mask |= NLATTR_BIT(type);
+	}
+
+	if (seen)
+		*seen = mask;
+
+	return true;
+}
+
+bool nlattr_decode(struct l_genl_msg *msg, const struct nlattr_table *table,
+				void *dst, uint64_t *seen)
+{
+	struct l_genl_attr attr;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return false;
+
+	return nlattr_decode_attrs(&attr, table, dst, seen);
+}
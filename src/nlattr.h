@@ -0,0 +1,102 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stddef.h>
+#include <net/if.h>
+
+enum nlattr_kind {
+	NLATTR_UNUSED = 0,	/* Attribute ignored by the decoder */
+	NLATTR_U8,
+	NLATTR_U16,
+	NLATTR_U32,
+	NLATTR_U64,
+	NLATTR_STRING,		/* NUL terminated, copied into a char array */
+	NLATTR_NESTED,		/* Elements of one type, copied into an array */
+};
+
+struct nlattr_policy {
+	uint8_t kind;
+	uint16_t size;		/* Destination size */
+	uint16_t offset;	/* Destination offset */
+	uint16_t nested;	/* NLATTR_NESTED: element attribute type */
+	uint16_t elem;		/* NLATTR_NESTED: element size */
+};
+
+struct nlattr_table {
+	const struct nlattr_policy *policy;
+	uint16_t max;		/* Highest attribute type in policy */
+};
+
+#define NLATTR_FIELD(attr, k, type, member)				\
+	[attr] = {							\
+		.kind = k,						\
+		.size = sizeof(((type *) 0)->member),			\
+		.offset = offsetof(type, member),			\
+	}
+
+/* Element i of the nested attribute lands in member[i] */
+#define NLATTR_NESTED_FIELD(attr, elem_attr, type, member)		\
+	[attr] = {							\
+		.kind = NLATTR_NESTED,					\
+		.size = sizeof(((type *) 0)->member),			\
+		.offset = offsetof(type, member),			\
+		.nested = elem_attr,					\
+		.elem = sizeof(((type *) 0)->member[0]),		\
+	}
+
+/* Bit of 'seen' set by nlattr_decode() */
+#define NLATTR_BIT(attr)	(UINT64_C(1) << (attr))
+
+#define NLATTR_PAGES		32	/* IEEE802154_MAX_PAGE + 1 */
+
+/* NL802154_CMD_NEW_WPAN_PHY: GET_WPAN_PHY replies */
+struct nlattr_wpan_phy {
+	uint32_t wpan_phy;
+	char name[IFNAMSIZ];
+	uint8_t page;
+	uint8_t channel;
+	uint32_t channels[NLATTR_PAGES];	/* Supported, by page */
+};
+
+/* NL802154_CMD_NEW_INTERFACE: GET_INTERFACE and NEW_INTERFACE replies */
+struct nlattr_interface {
+	uint32_t wpan_phy;
+	uint32_t ifindex;
+	char name[IFNAMSIZ];
+	uint32_t iftype;
+	uint64_t wpan_dev;
+	uint16_t panid;
+	uint16_t short_addr;
+	uint64_t extended_addr;
+};
+
+extern const struct nlattr_table nlattr_wpan_phy_table;
+extern const struct nlattr_table nlattr_interface_table;
+
+struct l_genl_attr;
+struct l_genl_msg;
+
+bool nlattr_decode_attrs(struct l_genl_attr *attr,
+				const struct nlattr_table *table,
+				void *dst, uint64_t *seen);
+bool nlattr_decode(struct l_genl_msg *msg, const struct nlattr_table *table,
+				void *dst, uint64_t *seen);
@@ -24,36 +24,370 @@
 #include <config.h>
 #endif
 
+#include <endian.h>
+#include <stddef.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
 #include <ell/ell.h>
 #include "nl802154.h"
+#include "nlattr.h"
 #include "dbus.h"
 #include "lowpan.h"
+#include "capture.h"
+#include "neighbor.h"
+#include "inject.h"
+#include "bridge.h"
+#include "metrics.h"
 #include "phy.h"
+#include "trace.h"
+#include "latency.h"
+#include "ratelimit.h"
+#include "pool.h"
+#include "iphc.h"
+#include "frag.h"
+#include "route.h"
+#include "hop.h"
+#include "survey.h"
 
 #define ADAPTER_INTERFACE		"net.connman.iwpand.Adapter"
+#define PHY_INTERFACE			"net.connman.iwpand.Phy"
 
-/* User defined settings */
-struct channel {
+struct phy {
+	uint32_t id;
+	char name[IFNAMSIZ];
 	uint8_t page;
-	uint8_t ch;
+	uint8_t channel;
+	bool stale;			/* nl802154 vanished: not usable */
+	bool unseen;			/* Live resync: not dumped again yet */
+	uint32_t channels;		/* Supported on the current page */
+	struct hop_schedule *hop;
+	struct hop_stats hop_stats;	/* Of the last schedule stopped */
+	struct survey *survey;
+	struct l_dbus_message *survey_pending;
+	bool survey_apply;		/* Move to the least loaded channel */
+	struct survey_result survey_result;	/* Of the last survey */
+	uint64_t surveys;
+};
+
+#define OBJECT_PATH_MAX		(IFNAMSIZ + 1)	/* "/wpan0" */
+
+/* Pool sizes, carved from the memory budget by phy_init() */
+#define PHY_MAX			16
+#define WPAN_MAX		16
+#define REQUEST_MAX		8
+
+#define PHY_CHANNEL_MAX		26	/* IEEE802154_MAX_CHANNEL */
+#define PHY_CHANNELS_24GHZ	0x07fff800	/* Channels 11-26 of page 0 */
+
+/* An InjectFrames call waiting for its frames to go out */
+struct inject_call {
+	struct l_dbus_message *message;
+	unsigned int count;
+	unsigned int remaining;
+	int32_t status[INJECT_QUEUE_MAX];
+};
+
+/* A CreateInterface/DeleteInterface call waiting for nl802154 */
+struct phy_request {
+	struct l_dbus_message *message;
+	char name[IFNAMSIZ];
+	bool replied;
+	bool handed_off;	/* To the GET_INTERFACE request */
+};
+
+struct wpan_stats {
+	uint64_t nl_sent;
+	uint64_t nl_failed;
+	uint64_t dbus_calls;
+	uint64_t dbus_errors;
 };
 
 struct wpan {
+	uint32_t id;		/* Never reused, matches kernel replies */
 	uint32_t ifindex;
-	char *name;
+	uint32_t phy;
+	char name[IFNAMSIZ];
 	bool powered;
 	uint16_t panid;
+	uint64_t extaddr;
+	bool stale;		/* nl802154 vanished: waiting for resync */
+	bool unseen;		/* Live resync: not dumped again yet */
+	struct capture *capture;
+	struct l_dbus_message *pending;
+	struct neighbor_table *neighbors;
+	struct inject *inject;		/* Opened by the first injection */
+	struct bridge *bridge;
+	struct iphc_table *contexts;
+	struct frag_config frag;	/* Applied when powered */
+	struct wpan_stats stats;
 };
 
 static struct l_queue *wpan_list = NULL;
+static struct l_queue *phy_list = NULL;
+static struct pool *wpan_pool = NULL;
+static struct pool *phy_pool = NULL;
+static struct pool *request_pool = NULL;
+static struct pool *inject_call_pool = NULL;
+static uint32_t last_wpan_id;
 static struct l_genl_family *nl802154 = NULL;
 
+/* User defined settings */
+static uint8_t default_page = 0xff;
+static uint8_t default_channel = 0xff;
+
+/* Incremented each time nl802154 vanishes: invalidates pending dumps */
+static unsigned int generation = 0;
+
+static phy_adapter_watch_func_t adapter_watch = NULL;
+static phy_filter_func_t phy_filter = NULL;
+
 static void wpan_free(void *data)
 {
 	struct wpan *wpan = data;
 
-	l_free(wpan->name);
-	l_free(wpan);
+	/* Answers a StartCapture still waiting for the monitor */
+	if (wpan->capture)
+		capture_stop(wpan->capture);
+
+	if (wpan->pending)
+		l_dbus_message_unref(wpan->pending);
+
+	if (wpan->powered)
+		lowpan_exit();
+
+	neighbor_table_free(wpan->neighbors);
+	inject_free(wpan->inject);
+	bridge_free(wpan->bridge);
+	iphc_table_free(wpan->contexts);
+
+	pool_release(wpan_pool, wpan);
+}
+
+static bool wpan_match_name(const void *a, const void *b)
+{
+	const struct wpan *wpan = a;
+	const char *name = b;
+
+	return !strcmp(wpan->name, name);
+}
+
+static bool phy_match_id(const void *a, const void *b)
+{
+	const struct phy *phy = a;
+
+	return phy->id == L_PTR_TO_UINT(b);
+}
+
+static uint8_t phy_channel(const struct phy *phy)
+{
+	return phy->hop ? hop_channel(phy->hop) : phy->channel;
+}
+
+static void wpan_get_state(const struct wpan *wpan,
+					struct phy_adapter *adapter)
+{
+	const struct phy *phy = l_queue_find(phy_list, phy_match_id,
+						L_UINT_TO_PTR(wpan->phy));
+
+	adapter->ifindex = wpan->ifindex;
+	adapter->powered = wpan->powered;
+	adapter->available = !wpan->stale;
+	adapter->panid = wpan->panid;
+	adapter->page = phy ? phy->page : 0xff;
+	adapter->channel = phy ? phy_channel(phy) : 0xff;
+}
+
+static void wpan_notify(struct wpan *wpan, bool removed)
+{
+	struct phy_adapter adapter;
+
+	if (!adapter_watch)
+		return;
+
+	wpan_get_state(wpan, &adapter);
+	adapter_watch(&adapter, removed);
+}
+
+static void wpan_available_changed(struct wpan *wpan)
+{
+	char path[OBJECT_PATH_MAX];
+
+	snprintf(path, sizeof(path), "/%s", wpan->name);
+	l_dbus_property_changed(dbus_get_bus(), path,
+					ADAPTER_INTERFACE, "Available");
+
+	wpan_notify(wpan, false);
+}
+
+static void wpan_remove(void *data)
+{
+	struct wpan *wpan = data;
+	char path[OBJECT_PATH_MAX];
+
+	snprintf(path, sizeof(path), "/%s", wpan->name);
+	l_dbus_unregister_object(dbus_get_bus(), path);
+
+	wpan_notify(wpan, true);
+	wpan_free(wpan);
+}
+
+static struct l_dbus_message *adapter_error(struct wpan *wpan,
+						struct l_dbus_message *reply)
+{
+	metrics_inc(&wpan->stats.dbus_errors);
+
+	return reply;
+}
+
+static bool wpan_match_id(const void *a, const void *b)
+{
+	const struct wpan *wpan = a;
+
+	return wpan->id == L_PTR_TO_UINT(b);
+}
+
+/* Kernel replies are matched by id: the adapter may be gone */
+static void wpan_command_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct wpan *wpan;
+	int err = l_genl_msg_get_error(msg);
+
+	trace_genl(0, __func__, msg);
+
+	if (err >= 0)
+		return;
+
+	wpan = l_queue_find(wpan_list, wpan_match_id, user_data);
+	if (!wpan)
+		return;
+
+	l_error("'%s': nl802154 command %u: %s", wpan->name,
+				l_genl_msg_get_command(msg), strerror(-err));
+	metrics_inc(&wpan->stats.nl_failed);
+}
+
+static bool wpan_send(struct wpan *wpan, struct l_genl_msg *msg)
+{
+	metrics_inc(&wpan->stats.nl_sent);
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (l_genl_family_send(nl802154, msg, wpan_command_callback,
+					L_UINT_TO_PTR(wpan->id), NULL))
+		return true;
+
+	metrics_inc(&wpan->stats.nl_failed);
+
+	return false;
+}
+
+static bool set_panid(struct wpan *wpan, uint16_t panid)
+{
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_SET_PAN_ID, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX,
+					sizeof(wpan->ifindex), &wpan->ifindex);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAN_ID,
+						sizeof(panid), &panid);
+
+	if (!wpan_send(wpan, msg)) {
+		l_error("NL802154_CMD_SET_PAN_ID failed");
+		return false;
+	}
+
+	return true;
+}
+
+/* Setters shared by the D-Bus properties and the control socket */
+static int wpan_set_powered(struct wpan *wpan, bool value)
+{
+	int err;
+
+	if (value == wpan->powered)
+		return 0;
+
+	if (value == true && !lowpan_init())
+		return -EIO;
+
+	/* The link does not come up with limits other than requested */
+	if (value == true) {
+		err = frag_apply(&wpan->frag);
+		if (err < 0) {
+			lowpan_exit();
+			return err;
+		}
+	}
+
+	if (value == false)
+		lowpan_exit();
+
+	wpan->powered = value;
+	wpan_notify(wpan, false);
+
+	return 0;
+}
+
+static int wpan_set_panid(struct wpan *wpan, uint16_t value)
+{
+	/* Stale adapter: keep the desired value and apply it on resync */
+	if (!wpan->stale && !set_panid(wpan, value))
+		return -EINVAL;
+
+	wpan->panid = value;
+	wpan_notify(wpan, false);
+
+	return 0;
+}
+
+static void notify_phy_wpan(void *data, void *user_data)
+{
+	struct wpan *wpan = data;
+
+	if (wpan->phy == L_PTR_TO_UINT(user_data))
+		wpan_notify(wpan, false);
+}
+
+/* The channel belongs to the PHY: every adapter on it follows */
+static int wpan_set_channel(struct wpan *wpan, uint8_t channel)
+{
+	struct l_genl_msg *msg;
+	struct phy *phy;
+
+	if (channel > PHY_CHANNEL_MAX)
+		return -EINVAL;
+
+	phy = l_queue_find(phy_list, phy_match_id, L_UINT_TO_PTR(wpan->phy));
+	if (!phy || wpan->stale)
+		return -ENODEV;
+
+	if (phy->hop || phy->survey)
+		return -EBUSY;
+
+	if (channel == phy->channel)
+		return 0;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_SET_CHANNEL, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY,
+					sizeof(phy->id), &phy->id);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAGE,
+					sizeof(phy->page), &phy->page);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_CHANNEL,
+					sizeof(channel), &channel);
+
+	if (!wpan_send(wpan, msg)) {
+		l_error("NL802154_CMD_SET_CHANNEL failed");
+		return -EIO;
+	}
+
+	phy->channel = channel;
+	l_queue_foreach(wpan_list, notify_phy_wpan, L_UINT_TO_PTR(phy->id));
+
+	return 0;
 }
 
 static bool property_get_powered(struct l_dbus *dbus,
@@ -63,12 +397,34 @@ static bool property_get_powered(struct l_dbus *dbus,
 {
 	struct wpan *wpan = user_data;
 
+	metrics_inc(&wpan->stats.dbus_calls);
+
 	l_dbus_message_builder_append_basic(builder, 'b', &wpan->powered);
 	l_info("GetProperty(Powered = %d)", wpan->powered);
 
 	return true;
 }
 
+LATENCY_GETTER(property_get_powered)
+
+static bool property_get_available(struct l_dbus *dbus,
+				     struct l_dbus_message *msg,
+				     struct l_dbus_message_builder *builder,
+				     void *user_data)
+{
+	struct wpan *wpan = user_data;
+	bool available = !wpan->stale;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	l_dbus_message_builder_append_basic(builder, 'b', &available);
+	l_info("GetProperty(Available = %d)", available);
+
+	return true;
+}
+
+LATENCY_GETTER(property_get_available)
+
 static struct l_dbus_message *property_set_powered(struct l_dbus *dbus,
 					struct l_dbus_message *message,
 					struct l_dbus_message_iter *new_value,
@@ -77,28 +433,29 @@ static struct l_dbus_message *property_set_powered(struct l_dbus *dbus,
 {
 	struct wpan *wpan = user_data;
 	bool value;
+	int err;
 
-	if (!l_dbus_message_iter_get_variant(new_value, "b", &value))
-		return dbus_error_invalid_args(message);
+	metrics_inc(&wpan->stats.dbus_calls);
 
-	l_info("SetProperty(Powered = %d)", value);
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
 
-	if (value == wpan->powered)
-		goto done;
+	if (!l_dbus_message_iter_get_variant(new_value, "b", &value))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
 
-	wpan->powered = value;
+	l_info("SetProperty(Powered = %d)", value);
 
-	if (value == true)
-		lowpan_init();
-	else
-		lowpan_exit();
+	err = wpan_set_powered(wpan, value);
+	if (err < 0)
+		return adapter_error(wpan, dbus_error_failed(message, err));
 
-done:
 	complete(dbus, message, NULL);
 
 	return NULL;
 }
 
+LATENCY_SETTER(property_set_powered)
+
 static bool property_get_name(struct l_dbus *dbus,
 				  struct l_dbus_message *msg,
 				  struct l_dbus_message_builder *builder,
@@ -106,12 +463,16 @@ static bool property_get_name(struct l_dbus *dbus,
 {
 	struct wpan *wpan = user_data;
 
+	metrics_inc(&wpan->stats.dbus_calls);
+
 	l_dbus_message_builder_append_basic(builder, 's', wpan->name);
 	l_info("GetProperty(Name = %s)", wpan->name);
 
 	return true;
 }
 
+LATENCY_GETTER(property_get_name)
+
 static bool property_get_panid(struct l_dbus *dbus,
 				  struct l_dbus_message *msg,
 				  struct l_dbus_message_builder *builder,
@@ -119,12 +480,16 @@ static bool property_get_panid(struct l_dbus *dbus,
 {
 	struct wpan *wpan = user_data;
 
+	metrics_inc(&wpan->stats.dbus_calls);
+
 	l_dbus_message_builder_append_basic(builder, 'q', &wpan->panid);
 	l_info("GetProperty(PanId = %d)", wpan->panid);
 
 	return true;
 }
 
+LATENCY_GETTER(property_get_panid)
+
 static struct l_dbus_message *property_set_panid(struct l_dbus *dbus,
 					struct l_dbus_message *message,
 					struct l_dbus_message_iter *new_value,
@@ -132,191 +497,1844 @@ static struct l_dbus_message *property_set_panid(struct l_dbus *dbus,
 					void *user_data)
 {
 	struct wpan *wpan = user_data;
-	struct l_genl_msg *msg;
 	uint16_t value;
 
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
+
 	if (!l_dbus_message_iter_get_variant(new_value, "q", &value))
-		return dbus_error_invalid_args(message);
+		return adapter_error(wpan, dbus_error_invalid_args(message));
 
 	l_info("SetProperty(PanId = %d)", value);
 
-	msg = l_genl_msg_new_sized(NL802154_CMD_SET_PAN_ID, 64);
-	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX,
-					sizeof(wpan->ifindex), &wpan->ifindex);
-	l_genl_msg_append_attr(msg, NL802154_ATTR_PAN_ID,
-						sizeof(value), &value);
-
-	if (!l_genl_family_send(nl802154, msg, NULL, NULL, NULL)) {
-		l_error("NL802154_CMD_SET_PAN_ID failed");
-		return dbus_error_invalid_args(message);
-	}
+	if (wpan_set_panid(wpan, value) < 0)
+		return adapter_error(wpan, dbus_error_invalid_args(message));
 
-	wpan->panid =value;
 	complete(dbus, message, NULL);
 
 	return NULL;
 }
 
-static void register_property(struct l_dbus_interface *interface)
-{
-	if (!l_dbus_interface_property(interface, "Powered", 0, "b",
-				       property_get_powered,
-				       property_set_powered))
-		l_error("Can't add 'Powered' property");
+LATENCY_SETTER(property_set_panid)
 
-	if (!l_dbus_interface_property(interface, "Name", 0, "s",
-				       property_get_name,
-				       NULL))
-		l_error("Can't add 'Name' property");
+static bool frag_get(struct wpan *wpan,
+				struct l_dbus_message_builder *builder,
+				size_t offset)
+{
+	struct frag_config kernel;
+	uint32_t value;
 
-	if (!l_dbus_interface_property(interface, "PanId", 0, "q",
-				       property_get_panid,
-				       property_set_panid))
-		l_error("Can't add 'PanId' property");
-}
+	metrics_inc(&wpan->stats.dbus_calls);
 
-static void add_interface(struct wpan *wpan)
-{
-	char *path;
+	memcpy(&value, (uint8_t *) &wpan->frag + offset, sizeof(value));
 
-	path = l_strdup_printf("/%s", wpan->name);
+	/* Not set on this adapter: what the kernel uses */
+	if (!value) {
+		if (frag_read(&kernel) < 0)
+			return false;
 
-	if (!l_dbus_object_add_interface(dbus_get_bus(),
-					 path,
-					 ADAPTER_INTERFACE,
-					 wpan))
-		l_error("'%s': Unable to register %s interface",
-							path,
-							ADAPTER_INTERFACE);
+		memcpy(&value, (uint8_t *) &kernel + offset, sizeof(value));
+	}
 
-	if (!l_dbus_object_add_interface(dbus_get_bus(),
-					 path,
-					 L_DBUS_INTERFACE_PROPERTIES,
-					 wpan))
-		l_error("'%s': Unable to register %s interface",
-						path,
-						L_DBUS_INTERFACE_PROPERTIES);
+	l_dbus_message_builder_append_basic(builder, 'u', &value);
 
-	l_free(path);
+	return true;
 }
 
-static void get_wpan_phy_callback(struct l_genl_msg *msg, void *user_data)
+static struct l_dbus_message *frag_set(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_iter *new_value,
+					l_dbus_property_complete_cb_t complete,
+					struct wpan *wpan, size_t offset)
 {
-	struct channel *channel = user_data;
-	struct l_genl_msg *setup;
-	struct l_genl_attr attr;
-	uint16_t type, len;
-	const void *data;
-	uint32_t id;
-	uint8_t page = 0xff;
-	uint8_t ch = 0xff;
-
-	l_debug("");
+	struct frag_config config = wpan->frag;
+	uint32_t value;
+	int err;
 
-	if (!l_genl_attr_init(&attr, msg))
-		return;
+	metrics_inc(&wpan->stats.dbus_calls);
 
-	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		l_debug("type: %u len:%u", type, len);
-		switch (type) {
-		case NL802154_ATTR_WPAN_PHY:
-			id = *((uint32_t *) data);
-			l_debug("  id: %d", id);
-			break;
-		case NL802154_ATTR_PAGE:
-			page = *((uint8_t *) data);
-			l_debug("  page: %d", page);
-			break;
-		case NL802154_ATTR_CHANNEL:
-			ch = *((uint8_t *) data);
-			l_debug("  channel: %d", ch);
-			break;
-		}
-	}
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
 
-	/* Malformed netlink message? */
-	if (page == 0xff || ch == 0xff)
-		return;
+	if (!l_dbus_message_iter_get_variant(new_value, "u", &value))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
 
-	/* Valid command line params? */
-	if (channel->page == 0xff || channel->ch == 0xff)
-		return;
+	memcpy((uint8_t *) &config + offset, &value, sizeof(value));
 
-	if (channel->page == page && channel->ch == ch)
-		return;
+	if (!frag_config_valid(&config))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
 
-	/* Change page and channel according to command line params */
-	setup = l_genl_msg_new_sized(NL802154_CMD_SET_CHANNEL, 64);
-	l_genl_msg_append_attr(setup, NL802154_ATTR_WPAN_PHY, sizeof(id), &id);
-	l_genl_msg_append_attr(setup, NL802154_ATTR_PAGE,
-			       sizeof(channel->page), &channel->page);
-	l_genl_msg_append_attr(setup, NL802154_ATTR_CHANNEL,
-			       sizeof(channel->ch), &channel->ch);
+	/* Otherwise applied by the Powered setter */
+	if (wpan->powered) {
+		err = frag_apply(&config);
+		if (err == -EINVAL)
+			return adapter_error(wpan,
+					dbus_error_invalid_args(message));
 
-	if (!l_genl_family_send(nl802154, setup, NULL, NULL, NULL)) {
-		l_error("NL802154_CMD_SET_CHANNEL failed");
-		return;
+		if (err < 0)
+			return adapter_error(wpan,
+					dbus_error_failed(message, err));
 	}
+
+	wpan->frag = config;
+	complete(dbus, message, NULL);
+
+	return NULL;
 }
 
-static void get_interface_callback(struct l_genl_msg *msg, void *user_data)
+#define FRAG_PROPERTY(name, field)					\
+static bool property_get_##name(struct l_dbus *dbus,			\
+				struct l_dbus_message *msg,		\
+				struct l_dbus_message_builder *builder,	\
+				void *user_data)			\
+{									\
+	return frag_get(user_data, builder,				\
+				offsetof(struct frag_config, field));	\
+}									\
+LATENCY_GETTER(property_get_##name)					\
+static struct l_dbus_message *property_set_##name(struct l_dbus *dbus,	\
+				struct l_dbus_message *message,		\
+				struct l_dbus_message_iter *new_value,	\
+				l_dbus_property_complete_cb_t complete,	\
+				void *user_data)			\
+{									\
+	return frag_set(dbus, message, new_value, complete, user_data,	\
+				offsetof(struct frag_config, field));	\
+}									\
+LATENCY_SETTER(property_set_##name)
+
+FRAG_PROPERTY(frag_high, high_thresh)
+FRAG_PROPERTY(frag_low, low_thresh)
+FRAG_PROPERTY(frag_timeout, timeout)
+
+static bool property_get_reasm_failures(struct l_dbus *dbus,
+				     struct l_dbus_message *msg,
+				     struct l_dbus_message_builder *builder,
+				     void *user_data)
 {
-	struct wpan *wpan;
-	struct l_genl_attr attr;
-	uint16_t type, len;
-	const void *data;
-
-	l_debug("");
+	struct wpan *wpan = user_data;
+	uint64_t fails, timeouts;
 
-	if (!l_genl_attr_init(&attr, msg))
-		return;
+	metrics_inc(&wpan->stats.dbus_calls);
 
-	wpan = l_new(struct wpan, 1);
-	l_queue_push_head(wpan_list, wpan);
+	if (!frag_stats(&fails, &timeouts))
+		return false;
 
-	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		l_debug("type: %u len:%u", type, len);
-		switch (type) {
-		case NL802154_ATTR_IFINDEX:
-			wpan->ifindex = *((uint32_t *) data);
-			l_debug("  id: %d",  wpan->ifindex);
-			break;
-		case NL802154_ATTR_IFNAME:
-			wpan->name = l_strdup(data);
-			l_debug("  name: %s", wpan->name);
-			break;
-		case NL802154_ATTR_PAN_ID:
-			wpan->panid = *((uint16_t *) data);
-			l_debug("  PAN ID: %d", wpan->panid);
-		}
-	}
+	l_dbus_message_builder_append_basic(builder, 't', &fails);
 
-	add_interface(wpan);
+	return true;
 }
 
-bool phy_init(struct l_genl_family *genl, uint8_t page, uint8_t ch)
-{
-	struct l_genl_msg *msg;
-	struct channel *channel;
+LATENCY_GETTER(property_get_reasm_failures)
 
-	channel = l_new(struct channel, 1);
-	channel->page = page;
-	channel->ch = ch;
+static bool property_get_reasm_timeouts(struct l_dbus *dbus,
+				     struct l_dbus_message *msg,
+				     struct l_dbus_message_builder *builder,
+				     void *user_data)
+{
+	struct wpan *wpan = user_data;
+	uint64_t fails, timeouts;
 
-	msg = l_genl_msg_new(NL802154_CMD_GET_WPAN_PHY);
-	if (!l_genl_family_dump(genl, msg, get_wpan_phy_callback,
-						channel, l_free)) {
-		l_error("Getting all PHY devices failed");
-		return false;
-	}
+	metrics_inc(&wpan->stats.dbus_calls);
 
-	msg = l_genl_msg_new(NL802154_CMD_GET_INTERFACE);
-	if (!l_genl_family_dump(genl, msg, get_interface_callback,
-						NULL, NULL)) {
-		l_error("Getting all interfaces failed");
+	if (!frag_stats(&fails, &timeouts))
 		return false;
-	}
 
+	l_dbus_message_builder_append_basic(builder, 't', &timeouts);
+
+	return true;
+}
+
+LATENCY_GETTER(property_get_reasm_timeouts)
+
+static void capture_started(int err, void *user_data)
+{
+	struct wpan *wpan = user_data;
+	struct l_dbus_message *reply;
+
+	if (err == -ECANCELED) {
+		wpan->capture = NULL;
+		reply = adapter_error(wpan,
+				dbus_error_not_available(wpan->pending));
+	} else if (err < 0) {
+		wpan->capture = NULL;
+		reply = adapter_error(wpan,
+				dbus_error_failed(wpan->pending, err));
+	} else
+		reply = l_dbus_message_new_method_return(wpan->pending);
+
+	l_dbus_send(dbus_get_bus(), reply);
+	l_dbus_message_unref(wpan->pending);
+	wpan->pending = NULL;
+}
+
+static void capture_stopped(void *user_data)
+{
+	struct wpan *wpan = user_data;
+
+	wpan->capture = NULL;
+}
+
+static struct l_dbus_message *method_start_capture(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	const char *path;
+	uint32_t size_limit, time_limit;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!l_dbus_message_get_arguments(message, "suu", &path,
+						&size_limit, &time_limit) ||
+							path[0] != '/')
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (wpan->stale)
+		return adapter_error(wpan, dbus_error_not_available(message));
+
+	if (wpan->capture)
+		return adapter_error(wpan, dbus_error_in_progress(message));
+
+	l_info("StartCapture(%s, %u, %u)", path, size_limit, time_limit);
+
+	wpan->capture = capture_start(nl802154, wpan->phy, path, size_limit,
+					time_limit, capture_started,
+					capture_stopped, wpan);
+	if (!wpan->capture)
+		return adapter_error(wpan, dbus_error_failed(message, -EIO));
+
+	wpan->pending = l_dbus_message_ref(message);
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_start_capture)
+
+static struct l_dbus_message *method_stop_capture(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	l_info("StopCapture()");
+
+	/* Still waiting for the monitor interface */
+	if (wpan->pending)
+		return adapter_error(wpan, dbus_error_in_progress(message));
+
+	if (!wpan->capture)
+		return adapter_error(wpan, dbus_error_not_found(message));
+
+	capture_stop(wpan->capture);
+	wpan->capture = NULL;
+
+	return l_dbus_message_new_method_return(message);
+}
+
+LATENCY_METHOD(method_stop_capture)
+
+static void append_neighbor(struct l_dbus_message_builder *builder,
+						const struct neighbor *n)
+{
+	char address[24];
+	uint8_t lqi_avg = n->lqi_avg >> 4;
+	uint32_t age = neighbor_age(n);
+
+	if (n->mode == NEIGHBOR_ADDR_LONG)
+		snprintf(address, sizeof(address),
+				"%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x",
+				(uint8_t) (n->addr >> 56),
+				(uint8_t) (n->addr >> 48),
+				(uint8_t) (n->addr >> 40),
+				(uint8_t) (n->addr >> 32),
+				(uint8_t) (n->addr >> 24),
+				(uint8_t) (n->addr >> 16),
+				(uint8_t) (n->addr >> 8),
+				(uint8_t) n->addr);
+	else
+		snprintf(address, sizeof(address), "0x%04x",
+						(uint16_t) n->addr);
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+	dbus_append_dict_basic(builder, "Address", 's', address);
+
+	if (n->mode == NEIGHBOR_ADDR_SHORT)
+		dbus_append_dict_basic(builder, "PanId", 'q', &n->panid);
+
+	dbus_append_dict_basic(builder, "Lqi", 'y', &n->lqi);
+	dbus_append_dict_basic(builder, "AverageLqi", 'y', &lqi_avg);
+	dbus_append_dict_basic(builder, "MinLqi", 'y', &n->lqi_min);
+	dbus_append_dict_basic(builder, "MaxLqi", 'y', &n->lqi_max);
+	dbus_append_dict_basic(builder, "Frames", 'u', &n->frames);
+	dbus_append_dict_basic(builder, "LastSeen", 'u', &age);
+	l_dbus_message_builder_leave_array(builder);
+}
+
+static struct l_dbus_message *method_get_neighbors(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	const struct neighbor *list[256];
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	uint32_t count, i;
+	bool weakest;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!l_dbus_message_get_arguments(message, "ub", &count, &weakest))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (count > L_ARRAY_SIZE(list))
+		count = L_ARRAY_SIZE(list);
+
+	count = neighbor_top(wpan->neighbors, weakest, list, count);
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+	for (i = 0; i < count; i++)
+		append_neighbor(builder, list[i]);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+LATENCY_METHOD(method_get_neighbors)
+
+static struct l_dbus_message *method_get_neighbor(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	const struct neighbor *n;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	const char *address;
+	uint64_t addr;
+	uint8_t mode;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!l_dbus_message_get_arguments(message, "s", &address) ||
+			!neighbor_parse_address(address, &mode, &addr))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	/* Short addresses are looked up in the adapter PAN */
+	n = neighbor_lookup(wpan->neighbors, mode, addr, wpan->panid);
+	if (!n)
+		return adapter_error(wpan, dbus_error_not_found(message));
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	append_neighbor(builder, n);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+LATENCY_METHOD(method_get_neighbor)
+
+static void contexts_committed(int err, void *user_data)
+{
+	struct l_dbus_message *message = user_data;
+	struct l_dbus_message *reply;
+
+	if (err < 0)
+		reply = dbus_error_failed(message, err);
+	else
+		reply = l_dbus_message_new_method_return(message);
+
+	l_dbus_send(dbus_get_bus(), reply);
+	l_dbus_message_unref(message);
+}
+
+/* Queued first: staged contexts are written by the flush it schedules */
+static struct l_dbus_message *contexts_commit(struct wpan *wpan,
+						struct l_dbus_message *message)
+{
+	const char *link = NULL;
+	int err;
+
+	if (!wpan->stale && wpan->powered)
+		link = lowpan_link_name(wpan->ifindex);
+
+	if (!link)
+		return adapter_error(wpan, dbus_error_not_available(message));
+
+	err = iphc_commit(wpan->contexts, link, contexts_committed,
+					l_dbus_message_ref(message));
+	if (!err)
+		return NULL;
+
+	l_dbus_message_unref(message);
+
+	if (err == -EBUSY)
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	return adapter_error(wpan, dbus_error_failed(message, err));
+}
+
+static struct l_dbus_message *method_add_context(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	struct l_dbus_message *reply;
+	struct in6_addr prefix;
+	const char *str;
+	uint8_t id, plen;
+	bool compression;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	if (!l_dbus_message_get_arguments(message, "ysb", &id, &str,
+							&compression) ||
+			id >= IPHC_CONTEXT_MAX ||
+			!iphc_parse_prefix(str, &prefix, &plen))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	l_info("AddContext(%u, %s, %d)", id, str, compression);
+
+	reply = contexts_commit(wpan, message);
+	if (reply)
+		return reply;
+
+	iphc_context_set(wpan->contexts, id, &prefix, plen, compression);
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_add_context)
+
+static struct l_dbus_message *method_remove_context(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	struct l_dbus_message *reply;
+	uint8_t id;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	if (!l_dbus_message_get_arguments(message, "y", &id))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (!iphc_context_get(wpan->contexts, id))
+		return adapter_error(wpan, dbus_error_not_found(message));
+
+	l_info("RemoveContext(%u)", id);
+
+	reply = contexts_commit(wpan, message);
+	if (reply)
+		return reply;
+
+	iphc_context_remove(wpan->contexts, id);
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_remove_context)
+
+static struct l_dbus_message *method_get_contexts(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	const struct iphc_context *ctx;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	char addr[INET6_ADDRSTRLEN];
+	char prefix[INET6_ADDRSTRLEN + 4];
+	uint8_t id;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+
+	for (id = 0; id < IPHC_CONTEXT_MAX; id++) {
+		ctx = iphc_context_get(wpan->contexts, id);
+		if (!ctx)
+			continue;
+
+		inet_ntop(AF_INET6, &ctx->prefix, addr, sizeof(addr));
+		snprintf(prefix, sizeof(prefix), "%s/%u", addr, ctx->plen);
+
+		l_dbus_message_builder_enter_array(builder, "{sv}");
+		dbus_append_dict_basic(builder, "Id", 'y', &id);
+		dbus_append_dict_basic(builder, "Prefix", 's', prefix);
+		dbus_append_dict_basic(builder, "Compression", 'b',
+							&ctx->compression);
+		l_dbus_message_builder_leave_array(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+LATENCY_METHOD(method_get_contexts)
+
+static struct l_dbus_message *method_start_bridge(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	const char *endpoint;
+	int fd;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!l_dbus_message_get_arguments(message, "s", &endpoint) ||
+							!endpoint[0])
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (wpan->stale)
+		return adapter_error(wpan, dbus_error_not_available(message));
+
+	if (wpan->bridge)
+		return adapter_error(wpan, dbus_error_in_progress(message));
+
+	l_info("StartBridge(%s)", endpoint);
+
+	fd = bridge_link_open(wpan->ifindex);
+	if (fd < 0)
+		return adapter_error(wpan, dbus_error_failed(message, fd));
+
+	wpan->bridge = bridge_new(wpan->name, fd, endpoint);
+	if (!wpan->bridge && errno == EINVAL)
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (!wpan->bridge)
+		return adapter_error(wpan, dbus_error_failed(message, -errno));
+
+	return l_dbus_message_new_method_return(message);
+}
+
+LATENCY_METHOD(method_start_bridge)
+
+static struct l_dbus_message *method_stop_bridge(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	l_info("StopBridge()");
+
+	if (!wpan->bridge)
+		return adapter_error(wpan, dbus_error_not_found(message));
+
+	bridge_free(wpan->bridge);
+	wpan->bridge = NULL;
+
+	return l_dbus_message_new_method_return(message);
+}
+
+LATENCY_METHOD(method_stop_bridge)
+
+static void route_set_applied(int err, unsigned int added,
+					unsigned int removed, void *user_data)
+{
+	struct l_dbus_message *message = user_data;
+	struct l_dbus_message *reply;
+
+	if (err < 0) {
+		reply = dbus_error_failed(message, err);
+	} else {
+		reply = l_dbus_message_new_method_return(message);
+		l_dbus_message_set_arguments(reply, "uu", added, removed);
+	}
+
+	l_dbus_send(dbus_get_bus(), reply);
+	l_dbus_message_unref(message);
+}
+
+/* Two passes: the arrays are sized before they are filled */
+static struct route_set *route_set_parse(struct l_dbus_message *message)
+{
+	struct l_dbus_message_iter addresses, routes;
+	struct route_set *set;
+	const char *str, *gateway;
+	unsigned int naddresses = 0, nroutes = 0;
+
+	if (!l_dbus_message_get_arguments(message, "asa(ss)",
+						&addresses, &routes))
+		return NULL;
+
+	while (l_dbus_message_iter_next_entry(&addresses, &str))
+		naddresses++;
+
+	while (l_dbus_message_iter_next_entry(&routes, &str, &gateway))
+		nroutes++;
+
+	set = route_set_new(naddresses, nroutes);
+	if (!set)
+		return NULL;
+
+	l_dbus_message_get_arguments(message, "asa(ss)", &addresses, &routes);
+
+	naddresses = 0;
+	while (l_dbus_message_iter_next_entry(&addresses, &str))
+		if (!route_parse_address(str,
+					&set->addresses[naddresses++]))
+			goto invalid;
+
+	nroutes = 0;
+	while (l_dbus_message_iter_next_entry(&routes, &str, &gateway))
+		if (!route_parse_route(str, gateway,
+					&set->routes[nroutes++]))
+			goto invalid;
+
+	return set;
+
+invalid:
+	route_set_free(set);
+	return NULL;
+}
+
+static struct l_dbus_message *method_apply_route_set(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	struct route_set *set;
+	uint32_t ifindex = 0;
+	int err;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	set = route_set_parse(message);
+	if (!set)
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (!wpan->stale && wpan->powered)
+		ifindex = lowpan_link_index(wpan->ifindex);
+
+	if (!ifindex) {
+		route_set_free(set);
+		return adapter_error(wpan, dbus_error_not_available(message));
+	}
+
+	l_info("ApplyRouteSet(%u addresses, %u routes)", set->address_count,
+							set->route_count);
+
+	err = route_apply(ifindex, set, route_set_applied,
+					l_dbus_message_ref(message));
+	if (err < 0) {
+		l_dbus_message_unref(message);
+		return adapter_error(wpan, dbus_error_in_progress(message));
+	}
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_apply_route_set)
+
+/* The socket is opened on the first injection */
+static int wpan_inject(struct wpan *wpan)
+{
+	if (wpan->inject)
+		return 0;
+
+	if (wpan->stale)
+		return -ENODEV;
+
+	wpan->inject = inject_new(wpan->name, wpan->extaddr);
+	if (!wpan->inject)
+		return -errno;
+
+	return 0;
+}
+
+static void frame_injected(int status, uint64_t tag, void *user_data)
+{
+	struct inject_call *call = user_data;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	unsigned int i;
+
+	call->status[tag] = status;
+
+	if (--call->remaining)
+		return;
+
+	reply = l_dbus_message_new_method_return(call->message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "i");
+
+	for (i = 0; i < call->count; i++)
+		l_dbus_message_builder_append_basic(builder, 'i',
+							&call->status[i]);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	l_dbus_send(dbus_get_bus(), reply);
+	l_dbus_message_unref(call->message);
+	pool_release(inject_call_pool, call);
+}
+
+static struct l_dbus_message *method_inject_frames(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wpan *wpan = user_data;
+	struct l_dbus_message_iter frames, frame;
+	const void *data[INJECT_QUEUE_MAX];
+	uint32_t len[INJECT_QUEUE_MAX];
+	struct inject_call *call;
+	unsigned int count = 0, i;
+	int err;
+
+	metrics_inc(&wpan->stats.dbus_calls);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message), wpan->name))
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	if (!l_dbus_message_get_arguments(message, "aay", &frames))
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	while (l_dbus_message_iter_next_entry(&frames, &frame)) {
+		if (count == INJECT_QUEUE_MAX ||
+				!l_dbus_message_iter_get_fixed_array(&frame,
+						&data[count], &len[count]) ||
+				!len[count] || len[count] > INJECT_FRAME_MAX)
+			return adapter_error(wpan,
+					dbus_error_invalid_args(message));
+
+		count++;
+	}
+
+	if (!count)
+		return adapter_error(wpan, dbus_error_invalid_args(message));
+
+	if (wpan->stale)
+		return adapter_error(wpan, dbus_error_not_available(message));
+
+	err = wpan_inject(wpan);
+	if (err < 0)
+		return adapter_error(wpan, dbus_error_failed(message, err));
+
+	/* All or nothing: the reply carries a status for every frame */
+	if (inject_room(wpan->inject) < count)
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	call = pool_alloc(inject_call_pool);
+	if (!call)
+		return adapter_error(wpan, dbus_error_busy(message));
+
+	l_debug("'%s': InjectFrames(%u frames)", wpan->name, count);
+
+	call->message = l_dbus_message_ref(message);
+	call->count = count;
+	call->remaining = count;
+
+	for (i = 0; i < count; i++)
+		inject_submit(wpan->inject, data[i], len[i], frame_injected,
+								i, call);
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_inject_frames)
+
+static void register_property(struct l_dbus_interface *interface)
+{
+	if (!l_dbus_interface_property(interface, "Powered", 0, "b",
+				       property_get_powered_timed,
+				       property_set_powered_timed))
+		l_error("Can't add 'Powered' property");
+
+	if (!l_dbus_interface_property(interface, "FragHighThreshold", 0,
+				       "u", property_get_frag_high_timed,
+				       property_set_frag_high_timed))
+		l_error("Can't add 'FragHighThreshold' property");
+
+	if (!l_dbus_interface_property(interface, "FragLowThreshold", 0,
+				       "u", property_get_frag_low_timed,
+				       property_set_frag_low_timed))
+		l_error("Can't add 'FragLowThreshold' property");
+
+	if (!l_dbus_interface_property(interface, "FragTimeout", 0,
+				       "u", property_get_frag_timeout_timed,
+				       property_set_frag_timeout_timed))
+		l_error("Can't add 'FragTimeout' property");
+
+	if (!l_dbus_interface_property(interface, "ReassemblyFailures", 0,
+				       "t", property_get_reasm_failures_timed,
+				       NULL))
+		l_error("Can't add 'ReassemblyFailures' property");
+
+	if (!l_dbus_interface_property(interface, "ReassemblyTimeouts", 0,
+				       "t", property_get_reasm_timeouts_timed,
+				       NULL))
+		l_error("Can't add 'ReassemblyTimeouts' property");
+
+	if (!l_dbus_interface_property(interface, "Name", 0, "s",
+				       property_get_name_timed,
+				       NULL))
+		l_error("Can't add 'Name' property");
+
+	if (!l_dbus_interface_property(interface, "PanId", 0, "q",
+				       property_get_panid_timed,
+				       property_set_panid_timed))
+		l_error("Can't add 'PanId' property");
+
+	if (!l_dbus_interface_property(interface, "Available", 0, "b",
+				       property_get_available_timed,
+				       NULL))
+		l_error("Can't add 'Available' property");
+
+	l_dbus_interface_method(interface, "StartCapture", 0,
+				method_start_capture_timed, "", "suu",
+				"path", "size_limit", "time_limit");
+	l_dbus_interface_method(interface, "StopCapture", 0,
+				method_stop_capture_timed, "", "");
+	l_dbus_interface_method(interface, "GetNeighbors", 0,
+				method_get_neighbors_timed, "aa{sv}", "ub",
+				"neighbors", "count", "weakest");
+	l_dbus_interface_method(interface, "GetNeighbor", 0,
+				method_get_neighbor_timed, "a{sv}", "s",
+				"neighbor", "address");
+	l_dbus_interface_method(interface, "AddContext", 0,
+				method_add_context_timed, "", "ysb",
+				"id", "prefix", "compression");
+	l_dbus_interface_method(interface, "RemoveContext", 0,
+				method_remove_context_timed, "", "y", "id");
+	l_dbus_interface_method(interface, "ApplyRouteSet", 0,
+				method_apply_route_set_timed, "uu", "asa(ss)",
+				"added", "removed", "addresses", "routes");
+	l_dbus_interface_method(interface, "InjectFrames", 0,
+				method_inject_frames_timed, "ai", "aay",
+				"status", "frames");
+	l_dbus_interface_method(interface, "GetContexts", 0,
+				method_get_contexts_timed, "aa{sv}", "",
+				"contexts");
+	l_dbus_interface_method(interface, "StartBridge", 0,
+				method_start_bridge_timed, "", "s",
+				"endpoint");
+	l_dbus_interface_method(interface, "StopBridge", 0,
+				method_stop_bridge_timed, "", "");
+}
+
+static void add_interface(struct wpan *wpan)
+{
+	char path[OBJECT_PATH_MAX];
+
+	snprintf(path, sizeof(path), "/%s", wpan->name);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(),
+					 path,
+					 ADAPTER_INTERFACE,
+					 wpan))
+		l_error("'%s': Unable to register %s interface",
+							path,
+							ADAPTER_INTERFACE);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(),
+					 path,
+					 L_DBUS_INTERFACE_PROPERTIES,
+					 wpan))
+		l_error("'%s': Unable to register %s interface",
+						path,
+						L_DBUS_INTERFACE_PROPERTIES);
+}
+
+static bool phy_match_name(const void *a, const void *b)
+{
+	const struct phy *phy = a;
+	const char *name = b;
+
+	return !strcmp(phy->name, name);
+}
+
+static void phy_hop_stop(struct phy *phy)
+{
+	if (!phy->hop)
+		return;
+
+	hop_get_stats(phy->hop, &phy->hop_stats);
+	phy->channel = hop_channel(phy->hop);
+
+	hop_stop(phy->hop);
+	phy->hop = NULL;
+}
+
+static void phy_hop_stats(const struct phy *phy, struct hop_stats *stats)
+{
+	if (phy->hop)
+		hop_get_stats(phy->hop, stats);
+	else
+		*stats = phy->hop_stats;
+}
+
+static void phy_survey_stop(struct phy *phy)
+{
+	if (!phy->survey)
+		return;
+
+	survey_cancel(phy->survey);
+	phy->survey = NULL;
+
+	l_dbus_send(dbus_get_bus(),
+			dbus_error_not_available(phy->survey_pending));
+	l_dbus_message_unref(phy->survey_pending);
+	phy->survey_pending = NULL;
+}
+
+static void phy_remove(void *data)
+{
+	struct phy *phy = data;
+	char path[OBJECT_PATH_MAX];
+
+	phy_hop_stop(phy);
+	phy_survey_stop(phy);
+
+	snprintf(path, sizeof(path), "/%s", phy->name);
+	l_dbus_unregister_object(dbus_get_bus(), path);
+
+	pool_release(phy_pool, phy);
+}
+
+static void add_phy_interface(struct phy *phy)
+{
+	char path[OBJECT_PATH_MAX];
+
+	snprintf(path, sizeof(path), "/%s", phy->name);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
+						PHY_INTERFACE, phy))
+		l_error("'%s': Unable to register %s interface",
+							path, PHY_INTERFACE);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
+					L_DBUS_INTERFACE_PROPERTIES, phy))
+		l_error("'%s': Unable to register %s interface",
+					path, L_DBUS_INTERFACE_PROPERTIES);
+}
+
+static void get_wpan_phy_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct l_genl_msg *setup;
+	struct nlattr_wpan_phy attrs = { .page = 0xff, .channel = 0xff };
+	struct phy *phy;
+	uint64_t seen;
+
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	if (!nlattr_decode(msg, &nlattr_wpan_phy_table, &attrs, &seen))
+		return;
+
+	l_debug("phy: %u page: %u channel: %u", attrs.wpan_phy,
+						attrs.page, attrs.channel);
+
+	/* Malformed netlink message? */
+	if (!(seen & NLATTR_BIT(NL802154_ATTR_WPAN_PHY)) ||
+			!(seen & NLATTR_BIT(NL802154_ATTR_WPAN_PHY_NAME)) ||
+			attrs.page == 0xff || attrs.channel == 0xff)
+		return;
+
+	/* Owned by another shard: left stale, removed once dumped */
+	if (phy_filter && !phy_filter(attrs.name))
+		return;
+
+	phy = l_queue_find(phy_list, phy_match_name, attrs.name);
+	if (!phy) {
+		phy = pool_alloc(phy_pool);
+		if (!phy) {
+			l_error("'%s': PHY limit reached", attrs.name);
+			return;
+		}
+
+		memcpy(phy->name, attrs.name, sizeof(phy->name));
+		l_queue_push_tail(phy_list, phy);
+		add_phy_interface(phy);
+	}
+
+	phy->id = attrs.wpan_phy;
+	phy->page = attrs.page;
+	phy->channels = attrs.page < NLATTR_PAGES ?
+					attrs.channels[attrs.page] : 0;
+	phy->stale = false;
+	phy->unseen = false;
+
+	/* Mid survey, the kernel reports the channel being visited */
+	if (!phy->survey)
+		phy->channel = attrs.channel;
+
+	/* The hop schedule or survey owns the channel until it is done */
+	if (phy->hop || phy->survey)
+		return;
+
+	/* Valid command line params? */
+	if (default_page == 0xff || default_channel == 0xff)
+		return;
+
+	if (default_page == attrs.page && default_channel == attrs.channel)
+		return;
+
+	/* Change page and channel according to command line params */
+	setup = l_genl_msg_new_sized(NL802154_CMD_SET_CHANNEL, 64);
+	l_genl_msg_append_attr(setup, NL802154_ATTR_WPAN_PHY,
+				sizeof(attrs.wpan_phy), &attrs.wpan_phy);
+	l_genl_msg_append_attr(setup, NL802154_ATTR_PAGE,
+			       sizeof(default_page), &default_page);
+	l_genl_msg_append_attr(setup, NL802154_ATTR_CHANNEL,
+			       sizeof(default_channel), &default_channel);
+
+	trace_genl(TRACE_OUT, __func__, setup);
+
+	if (!l_genl_family_send(nl802154, setup, NULL, NULL, NULL)) {
+		l_error("NL802154_CMD_SET_CHANNEL failed");
+		return;
+	}
+
+	phy->page = default_page;
+	phy->channel = default_channel;
+}
+
+LATENCY_GENL_CALLBACK(get_wpan_phy_callback)
+
+static bool phy_match_stale(const void *a, const void *b)
+{
+	const struct phy *phy = a;
+
+	return phy->stale || phy->unseen;
+}
+
+static void get_wpan_phy_done(void *user_data)
+{
+	struct phy *phy;
+
+	trace_genl_done(NL802154_CMD_GET_WPAN_PHY);
+
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	while ((phy = l_queue_remove_if(phy_list, phy_match_stale, NULL))) {
+		l_info("'%s': gone after resync", phy->name);
+		phy_remove(phy);
+	}
+}
+
+static void resync_wpan(struct wpan *wpan,
+				const struct nlattr_interface *iface)
+{
+	l_info("'%s': resync (ifindex %u -> %u)", wpan->name,
+						wpan->ifindex, iface->ifindex);
+
+	/* The injection socket is bound to the old address */
+	if (wpan->extaddr != iface->extended_addr) {
+		inject_free(wpan->inject);
+		wpan->inject = NULL;
+	}
+
+	/* The link socket is bound to the old interface */
+	if (wpan->ifindex != iface->ifindex) {
+		bridge_free(wpan->bridge);
+		wpan->bridge = NULL;
+	}
+
+	wpan->ifindex = iface->ifindex;
+	wpan->phy = iface->wpan_phy;
+	wpan->extaddr = iface->extended_addr;
+	wpan->stale = false;
+	wpan->unseen = false;
+
+	neighbor_table_rebind(wpan->neighbors, wpan->extaddr);
+
+	/* Reapply only the user settings that the kernel lost */
+	if (wpan->panid != iface->panid && !set_panid(wpan, wpan->panid))
+		wpan->panid = iface->panid;
+
+	wpan_available_changed(wpan);
+}
+
+static struct wpan *wpan_new(const struct nlattr_interface *iface)
+{
+	struct wpan *wpan;
+
+	wpan = pool_alloc(wpan_pool);
+	if (!wpan) {
+		l_error("'%s': adapter limit reached", iface->name);
+		return NULL;
+	}
+
+	wpan->id = ++last_wpan_id;
+	wpan->ifindex = iface->ifindex;
+	wpan->phy = iface->wpan_phy;
+	memcpy(wpan->name, iface->name, sizeof(wpan->name));
+	wpan->panid = iface->panid;
+	wpan->extaddr = iface->extended_addr;
+
+	wpan->neighbors = neighbor_table_new(wpan->name, wpan->extaddr);
+	if (!wpan->neighbors) {
+		pool_release(wpan_pool, wpan);
+		return NULL;
+	}
+
+	wpan->contexts = iphc_table_new(wpan->name);
+	if (!wpan->contexts) {
+		neighbor_table_free(wpan->neighbors);
+		pool_release(wpan_pool, wpan);
+		return NULL;
+	}
+
+	l_queue_push_head(wpan_list, wpan);
+
+	add_interface(wpan);
+	wpan_notify(wpan, false);
+
+	return wpan;
+}
+
+static void get_interface_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct wpan *wpan;
+	struct nlattr_interface iface = { .panid = 0xffff };
+	uint64_t seen;
+
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	if (!nlattr_decode(msg, &nlattr_interface_table, &iface, &seen))
+		return;
+
+	if (!(seen & NLATTR_BIT(NL802154_ATTR_IFNAME)) ||
+			!(seen & NLATTR_BIT(NL802154_ATTR_IFINDEX)))
+		return;
+
+	l_debug("ifindex: %u name: %s PAN ID: %u", iface.ifindex,
+						iface.name, iface.panid);
+
+	/* The PHY dump ran first: only owned PHYs are listed */
+	if (phy_filter && !l_queue_find(phy_list, phy_match_id,
+					L_UINT_TO_PTR(iface.wpan_phy)))
+		return;
+
+	wpan = l_queue_find(wpan_list, wpan_match_name, iface.name);
+	if (wpan) {
+		resync_wpan(wpan, &iface);
+		return;
+	}
+
+	wpan_new(&iface);
+}
+
+LATENCY_GENL_CALLBACK(get_interface_callback)
+
+static bool match_stale(const void *a, const void *b)
+{
+	const struct wpan *wpan = a;
+
+	return wpan->stale || wpan->unseen;
+}
+
+static void get_interface_done(void *user_data)
+{
+	struct wpan *wpan;
+
+	trace_genl_done(NL802154_CMD_GET_INTERFACE);
+
+	/* nl802154 vanished again while dumping: keep the stale objects */
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	/* Interfaces that did not come back with the module */
+	while ((wpan = l_queue_remove_if(wpan_list, match_stale, NULL))) {
+		l_info("'%s': gone after resync", wpan->name);
+		wpan_remove(wpan);
+	}
+}
+
+static void phy_request_free(void *data)
+{
+	struct phy_request *req = data;
+
+	l_dbus_message_unref(req->message);
+	pool_release(request_pool, req);
+}
+
+static void phy_request_reply(struct phy_request *req,
+						struct l_dbus_message *reply)
+{
+	l_dbus_send(dbus_get_bus(), reply);
+	req->replied = true;
+}
+
+/* Also run when the request is cancelled, e.g. nl802154 went away */
+static void phy_request_destroy(void *data)
+{
+	struct phy_request *req = data;
+
+	if (!req->replied)
+		l_dbus_send(dbus_get_bus(),
+				dbus_error_not_available(req->message));
+
+	phy_request_free(req);
+}
+
+static void get_new_interface_callback(struct l_genl_msg *msg,
+							void *user_data)
+{
+	struct phy_request *req = user_data;
+	struct nlattr_interface iface = { .panid = 0xffff };
+	struct l_dbus_message *reply;
+	struct wpan *wpan;
+	uint64_t seen;
+	char path[OBJECT_PATH_MAX];
+
+	if (l_genl_msg_get_error(msg) < 0 ||
+			!nlattr_decode(msg, &nlattr_interface_table,
+							&iface, &seen) ||
+			!(seen & NLATTR_BIT(NL802154_ATTR_IFNAME))) {
+		phy_request_reply(req, dbus_error_failed(req->message,
+								-EBADMSG));
+		return;
+	}
+
+	wpan = l_queue_find(wpan_list, wpan_match_name, iface.name);
+	if (!wpan)
+		wpan = wpan_new(&iface);
+
+	if (!wpan) {
+		phy_request_reply(req, dbus_error_failed(req->message,
+								-ENOSPC));
+		return;
+	}
+
+	l_info("'%s': created (ifindex %u)", wpan->name, wpan->ifindex);
+
+	snprintf(path, sizeof(path), "/%s", wpan->name);
+	reply = l_dbus_message_new_method_return(req->message);
+	l_dbus_message_set_arguments(reply, "o", path);
+	phy_request_reply(req, reply);
+}
+
+LATENCY_GENL_CALLBACK(get_new_interface_callback)
+
+static void new_interface_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct phy_request *req = user_data;
+	struct l_genl_msg *get;
+	uint32_t ifindex;
+	int err;
+
+	err = l_genl_msg_get_error(msg);
+	if (err < 0) {
+		l_error("'%s': NL802154_CMD_NEW_INTERFACE: %s", req->name,
+							strerror(-err));
+		goto fail;
+	}
+
+	/*
+	 * NL802154_CMD_NEW_INTERFACE is only acknowledged: fetch the
+	 * attributes of the new interface to publish the adapter.
+	 */
+	ifindex = if_nametoindex(req->name);
+	if (!ifindex || !nl802154) {
+		err = -ENODEV;
+		goto fail;
+	}
+
+	get = l_genl_msg_new_sized(NL802154_CMD_GET_INTERFACE, 32);
+	l_genl_msg_append_attr(get, NL802154_ATTR_IFINDEX,
+						sizeof(ifindex), &ifindex);
+
+	trace_genl(TRACE_OUT, __func__, get);
+
+	if (l_genl_family_send(nl802154, get, get_new_interface_callback_timed,
+						req, phy_request_destroy)) {
+		req->handed_off = true;
+		return;
+	}
+
+	err = -EIO;
+
+fail:
+	phy_request_reply(req, dbus_error_failed(req->message, err));
+}
+
+LATENCY_GENL_CALLBACK(new_interface_callback)
+
+static void new_interface_destroy(void *data)
+{
+	struct phy_request *req = data;
+
+	if (!req->handed_off)
+		phy_request_destroy(req);
+}
+
+/* The adapter's object path is "/" followed by the name */
+static bool valid_ifname(const char *name)
+{
+	size_t len = strlen(name);
+	size_t i;
+
+	if (!len || len >= IFNAMSIZ)
+		return false;
+
+	for (i = 0; i < len; i++)
+		if (!l_ascii_isalnum(name[i]) && name[i] != '_')
+			return false;
+
+	return true;
+}
+
+static bool parse_iftype(const char *type, uint32_t *iftype)
+{
+	if (!strcmp(type, "node"))
+		*iftype = NL802154_IFTYPE_NODE;
+	else if (!strcmp(type, "monitor"))
+		*iftype = NL802154_IFTYPE_MONITOR;
+	else if (!strcmp(type, "coordinator"))
+		*iftype = NL802154_IFTYPE_COORD;
+	else
+		return false;
+
+	return true;
+}
+
+static struct l_dbus_message *method_create_interface(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	struct phy_request *req;
+	struct l_genl_msg *msg;
+	const char *name, *type;
+	uint64_t extaddr;
+	uint32_t iftype;
+
+	if (!l_dbus_message_get_arguments(message, "sst", &name, &type,
+								&extaddr))
+		return dbus_error_invalid_args(message);
+
+	if (!valid_ifname(name) || !parse_iftype(type, &iftype))
+		return dbus_error_invalid_args(message);
+
+	if (phy->stale || !nl802154)
+		return dbus_error_not_available(message);
+
+	l_info("CreateInterface(%s, %s, %016" PRIx64 ")", name, type,
+								extaddr);
+
+	req = pool_alloc(request_pool);
+	if (!req)
+		return dbus_error_busy(message);
+
+	req->message = l_dbus_message_ref(message);
+	memcpy(req->name, name, strlen(name) + 1);
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY,
+						sizeof(phy->id), &phy->id);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFNAME,
+						strlen(name) + 1, name);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFTYPE,
+						sizeof(iftype), &iftype);
+
+	/* Zero: let the kernel pick a random extended address */
+	if (extaddr) {
+		extaddr = htole64(extaddr);
+		l_genl_msg_append_attr(msg, NL802154_ATTR_EXTENDED_ADDR,
+						sizeof(extaddr), &extaddr);
+	}
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_send(nl802154, msg, new_interface_callback_timed,
+						req, new_interface_destroy)) {
+		l_error("NL802154_CMD_NEW_INTERFACE failed");
+		phy_request_free(req);
+		return dbus_error_failed(message, -EIO);
+	}
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_create_interface)
+
+static void del_interface_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct phy_request *req = user_data;
+	struct wpan *wpan;
+	int err;
+
+	err = l_genl_msg_get_error(msg);
+	if (err < 0) {
+		l_error("'%s': NL802154_CMD_DEL_INTERFACE: %s", req->name,
+							strerror(-err));
+		phy_request_reply(req, dbus_error_failed(req->message, err));
+		return;
+	}
+
+	wpan = l_queue_remove_if(wpan_list, wpan_match_name, req->name);
+	if (wpan) {
+		l_info("'%s': deleted", wpan->name);
+		wpan_remove(wpan);
+	}
+
+	phy_request_reply(req, l_dbus_message_new_method_return(req->message));
+}
+
+LATENCY_GENL_CALLBACK(del_interface_callback)
+
+static struct l_dbus_message *method_delete_interface(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	struct phy_request *req;
+	struct l_genl_msg *msg;
+	struct wpan *wpan;
+	const char *path;
+
+	if (!l_dbus_message_get_arguments(message, "o", &path))
+		return dbus_error_invalid_args(message);
+
+	wpan = l_queue_find(wpan_list, wpan_match_name, path + 1);
+	if (!wpan || wpan->phy != phy->id)
+		return dbus_error_not_found(message);
+
+	if (wpan->stale || !nl802154)
+		return dbus_error_not_available(message);
+
+	l_info("DeleteInterface(%s)", path);
+
+	req = pool_alloc(request_pool);
+	if (!req)
+		return dbus_error_busy(message);
+
+	req->message = l_dbus_message_ref(message);
+	memcpy(req->name, wpan->name, strlen(wpan->name) + 1);
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_DEL_INTERFACE, 32);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX,
+					sizeof(wpan->ifindex), &wpan->ifindex);
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_send(nl802154, msg, del_interface_callback_timed,
+						req, phy_request_destroy)) {
+		l_error("NL802154_CMD_DEL_INTERFACE failed");
+		phy_request_free(req);
+		return dbus_error_failed(message, -EIO);
+	}
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_delete_interface)
+
+static bool property_get_phy_name(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct phy *phy = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's', phy->name);
+
+	return true;
+}
+
+LATENCY_GETTER(property_get_phy_name)
+
+static bool property_get_page(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct phy *phy = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'y', &phy->page);
+
+	return true;
+}
+
+LATENCY_GETTER(property_get_page)
+
+static bool property_get_channel(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct phy *phy = user_data;
+	uint8_t channel = phy_channel(phy);
+
+	l_dbus_message_builder_append_basic(builder, 'y', &channel);
+
+	return true;
+}
+
+LATENCY_GETTER(property_get_channel)
+
+static struct l_dbus_message *method_start_hopping(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	struct l_dbus_message_iter iter;
+	uint8_t channels[HOP_SEQUENCE_MAX];
+	unsigned int count = 0;
+	uint8_t channel;
+	uint32_t slot;
+	int err;
+
+	if (!l_dbus_message_get_arguments(message, "ayu", &iter, &slot))
+		return dbus_error_invalid_args(message);
+
+	while (l_dbus_message_iter_next_entry(&iter, &channel)) {
+		if (count == HOP_SEQUENCE_MAX || channel > PHY_CHANNEL_MAX)
+			return dbus_error_invalid_args(message);
+
+		channels[count++] = channel;
+	}
+
+	if (!count || slot < HOP_SLOT_MIN || slot > HOP_SLOT_MAX)
+		return dbus_error_invalid_args(message);
+
+	if (phy->hop || phy->survey)
+		return dbus_error_in_progress(message);
+
+	if (phy->stale || !nl802154)
+		return dbus_error_not_available(message);
+
+	l_info("StartHopping(%u channels, %u ms)", count, slot);
+
+	err = hop_start(phy->name, phy->id, phy->page, channels, count,
+							slot, &phy->hop);
+	if (err < 0)
+		return dbus_error_failed(message, err);
+
+	return l_dbus_message_new_method_return(message);
+}
+
+LATENCY_METHOD(method_start_hopping)
+
+static struct l_dbus_message *method_stop_hopping(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+
+	l_info("StopHopping()");
+
+	if (!phy->hop)
+		return dbus_error_not_found(message);
+
+	phy_hop_stop(phy);
+
+	return l_dbus_message_new_method_return(message);
+}
+
+LATENCY_METHOD(method_stop_hopping)
+
+static struct l_dbus_message *method_get_hop_stats(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	struct hop_stats stats;
+	uint32_t slot = phy->hop ? hop_slot(phy->hop) : 0;
+	uint64_t average = 0;
+
+	phy_hop_stats(phy, &stats);
+
+	if (stats.hops)
+		average = stats.jitter_total / stats.hops;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+	dbus_append_dict_basic(builder, "Slot", 'u', &slot);
+	dbus_append_dict_basic(builder, "Hops", 't', &stats.hops);
+	dbus_append_dict_basic(builder, "Late", 't', &stats.late);
+	dbus_append_dict_basic(builder, "Missed", 't', &stats.missed);
+	dbus_append_dict_basic(builder, "Failed", 't', &stats.failed);
+	dbus_append_dict_basic(builder, "JitterAverage", 't', &average);
+	dbus_append_dict_basic(builder, "JitterMax", 't', &stats.jitter_max);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+LATENCY_METHOD(method_get_hop_stats)
+
+static void phy_apply_channel(struct phy *phy, uint8_t channel)
+{
+	struct l_genl_msg *msg;
+
+	if (channel == phy->channel)
+		return;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_SET_CHANNEL, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY,
+					sizeof(phy->id), &phy->id);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAGE,
+					sizeof(phy->page), &phy->page);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_CHANNEL,
+					sizeof(channel), &channel);
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_send(nl802154, msg, NULL, NULL, NULL)) {
+		l_error("NL802154_CMD_SET_CHANNEL failed");
+		return;
+	}
+
+	l_info("'%s': moved to channel %u", phy->name, channel);
+
+	phy->channel = channel;
+	l_queue_foreach(wpan_list, notify_phy_wpan, L_UINT_TO_PTR(phy->id));
+}
+
+static void survey_done(int err, const struct survey_result *result,
+							void *user_data)
+{
+	struct phy *phy = user_data;
+	const struct survey_channel *best = &result->channels[0];
+	struct l_dbus_message *reply;
+
+	phy->survey = NULL;
+
+	if (err < 0) {
+		reply = dbus_error_failed(phy->survey_pending, err);
+		goto done;
+	}
+
+	phy->survey_result = *result;
+	phy->surveys++;
+
+	/* Every channel refused: nothing to rank */
+	if (best->failed) {
+		reply = dbus_error_failed(phy->survey_pending, -EIO);
+		goto done;
+	}
+
+	if (phy->survey_apply)
+		phy_apply_channel(phy, best->channel);
+
+	reply = l_dbus_message_new_method_return(phy->survey_pending);
+	l_dbus_message_set_arguments(reply, "y", best->channel);
+
+done:
+	l_dbus_send(dbus_get_bus(), reply);
+	l_dbus_message_unref(phy->survey_pending);
+	phy->survey_pending = NULL;
+}
+
+static struct l_dbus_message *method_start_survey(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	uint32_t channels;
+	uint32_t dwell;
+	bool apply;
+
+	if (!l_dbus_message_get_arguments(message, "ub", &dwell, &apply) ||
+			dwell < SURVEY_DWELL_MIN || dwell > SURVEY_DWELL_MAX)
+		return dbus_error_invalid_args(message);
+
+	if (phy->hop || phy->survey)
+		return dbus_error_in_progress(message);
+
+	if (phy->stale || !nl802154)
+		return dbus_error_not_available(message);
+
+	/* Kernels without the capability dump: 2.4 GHz on page 0 */
+	channels = phy->channels;
+	if (!channels && phy->page == 0)
+		channels = PHY_CHANNELS_24GHZ;
+
+	if (!channels)
+		return dbus_error_not_available(message);
+
+	l_info("StartSurvey(%u ms, %s)", dwell, apply ? "apply" : "report");
+
+	phy->survey = survey_start(nl802154, phy->id, phy->page,
+					phy->channel, channels, dwell,
+					survey_done, phy);
+	if (!phy->survey)
+		return dbus_error_failed(message, -EIO);
+
+	phy->survey_pending = l_dbus_message_ref(message);
+	phy->survey_apply = apply;
+
+	return NULL;
+}
+
+LATENCY_METHOD(method_start_survey)
+
+static struct l_dbus_message *method_get_survey(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct phy *phy = user_data;
+	const struct survey_result *result = &phy->survey_result;
+	const struct survey_channel *channel;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	uint32_t airtime;
+	uint32_t age;
+	unsigned int i;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+
+	for (i = 0; i < result->count; i++) {
+		channel = &result->channels[i];
+		airtime = channel->airtime;
+		age = survey_age(channel);
+
+		l_dbus_message_builder_enter_array(builder, "{sv}");
+		dbus_append_dict_basic(builder, "Channel", 'y',
+							&channel->channel);
+		dbus_append_dict_basic(builder, "Page", 'y', &result->page);
+		dbus_append_dict_basic(builder, "Failed", 'b',
+							&channel->failed);
+		dbus_append_dict_basic(builder, "Frames", 'u',
+							&channel->frames);
+		dbus_append_dict_basic(builder, "Bytes", 'u', &channel->bytes);
+		dbus_append_dict_basic(builder, "Airtime", 'u', &airtime);
+		dbus_append_dict_basic(builder, "Dwell", 'u', &channel->dwell);
+		dbus_append_dict_basic(builder, "Occupancy", 'q',
+							&channel->occupancy);
+		dbus_append_dict_basic(builder, "LastSurveyed", 'u', &age);
+		l_dbus_message_builder_leave_array(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+LATENCY_METHOD(method_get_survey)
+
+static void register_phy_interface(struct l_dbus_interface *interface)
+{
+	l_dbus_interface_method(interface, "CreateInterface", 0,
+				method_create_interface_timed, "o", "sst",
+				"path", "name", "type", "extaddr");
+	l_dbus_interface_method(interface, "DeleteInterface", 0,
+				method_delete_interface_timed, "", "o", "path");
+	l_dbus_interface_method(interface, "StartHopping", 0,
+				method_start_hopping_timed, "", "ayu",
+				"channels", "slot");
+	l_dbus_interface_method(interface, "StopHopping", 0,
+				method_stop_hopping_timed, "", "");
+	l_dbus_interface_method(interface, "GetHopStats", 0,
+				method_get_hop_stats_timed, "a{sv}", "",
+				"stats");
+	l_dbus_interface_method(interface, "StartSurvey", 0,
+				method_start_survey_timed, "y", "ub",
+				"channel", "dwell", "apply");
+	l_dbus_interface_method(interface, "GetSurvey", 0,
+				method_get_survey_timed, "aa{sv}", "",
+				"channels");
+
+	if (!l_dbus_interface_property(interface, "Name", 0, "s",
+				       property_get_phy_name_timed, NULL))
+		l_error("Can't add 'Name' property");
+
+	if (!l_dbus_interface_property(interface, "Page", 0, "y",
+				       property_get_page_timed, NULL))
+		l_error("Can't add 'Page' property");
+
+	if (!l_dbus_interface_property(interface, "Channel", 0, "y",
+				       property_get_channel_timed, NULL))
+		l_error("Can't add 'Channel' property");
+}
+
+static bool phy_dump(struct l_genl_family *genl)
+{
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new(NL802154_CMD_GET_WPAN_PHY);
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_dump(genl, msg, get_wpan_phy_callback_timed,
+					L_UINT_TO_PTR(generation),
+					get_wpan_phy_done)) {
+		l_error("Getting all PHY devices failed");
+		return false;
+	}
+
+	/*
+	 * A single interface dump creates new adapters and resyncs the
+	 * ones retained while nl802154 was gone.
+	 */
+	msg = l_genl_msg_new(NL802154_CMD_GET_INTERFACE);
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	if (!l_genl_family_dump(genl, msg, get_interface_callback_timed,
+					L_UINT_TO_PTR(generation),
+					get_interface_done)) {
+		l_error("Getting all interfaces failed");
+		return false;
+	}
+
+	return true;
+}
+
+static bool phy_register(void)
+{
+	wpan_pool = pool_new("wpan", sizeof(struct wpan), WPAN_MAX);
+	phy_pool = pool_new("phy", sizeof(struct phy), PHY_MAX);
+	request_pool = pool_new("phy_request", sizeof(struct phy_request),
+								REQUEST_MAX);
+	inject_call_pool = pool_new("inject_call", sizeof(struct inject_call),
+								REQUEST_MAX);
+	if (!wpan_pool || !phy_pool || !request_pool || !inject_call_pool) {
+		l_error("Memory budget too small for adapters");
+		return false;
+	}
 
 	if (!l_dbus_register_interface(dbus_get_bus(),
 				       ADAPTER_INTERFACE,
@@ -326,13 +2344,615 @@ bool phy_init(struct l_genl_family *genl, uint8_t page, uint8_t ch)
 		return false;
 	}
 
+	if (!l_dbus_register_interface(dbus_get_bus(),
+				       PHY_INTERFACE,
+				       register_phy_interface,
+				       NULL, false)) {
+		l_error("Unable to register %s interface", PHY_INTERFACE);
+		return false;
+	}
+
 	wpan_list = l_queue_new();
+	phy_list = l_queue_new();
+
+	return true;
+}
+
+bool phy_init(struct l_genl_family *genl, uint8_t page, uint8_t ch)
+{
+	default_page = page;
+	default_channel = ch;
+
+	/* Adapter objects survive nl802154 reappearing */
+	if (!wpan_list && !phy_register())
+		return false;
+
+	if (!phy_dump(genl))
+		return false;
+
 	nl802154 = genl;
 
 	return true;
 }
 
+void phy_set_adapter_watch(phy_adapter_watch_func_t func)
+{
+	adapter_watch = func;
+}
+
+void phy_set_filter(phy_filter_func_t func)
+{
+	phy_filter = func;
+}
+
+static bool wpan_match_ifindex(const void *a, const void *b)
+{
+	const struct wpan *wpan = a;
+
+	return wpan->ifindex == L_PTR_TO_UINT(b);
+}
+
+/* Control socket requests go through the same limits as D-Bus setters */
+static struct wpan *adapter_lookup(uint32_t ifindex, const char *client,
+								int *err)
+{
+	struct wpan *wpan;
+
+	wpan = l_queue_find(wpan_list, wpan_match_ifindex,
+						L_UINT_TO_PTR(ifindex));
+	if (!wpan) {
+		*err = -ENODEV;
+		return NULL;
+	}
+
+	if (client && !ratelimit_allow(client, wpan->name)) {
+		*err = -EBUSY;
+		return NULL;
+	}
+
+	return wpan;
+}
+
+int phy_adapter_get(uint32_t ifindex, struct phy_adapter *adapter)
+{
+	struct wpan *wpan;
+	int err;
+
+	wpan = adapter_lookup(ifindex, NULL, &err);
+	if (!wpan)
+		return err;
+
+	wpan_get_state(wpan, adapter);
+
+	return 0;
+}
+
+int phy_adapter_set_powered(uint32_t ifindex, const char *client,
+								bool powered)
+{
+	struct wpan *wpan;
+	int err;
+
+	wpan = adapter_lookup(ifindex, client, &err);
+	if (!wpan)
+		return err;
+
+	l_debug("'%s': control: Powered = %d", wpan->name, powered);
+
+	return wpan_set_powered(wpan, powered);
+}
+
+int phy_adapter_set_panid(uint32_t ifindex, const char *client,
+								uint16_t panid)
+{
+	struct wpan *wpan;
+	int err;
+
+	wpan = adapter_lookup(ifindex, client, &err);
+	if (!wpan)
+		return err;
+
+	l_debug("'%s': control: PanId = %d", wpan->name, panid);
+
+	return wpan_set_panid(wpan, panid);
+}
+
+int phy_adapter_set_channel(uint32_t ifindex, const char *client,
+							uint8_t channel)
+{
+	struct wpan *wpan;
+	int err;
+
+	wpan = adapter_lookup(ifindex, client, &err);
+	if (!wpan)
+		return err;
+
+	l_debug("'%s': control: Channel = %d", wpan->name, channel);
+
+	return wpan_set_channel(wpan, channel);
+}
+
+int phy_adapter_inject(uint32_t ifindex, const void *frame, size_t len,
+				phy_inject_done_func_t done, uint64_t tag,
+				void *user_data)
+{
+	struct wpan *wpan;
+	int err;
+
+	wpan = adapter_lookup(ifindex, NULL, &err);
+	if (!wpan)
+		return err;
+
+	err = wpan_inject(wpan);
+	if (err < 0)
+		return err;
+
+	return inject_submit(wpan->inject, frame, len, done, tag, user_data);
+}
+
+void phy_adapter_inject_cancel(void *user_data)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		struct wpan *wpan = entry->data;
+
+		if (wpan->inject)
+			inject_cancel(wpan->inject, user_data);
+	}
+}
+
+static uint64_t metric_powered(const struct wpan *wpan)
+{
+	return wpan->powered;
+}
+
+static uint64_t metric_available(const struct wpan *wpan)
+{
+	return !wpan->stale;
+}
+
+static uint64_t metric_panid(const struct wpan *wpan)
+{
+	return wpan->panid;
+}
+
+static uint64_t metric_channel(const struct wpan *wpan)
+{
+	const struct phy *phy = l_queue_find(phy_list, phy_match_id,
+						L_UINT_TO_PTR(wpan->phy));
+
+	return phy ? phy_channel(phy) : 0;
+}
+
+static uint64_t metric_nl_sent(const struct wpan *wpan)
+{
+	return metrics_read(&wpan->stats.nl_sent);
+}
+
+static uint64_t metric_nl_failed(const struct wpan *wpan)
+{
+	return metrics_read(&wpan->stats.nl_failed);
+}
+
+static uint64_t metric_dbus_calls(const struct wpan *wpan)
+{
+	return metrics_read(&wpan->stats.dbus_calls);
+}
+
+static uint64_t metric_dbus_errors(const struct wpan *wpan)
+{
+	return metrics_read(&wpan->stats.dbus_errors);
+}
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+	uint64_t (*value)(const struct wpan *wpan);
+} adapter_metrics[] = {
+	{ "iwpand_adapter_powered", "gauge",
+			"Adapter powered state", metric_powered },
+	{ "iwpand_adapter_available", "gauge",
+			"Adapter present in the kernel", metric_available },
+	{ "iwpand_adapter_pan_id", "gauge",
+			"Adapter PAN identifier", metric_panid },
+	{ "iwpand_adapter_channel", "gauge",
+			"Channel of the adapter PHY", metric_channel },
+	{ "iwpand_netlink_commands", "counter",
+			"nl802154 commands sent", metric_nl_sent },
+	{ "iwpand_netlink_commands_failed", "counter",
+			"nl802154 commands failed", metric_nl_failed },
+	{ "iwpand_dbus_calls", "counter",
+			"Adapter D-Bus calls", metric_dbus_calls },
+	{ "iwpand_dbus_errors", "counter",
+			"Adapter D-Bus calls answered with an error",
+			metric_dbus_errors },
+};
+
+static void hop_metrics(struct l_string *out)
+{
+	static const char * const results[] = {
+		"sent", "late", "missed", "failed",
+	};
+	const struct l_queue_entry *entry;
+	const struct phy *phy;
+	struct hop_stats stats;
+	unsigned int i;
+
+	metrics_family(out, "iwpand_phy_hops", "counter",
+				"Channel hops by PHY and outcome");
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		uint64_t values[L_ARRAY_SIZE(results)];
+
+		phy = entry->data;
+		phy_hop_stats(phy, &stats);
+
+		values[0] = stats.hops;
+		values[1] = stats.late;
+		values[2] = stats.missed;
+		values[3] = stats.failed;
+
+		for (i = 0; i < L_ARRAY_SIZE(results); i++)
+			l_string_append_printf(out, "iwpand_phy_hops_total"
+					"{phy=\"%s\",result=\"%s\"} %" PRIu64
+					"\n", phy->name, results[i], values[i]);
+	}
+
+	metrics_family(out, "iwpand_phy_hop_jitter_usec", "counter",
+				"Delay of the hops past their slot start");
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+		phy_hop_stats(phy, &stats);
+
+		l_string_append_printf(out, "iwpand_phy_hop_jitter_usec_total"
+					"{phy=\"%s\"} %" PRIu64 "\n",
+					phy->name, stats.jitter_total);
+	}
+
+	metrics_family(out, "iwpand_phy_hop_jitter_max_usec", "gauge",
+				"Largest delay of a hop past its slot start");
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+		phy_hop_stats(phy, &stats);
+
+		l_string_append_printf(out, "iwpand_phy_hop_jitter_max_usec"
+					"{phy=\"%s\"} %" PRIu64 "\n",
+					phy->name, stats.jitter_max);
+	}
+}
+
+static void survey_metrics(struct l_string *out)
+{
+	const struct l_queue_entry *entry;
+	const struct phy *phy;
+	const struct survey_channel *channel;
+	unsigned int i;
+
+	metrics_family(out, "iwpand_phy_surveys", "counter",
+				"Channel surveys completed by PHY");
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+
+		l_string_append_printf(out, "iwpand_phy_surveys_total"
+					"{phy=\"%s\"} %" PRIu64 "\n",
+					phy->name, phy->surveys);
+	}
+
+	metrics_family(out, "iwpand_phy_channel_occupancy", "gauge",
+			"Airtime ratio of each channel in the last survey");
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+
+		for (i = 0; i < phy->survey_result.count; i++) {
+			channel = &phy->survey_result.channels[i];
+			if (channel->failed)
+				continue;
+
+			l_string_append_printf(out,
+					"iwpand_phy_channel_occupancy"
+					"{phy=\"%s\",channel=\"%u\"} "
+					"%u.%04u\n", phy->name,
+					channel->channel,
+					channel->occupancy / 10000,
+					channel->occupancy % 10000);
+		}
+	}
+}
+
+static void inject_metrics(struct l_string *out)
+{
+	const struct l_queue_entry *entry;
+	const struct wpan *wpan;
+	struct inject_stats stats;
+
+	metrics_family(out, "iwpand_adapter_injected_frames", "counter",
+				"Raw frames injected by adapter and outcome");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->inject)
+			continue;
+
+		inject_get_stats(wpan->inject, &stats);
+
+		l_string_append_printf(out, "iwpand_adapter_injected_frames"
+				"_total{adapter=\"%s\",result=\"sent\"} %"
+				PRIu64 "\n" "iwpand_adapter_injected_frames"
+				"_total{adapter=\"%s\",result=\"failed\"} %"
+				PRIu64 "\n", wpan->name, stats.sent,
+				wpan->name, stats.failed);
+	}
+
+	metrics_family(out, "iwpand_adapter_inject_syscalls", "counter",
+				"sendmmsg() calls made for injected frames");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->inject)
+			continue;
+
+		inject_get_stats(wpan->inject, &stats);
+
+		l_string_append_printf(out, "iwpand_adapter_inject_syscalls"
+					"_total{adapter=\"%s\"} %" PRIu64 "\n",
+					wpan->name, stats.syscalls);
+	}
+
+	metrics_family(out, "iwpand_adapter_inject_paced", "counter",
+				"Injection batches held back by the pacing");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->inject)
+			continue;
+
+		inject_get_stats(wpan->inject, &stats);
+
+		l_string_append_printf(out, "iwpand_adapter_inject_paced"
+					"_total{adapter=\"%s\"} %" PRIu64 "\n",
+					wpan->name, stats.paced);
+	}
+}
+
+static void bridge_sample(struct l_string *out, const char *family,
+				const struct wpan *wpan, const char *label,
+				uint64_t value)
+{
+	l_string_append_printf(out, "%s_total{adapter=\"%s\"%s} %" PRIu64
+				"\n", family, wpan->name, label, value);
+}
+
+static void bridge_metrics(struct l_string *out)
+{
+	const char *frames = "iwpand_adapter_bridge_frames";
+	const char *drops = "iwpand_adapter_bridge_drops";
+	const char *stalls = "iwpand_adapter_bridge_stalls";
+	const char *submits = "iwpand_adapter_bridge_submits";
+	const struct l_queue_entry *entry;
+	const struct wpan *wpan;
+	struct bridge_stats stats;
+
+	metrics_family(out, frames, "counter",
+				"Frames moved by the bridge, by direction");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->bridge)
+			continue;
+
+		bridge_get_stats(wpan->bridge, &stats);
+		bridge_sample(out, frames, wpan, ",direction=\"to_socket\"",
+							stats.to_socket);
+		bridge_sample(out, frames, wpan, ",direction=\"to_link\"",
+							stats.to_link);
+	}
+
+	metrics_family(out, drops, "counter",
+				"Frames the bridge dropped, by reason");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->bridge)
+			continue;
+
+		bridge_get_stats(wpan->bridge, &stats);
+		bridge_sample(out, drops, wpan, ",reason=\"size\"",
+							stats.bad_size);
+		bridge_sample(out, drops, wpan, ",reason=\"send\"",
+							stats.send_failed);
+		bridge_sample(out, drops, wpan, ",reason=\"kernel\"",
+							stats.kernel_drops);
+	}
+
+	metrics_family(out, stalls, "counter",
+			"Bridge receives stopped with every buffer in flight");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->bridge)
+			continue;
+
+		bridge_get_stats(wpan->bridge, &stats);
+		bridge_sample(out, stalls, wpan, "", stats.no_buffer);
+	}
+
+	metrics_family(out, submits, "counter",
+				"io_uring_enter() calls made by the bridge");
+
+	for (entry = l_queue_get_entries(wpan_list); entry;
+						entry = entry->next) {
+		wpan = entry->data;
+		if (!wpan->bridge)
+			continue;
+
+		bridge_get_stats(wpan->bridge, &stats);
+		bridge_sample(out, submits, wpan, "", stats.submits);
+	}
+}
+
+void phy_metrics(struct l_string *out)
+{
+	const struct l_queue_entry *entry;
+	const struct wpan *wpan;
+	unsigned int i;
+	bool counter;
+
+	for (i = 0; i < L_ARRAY_SIZE(adapter_metrics); i++) {
+		metrics_family(out, adapter_metrics[i].name,
+					adapter_metrics[i].type,
+					adapter_metrics[i].help);
+
+		counter = !strcmp(adapter_metrics[i].type, "counter");
+
+		for (entry = l_queue_get_entries(wpan_list); entry;
+							entry = entry->next) {
+			wpan = entry->data;
+
+			l_string_append_printf(out,
+					"%s%s{adapter=\"%s\"} %" PRIu64 "\n",
+					adapter_metrics[i].name,
+					counter ? "_total" : "", wpan->name,
+					adapter_metrics[i].value(wpan));
+		}
+	}
+
+	hop_metrics(out);
+	survey_metrics(out);
+	inject_metrics(out);
+	bridge_metrics(out);
+}
+
+static void mark_stale(void *data, void *user_data)
+{
+	struct wpan *wpan = data;
+
+	if (wpan->stale)
+		return;
+
+	wpan->stale = true;
+
+	/* The monitor interface went away with the module */
+	if (wpan->capture) {
+		capture_stop(wpan->capture);
+		wpan->capture = NULL;
+	}
+
+	inject_free(wpan->inject);
+	wpan->inject = NULL;
+	bridge_free(wpan->bridge);
+	wpan->bridge = NULL;
+
+	if (wpan->pending) {
+		l_dbus_send(dbus_get_bus(),
+				dbus_error_not_available(wpan->pending));
+		l_dbus_message_unref(wpan->pending);
+		wpan->pending = NULL;
+	}
+
+	wpan_available_changed(wpan);
+}
+
+static void mark_phy_stale(void *data, void *user_data)
+{
+	struct phy *phy = data;
+
+	phy->stale = true;
+}
+
+/* The family, and the messages built for it, are gone */
+static void stop_hopping(void *data, void *user_data)
+{
+	struct phy *phy = data;
+
+	phy_hop_stop(phy);
+	phy_survey_stop(phy);
+}
+
+void phy_suspend(struct l_genl_family *genl)
+{
+	/*
+	 * Keep adapter objects and the user settings: nl802154 vanishes
+	 * when the kernel module is reloaded and comes back shortly.
+	 */
+	generation++;
+	nl802154 = NULL;
+
+	l_queue_foreach(wpan_list, mark_stale, NULL);
+	l_queue_foreach(phy_list, mark_phy_stale, NULL);
+	l_queue_foreach(phy_list, stop_hopping, NULL);
+}
+
+static void mark_unseen(void *data, void *user_data)
+{
+	struct wpan *wpan = data;
+
+	wpan->unseen = true;
+}
+
+static void mark_phy_unseen(void *data, void *user_data)
+{
+	struct phy *phy = data;
+
+	phy->unseen = true;
+}
+
+/*
+ * Events may have been lost: dump again without touching availability,
+ * objects missing from the dump are removed.
+ */
+void phy_resync(void)
+{
+	/* A full resync follows when nl802154 reappears */
+	if (!nl802154)
+		return;
+
+	l_info("Resyncing adapters");
+
+	generation++;
+
+	l_queue_foreach(wpan_list, mark_unseen, NULL);
+	l_queue_foreach(phy_list, mark_phy_unseen, NULL);
+
+	phy_dump(nl802154);
+}
+
 void phy_exit(struct l_genl_family *genl)
 {
-	l_queue_destroy(wpan_list, wpan_free);
+	generation++;
+	nl802154 = NULL;
+
+	l_queue_destroy(wpan_list, wpan_remove);
+	wpan_list = NULL;
+
+	l_queue_destroy(phy_list, phy_remove);
+	phy_list = NULL;
+
+	/*
+	 * The memory is returned with the budget by pool_exit(). Requests
+	 * are released when the family cancels them, after phy_exit().
+	 */
+	wpan_pool = NULL;
+	phy_pool = NULL;
+	inject_call_pool = NULL;
+
+	l_dbus_unregister_interface(dbus_get_bus(), ADAPTER_INTERFACE);
+	l_dbus_unregister_interface(dbus_get_bus(), PHY_INTERFACE);
 }
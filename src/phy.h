@@ -22,4 +22,46 @@
 
 bool phy_init(struct l_genl_family *genl, uint8_t page, uint8_t ch);
 
+void phy_suspend(struct l_genl_family *genl);
+void phy_resync(void);
 void phy_exit(struct l_genl_family *genl);
+
+/* Shard workers only manage the PHYs, and their adapters, they own */
+typedef bool (*phy_filter_func_t)(const char *name);
+
+void phy_set_filter(phy_filter_func_t func);
+
+struct l_string;
+void phy_metrics(struct l_string *out);
+
+/* Adapter state as seen by the control socket, see doc/control-api.txt */
+struct phy_adapter {
+	uint32_t ifindex;
+	bool powered;
+	bool available;
+	uint16_t panid;
+	uint8_t page;
+	uint8_t channel;
+};
+
+typedef void (*phy_adapter_watch_func_t)(const struct phy_adapter *adapter,
+								bool removed);
+
+void phy_set_adapter_watch(phy_adapter_watch_func_t func);
+
+int phy_adapter_get(uint32_t ifindex, struct phy_adapter *adapter);
+int phy_adapter_set_powered(uint32_t ifindex, const char *client,
+								bool powered);
+int phy_adapter_set_panid(uint32_t ifindex, const char *client,
+								uint16_t panid);
+int phy_adapter_set_channel(uint32_t ifindex, const char *client,
+							uint8_t channel);
+
+/* Raw frame injection, the status comes once the kernel took the frame */
+typedef void (*phy_inject_done_func_t)(int status, uint64_t tag,
+							void *user_data);
+
+int phy_adapter_inject(uint32_t ifindex, const void *frame, size_t len,
+				phy_inject_done_func_t done, uint64_t tag,
+				void *user_data);
+void phy_adapter_inject_cancel(void *user_data);
@@ -0,0 +1,204 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "metrics.h"
+#include "pool.h"
+
+#define POOL_MAX		16
+#define POOL_ALIGN		16
+
+struct pool_free {
+	struct pool_free *next;
+};
+
+struct pool {
+	const char *name;
+	size_t size;
+	unsigned int count;
+	unsigned int used;
+	uint64_t exhausted;
+	uint8_t *base;
+	struct pool_free *free;
+};
+
+/* The arena is only ever carved, pools live until pool_exit() */
+static uint8_t *arena = NULL;
+static size_t arena_size;
+static size_t arena_used;
+
+static struct pool pools[POOL_MAX];
+static unsigned int pool_num;
+
+static void *arena_carve(size_t size)
+{
+	void *ptr;
+
+	size = (size + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1);
+
+	if (size > arena_size - arena_used)
+		return NULL;
+
+	ptr = arena + arena_used;
+	arena_used += size;
+
+	return ptr;
+}
+
+struct pool *pool_new(const char *name, size_t size, unsigned int count)
+{
+	struct pool *pool;
+	unsigned int i;
+
+	if (!arena || pool_num == POOL_MAX || !count)
+		return NULL;
+
+	/* Every object must be able to hold the free list link */
+	if (size < sizeof(struct pool_free))
+		size = sizeof(struct pool_free);
+
+	size = (size + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1);
+
+	/* Asked again once its objects were all released, e.g. phy_exit() */
+	for (i = 0; i < pool_num; i++)
+		if (!strcmp(pools[i].name, name) && pools[i].size == size &&
+						pools[i].count == count)
+			return &pools[i];
+
+	if (count > (arena_size - arena_used) / size) {
+		l_error("Memory budget exhausted: pool %s needs %zu bytes, "
+				"%zu left", name, size * count,
+				arena_size - arena_used);
+		return NULL;
+	}
+
+	pool = &pools[pool_num++];
+	pool->name = name;
+	pool->size = size;
+	pool->count = count;
+	pool->base = arena_carve(size * count);
+
+	for (i = count; i > 0; i--) {
+		struct pool_free *obj = (struct pool_free *)
+					(pool->base + (i - 1) * size);
+
+		obj->next = pool->free;
+		pool->free = obj;
+	}
+
+	return pool;
+}
+
+void *pool_alloc(struct pool *pool)
+{
+	struct pool_free *obj = pool->free;
+
+	if (!obj) {
+		pool->exhausted++;
+		return NULL;
+	}
+
+	pool->free = obj->next;
+	pool->used++;
+	memset(obj, 0, pool->size);
+
+	return obj;
+}
+
+void pool_release(struct pool *pool, void *obj)
+{
+	struct pool_free *entry = obj;
+
+	if (!obj)
+		return;
+
+	entry->next = pool->free;
+	pool->free = entry;
+	pool->used--;
+}
+
+void pool_metrics(struct l_string *out)
+{
+	unsigned int i;
+
+	if (!arena)
+		return;
+
+	metrics_family(out, "iwpand_memory_budget_bytes", "gauge",
+				"Memory budget allocated at startup");
+	l_string_append_printf(out, "iwpand_memory_budget_bytes"
+				"{state=\"total\"} %zu\n"
+				"iwpand_memory_budget_bytes"
+				"{state=\"carved\"} %zu\n",
+				arena_size, arena_used);
+
+	metrics_family(out, "iwpand_pool_objects", "gauge",
+					"Pool capacity and objects in use");
+
+	for (i = 0; i < pool_num; i++)
+		l_string_append_printf(out, "iwpand_pool_objects"
+				"{pool=\"%s\",state=\"used\"} %u\n"
+				"iwpand_pool_objects"
+				"{pool=\"%s\",state=\"capacity\"} %u\n",
+				pools[i].name, pools[i].used,
+				pools[i].name, pools[i].count);
+
+	metrics_family(out, "iwpand_pool_exhausted", "counter",
+				"Allocations refused by an empty pool");
+
+	for (i = 0; i < pool_num; i++)
+		l_string_append_printf(out, "iwpand_pool_exhausted_total"
+				"{pool=\"%s\"} %" PRIu64 "\n",
+				pools[i].name, pools[i].exhausted);
+}
+
+bool pool_init(size_t budget)
+{
+	arena = l_malloc(budget);
+	arena_size = budget;
+	arena_used = 0;
+	pool_num = 0;
+
+	l_info("Memory budget: %zu bytes", budget);
+
+	return true;
+}
+
+void pool_exit(void)
+{
+	memset(pools, 0, sizeof(pools));
+	pool_num = 0;
+
+	l_free(arena);
+	arena = NULL;
+	arena_size = 0;
+	arena_used = 0;
+}
@@ -0,0 +1,38 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct l_string;
+struct pool;
+
+/*
+ * Fixed size object pools carved from one memory budget allocated at
+ * startup. pool_alloc() returns zeroed memory or NULL once the pool is
+ * exhausted, it never falls back to the heap.
+ */
+struct pool *pool_new(const char *name, size_t size, unsigned int count);
+void *pool_alloc(struct pool *pool);
+void pool_release(struct pool *pool, void *obj);
+
+void pool_metrics(struct l_string *out);
+
+bool pool_init(size_t budget);
+void pool_exit(void);
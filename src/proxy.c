@@ -0,0 +1,828 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <net/if.h>
+
+#include <ell/ell.h>
+
+#include "dbus.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+#include "shard.h"
+#include "proxy.h"
+
+/*
+ * The supervisor owns net.connman.iwpand and mirrors every Adapter and
+ * Phy object of the workers under the same path. Method calls and
+ * property writes are forwarded to the worker that currently owns the
+ * object, property reads are answered from the D-Bus client cache.
+ *
+ * Workers only ever see the supervisor as a client, so the per client
+ * rate limit is applied here. The member tables below mirror phy.c:
+ * members missing from them cannot be reached through the supervisor.
+ */
+
+#define ADAPTER_INTERFACE	"net.connman.iwpand.Adapter"
+#define PHY_INTERFACE		"net.connman.iwpand.Phy"
+
+#define PROXY_ARGS_MAX		4	/* Top level arguments of a member */
+#define PROXY_PROPERTY_MAX	9
+#define PROXY_OBJECT_MAX	(SHARD_MAX * SHARD_PHY_MAX * 2)
+#define PROXY_CALL_MAX		128
+#define OBJECT_PATH_MAX		(IFNAMSIZ + 1)	/* "/wpan0" */
+
+struct proxy_method {
+	const char *name;
+	const char *returns;
+	const char *params;
+	bool limited;		/* Counts against the client rate limit */
+	const char *args[PROXY_ARGS_MAX + 1];
+};
+
+struct proxy_property {
+	const char *name;
+	const char *type;
+	bool writable;
+};
+
+struct proxy_interface {
+	const char *name;
+	const struct proxy_method *methods;
+	unsigned int n_methods;
+	const struct proxy_property *properties;
+	unsigned int n_properties;
+};
+
+struct proxy_object {
+	char path[OBJECT_PATH_MAX];
+	const struct proxy_interface *interface;
+	struct l_dbus_proxy *proxy;
+	unsigned int shard;
+};
+
+struct proxy_call {
+	struct l_dbus_message *message;	/* Until answered */
+	const struct proxy_method *method;
+	l_dbus_property_complete_cb_t complete;
+};
+
+union proxy_value {
+	bool b;
+	uint8_t y;
+	uint16_t q;
+	uint32_t u;
+	uint64_t t;
+	const char *s;
+};
+
+static const struct proxy_method adapter_methods[] = {
+	{ "StartCapture", "", "suu", false,
+				{ "path", "size_limit", "time_limit" } },
+	{ "StopCapture", "", "", false, { } },
+	{ "GetNeighbors", "aa{sv}", "ub", false,
+				{ "neighbors", "count", "weakest" } },
+	{ "GetNeighbor", "a{sv}", "s", false, { "neighbor", "address" } },
+	{ "AddContext", "", "ysb", true,
+				{ "id", "prefix", "compression" } },
+	{ "RemoveContext", "", "y", true, { "id" } },
+	{ "ApplyRouteSet", "uu", "asa(ss)", true,
+			{ "added", "removed", "addresses", "routes" } },
+	{ "InjectFrames", "ai", "aay", true, { "status", "frames" } },
+	{ "GetContexts", "aa{sv}", "", false, { "contexts" } },
+	{ "StartBridge", "", "s", false, { "endpoint" } },
+	{ "StopBridge", "", "", false, { } },
+};
+
+static const struct proxy_property adapter_properties[] = {
+	{ "Powered", "b", true },
+	{ "FragHighThreshold", "u", true },
+	{ "FragLowThreshold", "u", true },
+	{ "FragTimeout", "u", true },
+	{ "ReassemblyFailures", "t", false },
+	{ "ReassemblyTimeouts", "t", false },
+	{ "Name", "s", false },
+	{ "PanId", "q", true },
+	{ "Available", "b", false },
+};
+
+static const struct proxy_method phy_methods[] = {
+	{ "CreateInterface", "o", "sst", false,
+				{ "path", "name", "type", "extaddr" } },
+	{ "DeleteInterface", "", "o", false, { "path" } },
+	{ "StartHopping", "", "ayu", false, { "channels", "slot" } },
+	{ "StopHopping", "", "", false, { } },
+	{ "GetHopStats", "a{sv}", "", false, { "stats" } },
+	{ "StartSurvey", "y", "ub", false, { "channel", "dwell", "apply" } },
+	{ "GetSurvey", "aa{sv}", "", false, { "channels" } },
+};
+
+static const struct proxy_property phy_properties[] = {
+	{ "Name", "s", false },
+	{ "Page", "y", false },
+	{ "Channel", "y", false },
+};
+
+static const struct proxy_interface interfaces[] = {
+	{ ADAPTER_INTERFACE, adapter_methods, L_ARRAY_SIZE(adapter_methods),
+		adapter_properties, L_ARRAY_SIZE(adapter_properties) },
+	{ PHY_INTERFACE, phy_methods, L_ARRAY_SIZE(phy_methods),
+		phy_properties, L_ARRAY_SIZE(phy_properties) },
+};
+
+static struct l_dbus_client *clients[SHARD_MAX];
+static unsigned int client_count = 0;
+static struct l_queue *object_list = NULL;
+static struct pool *object_pool = NULL;
+static struct pool *call_pool = NULL;
+static uint64_t calls_ok, calls_failed, calls_refused;
+
+static bool object_match_path(const void *a, const void *b)
+{
+	const struct proxy_object *object = a;
+
+	return !strcmp(object->path, b);
+}
+
+static const struct proxy_interface *interface_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(interfaces); i++)
+		if (!strcmp(interfaces[i].name, name))
+			return &interfaces[i];
+
+	return NULL;
+}
+
+static const struct proxy_property *property_find(
+				const struct proxy_interface *interface,
+				const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < interface->n_properties; i++)
+		if (!strcmp(interface->properties[i].name, name))
+			return &interface->properties[i];
+
+	return NULL;
+}
+
+/* Length of the single complete type at the start of sig */
+static size_t complete_type_len(const char *sig)
+{
+	size_t len = 1;
+	int depth = 0;
+
+	if (*sig == 'a')
+		return 1 + complete_type_len(sig + 1);
+
+	if (*sig != '(' && *sig != '{')
+		return 1;
+
+	do {
+		if (sig[len - 1] == '(' || sig[len - 1] == '{')
+			depth++;
+		else if (sig[len - 1] == ')' || sig[len - 1] == '}')
+			depth--;
+	} while (depth && sig[len++]);
+
+	return len;
+}
+
+static bool append_value(struct l_dbus_message_builder *builder, char type,
+						const union proxy_value *value)
+{
+	if (type == 's' || type == 'o' || type == 'g')
+		return l_dbus_message_builder_append_basic(builder, type,
+								value->s);
+
+	return l_dbus_message_builder_append_basic(builder, type, value);
+}
+
+/*
+ * Copy the arguments of from, described by sig, into to. Basic types
+ * are read into a value each, arrays are copied element by element.
+ */
+static bool copy_arguments(struct l_dbus_message *to,
+				struct l_dbus_message *from, const char *sig)
+{
+	union proxy_value values[PROXY_ARGS_MAX] = { };
+	struct l_dbus_message_iter iters[PROXY_ARGS_MAX];
+	void *args[PROXY_ARGS_MAX] = { };
+	struct l_dbus_message_builder *builder;
+	const char *types[PROXY_ARGS_MAX];
+	char element[32];
+	unsigned int count = 0;
+	unsigned int i;
+	const char *p;
+	size_t len;
+	bool ret = true;
+
+	if (!*sig)
+		return l_dbus_message_set_arguments(to, "");
+
+	for (p = sig; *p; p += complete_type_len(p)) {
+		if (count == PROXY_ARGS_MAX)
+			return false;
+
+		types[count] = p;
+		args[count] = *p == 'a' ? (void *) &iters[count] :
+						(void *) &values[count];
+		count++;
+	}
+
+	if (!l_dbus_message_get_arguments(from, sig, args[0], args[1],
+							args[2], args[3]))
+		return false;
+
+	builder = l_dbus_message_builder_new(to);
+
+	for (i = 0; i < count && ret; i++) {
+		if (*types[i] != 'a') {
+			ret = append_value(builder, *types[i], &values[i]);
+			continue;
+		}
+
+		len = complete_type_len(types[i] + 1);
+		if (len >= sizeof(element)) {
+			ret = false;
+			break;
+		}
+
+		memcpy(element, types[i] + 1, len);
+		element[len] = '\0';
+
+		ret = l_dbus_message_builder_enter_array(builder, element);
+
+		while (ret && l_dbus_message_builder_append_from_iter(builder,
+								&iters[i]));
+
+		ret = ret && l_dbus_message_builder_leave_array(builder);
+	}
+
+	ret = ret && l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return ret;
+}
+
+static void call_free(void *data)
+{
+	struct proxy_call *call = data;
+
+	/* The worker went away before answering */
+	if (call->message) {
+		struct l_dbus_message *error;
+
+		error = dbus_error_not_available(call->message);
+		calls_failed++;
+
+		if (call->complete)
+			call->complete(dbus_get_bus(), call->message, error);
+		else
+			l_dbus_send(dbus_get_bus(), error);
+
+		l_dbus_message_unref(call->message);
+	}
+
+	pool_release(call_pool, call);
+}
+
+static struct proxy_call *call_new(struct l_dbus_message *message)
+{
+	struct proxy_call *call;
+
+	if (!call_pool) {
+		call_pool = pool_new("proxy_call", sizeof(struct proxy_call),
+							PROXY_CALL_MAX);
+		if (!call_pool)
+			return NULL;
+	}
+
+	call = pool_alloc(call_pool);
+	if (!call)
+		return NULL;
+
+	memset(call, 0, sizeof(*call));
+	call->message = l_dbus_message_ref(message);
+
+	return call;
+}
+
+/* Error replies from the worker are passed on as they are */
+static struct l_dbus_message *forward_error(struct l_dbus_message *message,
+						struct l_dbus_message *result)
+{
+	const char *name, *text;
+
+	calls_failed++;
+
+	if (!l_dbus_message_get_error(result, &name, &text))
+		return dbus_error_failed(message, -EIO);
+
+	return l_dbus_message_new_error(message, name, "%s", text);
+}
+
+static void forward_setup(struct l_dbus_message *message, void *user_data)
+{
+	struct proxy_call *call = user_data;
+
+	if (!copy_arguments(message, call->message, call->method->params))
+		l_error("Unable to forward %s", call->method->name);
+}
+
+static void forward_reply(struct l_dbus_message *result, void *user_data)
+{
+	struct proxy_call *call = user_data;
+	struct l_dbus_message *reply;
+
+	if (l_dbus_message_is_error(result)) {
+		reply = forward_error(call->message, result);
+	} else {
+		reply = l_dbus_message_new_method_return(call->message);
+
+		if (copy_arguments(reply, result, call->method->returns)) {
+			calls_ok++;
+		} else {
+			l_dbus_message_unref(reply);
+			reply = dbus_error_failed(call->message,
+								-EPROTO);
+			calls_failed++;
+		}
+	}
+
+	l_dbus_send(dbus_get_bus(), reply);
+
+	l_dbus_message_unref(call->message);
+	call->message = NULL;
+}
+
+static struct l_dbus_message *forward_method(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct proxy_object *object = user_data;
+	const char *member = l_dbus_message_get_member(message);
+	const struct proxy_method *method = NULL;
+	struct proxy_call *call;
+	unsigned int i;
+
+	for (i = 0; i < object->interface->n_methods; i++)
+		if (!strcmp(object->interface->methods[i].name, member))
+			method = &object->interface->methods[i];
+
+	if (!method)
+		return dbus_error_invalid_args(message);
+
+	if (method->limited && !ratelimit_allow(
+				l_dbus_message_get_sender(message),
+				object->path + 1)) {
+		calls_refused++;
+		return dbus_error_busy(message);
+	}
+
+	call = call_new(message);
+	if (!call) {
+		calls_refused++;
+		return dbus_error_busy(message);
+	}
+
+	call->method = method;
+
+	if (!l_dbus_proxy_method_call(object->proxy, method->name,
+						forward_setup, forward_reply,
+						call, call_free)) {
+		l_dbus_message_unref(call->message);
+		pool_release(call_pool, call);
+		calls_failed++;
+		return dbus_error_not_available(message);
+	}
+
+	return NULL;
+}
+
+LATENCY_METHOD(forward_method)
+
+static void forward_set_reply(struct l_dbus_message *result, void *user_data)
+{
+	struct proxy_call *call = user_data;
+	struct l_dbus_message *error = NULL;
+
+	if (l_dbus_message_is_error(result))
+		error = forward_error(call->message, result);
+	else
+		calls_ok++;
+
+	call->complete(dbus_get_bus(), call->message, error);
+
+	l_dbus_message_unref(call->message);
+	call->message = NULL;
+}
+
+static uint32_t set_property(struct l_dbus_proxy *proxy,
+				const struct proxy_property *property,
+				const union proxy_value *value,
+				struct proxy_call *call)
+{
+	const char *name = property->name;
+	const char *type = property->type;
+
+	switch (*type) {
+	case 'b':
+		return l_dbus_proxy_set_property(proxy, forward_set_reply,
+						call, call_free, name, type,
+						value->b);
+	case 'q':
+		return l_dbus_proxy_set_property(proxy, forward_set_reply,
+						call, call_free, name, type,
+						value->q);
+	case 'u':
+		return l_dbus_proxy_set_property(proxy, forward_set_reply,
+						call, call_free, name, type,
+						value->u);
+	}
+
+	return 0;
+}
+
+static struct l_dbus_message *forward_set(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_iter *new_value,
+					l_dbus_property_complete_cb_t complete,
+					void *user_data)
+{
+	struct proxy_object *object = user_data;
+	const struct proxy_property *property;
+	struct l_dbus_message_iter variant;
+	const char *interface, *name;
+	union proxy_value value = { };
+	struct proxy_call *call;
+
+	if (!l_dbus_message_get_arguments(message, "ssv", &interface, &name,
+								&variant))
+		return dbus_error_invalid_args(message);
+
+	property = property_find(object->interface, name);
+	if (!property || !property->writable)
+		return dbus_error_invalid_args(message);
+
+	if (!l_dbus_message_iter_get_variant(new_value, property->type,
+								&value))
+		return dbus_error_invalid_args(message);
+
+	if (!ratelimit_allow(l_dbus_message_get_sender(message),
+							object->path + 1)) {
+		calls_refused++;
+		return dbus_error_busy(message);
+	}
+
+	call = call_new(message);
+	if (!call) {
+		calls_refused++;
+		return dbus_error_busy(message);
+	}
+
+	call->complete = complete;
+
+	if (!set_property(object->proxy, property, &value, call)) {
+		l_dbus_message_unref(call->message);
+		pool_release(call_pool, call);
+		calls_failed++;
+		return dbus_error_not_available(message);
+	}
+
+	return NULL;
+}
+
+LATENCY_SETTER(forward_set)
+
+static bool property_get(struct proxy_object *object, unsigned int index,
+				struct l_dbus_message_builder *builder)
+{
+	const struct proxy_property *property;
+	union proxy_value value = { };
+
+	if (index >= object->interface->n_properties)
+		return false;
+
+	property = &object->interface->properties[index];
+
+	if (!l_dbus_proxy_get_property(object->proxy, property->name,
+						property->type, &value))
+		return false;
+
+	return append_value(builder, *property->type, &value);
+}
+
+/* ELL does not tell a getter which property it serves */
+#define FORWARD_GET(n)							\
+static bool forward_get_##n(struct l_dbus *dbus,			\
+				struct l_dbus_message *msg,		\
+				struct l_dbus_message_builder *builder,	\
+				void *user_data)			\
+{									\
+	return property_get(user_data, n, builder);			\
+}									\
+									\
+LATENCY_GETTER(forward_get_##n)
+
+FORWARD_GET(0)
+FORWARD_GET(1)
+FORWARD_GET(2)
+FORWARD_GET(3)
+FORWARD_GET(4)
+FORWARD_GET(5)
+FORWARD_GET(6)
+FORWARD_GET(7)
+FORWARD_GET(8)
+
+static const l_dbus_property_get_cb_t getters[PROXY_PROPERTY_MAX] = {
+	forward_get_0_timed, forward_get_1_timed, forward_get_2_timed,
+	forward_get_3_timed, forward_get_4_timed, forward_get_5_timed,
+	forward_get_6_timed, forward_get_7_timed, forward_get_8_timed,
+};
+
+static void setup_interface(struct l_dbus_interface *interface,
+				const struct proxy_interface *table)
+{
+	const struct proxy_method *method;
+	const struct proxy_property *property;
+	unsigned int i;
+
+	for (i = 0; i < table->n_methods; i++) {
+		method = &table->methods[i];
+
+		/* ELL only reads as many names as the signatures need */
+		l_dbus_interface_method(interface, method->name, 0,
+					forward_method_timed, method->returns,
+					method->params, method->args[0],
+					method->args[1], method->args[2],
+					method->args[3]);
+	}
+
+	for (i = 0; i < table->n_properties && i < PROXY_PROPERTY_MAX; i++) {
+		property = &table->properties[i];
+
+		if (!l_dbus_interface_property(interface, property->name, 0,
+					property->type, getters[i],
+					property->writable ?
+						forward_set_timed : NULL))
+			l_error("Can't add '%s' property", property->name);
+	}
+}
+
+static void setup_adapter_interface(struct l_dbus_interface *interface)
+{
+	setup_interface(interface, &interfaces[0]);
+}
+
+static void setup_phy_interface(struct l_dbus_interface *interface)
+{
+	setup_interface(interface, &interfaces[1]);
+}
+
+static void object_changed(struct proxy_object *object)
+{
+	unsigned int i;
+
+	for (i = 0; i < object->interface->n_properties; i++)
+		l_dbus_property_changed(dbus_get_bus(), object->path,
+					object->interface->name,
+					object->interface->properties[i].name);
+}
+
+static void object_remove(struct proxy_object *object)
+{
+	l_debug("%s gone from shard %u", object->path, object->shard);
+
+	l_queue_remove(object_list, object);
+	l_dbus_unregister_object(dbus_get_bus(), object->path);
+	pool_release(object_pool, object);
+}
+
+static void proxy_added(struct l_dbus_proxy *proxy, void *user_data)
+{
+	unsigned int shard = L_PTR_TO_UINT(user_data);
+	const struct proxy_interface *interface;
+	const char *path = l_dbus_proxy_get_path(proxy);
+	struct proxy_object *object;
+
+	interface = interface_find(l_dbus_proxy_get_interface(proxy));
+	if (!interface || strlen(path) >= OBJECT_PATH_MAX)
+		return;
+
+	/*
+	 * A PHY moved to another worker: the new owner may announce the
+	 * objects before the old one has dropped them.
+	 */
+	object = l_queue_find(object_list, object_match_path, path);
+	if (object) {
+		l_debug("%s moved from shard %u to %u", path, object->shard,
+									shard);
+		object->proxy = proxy;
+		object->shard = shard;
+		object_changed(object);
+		return;
+	}
+
+	object = pool_alloc(object_pool);
+	if (!object) {
+		l_error("%s: no room for shard %u object", path, shard);
+		return;
+	}
+
+	memset(object, 0, sizeof(*object));
+	l_strlcpy(object->path, path, sizeof(object->path));
+	object->interface = interface;
+	object->proxy = proxy;
+	object->shard = shard;
+
+	l_queue_push_tail(object_list, object);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
+						interface->name, object))
+		l_error("'%s': Unable to register %s interface", path,
+							interface->name);
+
+	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
+					L_DBUS_INTERFACE_PROPERTIES, object))
+		l_error("'%s': Unable to register %s interface", path,
+						L_DBUS_INTERFACE_PROPERTIES);
+}
+
+static void proxy_removed(struct l_dbus_proxy *proxy, void *user_data)
+{
+	struct proxy_object *object;
+
+	object = l_queue_find(object_list, object_match_path,
+					l_dbus_proxy_get_path(proxy));
+	if (!object || object->proxy != proxy)
+		return;
+
+	object_remove(object);
+}
+
+static void proxy_property_changed(struct l_dbus_proxy *proxy,
+					const char *name,
+					struct l_dbus_message *msg,
+					void *user_data)
+{
+	struct proxy_object *object;
+
+	object = l_queue_find(object_list, object_match_path,
+					l_dbus_proxy_get_path(proxy));
+	if (!object || object->proxy != proxy)
+		return;
+
+	l_dbus_property_changed(dbus_get_bus(), object->path,
+					object->interface->name, name);
+}
+
+static void shard_connected(struct l_dbus *dbus, void *user_data)
+{
+	l_info("Shard %u on D-Bus", L_PTR_TO_UINT(user_data));
+}
+
+/* ELL drops the proxies without telling us about each one */
+static void shard_disconnected(struct l_dbus *dbus, void *user_data)
+{
+	unsigned int shard = L_PTR_TO_UINT(user_data);
+	const struct l_queue_entry *entry;
+	struct proxy_object *object;
+
+	l_info("Shard %u left D-Bus", shard);
+
+	entry = l_queue_get_entries(object_list);
+	while (entry) {
+		object = entry->data;
+		entry = entry->next;
+
+		if (object->shard == shard)
+			object_remove(object);
+	}
+}
+
+void proxy_metrics(struct l_string *out)
+{
+	if (!client_count)
+		return;
+
+	metrics_family(out, "iwpand_proxy_calls", "counter",
+			"Calls and property writes forwarded to workers");
+	l_string_append_printf(out, "iwpand_proxy_calls_total{result=\"ok\"}"
+						" %" PRIu64 "\n", calls_ok);
+	l_string_append_printf(out, "iwpand_proxy_calls_total"
+				"{result=\"error\"} %" PRIu64 "\n",
+				calls_failed);
+	l_string_append_printf(out, "iwpand_proxy_calls_total"
+				"{result=\"refused\"} %" PRIu64 "\n",
+				calls_refused);
+}
+
+bool proxy_init(unsigned int shards)
+{
+	char name[sizeof(SHARD_DBUS_SERVICE) + 3];
+	struct l_dbus *dbus = dbus_get_bus();
+	unsigned int i;
+
+	if (!shards || shards > SHARD_MAX)
+		return false;
+
+	object_pool = pool_new("proxy_object", sizeof(struct proxy_object),
+							PROXY_OBJECT_MAX);
+	if (!object_pool)
+		return false;
+
+	if (!l_dbus_register_interface(dbus, ADAPTER_INTERFACE,
+					setup_adapter_interface, NULL, false)) {
+		l_error("Unable to register %s interface", ADAPTER_INTERFACE);
+		return false;
+	}
+
+	if (!l_dbus_register_interface(dbus, PHY_INTERFACE,
+					setup_phy_interface, NULL, false)) {
+		l_error("Unable to register %s interface", PHY_INTERFACE);
+		return false;
+	}
+
+	object_list = l_queue_new();
+
+	for (i = 0; i < shards; i++) {
+		snprintf(name, sizeof(name), SHARD_DBUS_SERVICE "%u", i);
+
+		clients[i] = l_dbus_client_new(dbus, name, "/");
+		if (!clients[i]) {
+			l_error("Unable to watch %s", name);
+			return false;
+		}
+
+		client_count = i + 1;
+
+		l_dbus_client_set_connect_handler(clients[i], shard_connected,
+						L_UINT_TO_PTR(i), NULL);
+		l_dbus_client_set_disconnect_handler(clients[i],
+						shard_disconnected,
+						L_UINT_TO_PTR(i), NULL);
+		l_dbus_client_set_proxy_handlers(clients[i], proxy_added,
+						proxy_removed,
+						proxy_property_changed,
+						L_UINT_TO_PTR(i), NULL);
+	}
+
+	return true;
+}
+
+static void object_free(void *data)
+{
+	struct proxy_object *object = data;
+
+	l_dbus_unregister_object(dbus_get_bus(), object->path);
+	pool_release(object_pool, object);
+}
+
+void proxy_exit(void)
+{
+	unsigned int i;
+
+	/* Pending calls are answered from call_free */
+	for (i = 0; i < client_count; i++)
+		l_dbus_client_destroy(clients[i]);
+
+	client_count = 0;
+
+	l_queue_destroy(object_list, object_free);
+	object_list = NULL;
+
+	l_dbus_unregister_interface(dbus_get_bus(), ADAPTER_INTERFACE);
+	l_dbus_unregister_interface(dbus_get_bus(), PHY_INTERFACE);
+}
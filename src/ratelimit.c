@@ -0,0 +1,300 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <net/if.h>
+
+#include <ell/ell.h>
+
+#include "metrics.h"
+#include "ratelimit.h"
+#include "pool.h"
+
+/*
+ * Token buckets guarding the Adapter setters: one per (sender, adapter)
+ * pair so that a single client cannot starve the others, and one per
+ * adapter bounding the total netlink load put on a PHY. Tokens are kept
+ * in thousandths to avoid floating point.
+ */
+
+#define TOKEN_SCALE		1000
+#define SWEEP_INTERVAL		60	/* seconds */
+#define BUCKET_MAX		256
+#define SENDER_MAX		32	/* Unique names: ":1.4242" */
+
+struct limit {
+	uint32_t rate;		/* tokens per second, 0: unlimited */
+	uint32_t burst;
+};
+
+struct bucket {
+	uint64_t tokens;	/* x TOKEN_SCALE */
+	uint64_t last;		/* usec */
+	uint64_t allowed;
+	uint64_t throttled;
+	bool reported;
+	bool client;		/* Otherwise the adapter bucket */
+	char key[SENDER_MAX + 1 + IFNAMSIZ];	/* "sender adapter" */
+	const char *adapter;	/* Points into key */
+};
+
+static struct limit client_limit;
+static struct limit adapter_limit;
+
+static struct l_hashmap *buckets = NULL;	/* Keys live in the bucket */
+static struct pool *bucket_pool = NULL;
+static struct l_timeout *sweep_timeout = NULL;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bucket_free(void *data)
+{
+	pool_release(bucket_pool, data);
+}
+
+static struct bucket *bucket_get(const char *sender, const char *adapter,
+						const struct limit *limit)
+{
+	struct bucket *bucket;
+	char key[sizeof(bucket->key)];
+	int len;
+
+	len = snprintf(key, sizeof(key), "%.*s %s", SENDER_MAX,
+					sender ? : "*", adapter);
+	if (len < 0 || (size_t) len >= sizeof(key))
+		return NULL;
+
+	bucket = l_hashmap_lookup(buckets, key);
+	if (bucket)
+		return bucket;
+
+	/* Out of buckets: the client is only held by the adapter limit */
+	bucket = pool_alloc(bucket_pool);
+	if (!bucket)
+		return NULL;
+
+	bucket->tokens = (uint64_t) limit->burst * TOKEN_SCALE;
+	bucket->last = now_usec();
+	bucket->client = sender;
+	memcpy(bucket->key, key, len + 1);
+	bucket->adapter = bucket->key + len - strlen(adapter);
+
+	l_hashmap_insert(buckets, bucket->key, bucket);
+
+	return bucket;
+}
+
+static void bucket_refill(struct bucket *bucket, const struct limit *limit,
+								uint64_t now)
+{
+	uint64_t max = (uint64_t) limit->burst * TOKEN_SCALE;
+
+	bucket->tokens += (now - bucket->last) * limit->rate *
+						TOKEN_SCALE / 1000000;
+	if (bucket->tokens > max)
+		bucket->tokens = max;
+
+	bucket->last = now;
+}
+
+static bool bucket_take(struct bucket *bucket, const struct limit *limit,
+								uint64_t now)
+{
+	bucket_refill(bucket, limit, now);
+
+	if (bucket->tokens < TOKEN_SCALE) {
+		bucket->throttled++;
+
+		if (!bucket->reported && bucket->client)
+			l_warn("Throttling %.*s on %s", (int) (bucket->adapter -
+					bucket->key - 1), bucket->key,
+					bucket->adapter);
+		else if (!bucket->reported)
+			l_warn("Throttling all clients on %s",
+					bucket->adapter);
+
+		bucket->reported = true;
+
+		return false;
+	}
+
+	bucket->tokens -= TOKEN_SCALE;
+	bucket->allowed++;
+
+	return true;
+}
+
+bool ratelimit_allow(const char *sender, const char *adapter)
+{
+	struct bucket *client = NULL, *total = NULL;
+	uint64_t now = now_usec();
+
+	if (!buckets)
+		return true;
+
+	if (client_limit.rate)
+		client = bucket_get(sender, adapter, &client_limit);
+
+	if (adapter_limit.rate)
+		total = bucket_get(NULL, adapter, &adapter_limit);
+
+	if (client && !bucket_take(client, &client_limit, now))
+		return false;
+
+	/* Refund the client token: the call is rejected anyway */
+	if (total && !bucket_take(total, &adapter_limit, now)) {
+		if (client)
+			client->tokens += TOKEN_SCALE;
+
+		return false;
+	}
+
+	return true;
+}
+
+static void append_bucket(const void *key, void *value, void *user_data)
+{
+	const struct bucket *bucket = value;
+	struct l_string *out = user_data;
+
+	l_string_append_printf(out, "iwpand_ratelimit_throttled_total"
+				"{sender=\"%.*s\",adapter=\"%s\"} %" PRIu64
+				"\n", (int) (bucket->adapter - bucket->key - 1),
+				bucket->key, bucket->adapter,
+				bucket->throttled);
+}
+
+void ratelimit_metrics(struct l_string *out)
+{
+	if (!buckets)
+		return;
+
+	metrics_family(out, "iwpand_ratelimit_throttled", "counter",
+			"Adapter setter calls rejected as Busy, sender * "
+			"is the per adapter limit");
+	l_hashmap_foreach(buckets, append_bucket, out);
+}
+
+/* Forget idle buckets that refilled completely: they carry no state */
+static bool sweep_bucket(const void *key, void *value, void *user_data)
+{
+	struct bucket *bucket = value;
+	const struct limit *limit = bucket->client ? &client_limit :
+							&adapter_limit;
+	uint64_t now = *((uint64_t *) user_data);
+
+	bucket_refill(bucket, limit, now);
+	bucket->reported = false;
+
+	if (bucket->tokens < (uint64_t) limit->burst * TOKEN_SCALE)
+		return false;
+
+	bucket_free(bucket);
+
+	return true;
+}
+
+static void sweep_expired(struct l_timeout *timeout, void *user_data)
+{
+	uint64_t now = now_usec();
+
+	l_hashmap_foreach_remove(buckets, sweep_bucket, &now);
+	l_timeout_modify(timeout, SWEEP_INTERVAL);
+}
+
+bool ratelimit_parse(const char *str, uint32_t *rate, uint32_t *burst)
+{
+	unsigned int r, b;
+	char c;
+
+	switch (sscanf(str, "%u/%u%c", &r, &b, &c)) {
+	case 1:
+		b = r;
+		break;
+	case 2:
+		break;
+	default:
+		return false;
+	}
+
+	if (r && !b)
+		return false;
+
+	*rate = r;
+	*burst = b;
+
+	return true;
+}
+
+bool ratelimit_init(uint32_t client_rate, uint32_t client_burst,
+			uint32_t adapter_rate, uint32_t adapter_burst)
+{
+	client_limit.rate = client_rate;
+	client_limit.burst = client_burst;
+	adapter_limit.rate = adapter_rate;
+	adapter_limit.burst = adapter_burst;
+
+	if (!client_rate && !adapter_rate)
+		return true;
+
+	l_info("Rate limit: %u/%u per client, %u/%u per adapter",
+				client_rate, client_burst,
+				adapter_rate, adapter_burst);
+
+	bucket_pool = pool_new("ratelimit_bucket", sizeof(struct bucket),
+								BUCKET_MAX);
+	if (!bucket_pool)
+		return false;
+
+	buckets = l_hashmap_new();
+	l_hashmap_set_hash_function(buckets, l_str_hash);
+	l_hashmap_set_compare_function(buckets,
+				(l_hashmap_compare_func_t) strcmp);
+	sweep_timeout = l_timeout_create(SWEEP_INTERVAL, sweep_expired,
+								NULL, NULL);
+
+	return true;
+}
+
+void ratelimit_exit(void)
+{
+	l_timeout_remove(sweep_timeout);
+	sweep_timeout = NULL;
+
+	l_hashmap_destroy(buckets, bucket_free);
+	buckets = NULL;
+	bucket_pool = NULL;
+}
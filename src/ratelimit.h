@@ -0,0 +1,32 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct l_string;
+
+bool ratelimit_parse(const char *str, uint32_t *rate, uint32_t *burst);
+
+bool ratelimit_allow(const char *sender, const char *adapter);
+void ratelimit_metrics(struct l_string *out);
+
+bool ratelimit_init(uint32_t client_rate, uint32_t client_burst,
+			uint32_t adapter_rate, uint32_t adapter_burst);
+void ratelimit_exit(void);
@@ -0,0 +1,690 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <ell/ell.h>
+
+#include "lowpan.h"
+#include "metrics.h"
+#include "route.h"
+
+#define ROUTE_SET_MAX		4096	/* Entries of each kind */
+#define ROUTE_WINDOW		64	/* Requests waiting for their ack */
+#define ROUTE_BATCH		32	/* Requests per sendmsg() */
+#define ROUTE_RESTART_MAX	3	/* Replies lost to an overrun */
+
+enum route_phase {
+	ROUTE_PHASE_ADDRESSES,		/* RTM_GETADDR dump */
+	ROUTE_PHASE_ROUTES,		/* RTM_GETROUTE dump */
+	ROUTE_PHASE_INSTALL,
+};
+
+struct route_op {
+	uint16_t type;			/* RTM_NEWADDR ... RTM_DELROUTE */
+	union {
+		struct route_address address;
+		struct route_entry route;
+	};
+};
+
+struct route_msg {
+	struct nlmsghdr hdr;
+	union {
+		struct ifaddrmsg ifa;
+		struct rtmsg rtm;
+	};
+	uint8_t attrs[2 * RTA_SPACE(sizeof(struct in6_addr)) +
+					RTA_SPACE(sizeof(uint32_t))];
+};
+
+struct route_txn {
+	uint32_t ifindex;
+	struct route_set *set;
+	bool *address_found;
+	bool *route_found;
+	enum route_phase phase;
+	uint32_t dump_seq;
+	bool dump_intr;
+	struct route_op *ops;
+	unsigned int op_count;
+	unsigned int op_alloc;
+	uint32_t seq_first;		/* ops[i] is sent with seq_first + i */
+	unsigned int sent;
+	unsigned int acked;
+	unsigned int added;
+	unsigned int removed;
+	unsigned int restarts;
+	int err;
+	route_done_func_t done;
+	void *user_data;
+};
+
+/* One change at a time: the diff must see the previous one applied */
+static struct route_txn *txn = NULL;
+
+static struct route_msg batch[ROUTE_BATCH];
+static struct iovec batch_iov[ROUTE_BATCH];
+
+static uint64_t applies_ok;
+static uint64_t applies_failed;
+static uint64_t requests[4];		/* See request_index() */
+static uint64_t sendmsg_calls;
+
+static const char * const request_names[] = {
+	"newaddr", "deladdr", "newroute", "delroute",
+};
+
+static unsigned int request_index(uint16_t type)
+{
+	switch (type) {
+	case RTM_NEWADDR:
+		return 0;
+	case RTM_DELADDR:
+		return 1;
+	case RTM_NEWROUTE:
+		return 2;
+	}
+
+	return 3;
+}
+
+static int address_cmp(const void *a, const void *b)
+{
+	const struct route_address *x = a;
+	const struct route_address *y = b;
+	int r = memcmp(&x->addr, &y->addr, sizeof(x->addr));
+
+	return r ? r : x->plen - y->plen;
+}
+
+static int route_cmp(const void *a, const void *b)
+{
+	const struct route_entry *x = a;
+	const struct route_entry *y = b;
+	int r = memcmp(&x->dst, &y->dst, sizeof(x->dst));
+
+	if (r)
+		return r;
+
+	if (x->plen != y->plen)
+		return x->plen - y->plen;
+
+	if (x->onlink != y->onlink)
+		return x->onlink - y->onlink;
+
+	if (x->onlink)
+		return 0;
+
+	return memcmp(&x->gateway, &y->gateway, sizeof(x->gateway));
+}
+
+static bool parse_prefix(const char *str, struct in6_addr *addr,
+							uint8_t *plen)
+{
+	char buf[INET6_ADDRSTRLEN];
+	const char *slash = strchr(str, '/');
+	unsigned long len = 128;
+	char *end;
+
+	if (slash) {
+		if (slash - str >= (int) sizeof(buf))
+			return false;
+
+		memcpy(buf, str, slash - str);
+		buf[slash - str] = '\0';
+		str = buf;
+
+		errno = 0;
+		len = strtoul(slash + 1, &end, 10);
+		if (errno || end == slash + 1 || *end || len > 128)
+			return false;
+	}
+
+	if (inet_pton(AF_INET6, str, addr) != 1)
+		return false;
+
+	*plen = len;
+
+	return true;
+}
+
+/* "2001:db8::1/64" */
+bool route_parse_address(const char *str, struct route_address *address)
+{
+	memset(address, 0, sizeof(*address));
+
+	return parse_prefix(str, &address->addr, &address->plen);
+}
+
+/* "2001:db8::5/128" or "2001:db8:1::/48" via "fe80::1", "" if on link */
+bool route_parse_route(const char *dst, const char *gateway,
+						struct route_entry *route)
+{
+	memset(route, 0, sizeof(*route));
+
+	if (!parse_prefix(dst, &route->dst, &route->plen))
+		return false;
+
+	if (!gateway[0]) {
+		route->onlink = true;
+		return true;
+	}
+
+	return inet_pton(AF_INET6, gateway, &route->gateway) == 1;
+}
+
+struct route_set *route_set_new(unsigned int addresses, unsigned int routes)
+{
+	struct route_set *set;
+
+	if (addresses > ROUTE_SET_MAX || routes > ROUTE_SET_MAX)
+		return NULL;
+
+	set = l_new(struct route_set, 1);
+	set->addresses = l_new(struct route_address, addresses);
+	set->address_count = addresses;
+	set->routes = l_new(struct route_entry, routes);
+	set->route_count = routes;
+
+	return set;
+}
+
+void route_set_free(struct route_set *set)
+{
+	if (!set)
+		return;
+
+	l_free(set->addresses);
+	l_free(set->routes);
+	l_free(set);
+}
+
+static void txn_finish(int err)
+{
+	struct route_txn *t = txn;
+
+	txn = NULL;
+
+	if (!err)
+		err = t->err;
+
+	metrics_inc(err ? &applies_failed : &applies_ok);
+
+	l_info("route: ifindex %u: %u added, %u removed: %s", t->ifindex,
+			t->added, t->removed, err ? strerror(-err) : "done");
+
+	t->done(err, t->added, t->removed, t->user_data);
+
+	route_set_free(t->set);
+	l_free(t->address_found);
+	l_free(t->route_found);
+	l_free(t->ops);
+	l_free(t);
+}
+
+static struct route_op *op_new(uint16_t type)
+{
+	if (txn->op_count == txn->op_alloc) {
+		txn->op_alloc = txn->op_alloc ? txn->op_alloc * 2 : 64;
+		txn->ops = l_realloc(txn->ops,
+				txn->op_alloc * sizeof(struct route_op));
+	}
+
+	txn->ops[txn->op_count].type = type;
+
+	return &txn->ops[txn->op_count++];
+}
+
+static void dump_start(uint16_t type)
+{
+	txn->dump_seq = lowpan_rtnl_seq(1);
+	txn->dump_intr = false;
+
+	if (!lowpan_rtnl_dump(type, txn->dump_seq))
+		txn_finish(-EBUSY);
+}
+
+static void txn_restart(void)
+{
+	txn->phase = ROUTE_PHASE_ADDRESSES;
+	txn->op_count = 0;
+	txn->sent = 0;
+	txn->acked = 0;
+	txn->err = 0;
+
+	memset(txn->address_found, 0,
+				txn->set->address_count * sizeof(bool));
+	memset(txn->route_found, 0, txn->set->route_count * sizeof(bool));
+
+	dump_start(RTM_GETADDR);
+}
+
+static void address_seen(const struct nlmsghdr *nlh)
+{
+	const struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	const struct rtattr *rta;
+	struct route_address address;
+	const struct route_address *found;
+	int len = NLMSG_PAYLOAD(nlh, sizeof(*ifa));
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)) ||
+			ifa->ifa_family != AF_INET6 ||
+			ifa->ifa_index != txn->ifindex)
+		return;
+
+	/* Link local addresses belong to the kernel */
+	if (ifa->ifa_scope == RT_SCOPE_LINK)
+		return;
+
+	memset(&address, 0, sizeof(address));
+	address.plen = ifa->ifa_prefixlen;
+
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == IFA_ADDRESS &&
+				RTA_PAYLOAD(rta) == sizeof(address.addr))
+			memcpy(&address.addr, RTA_DATA(rta),
+						sizeof(address.addr));
+
+	found = bsearch(&address, txn->set->addresses,
+				txn->set->address_count,
+				sizeof(address), address_cmp);
+	if (found) {
+		txn->address_found[found - txn->set->addresses] = true;
+		return;
+	}
+
+	op_new(RTM_DELADDR)->address = address;
+}
+
+static void route_seen(const struct nlmsghdr *nlh)
+{
+	const struct rtmsg *rtm = NLMSG_DATA(nlh);
+	const struct rtattr *rta;
+	struct route_entry route;
+	const struct route_entry *found;
+	uint32_t table, oif = 0;
+	int len = NLMSG_PAYLOAD(nlh, sizeof(*rtm));
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm)) ||
+			rtm->rtm_family != AF_INET6 ||
+			rtm->rtm_protocol != ROUTE_PROTOCOL ||
+			rtm->rtm_type != RTN_UNICAST)
+		return;
+
+	memset(&route, 0, sizeof(route));
+	route.plen = rtm->rtm_dst_len;
+	route.onlink = true;
+	table = rtm->rtm_table;
+
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_DST:
+			if (RTA_PAYLOAD(rta) == sizeof(route.dst))
+				memcpy(&route.dst, RTA_DATA(rta),
+							sizeof(route.dst));
+			break;
+		case RTA_GATEWAY:
+			if (RTA_PAYLOAD(rta) == sizeof(route.gateway)) {
+				memcpy(&route.gateway, RTA_DATA(rta),
+						sizeof(route.gateway));
+				route.onlink = false;
+			}
+			break;
+		case RTA_OIF:
+			if (RTA_PAYLOAD(rta) == sizeof(oif))
+				memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+			break;
+		case RTA_TABLE:
+			if (RTA_PAYLOAD(rta) == sizeof(table))
+				memcpy(&table, RTA_DATA(rta), sizeof(table));
+			break;
+		}
+	}
+
+	if (table != RT_TABLE_MAIN || oif != txn->ifindex)
+		return;
+
+	found = bsearch(&route, txn->set->routes, txn->set->route_count,
+						sizeof(route), route_cmp);
+	if (found) {
+		txn->route_found[found - txn->set->routes] = true;
+		return;
+	}
+
+	op_new(RTM_DELROUTE)->route = route;
+}
+
+static void append_attr(struct route_msg *msg, uint16_t type,
+					const void *data, size_t size)
+{
+	struct rtattr *rta = (struct rtattr *) ((uint8_t *) msg +
+					NLMSG_ALIGN(msg->hdr.nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(size);
+	memcpy(RTA_DATA(rta), data, size);
+
+	msg->hdr.nlmsg_len = NLMSG_ALIGN(msg->hdr.nlmsg_len) +
+						RTA_ALIGN(rta->rta_len);
+}
+
+static void op_build(const struct route_op *op, uint32_t seq,
+						struct route_msg *msg)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->hdr.nlmsg_type = op->type;
+	msg->hdr.nlmsg_seq = seq;
+	msg->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+
+	/* Replace, not create: a repeated install converges */
+	if (op->type == RTM_NEWADDR || op->type == RTM_NEWROUTE)
+		msg->hdr.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+
+	switch (op->type) {
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		msg->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(msg->ifa));
+		msg->ifa.ifa_family = AF_INET6;
+		msg->ifa.ifa_prefixlen = op->address.plen;
+		msg->ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+		msg->ifa.ifa_index = txn->ifindex;
+		append_attr(msg, IFA_ADDRESS, &op->address.addr,
+					sizeof(op->address.addr));
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		msg->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(msg->rtm));
+		msg->rtm.rtm_family = AF_INET6;
+		msg->rtm.rtm_dst_len = op->route.plen;
+		msg->rtm.rtm_table = RT_TABLE_MAIN;
+		msg->rtm.rtm_protocol = ROUTE_PROTOCOL;
+		msg->rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+		msg->rtm.rtm_type = RTN_UNICAST;
+		append_attr(msg, RTA_DST, &op->route.dst,
+					sizeof(op->route.dst));
+		append_attr(msg, RTA_OIF, &txn->ifindex,
+					sizeof(txn->ifindex));
+
+		if (!op->route.onlink)
+			append_attr(msg, RTA_GATEWAY, &op->route.gateway,
+						sizeof(op->route.gateway));
+		break;
+	}
+}
+
+/* Up to ROUTE_WINDOW requests unacked, ROUTE_BATCH per sendmsg() */
+static void install_send(void)
+{
+	unsigned int n, count, window;
+	int err;
+
+	while (txn->sent < txn->op_count &&
+			txn->sent - txn->acked < ROUTE_WINDOW) {
+		count = txn->op_count - txn->sent;
+		window = ROUTE_WINDOW - (txn->sent - txn->acked);
+
+		if (count > window)
+			count = window;
+
+		if (count > ROUTE_BATCH)
+			count = ROUTE_BATCH;
+
+		for (n = 0; n < count; n++) {
+			op_build(&txn->ops[txn->sent + n],
+					txn->seq_first + txn->sent + n,
+					&batch[n]);
+			batch_iov[n].iov_base = &batch[n];
+			batch_iov[n].iov_len = batch[n].hdr.nlmsg_len;
+			metrics_inc(&requests[request_index(
+						batch[n].hdr.nlmsg_type)]);
+		}
+
+		err = lowpan_rtnl_send(batch_iov, n);
+		if (err < 0) {
+			txn_finish(err);
+			return;
+		}
+
+		metrics_inc(&sendmsg_calls);
+		txn->sent += n;
+	}
+
+	if (txn->acked == txn->op_count)
+		txn_finish(0);
+}
+
+static void install_start(void)
+{
+	unsigned int deletes = txn->op_count;
+	struct route_op *dels = txn->ops;
+	unsigned int i;
+
+	txn->ops = NULL;
+	txn->op_count = 0;
+	txn->op_alloc = 0;
+
+	/* Prefixes first: routes through a gateway need it on link */
+	for (i = 0; i < txn->set->address_count; i++)
+		if (!txn->address_found[i])
+			op_new(RTM_NEWADDR)->address = txn->set->addresses[i];
+
+	for (i = 0; i < txn->set->route_count; i++)
+		if (!txn->route_found[i])
+			op_new(RTM_NEWROUTE)->route = txn->set->routes[i];
+
+	for (i = 0; i < deletes; i++)
+		if (dels[i].type == RTM_DELROUTE)
+			*op_new(RTM_DELROUTE) = dels[i];
+
+	for (i = 0; i < deletes; i++)
+		if (dels[i].type == RTM_DELADDR)
+			*op_new(RTM_DELADDR) = dels[i];
+
+	l_free(dels);
+
+	txn->phase = ROUTE_PHASE_INSTALL;
+	txn->seq_first = lowpan_rtnl_seq(txn->op_count);
+
+	install_send();
+}
+
+static void dump_reply(const struct nlmsghdr *nlh)
+{
+	const struct nlmsgerr *err;
+
+	if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+		txn->dump_intr = true;
+
+	switch (nlh->nlmsg_type) {
+	case NLMSG_ERROR:
+		err = NLMSG_DATA(nlh);
+		txn_finish(err->error ? err->error : -EIO);
+		break;
+	case NLMSG_DONE:
+		/* Changed while dumping: the diff could be wrong */
+		if (txn->dump_intr) {
+			txn_restart();
+			break;
+		}
+
+		if (txn->phase == ROUTE_PHASE_ADDRESSES) {
+			txn->phase = ROUTE_PHASE_ROUTES;
+			dump_start(RTM_GETROUTE);
+			break;
+		}
+
+		install_start();
+		break;
+	case RTM_NEWADDR:
+		if (txn->phase == ROUTE_PHASE_ADDRESSES)
+			address_seen(nlh);
+		break;
+	case RTM_NEWROUTE:
+		if (txn->phase == ROUTE_PHASE_ROUTES)
+			route_seen(nlh);
+		break;
+	}
+}
+
+static void install_ack(const struct nlmsghdr *nlh)
+{
+	const struct nlmsgerr *err = NLMSG_DATA(nlh);
+	const struct route_op *op;
+	uint32_t index = nlh->nlmsg_seq - txn->seq_first;
+
+	if (nlh->nlmsg_type != NLMSG_ERROR || index >= txn->sent)
+		return;
+
+	op = &txn->ops[index];
+	txn->acked++;
+
+	switch (err->error) {
+	case 0:
+		if (op->type == RTM_NEWADDR || op->type == RTM_NEWROUTE)
+			txn->added++;
+		else
+			txn->removed++;
+		break;
+	case -ENOENT:
+	case -ESRCH:
+	case -EADDRNOTAVAIL:
+		/* Deleted meanwhile */
+		if (op->type == RTM_DELADDR || op->type == RTM_DELROUTE)
+			break;
+
+		/* fall through */
+	default:
+		l_error("route: request %u (type %u): %s", index, op->type,
+						strerror(-err->error));
+		if (!txn->err)
+			txn->err = err->error;
+		break;
+	}
+
+	install_send();
+}
+
+static void rtnl_reply(const struct nlmsghdr *nlh, int err, void *user_data)
+{
+	if (!txn)
+		return;
+
+	/* Lost replies: the diff is idempotent, start over */
+	if (!nlh && err == -ENOBUFS &&
+				txn->restarts++ < ROUTE_RESTART_MAX) {
+		l_warn("route: replies lost, restarting");
+		txn_restart();
+		return;
+	}
+
+	if (!nlh) {
+		txn_finish(err);
+		return;
+	}
+
+	if (txn->phase == ROUTE_PHASE_INSTALL)
+		install_ack(nlh);
+	else if (nlh->nlmsg_seq == txn->dump_seq)
+		dump_reply(nlh);
+}
+
+/* Takes ownership of set */
+int route_apply(uint32_t ifindex, struct route_set *set,
+				route_done_func_t done, void *user_data)
+{
+	if (txn) {
+		route_set_free(set);
+		return -EBUSY;
+	}
+
+	qsort(set->addresses, set->address_count,
+				sizeof(struct route_address), address_cmp);
+	qsort(set->routes, set->route_count, sizeof(struct route_entry),
+								route_cmp);
+
+	txn = l_new(struct route_txn, 1);
+	txn->ifindex = ifindex;
+	txn->set = set;
+	txn->address_found = l_new(bool, set->address_count);
+	txn->route_found = l_new(bool, set->route_count);
+	txn->done = done;
+	txn->user_data = user_data;
+
+	txn_restart();
+
+	return 0;
+}
+
+void route_metrics(struct l_string *out)
+{
+	unsigned int i;
+
+	metrics_family(out, "iwpand_route_applies", "counter",
+					"Route and address sets applied");
+	l_string_append_printf(out, "iwpand_route_applies_total"
+				"{result=\"ok\"} %" PRIu64 "\n"
+				"iwpand_route_applies_total"
+				"{result=\"failed\"} %" PRIu64 "\n",
+				metrics_read(&applies_ok),
+				metrics_read(&applies_failed));
+
+	metrics_family(out, "iwpand_route_requests", "counter",
+					"rtnl requests sent to apply sets");
+
+	for (i = 0; i < L_ARRAY_SIZE(requests); i++)
+		l_string_append_printf(out, "iwpand_route_requests_total"
+					"{type=\"%s\"} %" PRIu64 "\n",
+					request_names[i],
+					metrics_read(&requests[i]));
+
+	metrics_family(out, "iwpand_route_sendmsg", "counter",
+				"sendmsg() calls carrying route requests");
+	l_string_append_printf(out, "iwpand_route_sendmsg_total %" PRIu64
+					"\n", metrics_read(&sendmsg_calls));
+}
+
+void route_init(void)
+{
+	lowpan_rtnl_register(rtnl_reply, NULL);
+}
+
+void route_exit(void)
+{
+	if (txn)
+		txn_finish(-ECANCELED);
+
+	lowpan_rtnl_register(NULL, NULL);
+}
@@ -0,0 +1,67 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <netinet/in.h>
+
+/*
+ * rtm_protocol of the routes the daemon owns, unused by the kernel and
+ * the routing daemons registered in iproute2's rt_protos
+ */
+#define ROUTE_PROTOCOL		154
+
+struct route_address {
+	struct in6_addr addr;
+	uint8_t plen;
+};
+
+struct route_entry {
+	struct in6_addr dst;
+	uint8_t plen;
+	bool onlink;			/* No gateway */
+	struct in6_addr gateway;
+};
+
+struct route_set {
+	struct route_address *addresses;
+	unsigned int address_count;
+	struct route_entry *routes;
+	unsigned int route_count;
+};
+
+typedef void (*route_done_func_t)(int err, unsigned int added,
+					unsigned int removed, void *user_data);
+
+bool route_parse_address(const char *str, struct route_address *address);
+bool route_parse_route(const char *dst, const char *gateway,
+						struct route_entry *route);
+
+struct route_set *route_set_new(unsigned int addresses, unsigned int routes);
+void route_set_free(struct route_set *set);
+
+int route_apply(uint32_t ifindex, struct route_set *set,
+				route_done_func_t done, void *user_data);
+
+struct l_string;
+void route_metrics(struct l_string *out);
+
+void route_init(void);
+void route_exit(void);
@@ -0,0 +1,771 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <ell/ell.h>
+
+#include "nl802154.h"
+#include "nlattr.h"
+#include "phy.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+#include "shard.h"
+
+/*
+ * With --shards, iwpand supervises worker processes that each run the
+ * usual event loop over a group of PHYs: a stuck dump or a busy PHY
+ * only stalls its own group. The supervisor dumps the PHYs, gives each
+ * new one to the least loaded worker and sends every worker its list
+ * over a socket pair inherited as SHARD_FD. Workers own a D-Bus name of
+ * their own; proxy.c presents their objects as net.connman.iwpand.
+ *
+ * PHYs stay where they are unless the workers drift more than one PHY
+ * apart: moving a PHY recreates its objects in the other worker.
+ */
+
+#define SHARD_PHY_TOTAL		(SHARD_MAX * SHARD_PHY_MAX)
+#define SHARD_NONE		UINT_MAX
+#define SHARD_SCAN_DELAY	200	/* msec: link events come in bursts */
+#define SHARD_RESTART_DELAY	1	/* sec */
+
+/* Supervisor to worker: the complete list of PHYs it owns */
+struct shard_assign {
+	uint32_t count;
+	char names[SHARD_PHY_MAX][IFNAMSIZ];
+};
+
+struct shard {
+	unsigned int index;
+	pid_t pid;
+	int fd;			/* Supervisor end of the socket pair */
+	int cpu;
+	unsigned int phys;
+	bool dirty;		/* PHY list not sent yet */
+	struct l_timeout *restart;
+	uint64_t restarts;
+};
+
+struct shard_phy {
+	char name[IFNAMSIZ];
+	unsigned int shard;
+	bool seen;		/* By the last dump */
+};
+
+static struct shard shards[SHARD_MAX];
+static unsigned int shard_count = 0;
+static char **shard_argv = NULL;	/* argv + "--shard" <index> */
+static unsigned int shard_argc;
+static bool stopping = false;
+
+static struct l_queue *phy_list = NULL;
+static struct pool *phy_pool = NULL;
+static uint64_t moves;
+
+static struct l_genl_family *nl802154 = NULL;
+static unsigned int generation = 0;
+static unsigned int dump_id = 0;
+static bool rescan = false;
+static struct l_timeout *scan_timeout = NULL;
+static struct l_io *rtnl_io = NULL;
+
+/* Worker side */
+static struct l_io *worker_io = NULL;
+static unsigned int worker_index;
+static struct shard_assign owned;
+
+static void phy_free(void *data)
+{
+	pool_release(phy_pool, data);
+}
+
+static bool phy_match_name(const void *a, const void *b)
+{
+	const struct shard_phy *phy = a;
+
+	return !strcmp(phy->name, b);
+}
+
+static bool phy_match_unseen(const void *a, const void *b)
+{
+	const struct shard_phy *phy = a;
+
+	return !phy->seen;
+}
+
+static void shard_send(struct shard *shard)
+{
+	struct shard_assign assign;
+	const struct l_queue_entry *entry;
+	const struct shard_phy *phy;
+	size_t len;
+
+	/* Not running: sent again once respawned */
+	if (shard->fd < 0)
+		return;
+
+	memset(&assign, 0, sizeof(assign));
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+		if (phy->shard != shard->index)
+			continue;
+
+		memcpy(assign.names[assign.count++], phy->name, IFNAMSIZ);
+	}
+
+	len = offsetof(struct shard_assign, names) +
+					assign.count * IFNAMSIZ;
+
+	if (send(shard->fd, &assign, len, MSG_NOSIGNAL) < 0) {
+		l_warn("shard %u: PHY list: %s", shard->index,
+							strerror(errno));
+		return;
+	}
+
+	shard->dirty = false;
+}
+
+static struct shard *shard_least_loaded(void)
+{
+	struct shard *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < shard_count; i++) {
+		if (shards[i].phys == SHARD_PHY_MAX)
+			continue;
+
+		if (!best || shards[i].phys < best->phys)
+			best = &shards[i];
+	}
+
+	return best;
+}
+
+static struct shard *shard_most_loaded(void)
+{
+	struct shard *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < shard_count; i++)
+		if (!best || shards[i].phys > best->phys)
+			best = &shards[i];
+
+	return best;
+}
+
+static void phy_assign(struct shard_phy *phy, struct shard *to)
+{
+	if (phy->shard != SHARD_NONE) {
+		shards[phy->shard].phys--;
+		shards[phy->shard].dirty = true;
+	}
+
+	phy->shard = to->index;
+	to->phys++;
+	to->dirty = true;
+}
+
+static void shard_rebalance(void)
+{
+	const struct l_queue_entry *entry;
+	struct shard_phy *phy, *last;
+	struct shard *from, *to;
+	unsigned int i;
+
+	while ((phy = l_queue_remove_if(phy_list, phy_match_unseen, NULL))) {
+		l_info("shard: %s gone", phy->name);
+
+		if (phy->shard != SHARD_NONE) {
+			shards[phy->shard].phys--;
+			shards[phy->shard].dirty = true;
+		}
+
+		phy_free(phy);
+	}
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+		if (phy->shard != SHARD_NONE)
+			continue;
+
+		to = shard_least_loaded();
+		if (!to) {
+			l_warn("shard: no room left for %s", phy->name);
+			break;
+		}
+
+		phy_assign(phy, to);
+		l_info("shard: %s -> %u", phy->name, to->index);
+	}
+
+	for (;;) {
+		from = shard_most_loaded();
+		to = shard_least_loaded();
+
+		if (!from || !to || from->phys - to->phys <= 1)
+			break;
+
+		/* The most recently added, the least likely to be in use */
+		last = NULL;
+
+		for (entry = l_queue_get_entries(phy_list); entry;
+							entry = entry->next) {
+			phy = entry->data;
+			if (phy->shard == from->index)
+				last = phy;
+		}
+
+		phy_assign(last, to);
+		moves++;
+
+		l_info("shard: %s moved %u -> %u", last->name, from->index,
+								to->index);
+	}
+
+	for (i = 0; i < shard_count; i++)
+		if (shards[i].dirty)
+			shard_send(&shards[i]);
+}
+
+static void scan_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct nlattr_wpan_phy attrs = { .page = 0xff, .channel = 0xff };
+	struct shard_phy *phy;
+	uint64_t seen;
+
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	if (!nlattr_decode(msg, &nlattr_wpan_phy_table, &attrs, &seen) ||
+			!(seen & NLATTR_BIT(NL802154_ATTR_WPAN_PHY_NAME)))
+		return;
+
+	phy = l_queue_find(phy_list, phy_match_name, attrs.name);
+	if (!phy) {
+		phy = pool_alloc(phy_pool);
+		if (!phy) {
+			l_error("'%s': PHY limit reached", attrs.name);
+			return;
+		}
+
+		memcpy(phy->name, attrs.name, sizeof(phy->name));
+		phy->shard = SHARD_NONE;
+		l_queue_push_tail(phy_list, phy);
+	}
+
+	phy->seen = true;
+}
+
+LATENCY_GENL_CALLBACK(scan_callback)
+
+static void scan_done(void *user_data)
+{
+	trace_genl_done(NL802154_CMD_GET_WPAN_PHY);
+
+	/* nl802154 vanished while dumping: keep the assignment */
+	if (L_PTR_TO_UINT(user_data) != generation)
+		return;
+
+	dump_id = 0;
+	shard_rebalance();
+
+	if (rescan) {
+		rescan = false;
+		shard_scan(nl802154);
+	}
+}
+
+static void mark_unseen(void *data, void *user_data)
+{
+	struct shard_phy *phy = data;
+
+	phy->seen = false;
+}
+
+void shard_scan(struct l_genl_family *genl)
+{
+	struct l_genl_msg *msg;
+
+	nl802154 = genl;
+
+	if (dump_id) {
+		rescan = true;
+		return;
+	}
+
+	l_queue_foreach(phy_list, mark_unseen, NULL);
+
+	msg = l_genl_msg_new(NL802154_CMD_GET_WPAN_PHY);
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	dump_id = l_genl_family_dump(genl, msg, scan_callback_timed,
+					L_UINT_TO_PTR(generation), scan_done);
+	if (!dump_id)
+		l_error("Getting all PHY devices failed");
+}
+
+void shard_suspend(void)
+{
+	generation++;
+	nl802154 = NULL;
+	dump_id = 0;
+	rescan = false;
+}
+
+static void scan_expired(struct l_timeout *timeout, void *user_data)
+{
+	l_timeout_remove(scan_timeout);
+	scan_timeout = NULL;
+
+	if (nl802154)
+		shard_scan(nl802154);
+}
+
+LATENCY_TIMEOUT(scan_expired)
+
+/* PHYs come and go with their wpan interfaces */
+static bool rtnl_read(struct l_io *io, void *user_data)
+{
+	uint32_t buf[2048];
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	bool changed = false;
+	int len;
+
+	while ((len = recv(l_io_get_fd(io), buf, sizeof(buf),
+						MSG_DONTWAIT)) > 0) {
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+						nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != RTM_NEWLINK &&
+					nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+				continue;
+
+			ifi = NLMSG_DATA(nlh);
+			if (ifi->ifi_type == ARPHRD_IEEE802154)
+				changed = true;
+		}
+	}
+
+	/* Events were lost: one of them may have been ours */
+	if (len < 0 && errno == ENOBUFS)
+		changed = true;
+
+	if (!changed || !nl802154)
+		return true;
+
+	if (scan_timeout)
+		l_timeout_modify_ms(scan_timeout, SHARD_SCAN_DELAY);
+	else
+		scan_timeout = l_timeout_create_ms(SHARD_SCAN_DELAY,
+						scan_expired_timed, NULL, NULL);
+
+	return true;
+}
+
+LATENCY_IO(rtnl_read)
+
+static bool rtnl_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+							NETLINK_ROUTE);
+	if (fd < 0)
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return false;
+	}
+
+	rtnl_io = l_io_new(fd);
+	l_io_set_close_on_destroy(rtnl_io, true);
+	l_io_set_read_handler(rtnl_io, rtnl_read_timed, NULL, NULL);
+
+	return true;
+}
+
+static bool shard_spawn(struct shard *shard)
+{
+	char index[12];
+	cpu_set_t cpus;
+	sigset_t none;
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		l_error("shard %u: socketpair: %s", shard->index,
+							strerror(errno));
+		return false;
+	}
+
+	snprintf(index, sizeof(index), "%u", shard->index);
+	shard_argv[shard_argc + 1] = index;
+
+	pid = fork();
+	if (pid < 0) {
+		l_error("shard %u: fork: %s", shard->index, strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		/* The worker sets up its own signalfd */
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->cpu, &cpus);
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+
+		/* dup2() onto itself would keep close-on-exec */
+		if (sv[1] == SHARD_FD)
+			fcntl(sv[1], F_SETFD, 0);
+		else if (dup2(sv[1], SHARD_FD) < 0)
+			_exit(127);
+
+		execv("/proc/self/exe", shard_argv);
+		_exit(127);
+	}
+
+	shard_argv[shard_argc + 1] = NULL;
+
+	close(sv[1]);
+	shard->fd = sv[0];
+	shard->pid = pid;
+	shard->dirty = true;
+
+	l_info("shard %u: pid %d on cpu %d", shard->index, pid, shard->cpu);
+
+	return true;
+}
+
+static void restart_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct shard *shard = user_data;
+
+	if (!shard_spawn(shard)) {
+		l_timeout_modify(timeout, SHARD_RESTART_DELAY);
+		return;
+	}
+
+	l_timeout_remove(shard->restart);
+	shard->restart = NULL;
+
+	shard_send(shard);
+}
+
+LATENCY_TIMEOUT(restart_expired)
+
+static struct shard *shard_find_pid(pid_t pid)
+{
+	unsigned int i;
+
+	for (i = 0; i < shard_count; i++)
+		if (shards[i].pid == pid)
+			return &shards[i];
+
+	return NULL;
+}
+
+/* SIGCHLD: a worker died, start it again with the same PHYs */
+void shard_reap(void)
+{
+	struct shard *shard;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		shard = shard_find_pid(pid);
+		if (!shard)
+			continue;
+
+		if (WIFSIGNALED(status))
+			l_warn("shard %u: killed by signal %d", shard->index,
+							WTERMSIG(status));
+		else
+			l_warn("shard %u: exited with status %d",
+					shard->index, WEXITSTATUS(status));
+
+		close(shard->fd);
+		shard->fd = -1;
+		shard->pid = 0;
+
+		if (stopping)
+			continue;
+
+		shard->restarts++;
+		shard->restart = l_timeout_create(SHARD_RESTART_DELAY,
+						restart_expired_timed,
+						shard, NULL);
+	}
+}
+
+void shard_metrics(struct l_string *out)
+{
+	const struct l_queue_entry *entry;
+	const struct shard_phy *phy;
+	unsigned int unassigned = 0;
+	unsigned int i;
+
+	if (!shard_count)
+		return;
+
+	metrics_family(out, "iwpand_shard_phys", "gauge",
+				"PHYs handled by each worker process");
+
+	for (i = 0; i < shard_count; i++)
+		l_string_append_printf(out, "iwpand_shard_phys{shard=\"%u\"}"
+						" %u\n", i, shards[i].phys);
+
+	metrics_family(out, "iwpand_shard_up", "gauge",
+				"Worker process running");
+
+	for (i = 0; i < shard_count; i++)
+		l_string_append_printf(out, "iwpand_shard_up{shard=\"%u\"}"
+					" %u\n", i, shards[i].pid ? 1 : 0);
+
+	metrics_family(out, "iwpand_shard_restarts", "counter",
+				"Worker processes started again after dying");
+
+	for (i = 0; i < shard_count; i++)
+		l_string_append_printf(out, "iwpand_shard_restarts_total"
+					"{shard=\"%u\"} %" PRIu64 "\n", i,
+					shards[i].restarts);
+
+	for (entry = l_queue_get_entries(phy_list); entry;
+						entry = entry->next) {
+		phy = entry->data;
+		if (phy->shard == SHARD_NONE)
+			unassigned++;
+	}
+
+	metrics_family(out, "iwpand_shard_moves", "counter",
+				"PHYs moved to another worker to rebalance");
+	l_string_append_printf(out, "iwpand_shard_moves_total %" PRIu64 "\n",
+								moves);
+
+	metrics_family(out, "iwpand_shard_unassigned_phys", "gauge",
+				"PHYs left out: every worker is full");
+	l_string_append_printf(out, "iwpand_shard_unassigned_phys %u\n",
+								unassigned);
+}
+
+bool shard_init(unsigned int count, char *argv[])
+{
+	cpu_set_t allowed;
+	int cpus[CPU_SETSIZE];
+	unsigned int ncpus = 0;
+	unsigned int i;
+	int cpu;
+
+	if (!count || count > SHARD_MAX)
+		return false;
+
+	phy_pool = pool_new("shard_phy", sizeof(struct shard_phy),
+							SHARD_PHY_TOTAL);
+	if (!phy_pool)
+		return false;
+
+	phy_list = l_queue_new();
+
+	/* Workers go round robin over the CPUs iwpand may run on */
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed))
+				cpus[ncpus++] = cpu;
+
+	if (!ncpus)
+		cpus[ncpus++] = 0;
+
+	for (shard_argc = 0; argv[shard_argc]; shard_argc++);
+
+	shard_argv = l_new(char *, shard_argc + 3);
+	memcpy(shard_argv, argv, shard_argc * sizeof(char *));
+	shard_argv[shard_argc] = "--shard";
+
+	if (!rtnl_open())
+		l_warn("shard: no link events, PHYs only scanned at start");
+
+	for (i = 0; i < count; i++) {
+		shards[i].index = i;
+		shards[i].fd = -1;
+		shards[i].cpu = cpus[i % ncpus];
+	}
+
+	shard_count = count;
+
+	for (i = 0; i < count; i++)
+		if (!shard_spawn(&shards[i]))
+			return false;
+
+	l_info("Supervising %u workers on %u CPUs", count, ncpus);
+
+	return true;
+}
+
+void shard_exit(void)
+{
+	unsigned int i;
+
+	stopping = true;
+
+	for (i = 0; i < shard_count; i++)
+		if (shards[i].pid)
+			kill(shards[i].pid, SIGTERM);
+
+	for (i = 0; i < shard_count; i++) {
+		if (shards[i].pid)
+			waitpid(shards[i].pid, NULL, 0);
+
+		if (shards[i].fd >= 0)
+			close(shards[i].fd);
+
+		l_timeout_remove(shards[i].restart);
+	}
+
+	shard_count = 0;
+
+	l_timeout_remove(scan_timeout);
+	scan_timeout = NULL;
+	l_io_destroy(rtnl_io);
+	rtnl_io = NULL;
+
+	l_queue_destroy(phy_list, phy_free);
+	phy_list = NULL;
+
+	l_free(shard_argv);
+	shard_argv = NULL;
+}
+
+bool shard_owns(const char *phy)
+{
+	unsigned int i;
+
+	for (i = 0; i < owned.count; i++)
+		if (!strcmp(owned.names[i], phy))
+			return true;
+
+	return false;
+}
+
+static void supervisor_gone(struct l_io *io, void *user_data)
+{
+	l_warn("shard %u: supervisor gone", worker_index);
+	raise(SIGTERM);
+}
+
+static bool worker_read(struct l_io *io, void *user_data)
+{
+	struct shard_assign assign;
+	unsigned int i;
+	ssize_t len;
+
+	len = recv(l_io_get_fd(io), &assign, sizeof(assign), MSG_DONTWAIT);
+	if (len < 0)
+		return true;
+
+	if (!len) {
+		supervisor_gone(io, NULL);
+		return false;
+	}
+
+	if ((size_t) len < offsetof(struct shard_assign, names) ||
+			assign.count > SHARD_PHY_MAX ||
+			(size_t) len != offsetof(struct shard_assign, names) +
+						assign.count * IFNAMSIZ) {
+		l_warn("shard %u: malformed PHY list", worker_index);
+		return true;
+	}
+
+	for (i = 0; i < assign.count; i++)
+		assign.names[i][IFNAMSIZ - 1] = '\0';
+
+	memcpy(&owned, &assign, len);
+
+	l_info("shard %u: %u PHYs", worker_index, owned.count);
+
+	/* Drops the PHYs given to another worker, picks up the new ones */
+	phy_resync();
+
+	return true;
+}
+
+LATENCY_IO(worker_read)
+
+bool shard_worker_init(unsigned int index)
+{
+	if (fcntl(SHARD_FD, F_SETFD, FD_CLOEXEC) < 0) {
+		l_error("shard %u: no supervisor socket", index);
+		return false;
+	}
+
+	worker_index = index;
+
+	worker_io = l_io_new(SHARD_FD);
+	l_io_set_close_on_destroy(worker_io, true);
+	l_io_set_read_handler(worker_io, worker_read_timed, NULL, NULL);
+	l_io_set_disconnect_handler(worker_io, supervisor_gone, NULL, NULL);
+
+	return true;
+}
+
+void shard_worker_exit(void)
+{
+	l_io_destroy(worker_io);
+	worker_io = NULL;
+}
@@ -0,0 +1,42 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define SHARD_MAX		16	/* Worker processes */
+#define SHARD_PHY_MAX		16	/* PHYs per worker, its PHY pool */
+#define SHARD_FD		3	/* Worker end of the socket pair */
+#define SHARD_DBUS_SERVICE	"net.connman.iwpand.Shard"	/* + index */
+
+struct l_genl_family;
+struct l_string;
+
+/* Supervisor: spawns the workers and hands out the PHYs */
+bool shard_init(unsigned int count, char *argv[]);
+void shard_exit(void);
+void shard_scan(struct l_genl_family *nl802154);
+void shard_suspend(void);
+void shard_reap(void);
+void shard_metrics(struct l_string *out);
+
+/* Worker: told which PHYs it owns through SHARD_FD */
+bool shard_worker_init(unsigned int index);
+void shard_worker_exit(void);
+bool shard_owns(const char *phy);
@@ -0,0 +1,429 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <ell/ell.h>
+
+#include "nl802154.h"
+#include "survey.h"
+#include "monitor.h"
+#include "trace.h"
+#include "latency.h"
+#include "pool.h"
+
+/*
+ * A survey parks the PHY on each channel for a dwell time and listens
+ * through a monitor interface of its own. Only frame lengths are read:
+ * MSG_TRUNC reports the full length while copying a single byte. The
+ * airtime of a frame is its PSDU plus the synchronization header and
+ * PHR, at the bit rate of the channel. Energy from other technologies
+ * is not seen: occupancy only accounts for decodable 802.15.4 traffic.
+ */
+
+#define SURVEY_MAX		4	/* Concurrent surveys */
+#define SURVEY_BATCH		32	/* Frames per recvmmsg() */
+#define PHY_HEADER_LEN		6	/* Preamble, SFD and PHR */
+
+struct survey {
+	struct l_genl_family *nl802154;
+	uint32_t phy;
+	uint8_t home;		/* Channel restored at the end */
+	uint32_t dwell_ms;
+	struct monitor monitor;
+	unsigned int set_id;
+	bool moved;		/* Left the home channel */
+	bool listening;		/* Frames count for the current channel */
+	int fd;
+	struct l_io *io;
+	struct l_timeout *timeout;
+	unsigned int next;	/* Channel being visited */
+	uint64_t dwell_start;
+	survey_done_func_t done;
+	void *user_data;
+	struct survey_result result;
+};
+
+static struct pool *survey_pool = NULL;
+
+uint32_t survey_age(const struct survey_channel *channel)
+{
+	return (latency_now() - channel->time) / 1000;
+}
+
+/* Time on air of one byte */
+static uint32_t byte_usec(uint8_t page, uint8_t channel)
+{
+	if (page == 0 && channel == 0)
+		return 400;		/* 868 MHz BPSK, 20 kb/s */
+
+	if (page == 0 && channel <= 10)
+		return 200;		/* 915 MHz BPSK, 40 kb/s */
+
+	if (page == 2 && channel == 0)
+		return 80;		/* 868 MHz O-QPSK, 100 kb/s */
+
+	return 32;			/* 250 kb/s */
+}
+
+static void survey_count(struct survey *survey)
+{
+	struct survey_channel *channel = &survey->result.channels[survey->next];
+	uint32_t usec = byte_usec(survey->result.page, channel->channel);
+	struct mmsghdr msgs[SURVEY_BATCH];
+	struct iovec iov[SURVEY_BATCH];
+	uint8_t bytes[SURVEY_BATCH];
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < SURVEY_BATCH; i++) {
+		iov[i].iov_base = &bytes[i];
+		iov[i].iov_len = 1;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		n = recvmmsg(survey->fd, msgs, SURVEY_BATCH,
+					MSG_DONTWAIT | MSG_TRUNC, NULL);
+
+		/* Queued before the switch, or after the dwell */
+		if (n <= 0 || !survey->listening)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			channel->frames++;
+			channel->bytes += msgs[i].msg_len;
+			channel->airtime += (uint64_t) usec *
+					(msgs[i].msg_len + PHY_HEADER_LEN);
+		}
+	} while (n == SURVEY_BATCH);
+}
+
+static bool survey_read(struct l_io *io, void *user_data)
+{
+	survey_count(user_data);
+
+	return true;
+}
+
+LATENCY_IO(survey_read)
+
+static int channel_compare(const void *a, const void *b)
+{
+	const struct survey_channel *ca = a;
+	const struct survey_channel *cb = b;
+
+	if (ca->failed != cb->failed)
+		return ca->failed - cb->failed;
+
+	if (ca->occupancy != cb->occupancy)
+		return ca->occupancy - cb->occupancy;
+
+	if (ca->frames != cb->frames)
+		return ca->frames < cb->frames ? -1 : 1;
+
+	return ca->channel - cb->channel;
+}
+
+static unsigned int send_channel(struct survey *survey, uint8_t channel,
+					l_genl_msg_func_t callback)
+{
+	struct l_genl_msg *msg;
+	unsigned int id;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_SET_CHANNEL, 64);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY,
+					sizeof(survey->phy), &survey->phy);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAGE,
+					sizeof(survey->result.page),
+					&survey->result.page);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_CHANNEL,
+					sizeof(channel), &channel);
+
+	trace_genl(TRACE_OUT, __func__, msg);
+
+	id = l_genl_family_send(survey->nl802154, msg, callback, survey, NULL);
+	if (!id)
+		l_error("NL802154_CMD_SET_CHANNEL failed");
+
+	return id;
+}
+
+/*
+ * Leave the PHY as it was found: back on the channel its adapters
+ * expect and without the monitor. Done before the result is reported,
+ * so a channel applied from the done callback is the last one set.
+ */
+static void survey_teardown(struct survey *survey)
+{
+	if (survey->set_id) {
+		l_genl_family_cancel(survey->nl802154, survey->set_id);
+		survey->set_id = 0;
+	}
+
+	if (survey->moved) {
+		send_channel(survey, survey->home, NULL);
+		survey->moved = false;
+	}
+
+	monitor_remove(&survey->monitor);
+
+	l_timeout_remove(survey->timeout);
+	survey->timeout = NULL;
+	l_io_destroy(survey->io);
+	survey->io = NULL;
+
+	if (survey->fd >= 0) {
+		close(survey->fd);
+		survey->fd = -1;
+	}
+}
+
+static void survey_free(struct survey *survey)
+{
+	survey_teardown(survey);
+
+	/* Released by survey_released() once the monitor is answered */
+	if (survey->monitor.creating)
+		return;
+
+	pool_release(survey_pool, survey);
+}
+
+static void survey_finish(struct survey *survey, int err)
+{
+	struct survey_result *result = &survey->result;
+
+	if (!err)
+		qsort(result->channels, result->count,
+				sizeof(result->channels[0]), channel_compare);
+
+	l_info("survey: phy%u %u channels: %s", survey->phy, result->count,
+				err ? strerror(-err) : "done");
+
+	survey_teardown(survey);
+	survey->done(err, result, survey->user_data);
+	survey_free(survey);
+}
+
+static void survey_visit(struct survey *survey);
+
+static void dwell_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct survey *survey = user_data;
+	struct survey_channel *channel = &survey->result.channels[survey->next];
+	uint64_t now;
+	uint64_t dwell;
+	uint64_t occupancy = 0;
+
+	/* Frames still queued were received on this channel */
+	survey_count(survey);
+	survey->listening = false;
+
+	now = latency_now();
+	dwell = now - survey->dwell_start;
+
+	channel->time = now;
+	channel->dwell = dwell / 1000;
+
+	if (dwell)
+		occupancy = channel->airtime * 10000 / dwell;
+
+	/* A frame straddling the end of the dwell can push it over */
+	channel->occupancy = occupancy > 10000 ? 10000 : occupancy;
+
+	l_debug("survey: channel %u %u frames, %u/10000", channel->channel,
+					channel->frames, channel->occupancy);
+
+	survey->next++;
+	survey_visit(survey);
+}
+
+LATENCY_TIMEOUT(dwell_expired)
+
+static void channel_set_callback(struct l_genl_msg *msg, void *user_data)
+{
+	struct survey *survey = user_data;
+	struct survey_channel *channel = &survey->result.channels[survey->next];
+	int err;
+
+	survey->set_id = 0;
+
+	err = l_genl_msg_get_error(msg);
+	if (err < 0) {
+		l_warn("survey: channel %u: %s", channel->channel,
+							strerror(-err));
+		channel->failed = true;
+		channel->time = latency_now();
+		survey->next++;
+		survey_visit(survey);
+		return;
+	}
+
+	/* Drop what was heard on the previous channel */
+	survey_count(survey);
+
+	survey->listening = true;
+	survey->dwell_start = latency_now();
+
+	if (!survey->timeout)
+		survey->timeout = l_timeout_create_ms(survey->dwell_ms,
+						dwell_expired_timed,
+						survey, NULL);
+	else
+		l_timeout_modify_ms(survey->timeout, survey->dwell_ms);
+}
+
+LATENCY_GENL_CALLBACK(channel_set_callback)
+
+static void survey_visit(struct survey *survey)
+{
+	struct survey_channel *channel;
+
+	if (survey->next == survey->result.count) {
+		survey_finish(survey, 0);
+		return;
+	}
+
+	channel = &survey->result.channels[survey->next];
+
+	survey->set_id = send_channel(survey, channel->channel,
+					channel_set_callback_timed);
+	if (!survey->set_id) {
+		survey_finish(survey, -EIO);
+		return;
+	}
+
+	survey->moved = true;
+}
+
+static int socket_open(struct survey *survey)
+{
+	int fd, err;
+
+	/* Protocol 0: nothing is queued until bound to the monitor */
+	fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -errno;
+
+	err = monitor_bind(&survey->monitor, fd);
+	if (err < 0) {
+		close(fd);
+		return err;
+	}
+
+	survey->fd = fd;
+
+	return 0;
+}
+
+static void survey_monitor_created(int err, void *user_data)
+{
+	struct survey *survey = user_data;
+
+	if (err < 0) {
+		survey_finish(survey, err);
+		return;
+	}
+
+	err = socket_open(survey);
+	if (err < 0) {
+		l_error("survey: socket on %s: %s", survey->monitor.ifname,
+							strerror(-err));
+		survey_finish(survey, err);
+		return;
+	}
+
+	survey->io = l_io_new(survey->fd);
+	l_io_set_read_handler(survey->io, survey_read_timed, survey, NULL);
+
+	l_info("survey: %s %u channels, %u ms each", survey->monitor.ifname,
+				survey->result.count, survey->dwell_ms);
+
+	survey_visit(survey);
+}
+
+static void survey_released(void *user_data)
+{
+	pool_release(survey_pool, user_data);
+}
+
+struct survey *survey_start(struct l_genl_family *nl802154, uint32_t phy,
+				uint8_t page, uint8_t home,
+				uint32_t channels, uint32_t dwell_ms,
+				survey_done_func_t done, void *user_data)
+{
+	struct survey *survey;
+	unsigned int i;
+
+	if (!channels || dwell_ms < SURVEY_DWELL_MIN ||
+					dwell_ms > SURVEY_DWELL_MAX)
+		return NULL;
+
+	if (!survey_pool)
+		survey_pool = pool_new("survey", sizeof(struct survey),
+								SURVEY_MAX);
+
+	survey = survey_pool ? pool_alloc(survey_pool) : NULL;
+	if (!survey)
+		return NULL;
+
+	survey->nl802154 = nl802154;
+	survey->phy = phy;
+	survey->home = home;
+	survey->dwell_ms = dwell_ms;
+	survey->done = done;
+	survey->user_data = user_data;
+	survey->fd = -1;
+	survey->result.page = page;
+
+	for (i = 0; i < SURVEY_CHANNEL_MAX; i++)
+		if (channels & (1U << i))
+			survey->result.channels[survey->result.count++]
+							.channel = i;
+
+	if (!monitor_create(&survey->monitor, nl802154, phy, "survey",
+					survey_monitor_created,
+					survey_released, survey)) {
+		survey_free(survey);
+		return NULL;
+	}
+
+	return survey;
+}
+
+void survey_cancel(struct survey *survey)
+{
+	l_info("survey: phy%u cancelled", survey->phy);
+	survey_free(survey);
+}
@@ -0,0 +1,59 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define SURVEY_CHANNEL_MAX	27	/* Channels 0-26 of a page */
+#define SURVEY_DWELL_MIN	10	/* msec */
+#define SURVEY_DWELL_MAX	10000	/* msec */
+
+struct survey_channel {
+	uint8_t channel;
+	bool failed;		/* Refused by the kernel: not measured */
+	uint32_t frames;
+	uint32_t bytes;
+	uint64_t airtime;	/* usec, PHY headers included */
+	uint32_t dwell;		/* msec actually spent listening */
+	uint16_t occupancy;	/* Airtime per 10000 of the dwell */
+	uint64_t time;		/* CLOCK_MONOTONIC usec, end of the dwell */
+};
+
+struct survey_result {
+	uint8_t page;
+	unsigned int count;
+	/* Least loaded first */
+	struct survey_channel channels[SURVEY_CHANNEL_MAX];
+};
+
+struct survey;
+struct l_genl_family;
+
+/* The survey is freed once the callback returns */
+typedef void (*survey_done_func_t)(int err,
+					const struct survey_result *result,
+					void *user_data);
+
+struct survey *survey_start(struct l_genl_family *nl802154, uint32_t phy,
+				uint8_t page, uint8_t home,
+				uint32_t channels, uint32_t dwell_ms,
+				survey_done_func_t done, void *user_data);
+void survey_cancel(struct survey *survey);
+
+uint32_t survey_age(const struct survey_channel *channel);
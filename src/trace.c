@@ -0,0 +1,367 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/netlink.h>
+
+#include <ell/ell.h>
+
+#include "trace.h"
+
+/*
+ * Records go through a large stdio buffer: tracing costs a memcpy on
+ * the hot path and a write() every TRACE_BUFSIZE bytes.
+ */
+#define TRACE_BUFSIZE		65536
+#define TRACE_PAYLOAD_MAX	8192	/* GENL and DBUS records */
+
+static FILE *trace_file = NULL;
+static uint64_t last_time;
+static uint8_t payload[TRACE_PAYLOAD_MAX];
+
+struct trace_reader {
+	FILE *file;
+	uint64_t time;
+	uint8_t *buf;
+	size_t size;
+};
+
+static uint64_t now_usec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool trace_open(const char *path)
+{
+	struct trace_header hdr;
+
+	trace_file = fopen(path, "we");
+	if (!trace_file) {
+		l_error("Trace %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFSIZE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.start = now_usec(CLOCK_REALTIME);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, trace_file) != 1) {
+		l_error("Trace %s: %s", path, strerror(errno));
+		trace_close();
+		return false;
+	}
+
+	last_time = now_usec(CLOCK_MONOTONIC);
+
+	l_info("Tracing to %s", path);
+
+	return true;
+}
+
+void trace_close(void)
+{
+	if (!trace_file)
+		return;
+
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+static void record_write(unsigned int source, unsigned int flags,
+					const void *data, size_t len)
+{
+	static const uint8_t pad[4];
+	struct trace_record rec;
+	uint64_t now = now_usec(CLOCK_MONOTONIC);
+	uint64_t delta = now - last_time;
+
+	if (len > TRACE_LENGTH_MAX)
+		return;
+
+	rec.delta = delta > UINT32_MAX ? UINT32_MAX : delta;
+	rec.info = TRACE_INFO(source, flags, len);
+	last_time = now;
+
+	if (fwrite(&rec, sizeof(rec), 1, trace_file) != 1 ||
+			(len && fwrite(data, len, 1, trace_file) != 1) ||
+			(len % 4 && fwrite(pad, 4 - len % 4, 1,
+							trace_file) != 1)) {
+		l_error("Trace write failed: %s", strerror(errno));
+		trace_close();
+	}
+}
+
+static size_t genl_header(uint8_t cmd, int error, const char *site)
+{
+	struct trace_genl *hdr = (struct trace_genl *) payload;
+	size_t site_len = strlen(site);
+	size_t len;
+
+	if (site_len > UINT8_MAX)
+		site_len = UINT8_MAX;
+
+	hdr->cmd = cmd;
+	hdr->site_len = site_len;
+	hdr->error = error;
+	memcpy(payload + sizeof(*hdr), site, site_len);
+
+	len = sizeof(*hdr) + site_len;
+	memset(payload + len, 0, NLA_ALIGN(len) - len);
+
+	return NLA_ALIGN(len);
+}
+
+/* Attributes are copied back into netlink format, nested ones as is */
+void trace_genl(unsigned int flags, const char *site, struct l_genl_msg *msg)
+{
+	struct l_genl_attr attr;
+	struct nlattr *nla;
+	uint16_t type, len;
+	const void *data;
+	size_t pos;
+	int error;
+
+	if (!trace_file)
+		return;
+
+	error = flags & TRACE_OUT ? 0 : l_genl_msg_get_error(msg);
+	pos = genl_header(l_genl_msg_get_command(msg), error, site);
+
+	if (l_genl_attr_init(&attr, msg)) {
+		while (l_genl_attr_next(&attr, &type, &len, &data)) {
+			if (pos + NLA_HDRLEN + NLA_ALIGN(len) > sizeof(payload))
+				break;
+
+			nla = (struct nlattr *) (payload + pos);
+			nla->nla_type = type;
+			nla->nla_len = NLA_HDRLEN + len;
+			memcpy(payload + pos + NLA_HDRLEN, data, len);
+			memset(payload + pos + nla->nla_len, 0,
+					NLA_ALIGN(nla->nla_len) - nla->nla_len);
+
+			pos += NLA_ALIGN(nla->nla_len);
+		}
+	}
+
+	record_write(TRACE_GENL, flags, payload, pos);
+}
+
+void trace_genl_done(uint8_t cmd)
+{
+	if (!trace_file)
+		return;
+
+	record_write(TRACE_GENL, TRACE_DONE, payload,
+					genl_header(cmd, 0, ""));
+}
+
+void trace_rtnl(unsigned int flags, const void *data, size_t len)
+{
+	if (!trace_file)
+		return;
+
+	record_write(TRACE_RTNL, flags, data, len);
+}
+
+static bool append_string(size_t *pos, const char *str)
+{
+	size_t len = strlen(str ? str : "") + 1;
+
+	if (*pos + len > sizeof(payload))
+		return false;
+
+	memcpy(payload + *pos, str ? str : "", len);
+	*pos += len;
+
+	return true;
+}
+
+/* The setter reads the value again: only copies of the iterator are used */
+static bool append_value(size_t *pos, struct l_dbus_message_iter *value)
+{
+	static const char types[] = "bynqiuxtso";
+	struct l_dbus_message_iter iter;
+	union {
+		bool b;
+		uint8_t y;
+		uint16_t q;
+		uint32_t u;
+		uint64_t t;
+		const char *s;
+	} v;
+	char sig[2] = { 0, 0 };
+	unsigned int i;
+	size_t size;
+
+	for (i = 0; types[i]; i++) {
+		sig[0] = types[i];
+		iter = *value;
+
+		if (l_dbus_message_iter_get_variant(&iter, sig, &v))
+			break;
+	}
+
+	if (!types[i] || *pos + 1 + sizeof(v) > sizeof(payload))
+		return false;
+
+	payload[(*pos)++] = sig[0];
+
+	switch (sig[0]) {
+	case 's':
+	case 'o':
+		return append_string(pos, v.s);
+	case 'b':
+		v.y = v.b;
+		size = 1;
+		break;
+	case 'y':
+		size = 1;
+		break;
+	case 'n':
+	case 'q':
+		size = 2;
+		break;
+	case 'i':
+	case 'u':
+		size = 4;
+		break;
+	default:
+		size = 8;
+		break;
+	}
+
+	memcpy(payload + *pos, &v, size);
+	*pos += size;
+
+	return true;
+}
+
+/* Method calls, and property writes when 'value' is given */
+void trace_dbus(struct l_dbus_message *message,
+				struct l_dbus_message_iter *value)
+{
+	struct l_dbus_message_iter variant;
+	const char *interface, *name;
+	size_t pos = 0;
+
+	if (!trace_file)
+		return;
+
+	if (!append_string(&pos, l_dbus_message_get_sender(message)) ||
+		!append_string(&pos, l_dbus_message_get_path(message)) ||
+		!append_string(&pos, l_dbus_message_get_interface(message)) ||
+		!append_string(&pos, l_dbus_message_get_member(message)) ||
+		!append_string(&pos, l_dbus_message_get_signature(message)))
+		return;
+
+	if (value && l_dbus_message_get_arguments(message, "ssv", &interface,
+							&name, &variant)) {
+		size_t end = pos;
+
+		if (!append_string(&pos, interface) ||
+				!append_string(&pos, name) ||
+				!append_value(&pos, value))
+			pos = end;
+	}
+
+	record_write(TRACE_DBUS, 0, payload, pos);
+}
+
+struct trace_reader *trace_reader_open(const char *path)
+{
+	struct trace_reader *reader;
+	struct trace_header hdr;
+	FILE *file;
+
+	file = fopen(path, "re");
+	if (!file)
+		return NULL;
+
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+			memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+			hdr.version != TRACE_VERSION) {
+		fclose(file);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	reader = l_new(struct trace_reader, 1);
+	reader->file = file;
+
+	return reader;
+}
+
+bool trace_reader_next(struct trace_reader *reader, struct trace_event *event)
+{
+	struct trace_record rec;
+	size_t len;
+
+	if (fread(&rec, sizeof(rec), 1, reader->file) != 1)
+		return false;
+
+	len = TRACE_LEN(rec.info);
+
+	if (NLA_ALIGN(len) > reader->size) {
+		reader->size = NLA_ALIGN(len);
+		reader->buf = l_realloc(reader->buf, reader->size);
+	}
+
+	if (len && fread(reader->buf, NLA_ALIGN(len), 1, reader->file) != 1)
+		return false;
+
+	reader->time += rec.delta;
+
+	event->time = reader->time;
+	event->source = TRACE_SOURCE(rec.info);
+	event->flags = TRACE_FLAGS(rec.info);
+	event->data = reader->buf;
+	event->len = len;
+
+	return true;
+}
+
+void trace_reader_close(struct trace_reader *reader)
+{
+	if (!reader)
+		return;
+
+	fclose(reader->file);
+	l_free(reader->buf);
+	l_free(reader);
+}
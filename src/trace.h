@@ -0,0 +1,100 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Binary trace written with --trace, host byte order:
+ *
+ *	struct trace_header
+ *	struct trace_record, payload padded to 4 bytes, ...
+ *
+ * GENL payloads are a struct trace_genl, the name of the callback or
+ * sender (padded to 4 bytes) and the message attributes as struct
+ * nlattr. RTNL payloads are the bytes of one recv() or one request.
+ * DBUS payloads are NUL terminated strings: sender, path, interface,
+ * member and signature. Property writes add the interface and name of
+ * the property, the value type and the value (NUL terminated strings,
+ * one byte booleans).
+ */
+
+#define TRACE_MAGIC		"IWPTRACE"
+#define TRACE_VERSION		1
+
+#define TRACE_GENL		1
+#define TRACE_RTNL		2
+#define TRACE_DBUS		3
+
+#define TRACE_OUT		0x1	/* Sent by the daemon */
+#define TRACE_DONE		0x2	/* GENL: dump finished */
+#define TRACE_OVERFLOW		0x4	/* RTNL: recv() failed, ENOBUFS */
+
+#define TRACE_LENGTH_MAX	0xffffff
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t start;		/* CLOCK_REALTIME, usec */
+};
+
+struct trace_record {
+	uint32_t delta;		/* usec since the previous record */
+	uint32_t info;		/* source:4 flags:4 length:24 */
+};
+
+#define TRACE_INFO(source, flags, len) \
+	((uint32_t) (source) << 28 | (uint32_t) (flags) << 24 | (len))
+#define TRACE_SOURCE(info)	((info) >> 28)
+#define TRACE_FLAGS(info)	(((info) >> 24) & 0xf)
+#define TRACE_LEN(info)		((info) & TRACE_LENGTH_MAX)
+
+struct trace_genl {
+	uint8_t cmd;
+	uint8_t site_len;	/* Without NUL */
+	int16_t error;		/* Replies: negative errno */
+};
+
+struct l_genl_msg;
+struct l_dbus_message;
+struct l_dbus_message_iter;
+
+bool trace_open(const char *path);
+void trace_close(void);
+
+void trace_genl(unsigned int flags, const char *site, struct l_genl_msg *msg);
+void trace_genl_done(uint8_t cmd);
+void trace_rtnl(unsigned int flags, const void *data, size_t len);
+void trace_dbus(struct l_dbus_message *message,
+				struct l_dbus_message_iter *value);
+
+struct trace_event {
+	uint64_t time;		/* usec since the trace was opened */
+	unsigned int source;
+	unsigned int flags;
+	const void *data;	/* Valid until the next call */
+	uint32_t len;
+};
+
+struct trace_reader;
+
+struct trace_reader *trace_reader_open(const char *path);
+bool trace_reader_next(struct trace_reader *reader, struct trace_event *event);
+void trace_reader_close(struct trace_reader *reader);
@@ -0,0 +1,381 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <ell/ell.h>
+
+#include "metrics.h"
+#include "worker.h"
+#include "trace.h"
+#include "latency.h"
+
+/*
+ * The main loop hands jobs to each worker through a single producer,
+ * single consumer ring and never waits for them: workers push results
+ * to one multi producer, single consumer ring and wake the loop through
+ * an eventfd. No lock is taken on either side.
+ *
+ * A worker never has more than WORKER_RING_SIZE jobs between submission
+ * and reaping, which bounds both rings so that a push never fails.
+ */
+
+#define WORKER_MAX		16
+#define WORKER_RING_SIZE	64	/* Power of two */
+
+struct job {
+	worker_func_t func;
+	worker_done_func_t done;
+	void *user_data;
+	int result;
+};
+
+struct worker {
+	pthread_t thread;
+	int efd;
+	bool sleeping;
+
+	/* Submission ring, main loop -> worker */
+	uint32_t head;
+	uint32_t tail;
+	struct job jobs[WORKER_RING_SIZE];
+
+	/* Main loop only */
+	unsigned int pending;
+	uint64_t submitted;
+	uint64_t rejected;
+	uint64_t completed;
+};
+
+struct cell {
+	uint32_t seq;
+	struct worker *worker;
+	struct job job;
+};
+
+/* Completion ring, workers -> main loop */
+static struct cell *cells = NULL;
+static uint32_t cell_mask;
+static uint32_t cell_head;
+static uint32_t cell_tail;
+static bool wake_pending;
+static int done_efd = -1;
+static struct l_io *done_io = NULL;
+
+static struct worker *workers = NULL;
+static unsigned int worker_num = 0;
+static bool stopping;
+
+static void completion_push(struct worker *worker, const struct job *job)
+{
+	uint32_t pos = __atomic_load_n(&cell_tail, __ATOMIC_RELAXED);
+	struct cell *cell;
+	uint64_t one = 1;
+
+	for (;;) {
+		uint32_t seq;
+
+		cell = &cells[pos & cell_mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+		/* The cell is free for this position: claim it */
+		if (seq == pos && __atomic_compare_exchange_n(&cell_tail,
+					&pos, pos + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+			break;
+
+		if (seq != pos)
+			pos = __atomic_load_n(&cell_tail, __ATOMIC_RELAXED);
+	}
+
+	cell->worker = worker;
+	cell->job = *job;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	if (!__atomic_exchange_n(&wake_pending, true, __ATOMIC_SEQ_CST))
+		while (write(done_efd, &one, sizeof(one)) < 0 &&
+							errno == EINTR);
+}
+
+static bool completion_pop(struct worker **worker, struct job *job)
+{
+	struct cell *cell = &cells[cell_head & cell_mask];
+
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != cell_head + 1)
+		return false;
+
+	*worker = cell->worker;
+	*job = cell->job;
+	__atomic_store_n(&cell->seq, cell_head + cell_mask + 1,
+							__ATOMIC_RELEASE);
+	cell_head++;
+
+	return true;
+}
+
+static void completions_run(void)
+{
+	struct worker *worker;
+	struct job job;
+
+	while (completion_pop(&worker, &job)) {
+		worker->pending--;
+		worker->completed++;
+		job.done(job.result, job.user_data);
+	}
+}
+
+static bool done_read(struct l_io *io, void *user_data)
+{
+	uint64_t count;
+
+	if (read(done_efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return true;
+
+	/* Clear before draining so that a later push always wakes us */
+	__atomic_store_n(&wake_pending, false, __ATOMIC_SEQ_CST);
+	completions_run();
+
+	return true;
+}
+
+LATENCY_IO(done_read)
+
+static bool job_pop(struct worker *worker, struct job *job)
+{
+	uint32_t head = worker->head;
+
+	if (head == __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	*job = worker->jobs[head % WORKER_RING_SIZE];
+	__atomic_store_n(&worker->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void *worker_main(void *user_data)
+{
+	struct worker *worker = user_data;
+	struct job job;
+	uint64_t count;
+
+	for (;;) {
+		while (job_pop(worker, &job)) {
+			job.result = job.func(job.user_data);
+			completion_push(worker, &job);
+		}
+
+		if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&worker->sleeping, true, __ATOMIC_SEQ_CST);
+
+		if (worker->head == __atomic_load_n(&worker->tail,
+							__ATOMIC_SEQ_CST) &&
+				!__atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+			while (read(worker->efd, &count, sizeof(count)) < 0 &&
+							errno == EINTR);
+
+		__atomic_store_n(&worker->sleeping, false, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static void worker_wake(struct worker *worker)
+{
+	uint64_t one = 1;
+
+	while (write(worker->efd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+bool worker_submit(unsigned int key, worker_func_t func,
+				worker_done_func_t done, void *user_data)
+{
+	struct worker *worker;
+	struct job *job;
+
+	if (!worker_num || stopping)
+		return false;
+
+	worker = &workers[key % worker_num];
+
+	if (worker->pending == WORKER_RING_SIZE) {
+		worker->rejected++;
+		return false;
+	}
+
+	job = &worker->jobs[worker->tail % WORKER_RING_SIZE];
+	job->func = func;
+	job->done = done;
+	job->user_data = user_data;
+
+	__atomic_store_n(&worker->tail, worker->tail + 1, __ATOMIC_SEQ_CST);
+	worker->pending++;
+	worker->submitted++;
+
+	if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST))
+		worker_wake(worker);
+
+	return true;
+}
+
+void worker_metrics(struct l_string *out)
+{
+	unsigned int i;
+
+	if (!worker_num)
+		return;
+
+	metrics_family(out, "iwpand_worker_jobs", "counter",
+				"Jobs by worker and state");
+
+	for (i = 0; i < worker_num; i++) {
+		struct worker *worker = &workers[i];
+
+		l_string_append_printf(out,
+			"iwpand_worker_jobs_total{worker=\"%u\","
+			"state=\"submitted\"} %" PRIu64 "\n"
+			"iwpand_worker_jobs_total{worker=\"%u\","
+			"state=\"completed\"} %" PRIu64 "\n"
+			"iwpand_worker_jobs_total{worker=\"%u\","
+			"state=\"rejected\"} %" PRIu64 "\n",
+			i, worker->submitted, i, worker->completed,
+			i, worker->rejected);
+	}
+
+	metrics_family(out, "iwpand_worker_pending", "gauge",
+				"Jobs submitted and not yet completed");
+
+	for (i = 0; i < worker_num; i++)
+		l_string_append_printf(out,
+				"iwpand_worker_pending{worker=\"%u\"} %u\n",
+				i, workers[i].pending);
+}
+
+bool worker_init(unsigned int count)
+{
+	sigset_t all, old;
+	uint32_t size = 1;
+	unsigned int i;
+
+	if (!count)
+		return true;
+
+	if (count > WORKER_MAX)
+		count = WORKER_MAX;
+
+	while (size < count * WORKER_RING_SIZE)
+		size <<= 1;
+
+	done_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (done_efd < 0)
+		return false;
+
+	cells = l_new(struct cell, size);
+	cell_mask = size - 1;
+	cell_head = 0;
+	cell_tail = 0;
+
+	for (i = 0; i < size; i++)
+		cells[i].seq = i;
+
+	done_io = l_io_new(done_efd);
+	l_io_set_read_handler(done_io, done_read_timed, NULL, NULL);
+
+	workers = l_new(struct worker, count);
+	stopping = false;
+
+	/* Signals stay with the main loop's signalfd */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < count; i++) {
+		struct worker *worker = &workers[i];
+
+		worker->efd = eventfd(0, EFD_CLOEXEC);
+		if (worker->efd < 0)
+			break;
+
+		if (pthread_create(&worker->thread, NULL, worker_main,
+								worker)) {
+			close(worker->efd);
+			break;
+		}
+
+		worker_num++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!worker_num) {
+		worker_exit();
+		return false;
+	}
+
+	l_info("Started %u worker threads", worker_num);
+
+	return true;
+}
+
+void worker_exit(void)
+{
+	unsigned int i;
+
+	__atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+
+	/* Workers drain their queue before leaving */
+	for (i = 0; i < worker_num; i++) {
+		worker_wake(&workers[i]);
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].efd);
+	}
+
+	if (cells)
+		completions_run();
+
+	l_io_destroy(done_io);
+	done_io = NULL;
+
+	if (done_efd >= 0)
+		close(done_efd);
+
+	done_efd = -1;
+
+	l_free(workers);
+	workers = NULL;
+	worker_num = 0;
+
+	l_free(cells);
+	cells = NULL;
+}
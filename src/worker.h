@@ -0,0 +1,41 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct l_string;
+
+/* Runs on a worker thread, must not touch main loop state */
+typedef int (*worker_func_t)(void *user_data);
+/* Runs on the main loop with the value returned by worker_func_t */
+typedef void (*worker_done_func_t)(int result, void *user_data);
+
+/*
+ * Jobs sharing a key run on the same worker, in submission order.
+ * Returns false if no worker is running or its queue is full: the
+ * caller is expected to do the work inline.
+ */
+bool worker_submit(unsigned int key, worker_func_t func,
+				worker_done_func_t done, void *user_data);
+
+void worker_metrics(struct l_string *out);
+
+bool worker_init(unsigned int count);
+void worker_exit(void);
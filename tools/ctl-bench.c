@@ -0,0 +1,337 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Compares reading an adapter setting over the system bus with the
+ * binary control socket, against a running daemon:
+ *
+ *	ctl-bench [-n count] [-b batch] [-d depth] [-f size]
+ *					<socket> <adapter>
+ *
+ * D-Bus calls are issued back to back, each waiting for its reply.
+ * The control socket is measured with one request per round trip,
+ * then pipelined: depth packets of batch requests in flight.
+ *
+ * With -f, count broadcast data frames of size bytes are injected
+ * instead, with as many in flight as the daemon accepts. This puts
+ * the frames on the air: use a test channel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <net/if.h>
+
+#include <ell/ell.h>
+
+#include "lib/iwpanctl.h"
+
+#define IWPAND_SERVICE		"net.connman.iwpand"
+#define ADAPTER_INTERFACE	"net.connman.iwpand.Adapter"
+
+static unsigned int count = 100000;
+static unsigned int batch = 32;
+static unsigned int depth = 4;
+static unsigned int frame_size;
+
+static struct l_dbus *dbus;
+static char path[IF_NAMESIZE + 1];
+static unsigned int dbus_done;
+static uint64_t dbus_start, dbus_elapsed;
+static bool dbus_failed;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned int calls, uint64_t elapsed)
+{
+	printf("%-24s %8u calls %10.0f calls/s %8.2f us/call\n", name,
+				calls, calls / (elapsed / 1e9),
+				elapsed / 1e3 / calls);
+}
+
+static void dbus_get(void);
+
+static void dbus_get_reply(struct l_dbus_message *reply, void *user_data)
+{
+	if (l_dbus_message_is_error(reply)) {
+		fprintf(stderr, "D-Bus Get failed\n");
+		dbus_failed = true;
+		l_main_quit();
+		return;
+	}
+
+	if (++dbus_done < count) {
+		dbus_get();
+		return;
+	}
+
+	dbus_elapsed = now_ns() - dbus_start;
+	l_main_quit();
+}
+
+static void dbus_get(void)
+{
+	struct l_dbus_message *msg;
+
+	msg = l_dbus_message_new_method_call(dbus, IWPAND_SERVICE, path,
+					L_DBUS_INTERFACE_PROPERTIES, "Get");
+	l_dbus_message_set_arguments(msg, "ss", ADAPTER_INTERFACE, "PanId");
+	l_dbus_send_with_reply(dbus, msg, dbus_get_reply, NULL, NULL);
+}
+
+static void dbus_ready(void *user_data)
+{
+	dbus_start = now_ns();
+	dbus_get();
+}
+
+static bool bench_dbus(void)
+{
+	dbus = l_dbus_new_default(L_DBUS_SYSTEM_BUS);
+	if (!dbus) {
+		fprintf(stderr, "Unable to connect to the system bus\n");
+		return false;
+	}
+
+	l_dbus_set_ready_handler(dbus, dbus_ready, NULL, NULL);
+	l_main_run();
+	l_dbus_destroy(dbus);
+
+	if (dbus_failed)
+		return false;
+
+	report("D-Bus Get", count, dbus_elapsed);
+
+	return true;
+}
+
+static bool bench_sync(struct iwpanctl *ctl, uint32_t ifindex)
+{
+	struct iwpanctl_state state;
+	uint64_t start = now_ns();
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < count; i++) {
+		err = iwpanctl_get(ctl, ifindex, &state);
+		if (err < 0) {
+			fprintf(stderr, "GET: %s\n", strerror(-err));
+			return false;
+		}
+	}
+
+	report("control GET", count, now_ns() - start);
+
+	return true;
+}
+
+static bool send_batch(struct iwpanctl *ctl, uint32_t ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch; i++)
+		iwpanctl_queue(ctl, IWPANCTL_OP_GET, ifindex, 0);
+
+	return iwpanctl_flush(ctl) == (int) batch;
+}
+
+static bool bench_pipelined(struct iwpanctl *ctl, uint32_t ifindex)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	unsigned int packets = (count + batch - 1) / batch;
+	unsigned int sent, received = 0;
+	uint64_t start = now_ns();
+	char name[32];
+	int n;
+
+	for (sent = 0; sent < depth && sent < packets; sent++)
+		if (!send_batch(ctl, ifindex))
+			return false;
+
+	while (received < packets) {
+		n = iwpanctl_recv(ctl, resp, L_ARRAY_SIZE(resp), true);
+		if (n < 0) {
+			fprintf(stderr, "recv: %s\n", strerror(-n));
+			return false;
+		}
+
+		if (resp[0].op == IWPANCTL_OP_EVENT)
+			continue;
+
+		received++;
+
+		if (sent < packets) {
+			if (!send_batch(ctl, ifindex))
+				return false;
+
+			sent++;
+		}
+	}
+
+	snprintf(name, sizeof(name), "control GET x%u/%u", batch, depth);
+	report(name, packets * batch, now_ns() - start);
+
+	return true;
+}
+
+static bool bench_inject(struct iwpanctl *ctl, uint32_t ifindex)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	uint8_t frame[IWPANCTL_FRAME_MAX];
+	unsigned int sent = 0, received = 0, failed = 0;
+	uint64_t start = now_ns();
+	char name[32];
+	int n, i;
+
+	/* Data, PAN ID compression, short addresses: to 0xffff/0xffff */
+	memset(frame, 0xa5, sizeof(frame));
+	memcpy(frame, "\x41\x88\x00\xff\xff\xff\xff\x00\x00", 9);
+
+	while (received < count) {
+		while (sent < count && sent - received < IWPANCTL_BATCH_MAX) {
+			frame[2] = sent;
+
+			if (!iwpanctl_inject(ctl, ifindex, frame, frame_size)) {
+				fprintf(stderr, "inject: %s\n",
+							strerror(errno));
+				return false;
+			}
+
+			sent++;
+		}
+
+		n = iwpanctl_recv(ctl, resp, L_ARRAY_SIZE(resp), true);
+		if (n < 0) {
+			fprintf(stderr, "recv: %s\n", strerror(-n));
+			return false;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (resp[i].op != IWPANCTL_OP_INJECT)
+				continue;
+
+			if (resp[i].error)
+				failed++;
+
+			received++;
+		}
+	}
+
+	snprintf(name, sizeof(name), "inject %u bytes", frame_size);
+	report(name, count, now_ns() - start);
+
+	if (failed)
+		printf("%u frames not sent\n", failed);
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-b batch] [-d depth] "
+				"[-f size] <socket> <adapter>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct iwpanctl *ctl;
+	uint32_t ifindex;
+	int opt, ret = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "n:b:d:f:")) >= 0) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			frame_size = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2 || !count || !depth || !batch ||
+				batch > IWPANCTL_BATCH_MAX ||
+				(frame_size && (frame_size < 9 ||
+				frame_size > IWPANCTL_FRAME_MAX))) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ifindex = if_nametoindex(argv[optind + 1]);
+	if (!ifindex) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 1],
+							strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "/%s", argv[optind + 1]);
+
+	ctl = iwpanctl_connect(argv[optind]);
+	if (!ctl) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (frame_size) {
+		if (bench_inject(ctl, ifindex))
+			ret = EXIT_SUCCESS;
+
+		goto done;
+	}
+
+	if (!l_main_init())
+		goto done;
+
+	if (bench_dbus() && bench_sync(ctl, ifindex) &&
+					bench_pipelined(ctl, ifindex))
+		ret = EXIT_SUCCESS;
+
+	l_main_exit();
+
+done:
+	iwpanctl_close(ctl);
+
+	return ret;
+}
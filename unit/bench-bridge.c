@@ -0,0 +1,200 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Throughput of the io_uring bridge over a stand-in link: one end of a
+ * Unix datagram socket pair plays the wpan interface, a UDP socket on
+ * the loopback plays the collector.
+ *
+ *	bench-bridge [frames]
+ *
+ * Frames go from the link to the collector, then back, with up to one
+ * buffer group worth in flight. Every frame has to arrive. Exits 77
+ * (skipped) where io_uring is not available.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ell/ell.h>
+
+#include "src/pool.h"
+#include "src/bridge.h"
+
+#define FRAME_LEN	100
+#define IN_FLIGHT	16	/* Half a buffer group */
+#define STALL_NS	1000000000ULL	/* No progress: frames lost */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Sends frames into from, expects them out of to */
+static bool run(const char *name, struct bridge *bridge, int from, int to,
+						unsigned long frames)
+{
+	struct bridge_stats before, after;
+	uint64_t submits;
+	uint8_t frame[FRAME_LEN] = { };
+	uint8_t buf[256];
+	unsigned long sent = 0, received = 0;
+	uint64_t sum = 0, expected = 0;
+	uint64_t start, progress;
+	uint32_t seq;
+	ssize_t len;
+
+	bridge_get_stats(bridge, &before);
+	start = progress = now_ns();
+
+	while (received < frames) {
+		while (sent < frames && sent - received < IN_FLIGHT) {
+			seq = sent;
+			memcpy(frame, &seq, sizeof(seq));
+
+			if (send(from, frame, sizeof(frame),
+						MSG_DONTWAIT) < 0)
+				break;
+
+			expected += seq;
+			sent++;
+		}
+
+		l_main_iterate(1);
+
+		while ((len = recv(to, buf, sizeof(buf),
+						MSG_DONTWAIT)) > 0) {
+			if (len != FRAME_LEN) {
+				fprintf(stderr, "%s: %zd byte frame\n",
+								name, len);
+				return false;
+			}
+
+			memcpy(&seq, buf, sizeof(seq));
+			sum += seq;
+			received++;
+			progress = now_ns();
+		}
+
+		if (now_ns() - progress > STALL_NS)
+			break;
+	}
+
+	bridge_get_stats(bridge, &after);
+	submits = after.submits - before.submits;
+
+	printf("%-16s %8lu frames %10.0f frames/s %6.2f frames/submit "
+			"%4" PRIu64 " stalls\n", name, received,
+			received * 1e9 / (now_ns() - start),
+			(double) received / (submits ? submits : 1),
+			after.no_buffer - before.no_buffer);
+
+	if (received != frames || sum != expected) {
+		fprintf(stderr, "%s: %lu of %lu frames arrived\n", name,
+							received, frames);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t len = sizeof(addr);
+	unsigned long frames = 200000;
+	char endpoint[32];
+	struct bridge *bridge;
+	uint8_t buf[FRAME_LEN] = { };
+	int link[2], collector;
+	bool ok;
+
+	if (argc > 1)
+		frames = strtoul(argv[1], NULL, 0);
+
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	pool_init(512 * 1024);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, link) < 0)
+		return EXIT_FAILURE;
+
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	collector = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (collector < 0 ||
+			bind(collector, (struct sockaddr *) &addr, len) < 0 ||
+			getsockname(collector, (struct sockaddr *) &addr,
+								&len) < 0)
+		return EXIT_FAILURE;
+
+	snprintf(endpoint, sizeof(endpoint), "127.0.0.1:%u",
+						ntohs(addr.sin_port));
+
+	bridge = bridge_new("bench0", link[0], endpoint);
+	if (!bridge) {
+		fprintf(stderr, "no bridge: %s\n", strerror(errno));
+		return errno == EOPNOTSUPP || errno == ENOSYS ||
+					errno == EPERM ? 77 : EXIT_FAILURE;
+	}
+
+	ok = run("link to socket", bridge, link[1], collector, frames);
+
+	/* Answer the bridge from where its frames came from */
+	if (ok) {
+		ok = send(link[1], buf, sizeof(buf), 0) == sizeof(buf);
+
+		while (ok && recvfrom(collector, buf, sizeof(buf),
+					MSG_DONTWAIT, (struct sockaddr *) &addr,
+					&len) < 0)
+			l_main_iterate(1);
+
+		ok = ok && !connect(collector, (struct sockaddr *) &addr,
+									len);
+	}
+
+	ok = ok && run("socket to link", bridge, collector, link[1], frames);
+
+	bridge_free(bridge);
+	close(link[1]);
+	close(collector);
+	pool_exit();
+	l_main_exit();
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
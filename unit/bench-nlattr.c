@@ -0,0 +1,103 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/nlattr.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Same attribute layout as a kernel GET_INTERFACE dump reply */
+static struct l_genl_msg *build_interface_msg(void)
+{
+	struct l_genl_msg *msg;
+	uint32_t phy = 0, ifindex = 3, iftype = NL802154_IFTYPE_NODE;
+	uint64_t wpan_dev = 1, extaddr = 0x0123456789abcdefULL;
+	uint16_t panid = 0xabcd, short_addr = 0xfffe;
+	uint32_t generation = 7;
+	uint8_t ackreq = 0;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, 256);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY, 4, &phy);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFNAME, 6, "wpan0");
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFTYPE, 4, &iftype);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_DEV, 8, &wpan_dev);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_GENERATION, 4, &generation);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_EXTENDED_ADDR, 8, &extaddr);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_SHORT_ADDR, 2, &short_addr);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAN_ID, 2, &panid);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_ACKREQ_DEFAULT, 1, &ackreq);
+
+	return msg;
+}
+
+int main(int argc, char *argv[])
+{
+	struct l_genl_msg *msg;
+	struct nlattr_interface iface;
+	unsigned long i, iterations = 1000000;
+	uint64_t seen, start, elapsed;
+
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 0);
+
+	msg = build_interface_msg();
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		if (!nlattr_decode(msg, &nlattr_interface_table,
+							&iface, &seen)) {
+			fprintf(stderr, "decode failed\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	elapsed = now_ns() - start;
+
+	printf("nlattr_decode(interface): %lu iterations, %.1f ns/op, "
+			"%.0f ops/sec\n", iterations,
+			(double) elapsed / iterations,
+			iterations * 1e9 / (elapsed ? elapsed : 1));
+
+	l_genl_msg_unref(msg);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/nlattr.h"
+#include "src/pool.h"
+#include "src/phy.h"
+#include "unit/mock.h"
+
+#define ADAPTER		"net.connman.iwpand.Adapter"
+
+enum bench_op {
+	BENCH_GET_NAME,
+	BENCH_GET_PANID,
+	BENCH_GET_POWERED,
+	BENCH_SET_PANID,
+	BENCH_DECODE,
+};
+
+/*
+ * Floors are well below what a loaded build host manages; allocation
+ * counts are exact. IWPAND_BENCH_NO_FLOOR=1 skips the ops/sec floors,
+ * e.g. under valgrind.
+ */
+static const struct bench {
+	const char *name;
+	enum bench_op op;
+	unsigned long iterations;
+	double max_allocs;
+	double min_ops;
+} benches[] = {
+	{ "Adapter.Name get", BENCH_GET_NAME, 500000, 0, 200000 },
+	{ "Adapter.PanId get", BENCH_GET_PANID, 500000, 0, 200000 },
+	{ "Adapter.Powered get", BENCH_GET_POWERED, 500000, 0, 200000 },
+	{ "Adapter.PanId set", BENCH_SET_PANID, 200000, 3, 50000 },
+	{ "nlattr_decode(interface)", BENCH_DECODE, 1000000, 0, 1000000 },
+};
+
+static struct l_genl_msg *iface_msg;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool bench_run_once(enum bench_op op, unsigned long i)
+{
+	struct nlattr_interface iface;
+	char name[64];
+	uint16_t panid;
+	uint64_t seen;
+	bool value;
+
+	switch (op) {
+	case BENCH_GET_NAME:
+		return mock_dbus_get(ADAPTER, "/wpan0", "Name", name);
+	case BENCH_GET_PANID:
+		return mock_dbus_get(ADAPTER, "/wpan0", "PanId", &panid);
+	case BENCH_GET_POWERED:
+		return mock_dbus_get(ADAPTER, "/wpan0", "Powered", &value);
+	case BENCH_SET_PANID:
+		panid = i;
+		return !mock_dbus_set(ADAPTER, "/wpan0", "PanId", 'q',
+							&panid, &value) &&
+							value;
+	case BENCH_DECODE:
+		return nlattr_decode(iface_msg, &nlattr_interface_table,
+							&iface, &seen);
+	}
+
+	return false;
+}
+
+static bool bench_run(const struct bench *bench, bool floor)
+{
+	unsigned long i, allocations;
+	uint64_t start, elapsed;
+	double ops, allocs;
+
+	/* Warm up: lazily created state is not charged to the loop */
+	if (!bench_run_once(bench->op, 0))
+		return false;
+
+	allocations = mock_allocations;
+	start = now_ns();
+
+	for (i = 0; i < bench->iterations; i++)
+		if (!bench_run_once(bench->op, i))
+			return false;
+
+	elapsed = now_ns() - start;
+	allocations = mock_allocations - allocations;
+
+	ops = bench->iterations * 1e9 / (elapsed ? elapsed : 1);
+	allocs = (double) allocations / bench->iterations;
+
+	printf("%-26s %10.0f ops/sec %6.2f allocs/op\n",
+						bench->name, ops, allocs);
+
+	if (allocs > bench->max_allocs) {
+		fprintf(stderr, "%s: %.2f allocs/op, limit %.0f\n",
+				bench->name, allocs, bench->max_allocs);
+		return false;
+	}
+
+	if (floor && ops < bench->min_ops) {
+		fprintf(stderr, "%s: %.0f ops/sec, floor %.0f\n",
+				bench->name, ops, bench->min_ops);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *env = getenv("IWPAND_BENCH_NO_FLOOR");
+	bool floor = !env || strcmp(env, "1");
+	bool ok = true;
+	unsigned int i;
+
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	pool_init(512 * 1024);
+
+	if (!phy_init(mock_nl802154, 0xff, 0xff))
+		return EXIT_FAILURE;
+
+	iface_msg = mock_genl_interface(0, 3, "wpan0", 0xabcd);
+	mock_genl_dump_reply(NL802154_CMD_GET_INTERFACE,
+					l_genl_msg_ref(iface_msg));
+	mock_genl_dump_done(NL802154_CMD_GET_INTERFACE);
+
+	if (!mock_dbus_has_object("/wpan0", ADAPTER)) {
+		fprintf(stderr, "adapter not created\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(benches); i++)
+		if (!bench_run(&benches[i], floor)) {
+			fprintf(stderr, "%s: regression\n", benches[i].name);
+			ok = false;
+		}
+
+	l_genl_msg_unref(iface_msg);
+
+	phy_exit(mock_nl802154);
+	mock_reset();
+	pool_exit();
+	l_main_exit();
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/nlattr.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/*
+ * Input layout: one byte selecting the policy table followed by
+ * (u8 type, u8 len, len bytes) records. Records are appended as
+ * netlink attributes so that the decoder sees arbitrary types and
+ * lengths behind well formed nlattr headers.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct l_genl_msg *msg;
+	struct nlattr_interface iface;
+	struct nlattr_wpan_phy phy;
+	uint64_t seen;
+	size_t pos = 1;
+	uint8_t type, len;
+
+	if (size < 1)
+		return 0;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, size * 2 + 64);
+
+	while (pos + 2 <= size) {
+		type = data[pos];
+		len = data[pos + 1];
+		pos += 2;
+
+		if (len > size - pos)
+			len = size - pos;
+
+		l_genl_msg_append_attr(msg, type, len, data + pos);
+		pos += len;
+	}
+
+	memset(&iface, 0xaa, sizeof(iface));
+	memset(&phy, 0xaa, sizeof(phy));
+
+	if (data[0] & 1) {
+		if (nlattr_decode(msg, &nlattr_interface_table, &iface,
+						&seen) &&
+				(seen & NLATTR_BIT(NL802154_ATTR_IFNAME)) &&
+				!memchr(iface.name, '\0', sizeof(iface.name)))
+			abort();
+	} else {
+		if (nlattr_decode(msg, &nlattr_wpan_phy_table, &phy,
+						&seen) &&
+				(seen & NLATTR_BIT(NL802154_ATTR_WPAN_PHY_NAME)) &&
+				!memchr(phy.name, '\0', sizeof(phy.name)))
+			abort();
+	}
+
+	l_genl_msg_unref(msg);
+
+	return 0;
+}
+
+#ifndef HAVE_LIBFUZZER
+/* Standalone driver: replay one input from stdin (AFL compatible) */
+int main(int argc, char *argv[])
+{
+	static uint8_t buf[65536];
+	size_t size = 0;
+	ssize_t n;
+
+	while (size < sizeof(buf)) {
+		n = read(STDIN_FILENO, buf + size, sizeof(buf) - size);
+		if (n <= 0)
+			break;
+
+		size += n;
+	}
+
+	return LLVMFuzzerTestOneInput(buf, size);
+}
+#endif
@@ -0,0 +1,1723 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <ell/ell.h>
+
+#include "src/ieee802154.h"
+#include "src/nl802154.h"
+#include "src/nlattr.h"
+#include "unit/mock.h"
+
+#define MOCK_MAX		32
+#define MOCK_STRING_MAX		64
+#define MOCK_RTNL_MAX		16
+#define MOCK_RTNL_BUFSIZE	32768	/* RTNL_BUFSIZE in lowpan.c */
+#define MOCK_RTNL_FILTER_MAX	32
+#define MOCK_RTNL_REQUEST_MAX	64
+#define MOCK_RTNL_REQUEST_SIZE	256
+#define MOCK_METHOD_MAX		64
+#define MOCK_ARG_MAX		4
+#define MOCK_ARG_NAME_MAX	8	/* Return values and parameters */
+#define MOCK_IFINDEX_BASE	100	/* Interfaces from NEW_INTERFACE */
+
+/* Allocation counting */
+
+unsigned long mock_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+int __real_vasprintf(char **strp, const char *fmt, va_list ap);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+char *__wrap_strdup(const char *s);
+char *__wrap_strndup(const char *s, size_t n);
+int __wrap_vasprintf(char **strp, const char *fmt, va_list ap);
+
+void *__wrap_malloc(size_t size)
+{
+	mock_allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	mock_allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	mock_allocations++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	mock_allocations++;
+	return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n)
+{
+	mock_allocations++;
+	return __real_strndup(s, n);
+}
+
+int __wrap_vasprintf(char **strp, const char *fmt, va_list ap)
+{
+	mock_allocations++;
+	return __real_vasprintf(strp, fmt, ap);
+}
+
+/* Generic netlink */
+
+struct mock_dump {
+	uint8_t cmd;
+	l_genl_msg_func_t callback;
+	void *user_data;
+	l_genl_destroy_func_t destroy;
+};
+
+/* Commands waiting for mock_genl_ack(), in the order sent */
+struct mock_request {
+	unsigned int id;
+	uint8_t cmd;
+	l_genl_msg_func_t callback;
+	void *user_data;
+	l_genl_destroy_func_t destroy;
+};
+
+static int family_tag;
+struct l_genl_family *mock_nl802154 = (struct l_genl_family *) &family_tag;
+
+static struct mock_dump dumps[MOCK_MAX];
+static unsigned int dump_count;
+static struct mock_request requests[MOCK_MAX];
+static unsigned int request_count;
+static bool hold;
+static struct l_genl_msg *last_sent;
+static unsigned int sent_count;
+static unsigned int last_id;
+
+/* Reply being handed to a callback by mock_genl_ack() */
+static struct l_genl_msg *ack_msg;
+static int ack_error;
+
+/* Names given to NL802154_CMD_NEW_INTERFACE since mock_reset() */
+static char created[MOCK_MAX][IFNAMSIZ];
+static unsigned int created_count;
+
+unsigned int __wrap_l_genl_family_send(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy);
+unsigned int __wrap_l_genl_family_dump(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy);
+bool __wrap_l_genl_family_cancel(struct l_genl_family *family,
+							unsigned int id);
+int __wrap_l_genl_msg_get_error(struct l_genl_msg *msg);
+int __real_l_genl_msg_get_error(struct l_genl_msg *msg);
+unsigned int __wrap_if_nametoindex(const char *ifname);
+unsigned int __real_if_nametoindex(const char *ifname);
+
+static void record_created(struct l_genl_msg *msg)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != NL802154_ATTR_IFNAME || created_count == MOCK_MAX)
+			continue;
+
+		snprintf(created[created_count++], IFNAMSIZ, "%.*s",
+						(int) len, (const char *) data);
+	}
+}
+
+/*
+ * Commands are acknowledged at once, the callback is not invoked.
+ * After mock_genl_hold(true), commands with a callback wait for
+ * mock_genl_ack() instead.
+ */
+unsigned int __wrap_l_genl_family_send(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy)
+{
+	struct mock_request *request;
+
+	if (last_sent)
+		l_genl_msg_unref(last_sent);
+
+	last_sent = msg;
+	sent_count++;
+
+	if (l_genl_msg_get_command(msg) == NL802154_CMD_NEW_INTERFACE)
+		record_created(msg);
+
+	if (hold && callback && request_count < MOCK_MAX) {
+		request = &requests[request_count++];
+		request->id = ++last_id;
+		request->cmd = l_genl_msg_get_command(msg);
+		request->callback = callback;
+		request->user_data = user_data;
+		request->destroy = destroy;
+
+		return request->id;
+	}
+
+	if (destroy)
+		destroy(user_data);
+
+	return ++last_id;
+}
+
+unsigned int __wrap_l_genl_family_dump(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy)
+{
+	struct mock_dump *dump;
+
+	if (dump_count == MOCK_MAX) {
+		l_genl_msg_unref(msg);
+		return 0;
+	}
+
+	dump = &dumps[dump_count++];
+	dump->cmd = l_genl_msg_get_command(msg);
+	dump->callback = callback;
+	dump->user_data = user_data;
+	dump->destroy = destroy;
+
+	l_genl_msg_unref(msg);
+
+	return ++last_id;
+}
+
+static void request_remove(unsigned int index)
+{
+	memmove(&requests[index], &requests[index + 1],
+			(--request_count - index) * sizeof(requests[0]));
+}
+
+bool __wrap_l_genl_family_cancel(struct l_genl_family *family,
+							unsigned int id)
+{
+	struct mock_request request;
+	unsigned int i;
+
+	for (i = 0; i < request_count; i++) {
+		if (requests[i].id != id)
+			continue;
+
+		request = requests[i];
+		request_remove(i);
+
+		if (request.destroy)
+			request.destroy(request.user_data);
+
+		break;
+	}
+
+	return true;
+}
+
+int __wrap_l_genl_msg_get_error(struct l_genl_msg *msg)
+{
+	if (msg && msg == ack_msg)
+		return ack_error;
+
+	return __real_l_genl_msg_get_error(msg);
+}
+
+unsigned int __wrap_if_nametoindex(const char *ifname)
+{
+	unsigned int i;
+
+	for (i = 0; i < created_count; i++)
+		if (!strcmp(created[i], ifname))
+			return MOCK_IFINDEX_BASE + i;
+
+	return __real_if_nametoindex(ifname);
+}
+
+void mock_genl_hold(bool enable)
+{
+	hold = enable;
+}
+
+unsigned int mock_genl_held(void)
+{
+	return request_count;
+}
+
+/* Answers the oldest held command of that type */
+bool mock_genl_ack(uint8_t cmd, int error)
+{
+	struct mock_request request;
+	unsigned int i;
+
+	for (i = 0; i < request_count; i++)
+		if (requests[i].cmd == cmd)
+			break;
+
+	if (i == request_count)
+		return false;
+
+	request = requests[i];
+	request_remove(i);
+
+	ack_msg = l_genl_msg_new(cmd);
+	ack_error = error;
+
+	request.callback(ack_msg, request.user_data);
+
+	l_genl_msg_unref(ack_msg);
+	ack_msg = NULL;
+
+	if (request.destroy)
+		request.destroy(request.user_data);
+
+	return true;
+}
+
+/* As freeing the family does: held commands are cancelled */
+void mock_genl_cancel_all(void)
+{
+	struct mock_request request;
+
+	while (request_count) {
+		request = requests[0];
+		request_remove(0);
+
+		if (request.destroy)
+			request.destroy(request.user_data);
+	}
+}
+
+unsigned int mock_genl_sent(void)
+{
+	return sent_count;
+}
+
+struct l_genl_msg *mock_genl_last_sent(void)
+{
+	return last_sent;
+}
+
+static struct mock_dump *dump_find(uint8_t cmd)
+{
+	unsigned int i;
+
+	for (i = 0; i < dump_count; i++)
+		if (dumps[i].cmd == cmd)
+			return &dumps[i];
+
+	return NULL;
+}
+
+bool mock_genl_dump_reply(uint8_t cmd, struct l_genl_msg *msg)
+{
+	struct mock_dump *dump = dump_find(cmd);
+
+	if (dump)
+		dump->callback(msg, dump->user_data);
+
+	l_genl_msg_unref(msg);
+
+	return dump;
+}
+
+bool mock_genl_dump_done(uint8_t cmd)
+{
+	struct mock_dump *dump = dump_find(cmd);
+
+	if (!dump)
+		return false;
+
+	if (dump->destroy)
+		dump->destroy(dump->user_data);
+
+	*dump = dumps[--dump_count];
+
+	return true;
+}
+
+struct l_genl_msg *mock_genl_wpan_phy(uint32_t id, const char *name,
+					uint8_t page, uint8_t channel)
+{
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_WPAN_PHY, 128);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY, 4, &id);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY_NAME,
+						strlen(name) + 1, name);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAGE, 1, &page);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_CHANNEL, 1, &channel);
+
+	return msg;
+}
+
+/* One bitmap per page as the kernel sends them, only 'page' set */
+void mock_genl_append_channels(struct l_genl_msg *msg, uint8_t page,
+							uint32_t channels)
+{
+	uint32_t none = 0;
+	unsigned int i;
+
+	l_genl_msg_enter_nested(msg, NL802154_ATTR_CHANNELS_SUPPORTED);
+
+	for (i = 0; i < NLATTR_PAGES; i++)
+		l_genl_msg_append_attr(msg, NL802154_ATTR_SUPPORTED_CHANNEL,
+					4, i == page ? &channels : &none);
+
+	l_genl_msg_leave_nested(msg);
+}
+
+struct l_genl_msg *mock_genl_interface(uint32_t phy, uint32_t ifindex,
+					const char *name, uint16_t panid)
+{
+	struct l_genl_msg *msg;
+	uint32_t iftype = NL802154_IFTYPE_NODE;
+	uint64_t extaddr = 0x0123456789abcdefULL + ifindex;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, 128);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_WPAN_PHY, 4, &phy);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFNAME,
+						strlen(name) + 1, name);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFTYPE, 4, &iftype);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_EXTENDED_ADDR, 8, &extaddr);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAN_ID, 2, &panid);
+
+	return msg;
+}
+
+/* D-Bus */
+
+struct mock_property {
+	const char *interface;
+	const char *name;
+	const char *signature;
+	l_dbus_property_get_cb_t getter;
+	l_dbus_property_set_cb_t setter;
+};
+
+struct mock_object {
+	char path[MOCK_STRING_MAX];
+	const char *interface;
+	void *user_data;
+};
+
+struct mock_method {
+	const char *interface;
+	const char *name;
+	const char *returns;
+	const char *params;
+	const char *args[MOCK_ARG_NAME_MAX + 1];
+	l_dbus_interface_method_cb_t cb;
+};
+
+struct mock_arg {
+	char type;
+	union {
+		uint32_t u;
+		uint64_t t;
+		const char *s;
+	};
+};
+
+static struct mock_property properties[MOCK_MAX];
+static unsigned int property_count;
+static struct mock_method methods[MOCK_METHOD_MAX];
+static unsigned int method_count;
+static struct mock_object objects[MOCK_MAX];
+static unsigned int object_count;
+static unsigned int changed_count;
+
+/*
+ * Messages are tags: errors point to their name, method returns to
+ * return_tag. message_tag stands for the incoming call, whose
+ * arguments are in args.
+ */
+static char error_names[MOCK_MAX][MOCK_STRING_MAX];
+static unsigned int error_index;
+static int message_tag;
+static int return_tag;
+static struct mock_arg args[MOCK_ARG_MAX];
+static unsigned int arg_count;
+static struct l_dbus_message *last_reply;
+
+static struct {
+	char type;
+	union {
+		bool b;
+		uint8_t y;
+		uint16_t q;
+		uint32_t u;
+		uint64_t t;
+		char s[MOCK_STRING_MAX];
+	};
+} value;
+
+bool __wrap_l_dbus_register_interface(struct l_dbus *dbus,
+				const char *interface,
+				l_dbus_interface_setup_func_t setup_func,
+				l_dbus_destroy_func_t destroy,
+				bool old_style_properties);
+bool __wrap_l_dbus_unregister_interface(struct l_dbus *dbus,
+						const char *interface);
+bool __wrap_l_dbus_interface_property(struct l_dbus_interface *interface,
+					const char *name, uint32_t flags,
+					const char *signature,
+					l_dbus_property_get_cb_t getter,
+					l_dbus_property_set_cb_t setter);
+bool __wrap_l_dbus_interface_method(struct l_dbus_interface *interface,
+					const char *name, uint32_t flags,
+					l_dbus_interface_method_cb_t cb,
+					const char *return_sig,
+					const char *param_sig, ...);
+bool __wrap_l_dbus_object_add_interface(struct l_dbus *dbus,
+					const char *object,
+					const char *interface,
+					void *user_data);
+bool __wrap_l_dbus_unregister_object(struct l_dbus *dbus,
+						const char *object);
+bool __wrap_l_dbus_property_changed(struct l_dbus *dbus, const char *path,
+					const char *interface,
+					const char *property);
+bool __wrap_l_dbus_message_builder_append_basic(
+				struct l_dbus_message_builder *builder,
+				char type, const void *data);
+bool __real_l_dbus_message_builder_append_basic(
+				struct l_dbus_message_builder *builder,
+				char type, const void *data);
+bool __wrap_l_dbus_message_iter_get_variant(
+				struct l_dbus_message_iter *iter,
+				const char *signature, ...);
+const char *__wrap_l_dbus_message_get_sender(
+				struct l_dbus_message *message);
+struct l_dbus_message *__wrap_l_dbus_message_new_error(
+				struct l_dbus_message *method_call,
+				const char *name, const char *format, ...);
+uint32_t __wrap_l_dbus_send(struct l_dbus *dbus,
+				struct l_dbus_message *message);
+bool __wrap_l_dbus_message_get_arguments(struct l_dbus_message *message,
+					const char *signature, ...);
+struct l_dbus_message *__wrap_l_dbus_message_new_method_return(
+				struct l_dbus_message *method_call);
+struct l_dbus_message *__real_l_dbus_message_new_method_return(
+				struct l_dbus_message *method_call);
+bool __wrap_l_dbus_message_set_arguments(struct l_dbus_message *message,
+					const char *signature, ...);
+struct l_dbus_message *__wrap_l_dbus_message_ref(
+				struct l_dbus_message *message);
+struct l_dbus_message *__real_l_dbus_message_ref(
+				struct l_dbus_message *message);
+void __wrap_l_dbus_message_unref(struct l_dbus_message *message);
+void __real_l_dbus_message_unref(struct l_dbus_message *message);
+
+static unsigned int complete_types(const char *sig)
+{
+	unsigned int count = 0;
+	int depth = 0;
+
+	for (; *sig; sig++) {
+		if (*sig == '(' || *sig == '{')
+			depth++;
+		else if (*sig == ')' || *sig == '}')
+			depth--;
+
+		/* An array is complete with its element type */
+		if (!depth && *sig != 'a')
+			count++;
+	}
+
+	return count;
+}
+
+static bool message_is_tag(const struct l_dbus_message *message)
+{
+	const char *p = (const char *) message;
+
+	return p == (const char *) &message_tag ||
+			p == (const char *) &return_tag ||
+			(p >= error_names[0] && p <= error_names[MOCK_MAX - 1]);
+}
+
+bool __wrap_l_dbus_register_interface(struct l_dbus *dbus,
+				const char *interface,
+				l_dbus_interface_setup_func_t setup_func,
+				l_dbus_destroy_func_t destroy,
+				bool old_style_properties)
+{
+	/* The interface handle is its name */
+	setup_func((struct l_dbus_interface *) interface);
+
+	return true;
+}
+
+bool __wrap_l_dbus_unregister_interface(struct l_dbus *dbus,
+						const char *interface)
+{
+	unsigned int i = 0;
+
+	while (i < property_count) {
+		if (strcmp(properties[i].interface, interface)) {
+			i++;
+			continue;
+		}
+
+		properties[i] = properties[--property_count];
+	}
+
+	i = 0;
+
+	while (i < method_count) {
+		if (strcmp(methods[i].interface, interface)) {
+			i++;
+			continue;
+		}
+
+		methods[i] = methods[--method_count];
+	}
+
+	return true;
+}
+
+bool __wrap_l_dbus_interface_property(struct l_dbus_interface *interface,
+					const char *name, uint32_t flags,
+					const char *signature,
+					l_dbus_property_get_cb_t getter,
+					l_dbus_property_set_cb_t setter)
+{
+	struct mock_property *property;
+
+	if (property_count == MOCK_MAX)
+		return false;
+
+	property = &properties[property_count++];
+	property->interface = (const char *) interface;
+	property->name = name;
+	property->signature = signature;
+	property->getter = getter;
+	property->setter = setter;
+
+	return true;
+}
+
+bool __wrap_l_dbus_interface_method(struct l_dbus_interface *interface,
+					const char *name, uint32_t flags,
+					l_dbus_interface_method_cb_t cb,
+					const char *return_sig,
+					const char *param_sig, ...)
+{
+	struct mock_method *method;
+	unsigned int count;
+	unsigned int i;
+	va_list ap;
+
+	count = complete_types(return_sig) + complete_types(param_sig);
+
+	if (method_count == MOCK_METHOD_MAX || count > MOCK_ARG_NAME_MAX)
+		return false;
+
+	method = &methods[method_count++];
+	memset(method, 0, sizeof(*method));
+	method->interface = (const char *) interface;
+	method->name = name;
+	method->returns = return_sig;
+	method->params = param_sig;
+	method->cb = cb;
+
+	/* One name per complete type, as ELL reads them */
+	va_start(ap, param_sig);
+
+	for (i = 0; i < count; i++)
+		method->args[i] = va_arg(ap, const char *);
+
+	va_end(ap);
+
+	return true;
+}
+
+bool __wrap_l_dbus_object_add_interface(struct l_dbus *dbus,
+					const char *object,
+					const char *interface,
+					void *user_data)
+{
+	struct mock_object *obj;
+
+	if (object_count == MOCK_MAX)
+		return false;
+
+	obj = &objects[object_count++];
+	snprintf(obj->path, sizeof(obj->path), "%s", object);
+	obj->interface = interface;
+	obj->user_data = user_data;
+
+	return true;
+}
+
+bool __wrap_l_dbus_unregister_object(struct l_dbus *dbus,
+						const char *object)
+{
+	unsigned int i = 0;
+
+	while (i < object_count) {
+		if (strcmp(objects[i].path, object)) {
+			i++;
+			continue;
+		}
+
+		objects[i] = objects[--object_count];
+	}
+
+	return true;
+}
+
+bool __wrap_l_dbus_property_changed(struct l_dbus *dbus, const char *path,
+					const char *interface,
+					const char *property)
+{
+	changed_count++;
+
+	return true;
+}
+
+bool __wrap_l_dbus_message_builder_append_basic(
+				struct l_dbus_message_builder *builder,
+				char type, const void *data)
+{
+	/* Real messages, built by code under test */
+	if (builder && builder != (struct l_dbus_message_builder *) &value)
+		return __real_l_dbus_message_builder_append_basic(builder,
+								type, data);
+
+	value.type = type;
+
+	switch (type) {
+	case 'b':
+		value.b = *(const bool *) data;
+		break;
+	case 'y':
+		value.y = *(const uint8_t *) data;
+		break;
+	case 'q':
+		value.q = *(const uint16_t *) data;
+		break;
+	case 'u':
+		value.u = *(const uint32_t *) data;
+		break;
+	case 't':
+		value.t = *(const uint64_t *) data;
+		break;
+	case 's':
+	case 'o':
+		snprintf(value.s, sizeof(value.s), "%s", (const char *) data);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool __wrap_l_dbus_message_iter_get_variant(
+				struct l_dbus_message_iter *iter,
+				const char *signature, ...)
+{
+	va_list args;
+	void *out;
+
+	if (signature[0] != value.type || signature[1] != '\0')
+		return false;
+
+	va_start(args, signature);
+	out = va_arg(args, void *);
+	va_end(args);
+
+	switch (value.type) {
+	case 'b':
+		*(bool *) out = value.b;
+		break;
+	case 'y':
+		*(uint8_t *) out = value.y;
+		break;
+	case 'q':
+		*(uint16_t *) out = value.q;
+		break;
+	case 'u':
+		*(uint32_t *) out = value.u;
+		break;
+	case 't':
+		*(uint64_t *) out = value.t;
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+const char *__wrap_l_dbus_message_get_sender(
+				struct l_dbus_message *message)
+{
+	return ":1.1";
+}
+
+struct l_dbus_message *__wrap_l_dbus_message_new_error(
+				struct l_dbus_message *method_call,
+				const char *name, const char *format, ...)
+{
+	char *error = error_names[error_index++ % MOCK_MAX];
+
+	snprintf(error, MOCK_STRING_MAX, "%s", name);
+
+	return (struct l_dbus_message *) error;
+}
+
+uint32_t __wrap_l_dbus_send(struct l_dbus *dbus,
+				struct l_dbus_message *message)
+{
+	last_reply = message;
+
+	return 1;
+}
+
+/* Basic types of the call made by mock_dbus_call() */
+bool __wrap_l_dbus_message_get_arguments(struct l_dbus_message *message,
+					const char *signature, ...)
+{
+	va_list ap;
+	void *out;
+	unsigned int i;
+	bool ret;
+
+	if (message != (struct l_dbus_message *) &message_tag) {
+		va_start(ap, signature);
+		ret = l_dbus_message_get_arguments_valist(message, signature,
+									ap);
+		va_end(ap);
+
+		return ret;
+	}
+
+	if (strlen(signature) != arg_count)
+		return false;
+
+	for (i = 0; i < arg_count; i++)
+		if (signature[i] != args[i].type)
+			return false;
+
+	va_start(ap, signature);
+
+	for (i = 0; i < arg_count; i++) {
+		out = va_arg(ap, void *);
+
+		switch (args[i].type) {
+		case 'b':
+			*(bool *) out = args[i].u;
+			break;
+		case 'y':
+			*(uint8_t *) out = args[i].u;
+			break;
+		case 'q':
+			*(uint16_t *) out = args[i].u;
+			break;
+		case 'u':
+			*(uint32_t *) out = args[i].u;
+			break;
+		case 't':
+			*(uint64_t *) out = args[i].t;
+			break;
+		case 's':
+		case 'o':
+			*(const char **) out = args[i].s;
+			break;
+		}
+	}
+
+	va_end(ap);
+
+	return true;
+}
+
+struct l_dbus_message *__wrap_l_dbus_message_new_method_return(
+				struct l_dbus_message *method_call)
+{
+	if (!message_is_tag(method_call))
+		return __real_l_dbus_message_new_method_return(method_call);
+
+	return (struct l_dbus_message *) &return_tag;
+}
+
+bool __wrap_l_dbus_message_set_arguments(struct l_dbus_message *message,
+					const char *signature, ...)
+{
+	va_list ap;
+	bool ret;
+
+	if (message_is_tag(message))
+		return true;
+
+	va_start(ap, signature);
+	ret = l_dbus_message_set_arguments_valist(message, signature, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+struct l_dbus_message *__wrap_l_dbus_message_ref(
+				struct l_dbus_message *message)
+{
+	if (message_is_tag(message))
+		return message;
+
+	return __real_l_dbus_message_ref(message);
+}
+
+void __wrap_l_dbus_message_unref(struct l_dbus_message *message)
+{
+	if (message_is_tag(message))
+		return;
+
+	__real_l_dbus_message_unref(message);
+}
+
+bool mock_dbus_has_object(const char *path, const char *interface)
+{
+	unsigned int i;
+
+	for (i = 0; i < object_count; i++)
+		if (!strcmp(objects[i].path, path) &&
+				!strcmp(objects[i].interface, interface))
+			return true;
+
+	return false;
+}
+
+static struct mock_property *property_find(const char *interface,
+						const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < property_count; i++)
+		if (!strcmp(properties[i].interface, interface) &&
+				!strcmp(properties[i].name, name))
+			return &properties[i];
+
+	return NULL;
+}
+
+static void *object_find(const char *path, const char *interface)
+{
+	unsigned int i;
+
+	for (i = 0; i < object_count; i++)
+		if (!strcmp(objects[i].path, path) &&
+				!strcmp(objects[i].interface, interface))
+			return objects[i].user_data;
+
+	return NULL;
+}
+
+/* Basic types are stored as is, strings copied (64 bytes at most) */
+bool mock_dbus_get(const char *interface, const char *path,
+				const char *property, void *out)
+{
+	struct mock_property *prop = property_find(interface, property);
+	void *user_data = object_find(path, interface);
+	struct l_dbus_message_builder *builder;
+
+	if (!prop || !prop->getter || !user_data)
+		return false;
+
+	builder = (struct l_dbus_message_builder *) &value;
+	value.type = 0;
+
+	if (!prop->getter(NULL, (struct l_dbus_message *) &message_tag,
+							builder, user_data))
+		return false;
+
+	switch (value.type) {
+	case 'b':
+		*(bool *) out = value.b;
+		break;
+	case 'y':
+		*(uint8_t *) out = value.y;
+		break;
+	case 'q':
+		*(uint16_t *) out = value.q;
+		break;
+	case 'u':
+		*(uint32_t *) out = value.u;
+		break;
+	case 't':
+		*(uint64_t *) out = value.t;
+		break;
+	case 's':
+	case 'o':
+		memcpy(out, value.s, sizeof(value.s));
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static bool *set_completed;
+
+static void set_complete(struct l_dbus *dbus, struct l_dbus_message *message,
+					struct l_dbus_message *error)
+{
+	if (set_completed)
+		*set_completed = !error;
+}
+
+struct l_dbus_message *mock_dbus_set(const char *interface, const char *path,
+				const char *property, char type,
+				const void *data, bool *completed)
+{
+	struct mock_property *prop = property_find(interface, property);
+	void *user_data = object_find(path, interface);
+	struct l_dbus_message *reply;
+
+	*completed = false;
+
+	if (!prop || !prop->setter || !user_data)
+		return NULL;
+
+	__wrap_l_dbus_message_builder_append_basic(NULL, type, data);
+
+	set_completed = completed;
+	reply = prop->setter(NULL, (struct l_dbus_message *) &message_tag,
+				(struct l_dbus_message_iter *) &value,
+				set_complete, user_data);
+	set_completed = NULL;
+
+	return reply;
+}
+
+static struct mock_method *method_find(const char *interface,
+						const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < method_count; i++)
+		if (!strcmp(methods[i].interface, interface) &&
+					!strcmp(methods[i].name, name))
+			return &methods[i];
+
+	return NULL;
+}
+
+/* Basic types only, in the usual promoted vararg types */
+struct l_dbus_message *mock_dbus_call(const char *interface,
+					const char *path, const char *name,
+					const char *signature, ...)
+{
+	void *user_data = object_find(path, interface);
+	struct mock_method *method = method_find(interface, name);
+	va_list ap;
+
+	if (!method || !user_data || strlen(signature) > MOCK_ARG_MAX)
+		return NULL;
+
+	va_start(ap, signature);
+
+	for (arg_count = 0; signature[arg_count]; arg_count++) {
+		struct mock_arg *arg = &args[arg_count];
+
+		arg->type = signature[arg_count];
+
+		switch (arg->type) {
+		case 'b':
+		case 'y':
+		case 'q':
+		case 'u':
+			arg->u = va_arg(ap, unsigned int);
+			break;
+		case 't':
+			arg->t = va_arg(ap, uint64_t);
+			break;
+		case 's':
+		case 'o':
+			arg->s = va_arg(ap, const char *);
+			break;
+		default:
+			va_end(ap);
+			arg_count = 0;
+			return NULL;
+		}
+	}
+
+	va_end(ap);
+
+	return method->cb(NULL, (struct l_dbus_message *) &message_tag,
+								user_data);
+}
+
+unsigned int mock_dbus_methods(const char *interface)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < method_count; i++)
+		if (!strcmp(methods[i].interface, interface))
+			count++;
+
+	return count;
+}
+
+/* args: names of the return values, then of the parameters */
+bool mock_dbus_method(const char *interface, const char *name,
+				const char **returns, const char **params,
+				const char *const **args)
+{
+	struct mock_method *method = method_find(interface, name);
+
+	if (!method)
+		return false;
+
+	*returns = method->returns;
+	*params = method->params;
+	*args = method->args;
+
+	return true;
+}
+
+unsigned int mock_dbus_properties(const char *interface)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < property_count; i++)
+		if (!strcmp(properties[i].interface, interface))
+			count++;
+
+	return count;
+}
+
+bool mock_dbus_property(const char *interface, const char *name,
+				const char **signature, bool *writable)
+{
+	struct mock_property *prop = property_find(interface, name);
+
+	if (!prop)
+		return false;
+
+	*signature = prop->signature;
+	*writable = prop->setter;
+
+	return true;
+}
+
+/* NULL for a method return */
+const char *mock_dbus_error(struct l_dbus_message *reply)
+{
+	if (reply == (struct l_dbus_message *) &return_tag)
+		return NULL;
+
+	return (const char *) reply;
+}
+
+struct l_dbus_message *mock_dbus_last_reply(void)
+{
+	return last_reply;
+}
+
+unsigned int mock_dbus_changed(void)
+{
+	return changed_count;
+}
+
+/* rtnl */
+
+struct mock_rtnl_msg {
+	bool overflow;
+	size_t len;
+	uint8_t data[MOCK_RTNL_BUFSIZE];
+};
+
+static int rtnl_fd = -1;
+static l_io_read_cb_t rtnl_read;
+static struct l_io *rtnl_io;
+static struct mock_rtnl_msg rtnl_queue[MOCK_RTNL_MAX];
+static unsigned int rtnl_head, rtnl_tail;
+static unsigned int rtnl_dumps;
+static uint32_t rtnl_dump_seq;
+static uint32_t rtnl_last_seq;
+static struct sock_filter rtnl_filter[MOCK_RTNL_FILTER_MAX];
+static unsigned int rtnl_filter_len;
+
+/* Requests sent with sendmsg(), by route.c */
+static uint8_t rtnl_requests[MOCK_RTNL_REQUEST_MAX][MOCK_RTNL_REQUEST_SIZE];
+static unsigned int rtnl_request_count;
+
+/* Raw 802.15.4 socket opened by inject.c */
+static int wpan_raw_fd = -1;
+static int wpan_raw_peer = -1;
+
+/* Datagram socket opened by neighbor.c, never readable */
+static int wpan_dgram_fd = -1;
+
+/* Packet socket opened by survey.c or capture.c, never readable */
+static int packet_fd = -1;
+
+/* Address the last socket of each type was bound to */
+static struct sockaddr_ieee802154 wpan_raw_sa;
+static struct sockaddr_ieee802154 wpan_dgram_sa;
+
+int __real_socket(int domain, int type, int protocol);
+int __real_bind(int fd, const struct sockaddr *addr, socklen_t len);
+int __real_setsockopt(int fd, int level, int name, const void *val,
+							socklen_t len);
+int __real_getsockopt(int fd, int level, int name, void *val,
+							socklen_t *len);
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+int __real_ioctl(int fd, unsigned long request, ...);
+
+int __wrap_socket(int domain, int type, int protocol);
+int __wrap_bind(int fd, const struct sockaddr *addr, socklen_t len);
+int __wrap_setsockopt(int fd, int level, int name, const void *val,
+							socklen_t len);
+int __wrap_getsockopt(int fd, int level, int name, void *val,
+							socklen_t *len);
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags);
+int __wrap_ioctl(int fd, unsigned long request, ...);
+bool __wrap_l_io_set_read_handler(struct l_io *io, l_io_read_cb_t callback,
+				void *user_data, l_io_destroy_cb_t destroy);
+bool __real_l_io_set_read_handler(struct l_io *io, l_io_read_cb_t callback,
+				void *user_data, l_io_destroy_cb_t destroy);
+void __wrap_l_io_destroy(struct l_io *io);
+void __real_l_io_destroy(struct l_io *io);
+
+/* No 802.15.4 in the test environment, rtnl is faked */
+int __wrap_socket(int domain, int type, int protocol)
+{
+	if (domain == AF_NETLINK && protocol == NETLINK_ROUTE) {
+		rtnl_fd = eventfd(0, EFD_CLOEXEC);
+		return rtnl_fd;
+	}
+
+	if (domain == AF_NETLINK || domain == AF_INET || domain == AF_UNIX)
+		return __real_socket(domain, type, protocol);
+
+	/* Injected frames land on the test end of a datagram pair */
+	if (domain == AF_IEEE802154 && (type & 0xf) == SOCK_RAW) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC |
+						SOCK_NONBLOCK, 0, sv) < 0)
+			return -1;
+
+		if (wpan_raw_peer >= 0)
+			close(wpan_raw_peer);
+
+		wpan_raw_fd = sv[0];
+		wpan_raw_peer = sv[1];
+
+		return wpan_raw_fd;
+	}
+
+	if (domain == AF_IEEE802154 && (type & 0xf) == SOCK_DGRAM) {
+		wpan_dgram_fd = __real_socket(AF_UNIX, SOCK_DGRAM |
+					SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		return wpan_dgram_fd;
+	}
+
+	if (domain == AF_PACKET) {
+		packet_fd = __real_socket(AF_UNIX, SOCK_DGRAM |
+					SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		return packet_fd;
+	}
+
+	errno = EAFNOSUPPORT;
+	return -1;
+}
+
+int __wrap_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	if (fd == wpan_raw_fd || fd == wpan_dgram_fd) {
+		if (len > sizeof(wpan_raw_sa))
+			len = sizeof(wpan_raw_sa);
+
+		memcpy(fd == wpan_raw_fd ? &wpan_raw_sa : &wpan_dgram_sa,
+								addr, len);
+		return 0;
+	}
+
+	if (fd != rtnl_fd && fd != packet_fd)
+		return __real_bind(fd, addr, len);
+
+	return 0;
+}
+
+int __wrap_setsockopt(int fd, int level, int name, const void *val,
+							socklen_t len)
+{
+	const struct sock_fprog *prog = val;
+
+	/* WPAN_WANTLQI */
+	if (fd == wpan_dgram_fd)
+		return 0;
+
+	if (fd != rtnl_fd)
+		return __real_setsockopt(fd, level, name, val, len);
+
+	if (level == SOL_SOCKET && name == SO_ATTACH_FILTER) {
+		if (prog->len > MOCK_RTNL_FILTER_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		memcpy(rtnl_filter, prog->filter,
+					prog->len * sizeof(rtnl_filter[0]));
+		rtnl_filter_len = prog->len;
+	}
+
+	return 0;
+}
+
+int __wrap_getsockopt(int fd, int level, int name, void *val,
+							socklen_t *len)
+{
+	if (fd != rtnl_fd)
+		return __real_getsockopt(fd, level, name, val, len);
+
+	if (level != SOL_SOCKET || name != SO_RCVBUF)
+		return -1;
+
+	*(int *) val = 1 << 20;
+
+	return 0;
+}
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags)
+{
+	const struct nlmsghdr *nlh = buf;
+
+	if (fd != rtnl_fd)
+		return __real_send(fd, buf, len, flags);
+
+	rtnl_last_seq = nlh->nlmsg_seq;
+
+	if (nlh->nlmsg_type == RTM_GETLINK &&
+					(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		rtnl_dumps++;
+		rtnl_dump_seq = nlh->nlmsg_seq;
+	}
+
+	return len;
+}
+
+/* One request per iovec, as lowpan_rtnl_send() builds them */
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	ssize_t total = 0;
+	size_t i, len;
+
+	if (fd != rtnl_fd)
+		return __real_sendmsg(fd, msg, flags);
+
+	for (i = 0; i < msg->msg_iovlen; i++) {
+		len = msg->msg_iov[i].iov_len;
+		total += len;
+
+		if (rtnl_request_count == MOCK_RTNL_REQUEST_MAX ||
+						len > MOCK_RTNL_REQUEST_SIZE) {
+			errno = ENOBUFS;
+			return -1;
+		}
+
+		memcpy(rtnl_requests[rtnl_request_count++],
+					msg->msg_iov[i].iov_base, len);
+	}
+
+	return total;
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags)
+{
+	struct mock_rtnl_msg *msg;
+
+	if (fd != rtnl_fd)
+		return __real_recv(fd, buf, len, flags);
+
+	if (rtnl_head == rtnl_tail) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	msg = &rtnl_queue[rtnl_head++ % MOCK_RTNL_MAX];
+
+	if (msg->overflow) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	memcpy(buf, msg->data, msg->len);
+
+	return msg->len;
+}
+
+/* Interface flags of the monitor: bringing it up always works */
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd == packet_fd)
+		return 0;
+
+	return __real_ioctl(fd, request, arg);
+}
+
+bool __wrap_l_io_set_read_handler(struct l_io *io, l_io_read_cb_t callback,
+				void *user_data, l_io_destroy_cb_t destroy)
+{
+	if (l_io_get_fd(io) == rtnl_fd) {
+		rtnl_io = io;
+		rtnl_read = callback;
+	}
+
+	return __real_l_io_set_read_handler(io, callback, user_data,
+								destroy);
+}
+
+void __wrap_l_io_destroy(struct l_io *io)
+{
+	if (io && io == rtnl_io) {
+		rtnl_io = NULL;
+		rtnl_read = NULL;
+		rtnl_fd = -1;
+	}
+
+	__real_l_io_destroy(io);
+}
+
+bool mock_rtnl_open(void)
+{
+	return rtnl_read;
+}
+
+unsigned int mock_rtnl_dumps(void)
+{
+	return rtnl_dumps;
+}
+
+uint32_t mock_rtnl_dump_seq(void)
+{
+	return rtnl_dump_seq;
+}
+
+static struct mock_rtnl_msg *rtnl_queue_tail(void)
+{
+	struct mock_rtnl_msg *msg = &rtnl_queue[rtnl_tail++ % MOCK_RTNL_MAX];
+
+	memset(msg, 0, sizeof(*msg));
+
+	return msg;
+}
+
+void mock_rtnl_queue_link(uint16_t type, uint32_t seq, int ifindex,
+					const char *name, uint16_t arphrd)
+{
+	struct mock_rtnl_msg *msg = rtnl_queue_tail();
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg->data;
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *rta;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_flags = seq ? NLM_F_MULTI : 0;
+
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_type = arphrd;
+	ifi->ifi_index = ifindex;
+
+	rta = (struct rtattr *) ((uint8_t *) nlh +
+					NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = IFLA_IFNAME;
+	rta->rta_len = RTA_LENGTH(strlen(name) + 1);
+	memcpy(RTA_DATA(rta), name, strlen(name) + 1);
+
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) +
+						RTA_ALIGN(rta->rta_len);
+	msg->len = nlh->nlmsg_len;
+}
+
+static void rtnl_append(struct nlmsghdr *nlh, uint16_t type,
+					const void *data, size_t len)
+{
+	struct rtattr *rta = (struct rtattr *) ((uint8_t *) nlh +
+					NLMSG_ALIGN(nlh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) +
+						RTA_ALIGN(rta->rta_len);
+}
+
+/* RTM_GETADDR dump part */
+void mock_rtnl_queue_addr(uint32_t seq, int ifindex, const char *addr,
+						uint8_t plen, uint8_t scope)
+{
+	struct mock_rtnl_msg *msg = rtnl_queue_tail();
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg->data;
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct in6_addr in6;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifa));
+	nlh->nlmsg_type = RTM_NEWADDR;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_flags = NLM_F_MULTI;
+
+	ifa->ifa_family = AF_INET6;
+	ifa->ifa_prefixlen = plen;
+	ifa->ifa_scope = scope;
+	ifa->ifa_index = ifindex;
+
+	inet_pton(AF_INET6, addr, &in6);
+	rtnl_append(nlh, IFA_ADDRESS, &in6, sizeof(in6));
+
+	msg->len = nlh->nlmsg_len;
+}
+
+/* RTM_GETROUTE dump part in the main table, gateway NULL if on link */
+void mock_rtnl_queue_route(uint32_t seq, int ifindex, const char *dst,
+				uint8_t plen, const char *gateway,
+				uint8_t protocol)
+{
+	struct mock_rtnl_msg *msg = rtnl_queue_tail();
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg->data;
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct in6_addr in6;
+	uint32_t oif = ifindex;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*rtm));
+	nlh->nlmsg_type = RTM_NEWROUTE;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_flags = NLM_F_MULTI;
+
+	rtm->rtm_family = AF_INET6;
+	rtm->rtm_dst_len = plen;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = protocol;
+	rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+	rtm->rtm_type = RTN_UNICAST;
+
+	inet_pton(AF_INET6, dst, &in6);
+	rtnl_append(nlh, RTA_DST, &in6, sizeof(in6));
+	rtnl_append(nlh, RTA_OIF, &oif, sizeof(oif));
+
+	if (gateway) {
+		inet_pton(AF_INET6, gateway, &in6);
+		rtnl_append(nlh, RTA_GATEWAY, &in6, sizeof(in6));
+	}
+
+	msg->len = nlh->nlmsg_len;
+}
+
+/* Reply to a request sent with NLM_F_ACK */
+void mock_rtnl_queue_ack(uint32_t seq, int error)
+{
+	struct mock_rtnl_msg *msg = rtnl_queue_tail();
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg->data;
+	struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+	nlh->nlmsg_type = NLMSG_ERROR;
+	nlh->nlmsg_seq = seq;
+	err->error = error;
+	msg->len = nlh->nlmsg_len;
+}
+
+void mock_rtnl_queue_done(uint32_t seq)
+{
+	struct mock_rtnl_msg *msg = rtnl_queue_tail();
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg->data;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_flags = NLM_F_MULTI;
+	msg->len = nlh->nlmsg_len;
+}
+
+/* Messages as read from a real socket, e.g. recorded with --trace */
+bool mock_rtnl_queue_raw(const void *data, size_t len)
+{
+	struct mock_rtnl_msg *msg;
+
+	if (len > sizeof(msg->data))
+		return false;
+
+	msg = rtnl_queue_tail();
+	memcpy(msg->data, data, len);
+	msg->len = len;
+
+	return true;
+}
+
+uint32_t mock_rtnl_last_seq(void)
+{
+	return rtnl_last_seq;
+}
+
+void mock_rtnl_queue_overflow(void)
+{
+	rtnl_queue_tail()->overflow = true;
+}
+
+void mock_rtnl_deliver(void)
+{
+	if (rtnl_read)
+		rtnl_read(rtnl_io, NULL);
+}
+
+void mock_reset(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < dump_count; i++)
+		if (dumps[i].destroy)
+			dumps[i].destroy(dumps[i].user_data);
+
+	dump_count = 0;
+
+	for (i = 0; i < request_count; i++)
+		if (requests[i].destroy)
+			requests[i].destroy(requests[i].user_data);
+
+	request_count = 0;
+	hold = false;
+	created_count = 0;
+	last_reply = NULL;
+
+	if (last_sent)
+		l_genl_msg_unref(last_sent);
+
+	last_sent = NULL;
+	sent_count = 0;
+	changed_count = 0;
+	rtnl_head = rtnl_tail = 0;
+	rtnl_dumps = 0;
+	rtnl_filter_len = 0;
+	rtnl_request_count = 0;
+
+	if (wpan_raw_peer >= 0)
+		close(wpan_raw_peer);
+
+	wpan_raw_fd = -1;
+	wpan_raw_peer = -1;
+	wpan_dgram_fd = -1;
+	packet_fd = -1;
+	memset(&wpan_raw_sa, 0, sizeof(wpan_raw_sa));
+	memset(&wpan_dgram_sa, 0, sizeof(wpan_dgram_sa));
+}
+
+unsigned int mock_rtnl_requests(void)
+{
+	return rtnl_request_count;
+}
+
+const struct nlmsghdr *mock_rtnl_request(unsigned int index)
+{
+	if (index >= rtnl_request_count)
+		return NULL;
+
+	return (const struct nlmsghdr *) rtnl_requests[index];
+}
+
+unsigned int mock_rtnl_filter(const struct sock_filter **code)
+{
+	*code = rtnl_filter;
+
+	return rtnl_filter_len;
+}
+
+int mock_wpan_raw_peer(void)
+{
+	return wpan_raw_peer;
+}
+
+bool mock_wpan_bound(int type, uint8_t *hwaddr)
+{
+	const struct sockaddr_ieee802154 *sa = type == SOCK_RAW ?
+						&wpan_raw_sa : &wpan_dgram_sa;
+
+	if (sa->family != AF_IEEE802154 ||
+				sa->addr.addr_type != IEEE802154_ADDR_LONG)
+		return false;
+
+	memcpy(hwaddr, sa->addr.hwaddr, 8);
+
+	return true;
+}
@@ -0,0 +1,118 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Mock transports for unit tests. Test programs are linked with
+ * -Wl,--wrap for the ELL genl/D-Bus entry points and the socket calls
+ * of the daemon (see unit_mock_ldflags in Makefile.am), so the
+ * daemon sources run unmodified against these fakes.
+ */
+
+struct l_genl_family;
+struct l_genl_msg;
+struct l_dbus_message;
+
+/* Heap allocations through any libc allocator, ELL included */
+extern unsigned long mock_allocations;
+
+/* Generic netlink */
+extern struct l_genl_family *mock_nl802154;
+
+unsigned int mock_genl_sent(void);
+struct l_genl_msg *mock_genl_last_sent(void);
+bool mock_genl_dump_reply(uint8_t cmd, struct l_genl_msg *msg);
+bool mock_genl_dump_done(uint8_t cmd);
+
+/*
+ * Held commands wait for an answer, see __wrap_l_genl_family_send().
+ * if_nametoindex() knows the interfaces they create.
+ */
+void mock_genl_hold(bool enable);
+unsigned int mock_genl_held(void);
+bool mock_genl_ack(uint8_t cmd, int error);
+void mock_genl_cancel_all(void);
+
+/* Kernel message builders, same layout as nl802154 replies */
+struct l_genl_msg *mock_genl_wpan_phy(uint32_t id, const char *name,
+					uint8_t page, uint8_t channel);
+void mock_genl_append_channels(struct l_genl_msg *msg, uint8_t page,
+							uint32_t channels);
+struct l_genl_msg *mock_genl_interface(uint32_t phy, uint32_t ifindex,
+					const char *name, uint16_t panid);
+
+/* D-Bus: properties are reached through the registered callbacks */
+bool mock_dbus_has_object(const char *path, const char *interface);
+bool mock_dbus_get(const char *interface, const char *path,
+				const char *property, void *value);
+struct l_dbus_message *mock_dbus_set(const char *interface, const char *path,
+				const char *property, char type,
+				const void *value, bool *completed);
+struct l_dbus_message *mock_dbus_call(const char *interface,
+					const char *path, const char *name,
+					const char *signature, ...);
+const char *mock_dbus_error(struct l_dbus_message *reply);
+
+/* Members as registered by the interface setup functions */
+unsigned int mock_dbus_methods(const char *interface);
+bool mock_dbus_method(const char *interface, const char *name,
+				const char **returns, const char **params,
+				const char *const **args);
+unsigned int mock_dbus_properties(const char *interface);
+bool mock_dbus_property(const char *interface, const char *name,
+				const char **signature, bool *writable);
+struct l_dbus_message *mock_dbus_last_reply(void);
+unsigned int mock_dbus_changed(void);
+
+/* rtnl socket opened by lowpan.c */
+bool mock_rtnl_open(void);
+unsigned int mock_rtnl_dumps(void);
+uint32_t mock_rtnl_dump_seq(void);
+void mock_rtnl_queue_link(uint16_t type, uint32_t seq, int ifindex,
+					const char *name, uint16_t arphrd);
+void mock_rtnl_queue_done(uint32_t seq);
+void mock_rtnl_queue_addr(uint32_t seq, int ifindex, const char *addr,
+						uint8_t plen, uint8_t scope);
+void mock_rtnl_queue_route(uint32_t seq, int ifindex, const char *dst,
+				uint8_t plen, const char *gateway,
+				uint8_t protocol);
+void mock_rtnl_queue_ack(uint32_t seq, int error);
+bool mock_rtnl_queue_raw(const void *data, size_t len);
+uint32_t mock_rtnl_last_seq(void);
+void mock_rtnl_queue_overflow(void);
+void mock_rtnl_deliver(void);
+
+/* Requests sent with sendmsg() since mock_reset(), in order */
+struct nlmsghdr;
+unsigned int mock_rtnl_requests(void);
+const struct nlmsghdr *mock_rtnl_request(unsigned int index);
+
+/* Socket filter lowpan.c attached, 0 instructions when none */
+struct sock_filter;
+unsigned int mock_rtnl_filter(const struct sock_filter **code);
+
+/* Other end of the raw socket opened by inject.c, -1 if none */
+int mock_wpan_raw_peer(void);
+
+/* Extended address the last SOCK_RAW or SOCK_DGRAM socket was bound to */
+bool mock_wpan_bound(int type, uint8_t *hwaddr);
+
+void mock_reset(void);
@@ -0,0 +1,408 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Feeds a trace recorded with "iwpand --trace" back into the daemon
+ * sources through the mock transports: no radio, no 6LoWPAN link and no
+ * system bus are needed. Kernel messages and property writes are
+ * replayed, method calls are only counted: their arguments are not
+ * recorded. Requests sent by the daemon are counted on both sides, so
+ * a replay that diverges from the recording shows up in the summary.
+ *
+ *	replay-trace [--realtime] <trace>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/netlink.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/pool.h"
+#include "src/phy.h"
+#include "src/lowpan.h"
+#include "src/trace.h"
+#include "unit/mock.h"
+
+#define PROPERTIES		"org.freedesktop.DBus.Properties"
+#define SEQ_MAP_MAX		16
+
+enum replay_kind {
+	REPLAY_GENL_IN,
+	REPLAY_GENL_OUT,
+	REPLAY_RTNL_IN,
+	REPLAY_RTNL_OUT,
+	REPLAY_DBUS,
+	REPLAY_KIND_MAX,
+};
+
+static const char * const kind_names[] = {
+	"genl in", "genl out", "rtnl in", "rtnl out", "dbus",
+};
+
+struct replay_stats {
+	unsigned long replayed;
+	unsigned long skipped;
+	uint64_t total;		/* nsec */
+	uint64_t max;		/* nsec */
+};
+
+/* Dump callbacks and the request they answer, see phy_dump() */
+static const struct {
+	const char *site;
+	uint8_t cmd;
+} dump_sites[] = {
+	{ "get_wpan_phy_callback", NL802154_CMD_GET_WPAN_PHY },
+	{ "get_interface_callback", NL802154_CMD_GET_INTERFACE },
+};
+
+static struct replay_stats stats[REPLAY_KIND_MAX];
+
+/* Recorded rtnl sequence numbers and the ones used by this run */
+static struct {
+	uint32_t recorded;
+	uint32_t live;
+} seq_map[SEQ_MAP_MAX];
+static unsigned int seq_next;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool replay_genl(const struct trace_event *event)
+{
+	const struct trace_genl *hdr = event->data;
+	const uint8_t *data = event->data;
+	const struct nlattr *nla;
+	struct l_genl_msg *msg;
+	size_t pos;
+	unsigned int i;
+
+	if (event->len < sizeof(*hdr) ||
+			NLA_ALIGN(sizeof(*hdr) + hdr->site_len) > event->len)
+		return false;
+
+	if (event->flags & TRACE_DONE)
+		return mock_genl_dump_done(hdr->cmd);
+
+	/* Command replies: the mock acknowledges commands when sent */
+	for (i = 0; i < L_ARRAY_SIZE(dump_sites); i++)
+		if (strlen(dump_sites[i].site) == hdr->site_len &&
+				!memcmp(data + sizeof(*hdr),
+					dump_sites[i].site, hdr->site_len))
+			break;
+
+	if (i == L_ARRAY_SIZE(dump_sites))
+		return false;
+
+	msg = l_genl_msg_new_sized(hdr->cmd, event->len);
+	pos = NLA_ALIGN(sizeof(*hdr) + hdr->site_len);
+
+	while (pos + NLA_HDRLEN <= event->len) {
+		nla = (const struct nlattr *) (data + pos);
+
+		if (nla->nla_len < NLA_HDRLEN ||
+				pos + nla->nla_len > event->len)
+			break;
+
+		l_genl_msg_append_attr(msg, nla->nla_type,
+					nla->nla_len - NLA_HDRLEN,
+					data + pos + NLA_HDRLEN);
+		pos += NLA_ALIGN(nla->nla_len);
+	}
+
+	return mock_genl_dump_reply(dump_sites[i].cmd, msg);
+}
+
+static uint32_t seq_lookup(uint32_t recorded)
+{
+	unsigned int i;
+
+	for (i = 0; i < SEQ_MAP_MAX; i++)
+		if (seq_map[i].recorded == recorded)
+			return seq_map[i].live;
+
+	return recorded;
+}
+
+/* Requests were sent by this run already: learn its sequence number */
+static bool replay_rtnl_out(const struct trace_event *event)
+{
+	const struct nlmsghdr *nlh = event->data;
+
+	if (event->len < sizeof(*nlh) || !nlh->nlmsg_seq)
+		return false;
+
+	seq_map[seq_next % SEQ_MAP_MAX].recorded = nlh->nlmsg_seq;
+	seq_map[seq_next % SEQ_MAP_MAX].live = mock_rtnl_last_seq();
+	seq_next++;
+
+	return true;
+}
+
+static bool replay_rtnl_in(const struct trace_event *event)
+{
+	struct nlmsghdr *nlh;
+	uint8_t *buf;
+	int len = event->len;
+	bool queued;
+
+	if (!mock_rtnl_open())
+		return false;
+
+	if (event->flags & TRACE_OVERFLOW) {
+		mock_rtnl_queue_overflow();
+		mock_rtnl_deliver();
+		return true;
+	}
+
+	buf = l_memdup(event->data, event->len);
+
+	for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+						nlh = NLMSG_NEXT(nlh, len))
+		if (nlh->nlmsg_seq)
+			nlh->nlmsg_seq = seq_lookup(nlh->nlmsg_seq);
+
+	queued = mock_rtnl_queue_raw(buf, event->len);
+	l_free(buf);
+
+	if (queued)
+		mock_rtnl_deliver();
+
+	return queued;
+}
+
+static const char *next_string(const char **pos, const char *end)
+{
+	const char *str = *pos;
+	const char *nul = memchr(str, '\0', end - str);
+
+	if (!nul)
+		return NULL;
+
+	*pos = nul + 1;
+
+	return str;
+}
+
+/* Only property writes carry their arguments */
+static bool replay_dbus(const struct trace_event *event)
+{
+	const char *pos = event->data;
+	const char *end = pos + event->len;
+	const char *field[5], *interface, *name;
+	struct l_dbus_message *reply;
+	uint8_t value[8];
+	const void *data = value;
+	bool completed;
+	char type;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(field); i++)
+		if (!(field[i] = next_string(&pos, end)))
+			return false;
+
+	if (strcmp(field[2], PROPERTIES) || strcmp(field[3], "Set"))
+		return false;
+
+	interface = next_string(&pos, end);
+	name = next_string(&pos, end);
+	if (!interface || !name || pos == end)
+		return false;
+
+	type = *pos++;
+	memset(value, 0, sizeof(value));
+
+	switch (type) {
+	case 'b':
+		*(bool *) value = *pos;
+		break;
+	case 'y':
+	case 'q':
+	case 'u':
+	case 't':
+		if ((size_t) (end - pos) > sizeof(value))
+			return false;
+
+		memcpy(value, pos, end - pos);
+		break;
+	case 's':
+	case 'o':
+		if (!memchr(pos, '\0', end - pos))
+			return false;
+
+		data = pos;
+		break;
+	default:
+		return false;
+	}
+
+	reply = mock_dbus_set(interface, field[1], name, type, data,
+								&completed);
+	if (reply)
+		l_dbus_message_unref(reply);
+
+	return true;
+}
+
+static bool replay(const struct trace_event *event, enum replay_kind *kind)
+{
+	bool out = event->flags & TRACE_OUT;
+
+	switch (event->source) {
+	case TRACE_GENL:
+		*kind = out ? REPLAY_GENL_OUT : REPLAY_GENL_IN;
+		return out || replay_genl(event);
+	case TRACE_RTNL:
+		*kind = out ? REPLAY_RTNL_OUT : REPLAY_RTNL_IN;
+		return out ? replay_rtnl_out(event) : replay_rtnl_in(event);
+	case TRACE_DBUS:
+		*kind = REPLAY_DBUS;
+		return replay_dbus(event);
+	}
+
+	*kind = REPLAY_DBUS;
+	return false;
+}
+
+static void wait_until(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000ULL,
+		.tv_nsec = deadline % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+		;
+}
+
+static void summary(uint64_t elapsed, unsigned int genl_sent)
+{
+	unsigned long total = 0;
+	unsigned int i;
+
+	for (i = 0; i < REPLAY_KIND_MAX; i++)
+		total += stats[i].replayed + stats[i].skipped;
+
+	printf("%lu records in %.3f s, %.0f records/s\n", total,
+				elapsed / 1e9, total / (elapsed / 1e9));
+
+	for (i = 0; i < REPLAY_KIND_MAX; i++) {
+		const struct replay_stats *s = &stats[i];
+
+		if (!s->replayed && !s->skipped)
+			continue;
+
+		printf("  %-8s %8lu replayed %8lu skipped  "
+				"avg %8.1f us  max %8.1f us\n",
+				kind_names[i], s->replayed, s->skipped,
+				s->replayed ? s->total / 1e3 / s->replayed : 0,
+				s->max / 1e3);
+	}
+
+	printf("  nl802154 commands sent: %lu recorded, %u replayed\n",
+				stats[REPLAY_GENL_OUT].replayed, genl_sent);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_reader *reader;
+	struct trace_event event;
+	enum replay_kind kind;
+	bool realtime = false;
+	uint64_t start, begin, elapsed;
+	const char *path;
+
+	if (argc == 3 && !strcmp(argv[1], "--realtime"))
+		realtime = true;
+	else if (argc != 2) {
+		fprintf(stderr, "Usage: %s [--realtime] <trace>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	path = argv[argc - 1];
+
+	reader = trace_reader_open(path);
+	if (!reader) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	pool_init(512 * 1024);
+	lowpan_set_resync_handler(phy_resync);
+
+	if (!phy_init(mock_nl802154, 0xff, 0xff))
+		return EXIT_FAILURE;
+
+	start = now_ns();
+
+	while (trace_reader_next(reader, &event)) {
+		struct replay_stats *s;
+
+		if (realtime)
+			wait_until(start + event.time * 1000);
+
+		begin = now_ns();
+
+		if (!replay(&event, &kind)) {
+			stats[kind].skipped++;
+			continue;
+		}
+
+		elapsed = now_ns() - begin;
+
+		s = &stats[kind];
+		s->replayed++;
+		s->total += elapsed;
+
+		if (elapsed > s->max)
+			s->max = elapsed;
+	}
+
+	summary(now_ns() - start, mock_genl_sent());
+
+	trace_reader_close(reader);
+
+	phy_exit(mock_nl802154);
+	mock_reset();
+	pool_exit();
+	l_main_exit();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,392 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/pool.h"
+#include "src/phy.h"
+#include "src/control.h"
+#include "lib/iwpanctl.h"
+#include "unit/mock.h"
+
+#define ADAPTER		"net.connman.iwpand.Adapter"
+
+static char path[] = "/tmp/control-XXXXXX";
+
+static struct iwpanctl *setup(void)
+{
+	struct iwpanctl *ctl;
+
+	mock_reset();
+	assert(phy_init(mock_nl802154, 0xff, 0xff));
+	assert(control_init(path));
+	phy_set_adapter_watch(control_notify);
+
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(0, "wpan-phy0", 0, 26)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_INTERFACE,
+			mock_genl_interface(0, 3, "wpan0", 0xabcd)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_INTERFACE));
+
+	ctl = iwpanctl_connect(path);
+	assert(ctl);
+
+	return ctl;
+}
+
+static void teardown(struct iwpanctl *ctl)
+{
+	iwpanctl_close(ctl);
+	phy_set_adapter_watch(NULL);
+	phy_exit(mock_nl802154);
+	control_exit();
+	mock_reset();
+}
+
+/* The daemon side runs in this thread: spin its loop until answered */
+static int receive(struct iwpanctl *ctl, struct iwpanctl_response *resp)
+{
+	struct pollfd pfd = { .fd = iwpanctl_get_fd(ctl), .events = POLLIN };
+	int i;
+
+	for (i = 0; i < 100 && poll(&pfd, 1, 0) == 0; i++)
+		l_main_iterate(10);
+
+	return iwpanctl_recv(ctl, resp, IWPANCTL_BATCH_MAX, false);
+}
+
+static int roundtrip(struct iwpanctl *ctl, struct iwpanctl_response *resp)
+{
+	assert(iwpanctl_flush(ctl) > 0);
+
+	return receive(ctl, resp);
+}
+
+static void test_get(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	uint32_t seq;
+
+	seq = iwpanctl_queue(ctl, IWPANCTL_OP_GET, 3, 0);
+	assert(roundtrip(ctl, resp) == 1);
+
+	assert(resp[0].seq == seq);
+	assert(resp[0].op == IWPANCTL_OP_GET);
+	assert(!resp[0].error);
+	assert(resp[0].ifindex == 3);
+	assert(resp[0].state.panid == 0xabcd);
+	assert(resp[0].state.available);
+	assert(!resp[0].state.powered);
+	assert(resp[0].state.page == 0);
+	assert(resp[0].state.channel == 26);
+
+	teardown(ctl);
+}
+
+static void test_batch(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	uint16_t panid;
+
+	iwpanctl_queue(ctl, IWPANCTL_OP_SET_PANID, 3, 0x1234);
+	iwpanctl_queue(ctl, IWPANCTL_OP_SET_CHANNEL, 3, 15);
+	iwpanctl_queue(ctl, IWPANCTL_OP_SET_CHANNEL, 3, 40);
+	iwpanctl_queue(ctl, IWPANCTL_OP_GET, 99, 0);
+	iwpanctl_queue(ctl, 0x42, 3, 0);
+	assert(roundtrip(ctl, resp) == 5);
+
+	/* Answered in order, each with the state after it */
+	assert(resp[0].op == IWPANCTL_OP_SET_PANID && !resp[0].error);
+	assert(resp[0].state.panid == 0x1234);
+	assert(resp[1].op == IWPANCTL_OP_SET_CHANNEL && !resp[1].error);
+	assert(resp[1].state.channel == 15);
+	assert(resp[2].error == -EINVAL);
+	assert(resp[2].state.channel == 15);
+	assert(resp[3].error == -ENODEV);
+	assert(resp[4].error == -EOPNOTSUPP);
+
+	assert(mock_genl_sent() == 2);
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_CHANNEL);
+
+	/* Same setters as the D-Bus property */
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "PanId", &panid));
+	assert(panid == 0x1234);
+
+	teardown(ctl);
+}
+
+static void test_pipelined(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	uint32_t first, last = 0;
+	unsigned int i, received = 0;
+	int n;
+
+	first = iwpanctl_queue(ctl, IWPANCTL_OP_GET, 3, 0);
+	assert(iwpanctl_flush(ctl) == 1);
+
+	for (i = 0; i < 7; i++) {
+		last = iwpanctl_queue(ctl, IWPANCTL_OP_GET, 3, 0);
+		assert(iwpanctl_flush(ctl) == 1);
+	}
+
+	while (received < 8) {
+		n = receive(ctl, resp);
+		assert(n == 1);
+		assert(resp[0].seq == first + received);
+		received++;
+	}
+
+	assert(resp[0].seq == last);
+
+	teardown(ctl);
+}
+
+static void test_subscribe(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	bool completed;
+	uint16_t panid = 0x5678;
+
+	iwpanctl_queue(ctl, IWPANCTL_OP_SUBSCRIBE, 99, 0);
+	assert(roundtrip(ctl, resp) == 1);
+	assert(resp[0].error == -ENODEV);
+
+	iwpanctl_queue(ctl, IWPANCTL_OP_SUBSCRIBE, 0, 0);
+	assert(roundtrip(ctl, resp) == 1);
+	assert(!resp[0].error);
+
+	/* A D-Bus client changes the adapter */
+	assert(!mock_dbus_set(ADAPTER, "/wpan0", "PanId", 'q', &panid,
+								&completed));
+	assert(completed);
+
+	assert(receive(ctl, resp) == 1);
+	assert(resp[0].op == IWPANCTL_OP_EVENT);
+	assert(!resp[0].seq);
+	assert(resp[0].ifindex == 3);
+	assert(resp[0].state.panid == 0x5678);
+	assert(!(resp[0].state.flags & IWPANCTL_F_OVERFLOW));
+
+	/* Suspend: the adapter becomes unavailable */
+	phy_suspend(mock_nl802154);
+	assert(receive(ctl, resp) == 1);
+	assert(resp[0].op == IWPANCTL_OP_EVENT);
+	assert(!resp[0].state.available);
+
+	teardown(ctl);
+}
+
+static void test_malformed(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	uint8_t junk[3] = { };
+
+	assert(send(iwpanctl_get_fd(ctl), junk, sizeof(junk), 0) == 3);
+
+	/* The daemon hangs up rather than guess */
+	assert(receive(ctl, resp) == -ECONNRESET);
+
+	teardown(ctl);
+}
+
+static void test_inject(const void *data)
+{
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl *ctl = setup();
+	static const uint8_t extaddr[8] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xf2,
+	};
+	uint8_t frame[IWPANCTL_FRAME_MAX], buf[128], hwaddr[8];
+	unsigned int i, frames = 0, statuses = 0;
+	uint32_t first = 0, seq;
+	int n, j, peer;
+
+	assert(!iwpanctl_inject(ctl, 3, frame, IWPANCTL_FRAME_MAX + 1));
+	assert(errno == EMSGSIZE);
+
+	/* Refused before queueing: answered right away */
+	assert(iwpanctl_inject(ctl, 99, frame, 10));
+	assert(receive(ctl, resp) == 1);
+	assert(resp[0].op == IWPANCTL_OP_INJECT);
+	assert(resp[0].error == -ENODEV);
+
+	/* More than the peer queue holds: the daemon waits for room */
+	for (i = 0; i < 40; i++) {
+		memset(frame, i, sizeof(frame));
+		seq = iwpanctl_inject(ctl, 3, frame, 10 + i);
+		assert(seq);
+
+		if (!i)
+			first = seq;
+	}
+
+	peer = mock_wpan_raw_peer();
+	assert(peer >= 0);
+
+	/* Sent from wpan0's own extended address */
+	assert(mock_wpan_bound(SOCK_RAW, hwaddr));
+	assert(!memcmp(hwaddr, extaddr, sizeof(hwaddr)));
+
+	for (i = 0; i < 1000 && statuses < 40; i++) {
+		l_main_iterate(10);
+
+		/* In order, as submitted */
+		while ((n = recv(peer, buf, sizeof(buf), 0)) > 0) {
+			assert(n == (int) (10 + frames));
+			assert(buf[0] == frames && buf[n - 1] == frames);
+			frames++;
+		}
+
+		n = iwpanctl_recv(ctl, resp, IWPANCTL_BATCH_MAX, false);
+		assert(n >= 0);
+
+		for (j = 0; j < n; j++) {
+			assert(resp[j].op == IWPANCTL_OP_INJECT);
+			assert(resp[j].seq == first + statuses);
+			assert(resp[j].ifindex == 3);
+			assert(!resp[j].error);
+			statuses++;
+		}
+	}
+
+	assert(frames == 40);
+	assert(statuses == 40);
+
+	teardown(ctl);
+}
+
+static void answer(int fd, uint32_t seq, uint16_t op, uint16_t panid)
+{
+	struct iwpanctl_response resp = {
+		.seq = seq,
+		.op = op,
+		.ifindex = 3,
+		.state.panid = panid,
+	};
+
+	assert(send(fd, &resp, sizeof(resp), 0) == sizeof(resp));
+}
+
+/* No daemon: the answers are all written before the call is made */
+static void test_call_stash(const void *data)
+{
+	char fake[] = "/tmp/control-fake-XXXXXX";
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct iwpanctl_response resp[IWPANCTL_BATCH_MAX];
+	struct iwpanctl_request req;
+	struct iwpanctl_state state;
+	struct iwpanctl *ctl;
+	int listener, fd;
+	uint32_t seq;
+
+	fd = mkstemp(fake);
+	assert(fd >= 0);
+	close(fd);
+	unlink(fake);
+
+	listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	assert(listener >= 0);
+	strcpy(addr.sun_path, fake);
+	assert(!bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+	assert(!listen(listener, 1));
+
+	ctl = iwpanctl_connect(fake);
+	assert(ctl);
+	fd = accept(listener, NULL, NULL);
+	assert(fd >= 0);
+
+	/* Flushed and not answered yet */
+	seq = iwpanctl_queue(ctl, IWPANCTL_OP_SET_PANID, 3, 0x1234);
+	assert(iwpanctl_flush(ctl) == 1);
+	assert(recv(fd, &req, sizeof(req), 0) == sizeof(req));
+
+	answer(fd, seq + 100, IWPANCTL_OP_INJECT, 0);
+	answer(fd, seq, IWPANCTL_OP_SET_PANID, 0x1234);
+	answer(fd, seq + 1, IWPANCTL_OP_GET, 0x1234);
+
+	assert(!iwpanctl_get(ctl, 3, &state));
+	assert(state.panid == 0x1234);
+
+	/* Met by the call, kept for iwpanctl_recv() */
+	assert(iwpanctl_recv(ctl, resp, IWPANCTL_BATCH_MAX, false) == 2);
+	assert(resp[0].op == IWPANCTL_OP_INJECT);
+	assert(resp[0].seq == seq + 100);
+	assert(resp[1].op == IWPANCTL_OP_SET_PANID);
+	assert(resp[1].seq == seq);
+
+	iwpanctl_close(ctl);
+	close(fd);
+	close(listener);
+	unlink(fake);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+	pool_init(512 * 1024);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	l_test_add("GET returns the adapter state", test_get, NULL);
+	l_test_add("Batch answered in order", test_batch, NULL);
+	l_test_add("Pipelined packets", test_pipelined, NULL);
+	l_test_add("Subscribed events", test_subscribe, NULL);
+	l_test_add("Malformed request", test_malformed, NULL);
+	l_test_add("Injected frames", test_inject, NULL);
+	l_test_add("Synchronous call keeps other responses",
+						test_call_stash, NULL);
+
+	ret = l_test_run();
+
+	unlink(path);
+	pool_exit();
+
+	return ret;
+}
@@ -0,0 +1,182 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ell/ell.h>
+
+#include "src/frag.h"
+
+#define SYSCTL_DIR	"sys/net/ieee802154/6lowpan"
+
+static char root[] = "/tmp/frag-XXXXXX";
+
+static void put(const char *name, const char *value)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	fp = fopen(path, "w");
+	assert(fp);
+	fputs(value, fp);
+	fclose(fp);
+}
+
+static void kernel_defaults(void)
+{
+	put(SYSCTL_DIR "/6lowpanfrag_high_thresh", "4194304\n");
+	put(SYSCTL_DIR "/6lowpanfrag_low_thresh", "3145728\n");
+	put(SYSCTL_DIR "/6lowpanfrag_time", "60\n");
+}
+
+static void test_validate(const void *data)
+{
+	struct frag_config config = { };
+
+	assert(frag_config_valid(&config));
+
+	config.low_thresh = 8192;
+	assert(frag_config_valid(&config));
+
+	config.high_thresh = 4096;
+	assert(!frag_config_valid(&config));
+
+	config.high_thresh = 16384;
+	config.timeout = 100000;
+	assert(!frag_config_valid(&config));
+}
+
+static void test_apply(const void *data)
+{
+	struct frag_config config = { .low_thresh = 8192,
+					.high_thresh = 16384 };
+	struct frag_config kernel;
+
+	kernel_defaults();
+
+	/* Lowering both */
+	assert(!frag_apply(&config));
+	assert(!frag_read(&kernel));
+	assert(kernel.high_thresh == 16384);
+	assert(kernel.low_thresh == 8192);
+	assert(kernel.timeout == 60);
+
+	/* Unset fields keep the kernel value, the result must hold */
+	config.high_thresh = 0;
+	config.low_thresh = 32768;
+	assert(frag_apply(&config) == -EINVAL);
+
+	config.high_thresh = 65536;
+	config.timeout = 10;
+	assert(!frag_apply(&config));
+	assert(!frag_read(&kernel));
+	assert(kernel.high_thresh == 65536);
+	assert(kernel.low_thresh == 32768);
+	assert(kernel.timeout == 10);
+}
+
+static void test_rollback(const void *data)
+{
+	struct frag_config config = { .low_thresh = 8192,
+					.high_thresh = 16384,
+					.timeout = 5 };
+	struct frag_config kernel;
+	char path[PATH_MAX];
+
+	kernel_defaults();
+
+	/* Writing the timeout fails: thresholds are restored */
+	snprintf(path, sizeof(path), "%s/%s/6lowpanfrag_time", root,
+								SYSCTL_DIR);
+	assert(!chmod(path, 0444));
+
+	/* Root ignores the file mode */
+	if (!access(path, W_OK)) {
+		fprintf(stderr, "Rollback not tested: running as root\n");
+		assert(!chmod(path, 0644));
+		return;
+	}
+
+	assert(frag_apply(&config) < 0);
+	assert(!chmod(path, 0644));
+
+	assert(!frag_read(&kernel));
+	assert(kernel.high_thresh == 4194304);
+	assert(kernel.low_thresh == 3145728);
+	assert(kernel.timeout == 60);
+}
+
+static void test_stats(const void *data)
+{
+	uint64_t fails, timeouts;
+
+	put("net/snmp6", "Ip6InReceives                   	12\n"
+			"Ip6ReasmTimeout                 	3\n"
+			"Ip6ReasmReqds                   	40\n"
+			"Ip6ReasmOKs                     	30\n"
+			"Ip6ReasmFails                   	7\n");
+
+	assert(frag_stats(&fails, &timeouts));
+	assert(fails == 7);
+	assert(timeouts == 3);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[PATH_MAX];
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(mkdtemp(root));
+
+	snprintf(path, sizeof(path), "mkdir -p %s/%s %s/net", root,
+							SYSCTL_DIR, root);
+	assert(!system(path));
+
+	frag_set_proc_root(root);
+
+	l_test_add("Config validation", test_validate, NULL);
+	l_test_add("Apply thresholds", test_apply, NULL);
+	l_test_add("Rollback on failure", test_rollback, NULL);
+	l_test_add("Reassembly counters", test_stats, NULL);
+
+	ret = l_test_run();
+
+	snprintf(path, sizeof(path), "rm -rf %s", root);
+	if (system(path) < 0)
+		ret = EXIT_FAILURE;
+
+	return ret;
+}
@@ -0,0 +1,220 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ell/ell.h>
+
+#include "src/metrics.h"
+#include "src/pool.h"
+#include "src/iphc.h"
+
+static char root[] = "/tmp/iphc-XXXXXX";
+static int result;
+static unsigned int commits;
+
+/* Stand-in for the metrics module: pool metrics are never rendered */
+void metrics_family(struct l_string *out, const char *name,
+					const char *type, const char *help)
+{
+}
+
+static void committed(int err, void *user_data)
+{
+	result = err;
+
+	if (!--commits)
+		l_main_quit();
+}
+
+static void commit(struct iphc_table *table)
+{
+	commits++;
+	assert(!iphc_commit(table, "lowpan0", committed, NULL));
+}
+
+static void flush(void)
+{
+	l_main_run();
+}
+
+static void read_attr(unsigned int id, const char *attr, char *buf,
+								size_t size)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/lowpan0/contexts/%u/%s", root, id,
+									attr);
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+
+	len = read(fd, buf, size - 1);
+	assert(len >= 0);
+	buf[len] = '\0';
+
+	close(fd);
+}
+
+static bool attr_exists(unsigned int id, const char *attr)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/lowpan0/contexts/%u/%s", root, id,
+									attr);
+
+	return !access(path, F_OK);
+}
+
+static void remove_attr(unsigned int id, const char *attr)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/lowpan0/contexts/%u/%s", root, id,
+									attr);
+	unlink(path);
+}
+
+static void test_parse(const void *data)
+{
+	struct in6_addr prefix;
+	uint8_t plen;
+
+	assert(iphc_parse_prefix("2001:db8::/64", &prefix, &plen));
+	assert(plen == 64 && prefix.s6_addr[1] == 0x01);
+	assert(iphc_parse_prefix("::/0", &prefix, &plen) && plen == 0);
+
+	assert(!iphc_parse_prefix("2001:db8::", &prefix, &plen));
+	assert(!iphc_parse_prefix("2001:db8::/129", &prefix, &plen));
+	assert(!iphc_parse_prefix("2001:db8::/6x", &prefix, &plen));
+	assert(!iphc_parse_prefix("10.0.0.0/8", &prefix, &plen));
+	assert(!iphc_parse_prefix("/64", &prefix, &plen));
+}
+
+static void test_flush(const void *data)
+{
+	struct iphc_table *table = iphc_table_new("wpan0");
+	struct in6_addr prefix;
+	uint8_t plen;
+	char buf[64];
+
+	assert(table);
+	assert(iphc_parse_prefix("2001:db8::/64", &prefix, &plen));
+
+	/* Two calls in one iteration: a single flush answers both */
+	commit(table);
+	assert(iphc_context_set(table, 0, &prefix, plen, true));
+	commit(table);
+	assert(iphc_context_set(table, 1, &prefix, 48, false));
+	flush();
+	assert(!result);
+
+	read_attr(0, "prefix", buf, sizeof(buf));
+	assert(!strcmp(buf, "2001:0db8:0000:0000:0000:0000:0000:0000 64\n"));
+	read_attr(0, "compression", buf, sizeof(buf));
+	assert(!strcmp(buf, "1\n"));
+	read_attr(0, "active", buf, sizeof(buf));
+	assert(!strcmp(buf, "1\n"));
+	read_attr(1, "compression", buf, sizeof(buf));
+	assert(!strcmp(buf, "0\n"));
+
+	/* Unchanged files are not written again */
+	remove_attr(0, "prefix");
+	remove_attr(1, "prefix");
+	commit(table);
+	assert(iphc_context_set(table, 1, &prefix, 48, true));
+	flush();
+	assert(!result);
+	assert(!attr_exists(0, "prefix"));
+	assert(!attr_exists(1, "prefix"));
+	read_attr(1, "compression", buf, sizeof(buf));
+	assert(!strcmp(buf, "1\n"));
+
+	assert(iphc_context_remove(table, 0));
+	assert(!iphc_context_get(table, 0));
+	commit(table);
+	flush();
+	read_attr(0, "active", buf, sizeof(buf));
+	assert(!strcmp(buf, "0\n"));
+
+	/* No such context directory: rolled back to what was written */
+	assert(iphc_context_set(table, 5, &prefix, plen, true));
+	commit(table);
+	flush();
+	assert(result < 0);
+	assert(!iphc_context_get(table, 5));
+	assert(iphc_context_get(table, 1));
+
+	iphc_table_free(table);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[PATH_MAX];
+	unsigned int id;
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+	assert(mkdtemp(root));
+
+	snprintf(path, sizeof(path), "%s/lowpan0", root);
+	assert(!mkdir(path, 0755));
+	snprintf(path, sizeof(path), "%s/lowpan0/contexts", root);
+	assert(!mkdir(path, 0755));
+
+	for (id = 0; id < 2; id++) {
+		snprintf(path, sizeof(path), "%s/lowpan0/contexts/%u", root,
+									id);
+		assert(!mkdir(path, 0755));
+	}
+
+	iphc_set_root(root);
+	pool_init(64 * 1024);
+
+	l_test_add("Prefix parsing", test_parse, NULL);
+	l_test_add("Batched context writes", test_flush, NULL);
+
+	ret = l_test_run();
+
+	pool_exit();
+	l_main_exit();
+
+	snprintf(path, sizeof(path), "rm -rf %s", root);
+	if (system(path) < 0)
+		ret = EXIT_FAILURE;
+
+	return ret;
+}
@@ -0,0 +1,246 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <linux/filter.h>
+#include <linux/if_arp.h>
+#include <linux/rtnetlink.h>
+
+#include <ell/ell.h>
+
+#include "src/lowpan.h"
+#include "unit/mock.h"
+
+static unsigned int resyncs;
+
+static void resync(void)
+{
+	resyncs++;
+}
+
+/* Counters outlive lowpan_exit(): tests compare before and after */
+static uint64_t metric(const char *name)
+{
+	struct l_string *out = l_string_new(1024);
+	char *text, *line;
+	uint64_t value;
+
+	lowpan_metrics(out);
+	text = l_string_unwrap(out);
+
+	line = strstr(text, name);
+	assert(line);
+
+	value = strtoull(line + strlen(name), NULL, 10);
+	l_free(text);
+
+	return value;
+}
+
+#define NEWLINK		"iwpand_lowpan_link_events_total{event=\"newlink\"} "
+#define DELLINK		"iwpand_lowpan_link_events_total{event=\"dellink\"} "
+#define LINKS		"iwpand_lowpan_links "
+#define OVERFLOWS	"iwpand_rtnl_overflows_total "
+#define DUMPS		"iwpand_rtnl_dumps_total "
+#define LOST		"iwpand_rtnl_links_lost_total "
+#define IGNORED		"iwpand_rtnl_messages_total{result=\"ignored\"} "
+
+static void setup(void)
+{
+	mock_reset();
+	resyncs = 0;
+
+	assert(lowpan_init());
+	assert(mock_rtnl_open());
+	assert(mock_rtnl_dumps() == 1);
+
+	/* Nothing there yet */
+	mock_rtnl_queue_done(mock_rtnl_dump_seq());
+	mock_rtnl_deliver();
+}
+
+static void teardown(void)
+{
+	lowpan_exit();
+	assert(!mock_rtnl_open());
+	mock_reset();
+}
+
+static void test_link_events(const void *data)
+{
+	uint64_t newlink = metric(NEWLINK);
+	uint64_t dellink = metric(DELLINK);
+	uint64_t ignored = metric(IGNORED);
+
+	setup();
+
+	mock_rtnl_queue_link(RTM_NEWLINK, 0, 5, "lowpan0", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_link(RTM_NEWLINK, 0, 6, "lowpan1", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_link(RTM_NEWLINK, 0, 7, "eth0", ARPHRD_ETHER);
+	mock_rtnl_deliver();
+
+	assert(metric(NEWLINK) == newlink + 2);
+	assert(metric(LINKS) == 2);
+
+	mock_rtnl_queue_link(RTM_DELLINK, 0, 5, "lowpan0", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_link(RTM_DELLINK, 0, 7, "eth0", ARPHRD_ETHER);
+	mock_rtnl_deliver();
+
+	assert(metric(DELLINK) == dellink + 1);
+	assert(metric(LINKS) == 1);
+	assert(metric(IGNORED) == ignored + 2);
+	assert(!resyncs);
+
+	teardown();
+}
+
+static void test_overflow(const void *data)
+{
+	uint64_t overflows = metric(OVERFLOWS);
+	uint64_t dumps = metric(DUMPS);
+	uint64_t lost = metric(LOST);
+	uint32_t seq;
+
+	setup();
+
+	mock_rtnl_queue_link(RTM_NEWLINK, 0, 5, "lowpan0", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_link(RTM_NEWLINK, 0, 6, "lowpan1", ARPHRD_6LOWPAN);
+	mock_rtnl_deliver();
+
+	/* lowpan1 was deleted while the queue was overrun */
+	mock_rtnl_queue_overflow();
+	mock_rtnl_deliver();
+
+	assert(metric(OVERFLOWS) == overflows + 1);
+	assert(mock_rtnl_dumps() == 2);
+	assert(resyncs == 1);
+
+	/* A second overrun while dumping restarts the dump afterwards */
+	seq = mock_rtnl_dump_seq();
+	mock_rtnl_queue_overflow();
+	mock_rtnl_queue_link(RTM_NEWLINK, seq, 5, "lowpan0", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	assert(mock_rtnl_dumps() == 3);
+	assert(resyncs == 1);
+	assert(metric(DUMPS) == dumps + 1);
+
+	/* Stale reply of the first dump is ignored */
+	mock_rtnl_queue_link(RTM_NEWLINK, seq, 6, "lowpan1", ARPHRD_6LOWPAN);
+
+	seq = mock_rtnl_dump_seq();
+	mock_rtnl_queue_link(RTM_NEWLINK, seq, 5, "lowpan0", ARPHRD_6LOWPAN);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	assert(metric(DUMPS) == dumps + 2);
+	assert(metric(LOST) == lost + 1);
+	assert(metric(LINKS) == 1);
+
+	teardown();
+}
+
+/* The kernel runs the filter: a socket pair stands in for rtnl */
+static bool filter_passes(int sv[2], uint16_t type, uint32_t seq,
+							uint16_t arphrd)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifinfomsg ifi;
+	} msg;
+	char buf[64];
+
+	memset(&msg, 0, sizeof(msg));
+	msg.hdr.nlmsg_len = sizeof(msg);
+	msg.hdr.nlmsg_type = type;
+	msg.hdr.nlmsg_seq = seq;
+	msg.ifi.ifi_type = arphrd;
+
+	assert(send(sv[0], &msg, sizeof(msg), 0) == sizeof(msg));
+
+	return recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0;
+}
+
+static void test_filter(const void *data)
+{
+	const struct sock_filter *code;
+	struct sock_fprog prog;
+	int sv[2];
+
+	setup();
+
+	prog.len = mock_rtnl_filter(&code);
+	prog.filter = (struct sock_filter *) code;
+	assert(prog.len);
+
+	assert(!socketpair(AF_UNIX, SOCK_DGRAM, 0, sv));
+	assert(!setsockopt(sv[1], SOL_SOCKET, SO_ATTACH_FILTER,
+						&prog, sizeof(prog)));
+
+	/* Events of other link types never wake the daemon */
+	assert(!filter_passes(sv, RTM_NEWLINK, 0, ARPHRD_ETHER));
+	assert(!filter_passes(sv, RTM_DELLINK, 0, ARPHRD_LOOPBACK));
+	assert(filter_passes(sv, RTM_NEWLINK, 0, ARPHRD_6LOWPAN));
+	assert(filter_passes(sv, RTM_DELLINK, 0, ARPHRD_IEEE802154));
+
+	/* Dumps, replies and other messages all pass */
+	assert(filter_passes(sv, RTM_NEWLINK, mock_rtnl_dump_seq(),
+							ARPHRD_ETHER));
+	assert(filter_passes(sv, RTM_NEWADDR, 0, 0));
+	assert(filter_passes(sv, NLMSG_ERROR, 0, 0));
+
+	close(sv[0]);
+	close(sv[1]);
+	teardown();
+
+	/* --no-rtnl-filter */
+	lowpan_set_rtnl_filter(false);
+	setup();
+	assert(!mock_rtnl_filter(&code));
+	teardown();
+	lowpan_set_rtnl_filter(true);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+
+	lowpan_set_resync_handler(resync);
+
+	l_test_add("6LoWPAN link events", test_link_events, NULL);
+	l_test_add("rtnl overflow resync", test_overflow, NULL);
+	l_test_add("rtnl link event filter", test_filter, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,487 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/pool.h"
+#include "src/phy.h"
+#include "unit/mock.h"
+
+#define ADAPTER		"net.connman.iwpand.Adapter"
+#define PHY		"net.connman.iwpand.Phy"
+
+static void setup(uint8_t page, uint8_t channel)
+{
+	mock_reset();
+	assert(phy_init(mock_nl802154, page, channel));
+}
+
+static void teardown(void)
+{
+	phy_exit(mock_nl802154);
+	mock_reset();
+}
+
+static void add_wpan0(void)
+{
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(0, "wpan-phy0", 0, 26)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_INTERFACE,
+			mock_genl_interface(0, 3, "wpan0", 0xabcd)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_INTERFACE));
+}
+
+static bool sent_attr(uint16_t type, void *out, uint16_t size)
+{
+	struct l_genl_attr attr;
+	uint16_t t, len;
+	const void *data;
+
+	if (!l_genl_attr_init(&attr, mock_genl_last_sent()))
+		return false;
+
+	while (l_genl_attr_next(&attr, &t, &len, &data)) {
+		if (t != type || len != size)
+			continue;
+
+		memcpy(out, data, size);
+		return true;
+	}
+
+	return false;
+}
+
+static void test_phy_dump(const void *data)
+{
+	uint8_t channel;
+	char name[64];
+
+	/* Command line asks for channel 11 on page 0 */
+	setup(0, 11);
+
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(0, "wpan-phy0", 0, 26)));
+	assert(mock_dbus_has_object("/wpan-phy0", PHY));
+
+	assert(mock_genl_sent() == 1);
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_CHANNEL);
+	assert(sent_attr(NL802154_ATTR_CHANNEL, &channel, 1));
+	assert(channel == 11);
+
+	assert(mock_dbus_get(PHY, "/wpan-phy0", "Name", name));
+	assert(!strcmp(name, "wpan-phy0"));
+	assert(mock_dbus_get(PHY, "/wpan-phy0", "Channel", &channel));
+	assert(channel == 11);
+
+	/* Malformed: no page or channel */
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(1, "wpan-phy1", 0xff, 0)));
+	assert(!mock_dbus_has_object("/wpan-phy1", PHY));
+
+	teardown();
+}
+
+static void test_interface_dump(const void *data)
+{
+	uint16_t panid;
+	bool value;
+	char name[64];
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	assert(mock_dbus_has_object("/wpan0", ADAPTER));
+
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "Name", name));
+	assert(!strcmp(name, "wpan0"));
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "PanId", &panid));
+	assert(panid == 0xabcd);
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "Powered", &value));
+	assert(!value);
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "Available", &value));
+	assert(value);
+
+	/* No channel requested on the command line */
+	assert(mock_genl_sent() == 0);
+
+	teardown();
+}
+
+static void test_neighbor_bind(const void *data)
+{
+	/* mock_genl_interface(): 0x0123456789abcdef + ifindex 3 */
+	static const uint8_t expected[8] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xf2,
+	};
+	uint8_t hwaddr[8];
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	/* Most significant byte first, as the kernel compares it */
+	assert(mock_wpan_bound(SOCK_DGRAM, hwaddr));
+	assert(!memcmp(hwaddr, expected, sizeof(hwaddr)));
+
+	teardown();
+}
+
+static void test_set_panid(const void *data)
+{
+	struct l_dbus_message *reply;
+	uint16_t panid = 0x1234;
+	uint32_t ifindex;
+	bool completed;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	reply = mock_dbus_set(ADAPTER, "/wpan0", "PanId", 'q', &panid,
+								&completed);
+	assert(!reply);
+	assert(completed);
+
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_PAN_ID);
+	assert(sent_attr(NL802154_ATTR_IFINDEX, &ifindex, 4));
+	assert(ifindex == 3);
+	assert(sent_attr(NL802154_ATTR_PAN_ID, &panid, 2));
+	assert(panid == 0x1234);
+
+	panid = 0;
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "PanId", &panid));
+	assert(panid == 0x1234);
+
+	teardown();
+}
+
+static void test_set_invalid(const void *data)
+{
+	struct l_dbus_message *reply;
+	bool completed, value = true;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	reply = mock_dbus_set(ADAPTER, "/wpan0", "PanId", 'b', &value,
+								&completed);
+	assert(reply);
+	assert(!completed);
+	assert(!strcmp(mock_dbus_error(reply),
+				"net.connman.iwpand.InvalidArgs"));
+	assert(mock_genl_sent() == 0);
+
+	teardown();
+}
+
+static void test_set_powered(const void *data)
+{
+	bool completed, value = true;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	assert(!mock_rtnl_open());
+
+	assert(!mock_dbus_set(ADAPTER, "/wpan0", "Powered", 'b', &value,
+								&completed));
+	assert(completed);
+	assert(mock_rtnl_open());
+	assert(mock_rtnl_dumps() == 1);
+
+	/* Same value again: no second rtnl user */
+	assert(!mock_dbus_set(ADAPTER, "/wpan0", "Powered", 'b', &value,
+								&completed));
+	assert(completed);
+
+	value = false;
+	assert(!mock_dbus_set(ADAPTER, "/wpan0", "Powered", 'b', &value,
+								&completed));
+	assert(completed);
+	assert(!mock_rtnl_open());
+
+	teardown();
+}
+
+static void test_suspend_resync(const void *data)
+{
+	uint16_t panid = 0x1234;
+	bool completed, value;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	assert(!mock_dbus_set(ADAPTER, "/wpan0", "PanId", 'q', &panid,
+								&completed));
+
+	/* Module reload: the adapter stays, unavailable */
+	phy_suspend(mock_nl802154);
+	assert(mock_dbus_has_object("/wpan0", ADAPTER));
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "Available", &value));
+	assert(!value);
+
+	/* Back with the default PAN ID: the user setting is reapplied */
+	assert(phy_init(mock_nl802154, 0xff, 0xff));
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_INTERFACE,
+			mock_genl_interface(0, 7, "wpan0", 0xffff)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_INTERFACE));
+
+	assert(mock_dbus_get(ADAPTER, "/wpan0", "Available", &value));
+	assert(value);
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_PAN_ID);
+
+	/* Live resync without wpan0 in the dump: the adapter is gone */
+	phy_resync();
+	assert(mock_genl_dump_done(NL802154_CMD_GET_INTERFACE));
+	assert(!mock_dbus_has_object("/wpan0", ADAPTER));
+
+	teardown();
+}
+
+static void test_resync_available(const void *data)
+{
+	setup(0xff, 0xff);
+	add_wpan0();
+	mock_genl_hold(true);
+
+	/* Until the dump is done, the PHY stays usable */
+	phy_resync();
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "CreateInterface", "sst",
+					"wpan1", "node", (uint64_t) 0));
+	assert(mock_genl_held() == 1);
+
+	/* Dumped again: kept */
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(0, "wpan-phy0", 0, 26)));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+	assert(mock_dbus_has_object("/wpan-phy0", PHY));
+
+	teardown();
+}
+
+static void test_stop_capture(const void *data)
+{
+	struct l_dbus_message *reply;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	reply = mock_dbus_call(ADAPTER, "/wpan0", "StopCapture", "");
+	assert(!strcmp(mock_dbus_error(reply), "net.connman.iwpand.NotFound"));
+
+	teardown();
+}
+
+static void test_create_interface(const void *data)
+{
+	struct l_dbus_message *reply;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+
+	/* Not usable in the adapter's object path */
+	reply = mock_dbus_call(PHY, "/wpan-phy0", "CreateInterface", "sst",
+					"wpan-1", "node", (uint64_t) 0);
+	assert(!strcmp(mock_dbus_error(reply),
+				"net.connman.iwpand.InvalidArgs"));
+	reply = mock_dbus_call(PHY, "/wpan-phy0", "CreateInterface", "sst",
+					"wpan0.1", "node", (uint64_t) 0);
+	assert(!strcmp(mock_dbus_error(reply),
+				"net.connman.iwpand.InvalidArgs"));
+	assert(mock_genl_sent() == 0);
+
+	mock_genl_hold(true);
+
+	/* nl802154 goes away before NEW_INTERFACE is acknowledged */
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "CreateInterface", "sst",
+					"wpan_1", "node", (uint64_t) 0));
+	mock_genl_cancel_all();
+	assert(!strcmp(mock_dbus_error(mock_dbus_last_reply()),
+					"net.connman.iwpand.NotAvailable"));
+
+	/* Or while the new interface is fetched */
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "CreateInterface", "sst",
+					"wpan1", "node", (uint64_t) 0));
+	assert(mock_genl_ack(NL802154_CMD_NEW_INTERFACE, 0));
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_GET_INTERFACE);
+	assert(mock_genl_held() == 1);
+	mock_genl_cancel_all();
+	assert(!strcmp(mock_dbus_error(mock_dbus_last_reply()),
+					"net.connman.iwpand.NotAvailable"));
+
+	teardown();
+}
+
+/* Acknowledges every channel change until StartSurvey is answered */
+static void survey_run(void)
+{
+	unsigned int i;
+
+	for (i = 0; !mock_dbus_last_reply() && i < 1000; i++)
+		if (!mock_genl_ack(NL802154_CMD_SET_CHANNEL, 0))
+			l_main_iterate(10);
+
+	assert(mock_dbus_last_reply());
+}
+
+static void test_survey_apply(const void *data)
+{
+	uint8_t channel;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+	mock_genl_hold(true);
+
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "StartSurvey", "ub",
+								10, true));
+	assert(mock_genl_ack(NL802154_CMD_NEW_INTERFACE, 0));
+
+	/* Channels 11 to 26 in turn, each for its dwell */
+	survey_run();
+	assert(!mock_dbus_error(mock_dbus_last_reply()));
+	assert(!mock_genl_held());
+
+	/* Nothing heard anywhere: 11 wins, set after the way home to 26 */
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_CHANNEL);
+	assert(sent_attr(NL802154_ATTR_CHANNEL, &channel, 1));
+	assert(channel == 11);
+	assert(mock_dbus_get(PHY, "/wpan-phy0", "Channel", &channel));
+	assert(channel == 11);
+
+	teardown();
+}
+
+static void test_survey_channels(const void *data)
+{
+	struct l_genl_msg *msg;
+	uint8_t channel;
+
+	setup(0xff, 0xff);
+
+	/* Page 0 limited to channels 15 and 20 */
+	msg = mock_genl_wpan_phy(0, "wpan-phy0", 0, 26);
+	mock_genl_append_channels(msg, 0, 1 << 15 | 1 << 20);
+	assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY, msg));
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+
+	mock_genl_hold(true);
+
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "StartSurvey", "ub",
+								10, true));
+	assert(mock_genl_ack(NL802154_CMD_NEW_INTERFACE, 0));
+
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_SET_CHANNEL);
+	assert(sent_attr(NL802154_ATTR_CHANNEL, &channel, 1));
+	assert(channel == 15);
+
+	survey_run();
+	assert(!mock_dbus_error(mock_dbus_last_reply()));
+	assert(mock_dbus_get(PHY, "/wpan-phy0", "Channel", &channel));
+	assert(channel == 15);
+
+	teardown();
+}
+
+static void test_survey_cancel(const void *data)
+{
+	uint32_t ifindex;
+
+	setup(0xff, 0xff);
+	add_wpan0();
+	mock_genl_hold(true);
+
+	assert(!mock_dbus_call(PHY, "/wpan-phy0", "StartSurvey", "ub",
+								10, false));
+
+	/* The PHY goes away before the monitor is acknowledged */
+	phy_resync();
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+	assert(!mock_dbus_has_object("/wpan-phy0", PHY));
+	assert(!strcmp(mock_dbus_error(mock_dbus_last_reply()),
+					"net.connman.iwpand.NotAvailable"));
+
+	/* Created after all: removed rather than left behind */
+	assert(mock_genl_ack(NL802154_CMD_NEW_INTERFACE, 0));
+	assert(l_genl_msg_get_command(mock_genl_last_sent()) ==
+						NL802154_CMD_DEL_INTERFACE);
+	assert(sent_attr(NL802154_ATTR_IFINDEX, &ifindex, 4));
+	assert(ifindex == if_nametoindex("survey0"));
+	assert(!mock_genl_held());
+
+	teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+
+	/* Pools outlive phy_exit(): phy_init() finds them again */
+	pool_init(512 * 1024);
+
+	l_test_add("PHY dump applies the channel", test_phy_dump, NULL);
+	l_test_add("Interface dump creates adapters", test_interface_dump,
+									NULL);
+	l_test_add("Neighbor socket bound to the extended address",
+						test_neighbor_bind, NULL);
+	l_test_add("PanId setter sends SET_PAN_ID", test_set_panid, NULL);
+	l_test_add("Setter rejects a wrong type", test_set_invalid, NULL);
+	l_test_add("Powered setter opens rtnl", test_set_powered, NULL);
+	l_test_add("Suspend and resync", test_suspend_resync, NULL);
+	l_test_add("PHYs usable during a resync", test_resync_available,
+									NULL);
+	l_test_add("StopCapture without a capture", test_stop_capture,
+									NULL);
+	l_test_add("CreateInterface answered when cancelled",
+					test_create_interface, NULL);
+	l_test_add("Applied survey channel is set last", test_survey_apply,
+									NULL);
+	l_test_add("Survey visits the supported channels",
+					test_survey_channels, NULL);
+	l_test_add("Survey monitor removed after cancel", test_survey_cancel,
+									NULL);
+
+	ret = l_test_run();
+
+	pool_exit();
+
+	return ret;
+}
@@ -0,0 +1,177 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+
+#include <ell/ell.h>
+
+#include "src/nl802154.h"
+#include "src/nlattr.h"
+#include "src/metrics.h"
+#include "src/pool.h"
+#include "src/ratelimit.h"
+#include "unit/mock.h"
+
+#define SOAK_ITERATIONS		100000
+
+/* Stand-in for the metrics module: the soak never renders */
+void metrics_family(struct l_string *out, const char *name,
+					const char *type, const char *help)
+{
+}
+
+static void test_pool(const void *data)
+{
+	struct pool *pool;
+	void *obj[4];
+	unsigned int i, j;
+
+	pool_init(4096);
+
+	pool = pool_new("test", 24, 4);
+	assert(pool);
+
+	for (i = 0; i < 4; i++) {
+		obj[i] = pool_alloc(pool);
+		assert(obj[i]);
+		assert(!((uintptr_t) obj[i] % 16));
+
+		for (j = 0; j < i; j++)
+			assert(obj[i] != obj[j]);
+
+		memset(obj[i], 0xff, 24);
+	}
+
+	/* Exhausted: no fallback to the heap */
+	assert(!pool_alloc(pool));
+
+	pool_release(pool, obj[2]);
+	assert(pool_alloc(pool) == obj[2]);
+
+	/* Returned zeroed */
+	for (j = 0; j < 24; j++)
+		assert(((uint8_t *) obj[2])[j] == 0);
+
+	/* Over budget */
+	assert(!pool_new("large", 1024, 8));
+
+	pool_exit();
+}
+
+/* Same attribute layout as a kernel GET_INTERFACE reply */
+static struct l_genl_msg *build_interface_msg(void)
+{
+	struct l_genl_msg *msg;
+	uint32_t ifindex = 3, iftype = NL802154_IFTYPE_NODE;
+	uint64_t extaddr = 0x0123456789abcdefULL;
+	uint16_t panid = 0xabcd;
+
+	msg = l_genl_msg_new_sized(NL802154_CMD_NEW_INTERFACE, 128);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFNAME, 6, "wpan0");
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_IFTYPE, 4, &iftype);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_EXTENDED_ADDR, 8, &extaddr);
+	l_genl_msg_append_attr(msg, NL802154_ATTR_PAN_ID, 2, &panid);
+
+	return msg;
+}
+
+/*
+ * The daemon side of Adapter Get/Set: rate limiter lookup for the
+ * sender, a request record, the object path and decoding the kernel
+ * reply. ELL's D-Bus and genl message objects are not part of it.
+ */
+static void soak_one(struct pool *requests, struct l_genl_msg *reply)
+{
+	struct nlattr_interface iface;
+	char path[IFNAMSIZ + 1];
+	uint64_t seen;
+	void *req;
+
+	ratelimit_allow(":1.42", "wpan0");
+	ratelimit_allow(":1.43", "wpan0");
+
+	req = pool_alloc(requests);
+	assert(req);
+
+	snprintf(path, sizeof(path), "/%s", "wpan0");
+	assert(nlattr_decode(reply, &nlattr_interface_table, &iface, &seen));
+
+	pool_release(requests, req);
+}
+
+static void test_soak(const void *data)
+{
+	struct l_genl_msg *reply;
+	struct pool *requests;
+	unsigned long before;
+	unsigned int i;
+
+	assert(l_main_init());
+
+	pool_init(64 * 1024);
+
+	/* Both clients are throttled for most of the soak: Busy included */
+	assert(ratelimit_init(10, 10, 1000000, 1000000));
+
+	requests = pool_new("request", 64, 8);
+	assert(requests);
+
+	reply = build_interface_msg();
+
+	/* Warm up: first sighting of each sender creates its buckets */
+	soak_one(requests, reply);
+
+	before = mock_allocations;
+
+	for (i = 0; i < SOAK_ITERATIONS; i++)
+		soak_one(requests, reply);
+
+	if (mock_allocations != before)
+		fprintf(stderr, "%lu allocations in %u iterations\n",
+				mock_allocations - before, SOAK_ITERATIONS);
+
+	assert(mock_allocations == before);
+
+	l_genl_msg_unref(reply);
+	ratelimit_exit();
+	pool_exit();
+	l_main_exit();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Pool allocation", test_pool, NULL);
+	l_test_add("Steady state without allocations", test_soak, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,236 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <assert.h>
+
+/* The member tables and copy_arguments() are private to proxy.c */
+#include "src/proxy.c"
+
+/* Messages without a bus, as ELL's own tests build them */
+#include "ell/dbus-private.h"
+
+#include "src/phy.h"
+#include "unit/mock.h"
+
+static unsigned int complete_types(const char *sig)
+{
+	unsigned int count = 0;
+
+	for (; *sig; sig += complete_type_len(sig))
+		count++;
+
+	return count;
+}
+
+static void check_interface(const struct proxy_interface *table)
+{
+	const struct proxy_method *method;
+	const struct proxy_property *property;
+	const char *returns, *params, *type;
+	const char *const *args;
+	bool writable;
+	unsigned int i, j;
+
+	assert(mock_dbus_methods(table->name) == table->n_methods);
+	assert(mock_dbus_properties(table->name) == table->n_properties);
+	assert(table->n_properties <= PROXY_PROPERTY_MAX);
+
+	for (i = 0; i < table->n_methods; i++) {
+		method = &table->methods[i];
+
+		assert(mock_dbus_method(table->name, method->name,
+						&returns, &params, &args));
+		assert(!strcmp(method->returns, returns));
+		assert(!strcmp(method->params, params));
+
+		/* copy_arguments() handles this many in each direction */
+		assert(complete_types(params) <= PROXY_ARGS_MAX);
+		assert(complete_types(returns) <= PROXY_ARGS_MAX);
+
+		for (j = 0; method->args[j] || args[j]; j++) {
+			assert(method->args[j] && args[j]);
+			assert(!strcmp(method->args[j], args[j]));
+		}
+	}
+
+	for (i = 0; i < table->n_properties; i++) {
+		property = &table->properties[i];
+
+		assert(mock_dbus_property(table->name, property->name,
+							&type, &writable));
+		assert(!strcmp(property->type, type));
+		assert(property->writable == writable);
+	}
+}
+
+static void test_tables(const void *data)
+{
+	unsigned int i;
+
+	mock_reset();
+
+	/* The interfaces as the workers register them */
+	assert(phy_init(mock_nl802154, 0xff, 0xff));
+
+	for (i = 0; i < L_ARRAY_SIZE(interfaces); i++)
+		check_interface(&interfaces[i]);
+
+	phy_exit(mock_nl802154);
+	mock_reset();
+}
+
+static void test_complete_type_len(const void *data)
+{
+	assert(complete_type_len("u") == 1);
+	assert(complete_type_len("sst") == 1);
+	assert(complete_type_len("ay") == 2);
+	assert(complete_type_len("aayu") == 3);
+	assert(complete_type_len("a(ss)") == 5);
+	assert(complete_type_len("aa{sv}") == 6);
+	assert(complete_type_len("(s(uu)a{sv})y") == 12);
+
+	assert(complete_types("asa(ss)") == 2);
+	assert(complete_types("") == 0);
+}
+
+static struct l_dbus_message *message_new(const char *method)
+{
+	return _dbus_message_new_method_call(1, "net.connman.iwpand.Shard0",
+					"/wpan0", ADAPTER_INTERFACE, method);
+}
+
+static void test_copy_basic(const void *data)
+{
+	struct l_dbus_message *from = message_new("AddContext");
+	struct l_dbus_message *to = message_new("AddContext");
+	const char *prefix;
+	uint8_t id;
+	bool compression;
+
+	assert(l_dbus_message_set_arguments(from, "ysb", 3, "fd00::/64",
+									true));
+	assert(copy_arguments(to, from, "ysb"));
+
+	assert(l_dbus_message_get_arguments(to, "ysb", &id, &prefix,
+							&compression));
+	assert(id == 3);
+	assert(!strcmp(prefix, "fd00::/64"));
+	assert(compression);
+
+	l_dbus_message_unref(from);
+	l_dbus_message_unref(to);
+
+	/* No arguments at all */
+	from = message_new("StopCapture");
+	to = message_new("StopCapture");
+	assert(l_dbus_message_set_arguments(from, ""));
+	assert(copy_arguments(to, from, ""));
+
+	l_dbus_message_unref(from);
+	l_dbus_message_unref(to);
+}
+
+static void test_copy_arrays(const void *data)
+{
+	struct l_dbus_message *from = message_new("ApplyRouteSet");
+	struct l_dbus_message *to = message_new("ApplyRouteSet");
+	struct l_dbus_message_builder *builder;
+	struct l_dbus_message_iter addresses, routes;
+	const char *dst, *gateway;
+
+	builder = l_dbus_message_builder_new(from);
+	assert(l_dbus_message_builder_enter_array(builder, "s"));
+	assert(l_dbus_message_builder_append_basic(builder, 's',
+								"fd00::2/64"));
+	assert(l_dbus_message_builder_append_basic(builder, 's',
+								"fd01::2/64"));
+	assert(l_dbus_message_builder_leave_array(builder));
+	assert(l_dbus_message_builder_enter_array(builder, "(ss)"));
+	assert(l_dbus_message_builder_enter_struct(builder, "ss"));
+	assert(l_dbus_message_builder_append_basic(builder, 's',
+								"fd02::/64"));
+	assert(l_dbus_message_builder_append_basic(builder, 's',
+								"fd00::1"));
+	assert(l_dbus_message_builder_leave_struct(builder));
+	assert(l_dbus_message_builder_leave_array(builder));
+	assert(l_dbus_message_builder_finalize(builder));
+	l_dbus_message_builder_destroy(builder);
+
+	assert(copy_arguments(to, from, "asa(ss)"));
+	assert(l_dbus_message_get_arguments(to, "asa(ss)", &addresses,
+								&routes));
+
+	assert(l_dbus_message_iter_next_entry(&addresses, &dst));
+	assert(!strcmp(dst, "fd00::2/64"));
+	assert(l_dbus_message_iter_next_entry(&addresses, &dst));
+	assert(!strcmp(dst, "fd01::2/64"));
+	assert(!l_dbus_message_iter_next_entry(&addresses, &dst));
+
+	assert(l_dbus_message_iter_next_entry(&routes, &dst, &gateway));
+	assert(!strcmp(dst, "fd02::/64"));
+	assert(!strcmp(gateway, "fd00::1"));
+	assert(!l_dbus_message_iter_next_entry(&routes, &dst, &gateway));
+
+	l_dbus_message_unref(from);
+	l_dbus_message_unref(to);
+}
+
+static void test_copy_limits(const void *data)
+{
+	struct l_dbus_message *from = message_new("AddContext");
+	struct l_dbus_message *to = message_new("AddContext");
+
+	assert(l_dbus_message_set_arguments(from, "yyyyy", 1, 2, 3, 4, 5));
+
+	/* One more top level argument than there are slots for */
+	assert(!copy_arguments(to, from, "yyyyy"));
+
+	/* Signature not matching the message */
+	assert(!copy_arguments(to, from, "yyyy"));
+
+	l_dbus_message_unref(from);
+	l_dbus_message_unref(to);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+
+	pool_init(512 * 1024);
+
+	l_test_add("Member tables mirror phy.c", test_tables, NULL);
+	l_test_add("Complete type length", test_complete_type_len, NULL);
+	l_test_add("Copy basic arguments", test_copy_basic, NULL);
+	l_test_add("Copy array arguments", test_copy_arrays, NULL);
+	l_test_add("Copy refuses what it cannot hold", test_copy_limits,
+									NULL);
+
+	ret = l_test_run();
+
+	pool_exit();
+
+	return ret;
+}
@@ -0,0 +1,199 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <assert.h>
+#include <time.h>
+
+/* The buckets and the sweep are private to ratelimit.c */
+#include "src/ratelimit.c"
+
+static uint64_t now = 1000000;	/* usec */
+
+/* Linked with --wrap=clock_gettime: the monotonic clock is the test's */
+int __wrap_clock_gettime(clockid_t clock, struct timespec *ts);
+int __real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+int __wrap_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	if (clock != CLOCK_MONOTONIC)
+		return __real_clock_gettime(clock, ts);
+
+	ts->tv_sec = now / 1000000;
+	ts->tv_nsec = now % 1000000 * 1000;
+
+	return 0;
+}
+
+/* Stand-in for the metrics module: nothing is rendered */
+void metrics_family(struct l_string *out, const char *name,
+					const char *type, const char *help)
+{
+}
+
+static struct bucket *lookup(const char *key)
+{
+	return l_hashmap_lookup(buckets, key);
+}
+
+static void test_parse(const void *data)
+{
+	uint32_t rate, burst;
+
+	assert(ratelimit_parse("10", &rate, &burst));
+	assert(rate == 10 && burst == 10);
+	assert(ratelimit_parse("10/25", &rate, &burst));
+	assert(rate == 10 && burst == 25);
+
+	/* Unlimited */
+	assert(ratelimit_parse("0", &rate, &burst));
+	assert(!rate);
+
+	assert(!ratelimit_parse("10/0", &rate, &burst));
+	assert(!ratelimit_parse("10/25x", &rate, &burst));
+	assert(!ratelimit_parse("fast", &rate, &burst));
+	assert(!ratelimit_parse("", &rate, &burst));
+}
+
+static void test_refill(const void *data)
+{
+	unsigned int i;
+
+	assert(ratelimit_init(10, 3, 0, 0));
+
+	for (i = 0; i < 3; i++)
+		assert(ratelimit_allow(":1.42", "wpan0"));
+
+	assert(!ratelimit_allow(":1.42", "wpan0"));
+	assert(lookup(":1.42 wpan0")->throttled == 1);
+
+	/* Other clients have buckets of their own */
+	assert(ratelimit_allow(":1.43", "wpan0"));
+	assert(ratelimit_allow(":1.42", "wpan1"));
+
+	/* A tenth of a second is one token at 10/s */
+	now += 100000;
+	assert(ratelimit_allow(":1.42", "wpan0"));
+	assert(!ratelimit_allow(":1.42", "wpan0"));
+
+	/* Never more than the burst */
+	now += 10000000;
+
+	for (i = 0; i < 3; i++)
+		assert(ratelimit_allow(":1.42", "wpan0"));
+
+	assert(!ratelimit_allow(":1.42", "wpan0"));
+	assert(lookup(":1.42 wpan0")->throttled == 3);
+	assert(lookup(":1.42 wpan0")->allowed == 7);
+
+	ratelimit_exit();
+}
+
+static void test_refund(const void *data)
+{
+	assert(ratelimit_init(10, 5, 10, 1));
+
+	assert(ratelimit_allow(":1.42", "wpan0"));
+	assert(lookup(":1.42 wpan0")->tokens == 4 * TOKEN_SCALE);
+
+	/* Refused by the adapter bucket: the client keeps its token */
+	assert(!ratelimit_allow(":1.42", "wpan0"));
+	assert(lookup(":1.42 wpan0")->tokens == 4 * TOKEN_SCALE);
+	assert(lookup("* wpan0")->throttled == 1);
+
+	/* Another adapter is not held by this one */
+	assert(ratelimit_allow(":1.42", "wpan1"));
+
+	ratelimit_exit();
+}
+
+static void test_exhausted(const void *data)
+{
+	char sender[16];
+	unsigned int i;
+
+	assert(ratelimit_init(10, 1, 0, 0));
+
+	for (i = 0; i < BUCKET_MAX; i++) {
+		snprintf(sender, sizeof(sender), ":1.%u", i);
+		assert(ratelimit_allow(sender, "wpan0"));
+	}
+
+	assert(l_hashmap_size(buckets) == BUCKET_MAX);
+
+	/* No bucket left: only the adapter limit, none here, applies */
+	assert(ratelimit_allow(":1.999", "wpan0"));
+	assert(ratelimit_allow(":1.999", "wpan0"));
+	assert(!lookup(":1.999 wpan0"));
+
+	/* Known clients are still limited */
+	assert(!ratelimit_allow(":1.0", "wpan0"));
+
+	ratelimit_exit();
+}
+
+static void test_sweep(const void *data)
+{
+	assert(ratelimit_init(10, 2, 0, 0));
+
+	assert(ratelimit_allow(":1.42", "wpan0"));
+	assert(ratelimit_allow(":1.43", "wpan0"));
+	assert(ratelimit_allow(":1.43", "wpan0"));
+	assert(!ratelimit_allow(":1.43", "wpan0"));
+	assert(lookup(":1.43 wpan0")->reported);
+
+	/* :1.42 is full again, :1.43 one token short */
+	now += 100000;
+	sweep_expired(sweep_timeout, NULL);
+
+	assert(!lookup(":1.42 wpan0"));
+	assert(lookup(":1.43 wpan0"));
+	assert(!lookup(":1.43 wpan0")->reported);
+
+	now += 100000;
+	sweep_expired(sweep_timeout, NULL);
+	assert(!l_hashmap_size(buckets));
+
+	ratelimit_exit();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+	pool_init(64 * 1024);
+
+	l_test_add("Parse rate and burst", test_parse, NULL);
+	l_test_add("Burst then refill", test_refill, NULL);
+	l_test_add("Client token refunded", test_refund, NULL);
+	l_test_add("Out of buckets", test_exhausted, NULL);
+	l_test_add("Sweep forgets full buckets", test_sweep, NULL);
+
+	ret = l_test_run();
+
+	pool_exit();
+	l_main_exit();
+
+	return ret;
+}
@@ -0,0 +1,289 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+
+#include <ell/ell.h>
+
+#include "src/lowpan.h"
+#include "src/route.h"
+#include "unit/mock.h"
+
+#define IFINDEX		5
+
+static unsigned int done_calls;
+static int done_err;
+static unsigned int done_added;
+static unsigned int done_removed;
+
+static void applied(int err, unsigned int added, unsigned int removed,
+							void *user_data)
+{
+	done_calls++;
+	done_err = err;
+	done_added = added;
+	done_removed = removed;
+}
+
+static void setup(void)
+{
+	mock_reset();
+	done_calls = 0;
+
+	assert(lowpan_init());
+	mock_rtnl_queue_done(mock_rtnl_dump_seq());
+	mock_rtnl_deliver();
+
+	route_init();
+}
+
+static void teardown(void)
+{
+	route_exit();
+	lowpan_exit();
+	mock_reset();
+}
+
+/* Two addresses, a route on link and one through a gateway */
+static struct route_set *set_new(void)
+{
+	struct route_set *set = route_set_new(2, 2);
+
+	assert(route_parse_address("fd00::2/64", &set->addresses[0]));
+	assert(route_parse_address("fd00::1/64", &set->addresses[1]));
+	assert(route_parse_route("fd00:2::/48", "", &set->routes[0]));
+	assert(route_parse_route("fd00:1::/48", "fe80::1",
+							&set->routes[1]));
+
+	return set;
+}
+
+/* Address of an RTM_*ADDR request, destination of an RTM_*ROUTE one */
+static void check_request(unsigned int index, uint16_t type,
+							const char *addr)
+{
+	const struct nlmsghdr *nlh = mock_rtnl_request(index);
+	const struct rtattr *rta;
+	struct in6_addr expected;
+	int len;
+
+	assert(nlh);
+	assert(nlh->nlmsg_type == type);
+	assert(nlh->nlmsg_flags & NLM_F_ACK);
+	assert(inet_pton(AF_INET6, addr, &expected) == 1);
+
+	if (type == RTM_NEWADDR || type == RTM_DELADDR) {
+		const struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+
+		assert(ifa->ifa_index == IFINDEX);
+		rta = IFA_RTA(ifa);
+		len = NLMSG_PAYLOAD(nlh, sizeof(*ifa));
+	} else {
+		const struct rtmsg *rtm = NLMSG_DATA(nlh);
+
+		assert(rtm->rtm_protocol == ROUTE_PROTOCOL);
+		rta = RTM_RTA(rtm);
+		len = NLMSG_PAYLOAD(nlh, sizeof(*rtm));
+	}
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == IFA_ADDRESS ||
+				rta->rta_type == RTA_DST)
+			break;
+
+	assert(RTA_OK(rta, len));
+	assert(!memcmp(RTA_DATA(rta), &expected, sizeof(expected)));
+}
+
+static void test_apply_order(const void *data)
+{
+	uint32_t seq;
+	unsigned int i;
+
+	setup();
+
+	assert(!route_apply(IFINDEX, set_new(), applied, NULL));
+	assert(route_apply(IFINDEX, set_new(), applied, NULL) == -EBUSY);
+
+	/* Addresses are dumped first */
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::1", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::9", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_addr(seq, IFINDEX, "fe80::5", 64, RT_SCOPE_LINK);
+	mock_rtnl_queue_addr(seq, IFINDEX + 1, "fd00::8", 64,
+							RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	/* Then routes: only ours on this interface are candidates */
+	assert(mock_rtnl_last_seq() != seq);
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:1::", 48, "fe80::1",
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:3::", 48, NULL,
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:4::", 48, NULL,
+							RTPROT_STATIC);
+	mock_rtnl_queue_route(seq, IFINDEX + 1, "fd00:5::", 48, NULL,
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	/* Prefixes before the routes using them, adds before deletes */
+	assert(mock_rtnl_requests() == 4);
+	check_request(0, RTM_NEWADDR, "fd00::2");
+	check_request(1, RTM_NEWROUTE, "fd00:2::");
+	check_request(2, RTM_DELROUTE, "fd00:3::");
+	check_request(3, RTM_DELADDR, "fd00::9");
+
+	seq = mock_rtnl_request(0)->nlmsg_seq;
+
+	for (i = 1; i < 4; i++)
+		assert(mock_rtnl_request(i)->nlmsg_seq == seq + i);
+
+	/* Done once every request is acknowledged */
+	for (i = 0; i < 3; i++)
+		mock_rtnl_queue_ack(seq + i, 0);
+
+	mock_rtnl_deliver();
+	assert(!done_calls);
+
+	mock_rtnl_queue_ack(seq + 3, 0);
+	mock_rtnl_deliver();
+
+	assert(done_calls == 1);
+	assert(!done_err);
+	assert(done_added == 2);
+	assert(done_removed == 2);
+
+	/* Applied already: nothing is sent */
+	assert(!route_apply(IFINDEX, set_new(), applied, NULL));
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::1", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::2", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:1::", 48, "fe80::1",
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:2::", 48, NULL,
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	assert(mock_rtnl_requests() == 4);
+	assert(done_calls == 2);
+	assert(!done_err);
+	assert(!done_added && !done_removed);
+
+	teardown();
+}
+
+static void test_delete_gone(const void *data)
+{
+	struct route_set *set;
+	uint32_t seq;
+
+	setup();
+
+	set = route_set_new(1, 0);
+	assert(route_parse_address("fd00::1/64", &set->addresses[0]));
+	assert(!route_apply(IFINDEX, set, applied, NULL));
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::1", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_addr(seq, IFINDEX, "fd00::9", 64, RT_SCOPE_UNIVERSE);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_route(seq, IFINDEX, "fd00:3::", 48, NULL,
+							ROUTE_PROTOCOL);
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	assert(mock_rtnl_requests() == 2);
+	check_request(0, RTM_DELROUTE, "fd00:3::");
+	check_request(1, RTM_DELADDR, "fd00::9");
+
+	/* Removed by someone else meanwhile: not an error */
+	seq = mock_rtnl_request(0)->nlmsg_seq;
+	mock_rtnl_queue_ack(seq, -ESRCH);
+	mock_rtnl_queue_ack(seq + 1, -EADDRNOTAVAIL);
+	mock_rtnl_deliver();
+
+	assert(done_calls == 1);
+	assert(!done_err);
+	assert(!done_added && !done_removed);
+
+	/* ENOENT on an add is */
+	assert(!route_apply(IFINDEX, set_new(), applied, NULL));
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	seq = mock_rtnl_last_seq();
+	mock_rtnl_queue_done(seq);
+	mock_rtnl_deliver();
+
+	assert(mock_rtnl_requests() == 6);
+	check_request(2, RTM_NEWADDR, "fd00::1");
+
+	seq = mock_rtnl_request(2)->nlmsg_seq;
+	mock_rtnl_queue_ack(seq, -ENOENT);
+	mock_rtnl_queue_ack(seq + 1, 0);
+	mock_rtnl_queue_ack(seq + 2, 0);
+	mock_rtnl_queue_ack(seq + 3, 0);
+	mock_rtnl_deliver();
+
+	assert(done_calls == 2);
+	assert(done_err == -ENOENT);
+	assert(done_added == 3);
+
+	teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+
+	l_test_add("Route set diff and request order", test_apply_order,
+									NULL);
+	l_test_add("Deleted meanwhile is not an error", test_delete_gone,
+									NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,221 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <assert.h>
+
+/* The supervisor is tested from the inside: no workers are spawned */
+#include "src/shard.c"
+
+#include "unit/mock.h"
+
+static int peers[SHARD_MAX];
+
+/* shard_init() without the fork: each worker is the test end of a pair */
+static void setup(unsigned int count)
+{
+	unsigned int i;
+	int sv[2];
+
+	mock_reset();
+
+	if (!phy_pool)
+		phy_pool = pool_new("shard_phy", sizeof(struct shard_phy),
+							SHARD_PHY_TOTAL);
+
+	assert(phy_pool);
+	phy_list = l_queue_new();
+	moves = 0;
+
+	for (i = 0; i < count; i++) {
+		assert(!socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+						SOCK_NONBLOCK, 0, sv));
+
+		memset(&shards[i], 0, sizeof(shards[i]));
+		shards[i].index = i;
+		shards[i].fd = sv[0];
+		peers[i] = sv[1];
+	}
+
+	shard_count = count;
+}
+
+static void teardown(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < shard_count; i++) {
+		close(shards[i].fd);
+		close(peers[i]);
+	}
+
+	shard_count = 0;
+
+	l_queue_destroy(phy_list, phy_free);
+	phy_list = NULL;
+
+	shard_suspend();
+	mock_reset();
+}
+
+/* One dump listing wpan-phy<N> for every N in phys */
+static void scan(const unsigned int *phys, unsigned int count)
+{
+	char name[IFNAMSIZ];
+	unsigned int i;
+
+	shard_scan(mock_nl802154);
+
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "wpan-phy%u", phys[i]);
+		assert(mock_genl_dump_reply(NL802154_CMD_GET_WPAN_PHY,
+				mock_genl_wpan_phy(phys[i], name, 0, 11)));
+	}
+
+	assert(mock_genl_dump_done(NL802154_CMD_GET_WPAN_PHY));
+}
+
+/* The last list sent to a worker, -1 if none since the last call */
+static int received(unsigned int index, struct shard_assign *assign)
+{
+	ssize_t len;
+	int count = -1;
+
+	memset(assign, 0, sizeof(*assign));
+
+	while ((len = recv(peers[index], assign, sizeof(*assign), 0)) > 0) {
+		assert((size_t) len == offsetof(struct shard_assign, names) +
+						assign->count * IFNAMSIZ);
+		count = assign->count;
+	}
+
+	return count;
+}
+
+static void test_assign(const void *data)
+{
+	static const unsigned int phys[] = { 0, 1, 2, 3, 4 };
+	struct shard_assign assign;
+
+	setup(3);
+	scan(phys, L_ARRAY_SIZE(phys));
+
+	/* Each new PHY to the first of the least loaded workers */
+	assert(received(0, &assign) == 2);
+	assert(!strcmp(assign.names[0], "wpan-phy0"));
+	assert(!strcmp(assign.names[1], "wpan-phy3"));
+	assert(received(1, &assign) == 2);
+	assert(!strcmp(assign.names[0], "wpan-phy1"));
+	assert(!strcmp(assign.names[1], "wpan-phy4"));
+	assert(received(2, &assign) == 1);
+	assert(!strcmp(assign.names[0], "wpan-phy2"));
+	assert(moves == 0);
+
+	/* Same PHYs again: nothing moves, nothing is sent */
+	scan(phys, L_ARRAY_SIZE(phys));
+	assert(received(0, &assign) == -1);
+	assert(received(1, &assign) == -1);
+	assert(received(2, &assign) == -1);
+
+	teardown();
+}
+
+static void test_rebalance(const void *data)
+{
+	static const unsigned int before[] = { 0, 1, 2, 3, 4 };
+	static const unsigned int after[] = { 0, 2, 3 };
+	struct shard_assign assign;
+
+	setup(3);
+	scan(before, L_ARRAY_SIZE(before));
+	received(0, &assign);
+	received(1, &assign);
+	received(2, &assign);
+
+	/* Worker 1 loses both: 2, 0, 1 is more than one PHY apart */
+	scan(after, L_ARRAY_SIZE(after));
+	assert(moves == 1);
+
+	/* The most recently added PHY of worker 0 moves */
+	assert(received(0, &assign) == 1);
+	assert(!strcmp(assign.names[0], "wpan-phy0"));
+	assert(received(1, &assign) == 1);
+	assert(!strcmp(assign.names[0], "wpan-phy3"));
+	assert(received(2, &assign) == -1);
+
+	/* One apart is close enough */
+	scan((const unsigned int []) { 0, 2, 3, 5 }, 4);
+	assert(moves == 1);
+	assert(received(0, &assign) == 2);
+	assert(!strcmp(assign.names[1], "wpan-phy5"));
+
+	teardown();
+}
+
+static void test_full(const void *data)
+{
+	unsigned int phys[SHARD_PHY_MAX + 1];
+	struct shard_assign assign;
+	const struct shard_phy *phy;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(phys); i++)
+		phys[i] = i;
+
+	setup(1);
+	scan(phys, L_ARRAY_SIZE(phys));
+
+	assert(received(0, &assign) == SHARD_PHY_MAX);
+	assert(shards[0].phys == SHARD_PHY_MAX);
+
+	/* Kept, but not handled until a worker has room */
+	assert(l_queue_length(phy_list) == SHARD_PHY_MAX + 1);
+	phy = l_queue_peek_tail(phy_list);
+	assert(phy->shard == SHARD_NONE);
+
+	scan(phys + 1, SHARD_PHY_MAX);
+	assert(received(0, &assign) == SHARD_PHY_MAX);
+	assert(phy->shard == 0);
+
+	teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	pool_init(512 * 1024);
+
+	l_test_add("New PHYs go to the least loaded worker", test_assign,
+									NULL);
+	l_test_add("PHYs move once workers are two apart", test_rebalance,
+									NULL);
+	l_test_add("PHYs beyond full workers are left out", test_full,
+									NULL);
+
+	ret = l_test_run();
+
+	pool_exit();
+
+	return ret;
+}
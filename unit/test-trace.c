@@ -0,0 +1,155 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ell/ell.h>
+
+#include "src/trace.h"
+
+static char path[] = "/tmp/trace-XXXXXX";
+
+static void test_roundtrip(const void *data)
+{
+	static const uint8_t request[] = { 1, 2, 3, 4, 5, 6 };
+	static const uint8_t reply[] = { 9, 8, 7, 6, 5, 4, 3, 2 };
+	const struct trace_genl *genl;
+	struct trace_reader *reader;
+	struct trace_event event;
+	uint64_t time = 0;
+
+	assert(trace_open(path));
+	trace_rtnl(TRACE_OUT, request, sizeof(request));
+	trace_rtnl(0, reply, sizeof(reply));
+	trace_rtnl(TRACE_OVERFLOW, NULL, 0);
+	trace_genl_done(17);
+	trace_close();
+
+	/* Recording is off once closed */
+	trace_rtnl(0, reply, sizeof(reply));
+
+	reader = trace_reader_open(path);
+	assert(reader);
+
+	assert(trace_reader_next(reader, &event));
+	assert(event.source == TRACE_RTNL);
+	assert(event.flags == TRACE_OUT);
+	assert(event.len == sizeof(request));
+	assert(!memcmp(event.data, request, sizeof(request)));
+	time = event.time;
+
+	/* Payloads are padded: the next record must still line up */
+	assert(trace_reader_next(reader, &event));
+	assert(event.source == TRACE_RTNL);
+	assert(!event.flags);
+	assert(event.len == sizeof(reply));
+	assert(!memcmp(event.data, reply, sizeof(reply)));
+	assert(event.time >= time);
+
+	assert(trace_reader_next(reader, &event));
+	assert(event.source == TRACE_RTNL);
+	assert(event.flags == TRACE_OVERFLOW);
+	assert(!event.len);
+
+	assert(trace_reader_next(reader, &event));
+	assert(event.source == TRACE_GENL);
+	assert(event.flags == TRACE_DONE);
+	genl = event.data;
+	assert(genl->cmd == 17);
+	assert(!genl->site_len);
+	assert(!genl->error);
+
+	assert(!trace_reader_next(reader, &event));
+	trace_reader_close(reader);
+}
+
+static void test_bad_header(const void *data)
+{
+	struct trace_header hdr;
+	FILE *fp;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION + 1;
+
+	fp = fopen(path, "w");
+	assert(fp);
+	assert(fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+	fclose(fp);
+
+	assert(!trace_reader_open(path));
+	assert(errno == EPROTO);
+}
+
+static void test_truncated(const void *data)
+{
+	static const uint8_t msg[64];
+	struct trace_reader *reader;
+	struct trace_event event;
+
+	assert(trace_open(path));
+	trace_rtnl(0, msg, sizeof(msg));
+	trace_rtnl(0, msg, sizeof(msg));
+	trace_close();
+
+	/* A daemon killed mid-write leaves a partial last record */
+	assert(!truncate(path, sizeof(struct trace_header) +
+				2 * sizeof(struct trace_record) +
+				sizeof(msg) + sizeof(msg) / 2));
+
+	reader = trace_reader_open(path);
+	assert(reader);
+	assert(trace_reader_next(reader, &event));
+	assert(event.len == sizeof(msg));
+	assert(!trace_reader_next(reader, &event));
+	trace_reader_close(reader);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, ret;
+
+	l_test_init(&argc, &argv);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	l_test_add("Record and read back", test_roundtrip, NULL);
+	l_test_add("Bad header", test_bad_header, NULL);
+	l_test_add("Truncated trace", test_truncated, NULL);
+
+	ret = l_test_run();
+
+	unlink(path);
+
+	return ret;
+}
@@ -0,0 +1,236 @@
+/*
+ *
+ *  Wireless PAN (802.15.4) daemon for Linux
+ *
+ *  Copyright (C) 2017 CESAR. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ell/ell.h>
+
+/* The rings and the eventfd are private to worker.c */
+#include "src/worker.c"
+
+#define WORKERS		4
+#define ROUNDS		100
+
+struct item {
+	unsigned int key;
+	unsigned int seq;
+};
+
+static struct item items[WORKERS * WORKER_RING_SIZE];
+static unsigned int next_seq[WORKERS];
+static unsigned int delivered;
+static bool gate;
+static useconds_t job_usec;
+
+/* Stand-ins for the latency and metrics modules: nothing is rendered */
+void latency_record(struct latency_site *site, uint64_t start)
+{
+}
+
+void metrics_family(struct l_string *out, const char *name,
+					const char *type, const char *help)
+{
+}
+
+static int job_run(void *user_data)
+{
+	struct item *item = user_data;
+
+	while (!__atomic_load_n(&gate, __ATOMIC_ACQUIRE))
+		usleep(100);
+
+	if (job_usec)
+		usleep(job_usec);
+
+	return item->seq;
+}
+
+/* Per key, completions arrive in submission order */
+static void job_done(int result, void *user_data)
+{
+	struct item *item = user_data;
+
+	assert(result == (int) item->seq);
+	assert(item->seq == next_seq[item->key]);
+	next_seq[item->key]++;
+	delivered++;
+}
+
+static void setup(bool open)
+{
+	memset(next_seq, 0, sizeof(next_seq));
+	delivered = 0;
+	job_usec = 0;
+	__atomic_store_n(&gate, open, __ATOMIC_RELEASE);
+
+	assert(worker_init(WORKERS));
+	assert(worker_num == WORKERS);
+}
+
+static bool submit(unsigned int index, unsigned int key, unsigned int seq)
+{
+	items[index].key = key;
+	items[index].seq = seq;
+
+	return worker_submit(key, job_run, job_done, &items[index]);
+}
+
+static void wait_delivered(unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < 1000 && delivered < count; i++)
+		l_main_iterate(10);
+
+	assert(delivered == count);
+}
+
+static void test_order(const void *data)
+{
+	unsigned int round, i, key;
+
+	setup(true);
+
+	/* All workers pushing to the completion ring at once */
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < L_ARRAY_SIZE(items); i++) {
+			key = i % WORKERS;
+			assert(submit(i, key, next_seq[key] +
+							i / WORKERS));
+		}
+
+		wait_delivered((round + 1) * L_ARRAY_SIZE(items));
+	}
+
+	for (key = 0; key < WORKERS; key++) {
+		assert(next_seq[key] == ROUNDS * WORKER_RING_SIZE);
+		assert(workers[key].completed == ROUNDS * WORKER_RING_SIZE);
+		assert(!workers[key].pending);
+	}
+
+	worker_exit();
+}
+
+static void test_full(const void *data)
+{
+	unsigned int i;
+
+	setup(false);
+
+	for (i = 0; i < WORKER_RING_SIZE; i++)
+		assert(submit(i, 0, i));
+
+	/* The caller does the work inline instead */
+	assert(!submit(i, 0, i));
+	assert(workers[0].rejected == 1);
+
+	/* Other workers still take jobs */
+	assert(submit(i, 1, 0));
+
+	/* Room again only once the results are reaped */
+	__atomic_store_n(&gate, true, __ATOMIC_RELEASE);
+	wait_delivered(WORKER_RING_SIZE + 1);
+	assert(submit(0, 0, WORKER_RING_SIZE));
+	wait_delivered(WORKER_RING_SIZE + 2);
+
+	worker_exit();
+}
+
+static void test_wakeup(const void *data)
+{
+	uint64_t count;
+	unsigned int i;
+
+	setup(false);
+
+	for (i = 0; i < 8; i++)
+		assert(submit(i, i % 2, i / 2));
+
+	__atomic_store_n(&gate, true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < 1000 && __atomic_load_n(&cell_tail,
+						__ATOMIC_ACQUIRE) < 8; i++)
+		usleep(1000);
+
+	/* Eight results, a single write to the eventfd */
+	assert(read(done_efd, &count, sizeof(count)) == sizeof(count));
+	assert(count == 1);
+	assert(!delivered);
+
+	assert(done_read(done_io, NULL));
+	assert(delivered == 8);
+	assert(!__atomic_load_n(&wake_pending, __ATOMIC_ACQUIRE));
+
+	/* A sleeping worker is woken by the next submission */
+	for (i = 0; i < 1000 && !__atomic_load_n(&workers[0].sleeping,
+						__ATOMIC_ACQUIRE); i++)
+		usleep(1000);
+
+	assert(submit(0, 0, 4));
+	wait_delivered(9);
+
+	worker_exit();
+}
+
+static void test_exit(const void *data)
+{
+	unsigned int i;
+
+	setup(true);
+	job_usec = 1000;
+
+	for (i = 0; i < L_ARRAY_SIZE(items); i++)
+		assert(submit(i, i % WORKERS, i / WORKERS));
+
+	/* Workers drain their rings, the results are delivered */
+	worker_exit();
+	assert(delivered == L_ARRAY_SIZE(items));
+
+	assert(!worker_submit(0, job_run, job_done, &items[0]));
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	assert(l_main_init());
+
+	l_test_add("Completions in order from all workers", test_order,
+									NULL);
+	l_test_add("Full ring rejects", test_full, NULL);
+	l_test_add("Eventfd wakeups", test_wakeup, NULL);
+	l_test_add("Exit with jobs in flight", test_exit, NULL);
+
+	ret = l_test_run();
+
+	l_main_exit();
+
+	return ret;
+}